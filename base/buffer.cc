@@ -81,6 +81,25 @@ byte_view ring_buffer::push_free() {
   return byte_view(data_ + end, free);
 }
 
+std::size_t ring_buffer::push_free_iov(struct iovec iov[2]) {
+  if (used_ == size_) {
+    std::size_t new_size = size_ << 1;
+    CHECK(new_size > 0);
+    resize(new_size);
+  }
+
+  std::size_t free = size_ - used_;
+  std::size_t end = (first_byte_ + used_) & (size_ - 1);
+  used_ += free;
+
+  auto [head, tail] = view_from(end, free);
+  iov[0].iov_base = head.data();
+  iov[0].iov_len = head.size();
+  iov[1].iov_base = tail.data();
+  iov[1].iov_len = tail.size();
+  return free;
+}
+
 void ring_buffer::resize(std::size_t new_size) {
   byte* new_data = new byte[new_size];
 
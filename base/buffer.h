@@ -12,6 +12,10 @@
 
 #include "base/log.h"
 
+extern "C" {
+#include <sys/uio.h>
+}
+
 namespace base {
 
 /** Short name for unsigned char. */
@@ -206,6 +210,17 @@ class ring_buffer {
    */
   byte_view push_free();
 
+  /**
+   * Allocates all the free space in the queue, as a pair of `iovec` structures for `readv(2)`.
+   *
+   * This is a variant of #push_free() for scatter reads: instead of the contiguous chunk up to the
+   * wrap-around point, both free regions are reserved at once, so that a single system call can
+   * fill them. As with #push_free(), the buffer is only resized if it is full. The second entry of
+   * \p iov has a zero length if the free space is contiguous. Returns the total number of bytes
+   * allocated; #unpush() the amount you did not write.
+   */
+  std::size_t push_free_iov(struct iovec iov[2]);
+
   /** Allocates \p size bytes and copies data from \p src there. */
   void write(const byte* src, std::size_t size) {
     std::size_t end = (first_byte_ + used_) & (size_ - 1);
@@ -261,6 +276,21 @@ class ring_buffer {
     return view_from(first_byte_, size);
   }
 
+  /**
+   * Describes the first \p size bytes of the queue as a pair of `iovec` structures for `writev(2)`.
+   *
+   * The argument must be at most #size(). The second entry of \p iov has a zero length unless the
+   * region crosses the wrap-around point. Nothing is deallocated: call #pop() with the number of
+   * bytes actually consumed.
+   */
+  void front_iov(struct iovec iov[2], std::size_t size) {
+    auto [head, tail] = front(size);
+    iov[0].iov_base = head.data();
+    iov[0].iov_len = head.size();
+    iov[1].iov_base = tail.data();
+    iov[1].iov_len = tail.size();
+  }
+
   /**
    * Returns a view to the next contiguous used region, or an invalid view if empty.
    *
@@ -0,0 +1,58 @@
+#include <cstring>
+#include <vector>
+
+#include "base/buffer.h"
+#include "base/mirrored_buffer.h"
+#include "benchmark/benchmark.h"
+
+namespace base {
+
+namespace {
+
+// Adapters for reading the front of the queue in one piece, the way a consumer that needs a
+// contiguous record (e.g., a parser) would.
+
+void CopyFront(ring_buffer* buffer, std::size_t size, byte* tmp) {
+  auto [head, tail] = buffer->front(size);
+  if (!tail.valid()) {
+    benchmark::DoNotOptimize(head.data());
+    return;
+  }
+  std::memcpy(tmp, head.data(), head.size());
+  std::memcpy(tmp + head.size(), tail.data(), tail.size());
+  benchmark::DoNotOptimize(tmp);
+}
+
+void CopyFront(mirrored_ring_buffer* buffer, std::size_t size, byte*) {
+  benchmark::DoNotOptimize(buffer->contiguous_front().data());
+}
+
+} // unnamed namespace
+
+/**
+ * Streams records of \p N bytes through a 64 KiB queue: reserve an upper bound, fill, trim, then
+ * look at the record as one piece and pop it. Records regularly straddle the wrap-around point.
+ */
+template <typename Buffer>
+void BM_StreamRecords(benchmark::State& state) {
+  const std::size_t n = state.range(0);
+  Buffer buffer(65536);
+  std::vector<byte> tmp(n);
+
+  for (auto _ : state) {
+    auto [head, tail] = buffer.push(n + 64);
+    std::memset(head.data(), 'x', head.size());
+    if (tail.valid())
+      std::memset(tail.data(), 'x', tail.size());
+    buffer.unpush(64);
+    CopyFront(&buffer, n, tmp.data());
+    buffer.pop(n);
+  }
+
+  state.SetBytesProcessed(state.iterations() * n);
+}
+
+BENCHMARK_TEMPLATE(BM_StreamRecords, ring_buffer)->Arg(100)->Arg(512)->Arg(4000);
+BENCHMARK_TEMPLATE(BM_StreamRecords, mirrored_ring_buffer)->Arg(100)->Arg(512)->Arg(4000);
+
+} // namespace base
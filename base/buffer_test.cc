@@ -86,6 +86,46 @@ TEST(RingBufferTest, PushFree) {
   EXPECT_EQ(resized.size(), 16u);
 }
 
+TEST(RingBufferTest, PushFreeIov) {
+  ring_buffer buffer(16);
+  auto* base = buffer.push(14).first.data();
+  buffer.pop(8);
+
+  struct iovec iov[2];
+  EXPECT_EQ(buffer.push_free_iov(iov), 10u);
+  EXPECT_EQ(buffer.size(), 16u);
+  EXPECT_EQ(iov[0].iov_base, base + 14);
+  EXPECT_EQ(iov[0].iov_len, 2u);
+  EXPECT_EQ(iov[1].iov_base, base);
+  EXPECT_EQ(iov[1].iov_len, 8u);
+
+  EXPECT_EQ(buffer.push_free_iov(iov), 16u);
+  EXPECT_EQ(buffer.size(), 32u);
+  EXPECT_EQ(iov[0].iov_base, &buffer[0] + 16);
+  EXPECT_EQ(iov[0].iov_len, 16u);
+  EXPECT_EQ(iov[1].iov_len, 0u);
+}
+
+TEST(RingBufferTest, FrontIov) {
+  ring_buffer buffer(16);
+  auto* base = buffer.push(14).first.data();
+  buffer.pop(12);
+  buffer.push(8);
+
+  struct iovec iov[2];
+  buffer.front_iov(iov, 3);
+  EXPECT_EQ(iov[0].iov_base, base + 12);
+  EXPECT_EQ(iov[0].iov_len, 3u);
+  EXPECT_EQ(iov[1].iov_len, 0u);
+
+  buffer.front_iov(iov, 10);
+  EXPECT_EQ(iov[0].iov_base, base + 12);
+  EXPECT_EQ(iov[0].iov_len, 4u);
+  EXPECT_EQ(iov[1].iov_base, base);
+  EXPECT_EQ(iov[1].iov_len, 6u);
+  EXPECT_EQ(buffer.size(), 10u);
+}
+
 TEST(RingBufferTest, Unpush) {
   ring_buffer buffer(16);
   auto* base = buffer.push(1).first.data();
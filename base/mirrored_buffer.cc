@@ -0,0 +1,87 @@
+#include <cerrno>
+
+#include "base/exc.h"
+#include "base/mirrored_buffer.h"
+
+extern "C" {
+#include <sys/mman.h>
+#include <unistd.h>
+}
+
+namespace base {
+
+namespace {
+
+std::size_t RoundSize(std::size_t size) {
+  std::size_t rounded = sysconf(_SC_PAGESIZE);
+  while (rounded < size) {
+    rounded <<= 1;
+    CHECK(rounded > 0);
+  }
+  return rounded;
+}
+
+} // unnamed namespace
+
+mirrored_ring_buffer::mirrored_ring_buffer(std::size_t initial_size)
+    : size_(RoundSize(initial_size))
+{
+  data_ = map(size_);
+}
+
+mirrored_ring_buffer::~mirrored_ring_buffer() {
+  unmap(data_, size_);
+}
+
+void mirrored_ring_buffer::grow(std::size_t min_size) {
+  std::size_t new_size = size_ << 1;
+  while (new_size && new_size < min_size)
+    new_size <<= 1;
+  CHECK(new_size > 0);
+
+  byte* new_data = map(new_size);
+  std::memcpy(new_data, data_ + first_byte_, used_);  // contiguous thanks to the mirror
+
+  unmap(data_, size_);
+  data_ = new_data;
+  size_ = new_size;
+  first_byte_ = 0;
+}
+
+byte* mirrored_ring_buffer::map(std::size_t size) {
+  int fd = memfd_create("mirrored_ring_buffer", MFD_CLOEXEC);
+  if (fd == -1)
+    throw base::Exception("memfd_create", errno);
+  if (ftruncate(fd, size) == -1) {
+    int error = errno;
+    close(fd);
+    throw base::Exception("ftruncate", error);
+  }
+
+  // reserve address space for both halves, then map the object over each of them
+  void* area = mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (area == MAP_FAILED) {
+    int error = errno;
+    close(fd);
+    throw base::Exception("mmap", error);
+  }
+  byte* data = static_cast<byte*>(area);
+
+  for (byte* half : { data, data + size }) {
+    if (mmap(half, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+      int error = errno;
+      munmap(area, 2 * size);
+      close(fd);
+      throw base::Exception("mmap(mirror)", error);
+    }
+  }
+
+  close(fd);  // the mappings keep the object alive
+  return data;
+}
+
+void mirrored_ring_buffer::unmap(byte* data, std::size_t size) noexcept {
+  munmap(data, 2 * size);
+}
+
+} // namespace base
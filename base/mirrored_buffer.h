@@ -0,0 +1,222 @@
+/** \file
+ * Ring buffer backed by a doubly mapped memory region.
+ */
+
+#ifndef BASE_MIRRORED_BUFFER_H_
+#define BASE_MIRRORED_BUFFER_H_
+
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include "base/buffer.h"
+#include "base/common.h"
+#include "base/log.h"
+
+extern "C" {
+#include <sys/uio.h>
+}
+
+namespace base {
+
+/**
+ * Automatically resizable ring buffer, where every region is contiguous in memory.
+ *
+ * This class has the same interface as ring_buffer, but the storage is a `memfd_create(2)` object
+ * mapped twice, back to back. Any byte at offset `i < capacity()` can also be reached at offset `i +
+ * capacity()`, so both the used and the free regions of the queue can always be accessed as a
+ * single span, even when they cross the wrap-around point. The two-view methods (push(), front())
+ * consequently always return an invalid second view, and there are contiguous_front() and
+ * contiguous_free() methods to get at the whole regions.
+ *
+ * The capacity is always a multiple of the system page size, so this is best suited for buffers of
+ * a few pages or more. Memory mapping failures throw base::Exception.
+ */
+class mirrored_ring_buffer {
+ public:
+  /**
+   * Constructs a new ring buffer, with a capacity of at least \p initial_size bytes.
+   *
+   * The capacity is rounded up to a power of 2 that is also a multiple of the page size.
+   */
+  explicit mirrored_ring_buffer(std::size_t initial_size = 4096);
+
+  /** Destroys this buffer, unmapping the memory. */
+  ~mirrored_ring_buffer();
+
+  DISALLOW_COPY(mirrored_ring_buffer);
+
+  /** Allocates \p push_size bytes in the queue. The second view is never valid. \sa ring_buffer::push() */
+  std::pair<byte_view, byte_view> push(std::size_t push_size) {
+    return std::make_pair(byte_view(push_cont(push_size), push_size), byte_view());
+  }
+
+  /** Allocates \p push_size contiguous bytes in the queue. \sa ring_buffer::push_cont() */
+  byte* push_cont(std::size_t push_size) {
+    if (used_ + push_size > size_)
+      grow(used_ + push_size);
+    byte* p = data_ + end();
+    used_ += push_size;
+    return p;
+  }
+
+  /**
+   * Allocates all the free space in the queue, resizing only if the buffer is full.
+   *
+   * Unlike ring_buffer::push_free(), this always returns all of the free space.
+   */
+  byte_view push_free() {
+    if (used_ == size_)
+      grow(size_ + 1);
+    std::size_t free = size_ - used_;
+    byte* p = data_ + end();
+    used_ += free;
+    return byte_view(p, free);
+  }
+
+  /** Allocates all the free space in the queue, as an `iovec` pair. \sa ring_buffer::push_free_iov() */
+  std::size_t push_free_iov(struct iovec iov[2]) {
+    byte_view free = push_free();
+    iov[0].iov_base = free.data();
+    iov[0].iov_len = free.size();
+    iov[1].iov_base = nullptr;
+    iov[1].iov_len = 0;
+    return free.size();
+  }
+
+  /**
+   * Returns a view to all the free space in the queue, without allocating it.
+   *
+   * The view stays valid until the buffer is resized. To append data, write it into the view, and
+   * then commit it with push() or push_cont(), which will return the same memory.
+   */
+  byte_view contiguous_free() noexcept { return byte_view(data_ + end(), size_ - used_); }
+
+  /** Allocates \p size bytes and copies data from \p src there. */
+  void write(const byte* src, std::size_t size) { std::memcpy(push_cont(size), src, size); }
+
+  /** Allocates and writes a signed 8-bit integer. */
+  void write_i8(std::int8_t v) { write(reinterpret_cast<const byte*>(&v), 1); }
+  /** Allocates and writes an unsigned 8-bit integer. */
+  void write_u8(std::uint8_t v) { write(&v, 1); }
+  /** Allocates and writes a signed 16-bit integer. */
+  void write_i16(std::int16_t v) { base::write_i16(v, push_cont(2)); }
+  /** Allocates and writes an unsigned 16-bit integer. */
+  void write_u16(std::uint16_t v) { base::write_u16(v, push_cont(2)); }
+  /** Allocates and writes a signed 32-bit integer. */
+  void write_i32(std::int32_t v) { base::write_i32(v, push_cont(4)); }
+  /** Allocates and writes an unsigned 32-bit integer. */
+  void write_u32(std::uint32_t v) { base::write_u32(v, push_cont(4)); }
+
+  /** Deallocates storage from the end of the buffer. \sa ring_buffer::unpush() */
+  void unpush(std::size_t size) {
+    CHECK(size <= used_);
+    used_ -= size;
+    if (!used_)
+      first_byte_ = 0;
+  }
+
+  /** Returns a view to the first \p size bytes of the queue. The second view is never valid. */
+  std::pair<byte_view, byte_view> front(std::size_t size) {
+    CHECK(size <= used_);
+    return std::make_pair(byte_view(data_ + first_byte_, size), byte_view());
+  }
+
+  /** Returns a view to all the bytes in the queue. */
+  byte_view contiguous_front() noexcept { return byte_view(data_ + first_byte_, used_); }
+
+  /** Describes the first \p size bytes of the queue as an `iovec` pair. \sa ring_buffer::front_iov() */
+  void front_iov(struct iovec iov[2], std::size_t size) {
+    CHECK(size <= used_);
+    iov[0].iov_base = data_ + first_byte_;
+    iov[0].iov_len = size;
+    iov[1].iov_base = nullptr;
+    iov[1].iov_len = 0;
+  }
+
+  /** Returns a view to all the bytes in the queue, or an invalid view if empty. \sa ring_buffer::next() */
+  byte_view next() {
+    if (empty())
+      return byte_view();
+    return contiguous_front();
+  }
+
+  /** Deallocates first \p size bytes. Must be at most #size(). */
+  void pop(std::size_t size) {
+    CHECK(size <= used_);
+    used_ -= size;
+    if (!used_)
+      first_byte_ = 0;
+    else
+      first_byte_ = (first_byte_ + size) & (size_ - 1);
+  }
+
+  /** Deallocates \p size bytes, and copies their former contents to \p dst. */
+  void read(byte* dst, std::size_t size) {
+    CHECK(size <= used_);
+    std::memcpy(dst, data_ + first_byte_, size);
+    pop(size);
+  }
+
+  /** Deallocates and returns a signed 8-bit integer. */
+  std::int8_t read_i8() { byte b[1]; read(b, 1); return base::read_i8(b); }
+  /** Deallocates and returns an unsigned 8-bit integer. */
+  std::uint8_t read_u8() { byte b[1]; read(b, 1); return base::read_u8(b); }
+  /** Deallocates and returns a signed 16-bit integer. */
+  std::int16_t read_i16() { byte b[2]; read(b, 2); return base::read_i16(b); }
+  /** Deallocates and returns an unsigned 16-bit integer. */
+  std::uint16_t read_u16() { byte b[2]; read(b, 2); return base::read_u16(b); }
+  /** Deallocates and returns a signed 32-bit integer. */
+  std::int32_t read_i32() { byte b[4]; read(b, 4); return base::read_i32(b); }
+  /** Deallocates and returns an unsigned 32-bit integer. */
+  std::uint32_t read_u32() { byte b[4]; read(b, 4); return base::read_u32(b); }
+
+  /** Resets the queue to empty. */
+  void clear() noexcept {
+    used_ = 0;
+    first_byte_ = 0;
+  }
+
+  /** Returns `true` if the buffer is empty. */
+  bool empty() const noexcept { return size() == 0; }
+  /** Returns the number of bytes stored in the queue. */
+  std::size_t size() const noexcept { return used_; }
+  /** Returns the amount of memory allocated for the queue. */
+  std::size_t capacity() const noexcept { return size_; }
+  /** Returns the size of the longest contiguous block that could be pushed without reallocation. */
+  std::size_t free_cont() const noexcept { return size_ - used_; }
+
+  /** Accesses the `i`th byte of the queue, with 0 being the front. */
+  byte& operator[](std::size_t i) noexcept { return data_[first_byte_ + i]; }
+  /** \overload */
+  const byte& operator[](std::size_t i) const noexcept { return data_[first_byte_ + i]; }
+
+ private:
+  /** Start of the mapping, which is `2 * size_` bytes long. */
+  byte* data_;
+  /** Size of the buffer (half the mapping). */
+  std::size_t size_;
+  /** Number of bytes in the queue. */
+  std::size_t used_ = 0;
+  /** Offset of the first (earliest inserted) byte. Always less than #size_. */
+  std::size_t first_byte_ = 0;
+
+  /** Returns the offset just past the last used byte. */
+  std::size_t end() const noexcept { return (first_byte_ + used_) & (size_ - 1); }
+
+  /** Resizes the buffer to hold at least \p min_size bytes, by at least doubling its size. */
+  void grow(std::size_t min_size);
+
+  /** Creates a new doubly mapped region of \p size bytes (per half). */
+  static byte* map(std::size_t size);
+  /** Unmaps a region created by map(). */
+  static void unmap(byte* data, std::size_t size) noexcept;
+};
+
+} // namespace base
+
+#endif // BASE_MIRRORED_BUFFER_H_
+
+// Local Variables:
+// mode: c++
+// End:
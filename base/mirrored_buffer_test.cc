@@ -0,0 +1,100 @@
+#include <cstring>
+#include <string>
+
+#include "base/mirrored_buffer.h"
+#include "gtest/gtest.h"
+
+extern "C" {
+#include <unistd.h>
+}
+
+namespace base {
+
+TEST(MirroredRingBufferTest, CapacityRounding) {
+  std::size_t page = sysconf(_SC_PAGESIZE);
+  EXPECT_EQ(mirrored_ring_buffer(1).capacity(), page);
+  EXPECT_EQ(mirrored_ring_buffer(page + 1).capacity(), 2 * page);
+}
+
+TEST(MirroredRingBufferTest, WrapAroundIsContiguous) {
+  mirrored_ring_buffer buffer;
+  std::size_t cap = buffer.capacity();
+  buffer.push(cap - 4);
+  buffer.pop(cap - 4);
+
+  // the next push crosses the wrap-around point
+  auto d = buffer.push(10);
+  EXPECT_EQ(d.first.size(), 10u);
+  EXPECT_FALSE(d.second.valid());
+  std::memcpy(d.first.data(), "0123456789", 10);
+
+  EXPECT_EQ(buffer.capacity(), cap);
+  EXPECT_EQ(buffer.free_cont(), cap - 10);
+  auto front = buffer.contiguous_front();
+  ASSERT_EQ(front.size(), 10u);
+  EXPECT_EQ(std::memcmp(front.data(), "0123456789", 10), 0);
+  EXPECT_EQ(buffer[9], '9');
+
+  char out[10];
+  buffer.read(reinterpret_cast<byte*>(out), 10);
+  EXPECT_EQ(std::string(out, 10), "0123456789");
+  EXPECT_TRUE(buffer.empty());
+}
+
+TEST(MirroredRingBufferTest, ContiguousFree) {
+  mirrored_ring_buffer buffer;
+  std::size_t cap = buffer.capacity();
+  buffer.push(cap - 2);
+  buffer.pop(cap - 4);
+
+  auto free = buffer.contiguous_free();
+  EXPECT_EQ(free.size(), cap - 2);
+  std::memset(free.data(), 'x', free.size());
+  EXPECT_EQ(buffer.push_cont(free.size()), free.data());
+  EXPECT_EQ(buffer.size(), cap);
+  EXPECT_EQ(buffer[cap - 1], 'x');
+}
+
+TEST(MirroredRingBufferTest, Grow) {
+  mirrored_ring_buffer buffer;
+  std::size_t cap = buffer.capacity();
+  buffer.push(cap - 2);
+  buffer.pop(cap - 4);
+  buffer.write(reinterpret_cast<const byte*>("abcdef"), 6);  // wraps
+
+  byte* big = buffer.push_cont(cap);
+  EXPECT_EQ(buffer.capacity(), 2 * cap);
+  std::memset(big, 'y', cap);
+  EXPECT_EQ(buffer.size(), cap + 8);
+  auto front = buffer.contiguous_front();
+  EXPECT_EQ(std::memcmp(front.data() + 2, "abcdef", 6), 0);
+  EXPECT_EQ(front.data()[cap + 7], 'y');
+}
+
+TEST(MirroredRingBufferTest, PushFree) {
+  mirrored_ring_buffer buffer;
+  std::size_t cap = buffer.capacity();
+  buffer.push(cap - 2);
+  buffer.pop(cap - 4);
+
+  auto all = buffer.push_free();
+  EXPECT_EQ(all.size(), cap - 2);
+  EXPECT_EQ(buffer.size(), cap);
+
+  auto more = buffer.push_free();
+  EXPECT_EQ(buffer.capacity(), 2 * cap);
+  EXPECT_EQ(more.size(), cap);
+}
+
+TEST(MirroredRingBufferTest, ReadWritePrimitives) {
+  mirrored_ring_buffer buffer;
+  buffer.push(buffer.capacity() - 3);
+  buffer.pop(buffer.capacity() - 3);
+
+  buffer.write_u32(0x01020304);
+  buffer.write_i16(-2);
+  EXPECT_EQ(buffer.read_u32(), 0x01020304u);
+  EXPECT_EQ(buffer.read_i16(), -2);
+}
+
+} // namespace base
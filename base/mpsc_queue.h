@@ -0,0 +1,112 @@
+/** \file
+ * Lock-free multi-producer, single-consumer queue.
+ */
+
+#ifndef BASE_MPSC_QUEUE_H_
+#define BASE_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+#include "base/common.h"
+
+namespace base {
+
+/**
+ * Unbounded lock-free queue for passing values from any number of threads to a single consumer.
+ *
+ * This is the node-based queue design of Dmitry Vyukov. The push() method may be called from any
+ * thread, and never blocks: it costs one allocation and one atomic exchange. The pop() method must
+ * only ever be called from one thread at a time.
+ *
+ * While a push() is in progress in another thread, pop() may transiently report the queue as
+ * empty even if other items were pushed after it. Such items will be returned by pop() once the
+ * push() has finished. Callers that need to be woken up about new items should signal after the
+ * push() call returns, like event::Loop::PostClientEvent() does.
+ *
+ * \tparam T type of queued values, must be default-constructible and movable
+ */
+template <typename T>
+class mpsc_queue {
+ public:
+  /** Constructs an empty queue. */
+  mpsc_queue() : head_(&stub_), tail_(&stub_) {}
+  DISALLOW_COPY(mpsc_queue);
+
+  /** Destroys the queue, and any values still left in it. */
+  ~mpsc_queue() {
+    Node* node = tail_;
+    while (node) {
+      Node* next = node->next.load(std::memory_order_relaxed);
+      if (node != &stub_)
+        delete node;
+      node = next;
+    }
+  }
+
+  /** Appends \p value to the queue. Safe to call from any thread. */
+  void push(T value) {
+    Push(new Node(std::move(value)));
+  }
+
+  /**
+   * Removes the value in front of the queue, and moves it to \p value.
+   *
+   * Returns `false` (and leaves \p value alone) if the queue is, or appears to be, empty.
+   */
+  bool pop(T* value) {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+
+    if (tail == &stub_) {
+      if (!next)
+        return false;
+      tail_ = tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (!next) {
+      if (tail != head_.load(std::memory_order_acquire))
+        return false;  // a push is in progress
+      // tail is the last real node: put the stub back behind it, so that it can be popped
+      Push(&stub_);
+      next = tail->next.load(std::memory_order_acquire);
+      if (!next)
+        return false;
+    }
+
+    tail_ = next;
+    *value = std::move(tail->value);
+    delete tail;
+    return true;
+  }
+
+ private:
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    T value;
+    Node() = default;
+    explicit Node(T&& v) : value(std::move(v)) {}
+  };
+
+  void Push(Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  /** Most recently pushed node. Written by producers. */
+  alignas(64) std::atomic<Node*> head_;
+  /** Next node to pop. Only touched by the consumer. */
+  alignas(64) Node* tail_;
+  /** Placeholder node, which keeps the list non-empty. */
+  Node stub_;
+};
+
+} // namespace base
+
+#endif // BASE_MPSC_QUEUE_H_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,65 @@
+#include <thread>
+#include <vector>
+
+#include "base/mpsc_queue.h"
+#include "gtest/gtest.h"
+
+namespace base {
+
+TEST(MpscQueueTest, Fifo) {
+  mpsc_queue<int> queue;
+  int value = 0;
+
+  EXPECT_FALSE(queue.pop(&value));
+  queue.push(1);
+  queue.push(2);
+  EXPECT_TRUE(queue.pop(&value));
+  EXPECT_EQ(value, 1);
+  queue.push(3);
+  EXPECT_TRUE(queue.pop(&value));
+  EXPECT_EQ(value, 2);
+  EXPECT_TRUE(queue.pop(&value));
+  EXPECT_EQ(value, 3);
+  EXPECT_FALSE(queue.pop(&value));
+  queue.push(4);
+  EXPECT_TRUE(queue.pop(&value));
+  EXPECT_EQ(value, 4);
+}
+
+TEST(MpscQueueTest, DestroyNonEmpty) {
+  mpsc_queue<std::vector<int>> queue;
+  queue.push({1, 2, 3});
+  queue.push({4, 5, 6});
+}
+
+TEST(MpscQueueTest, Producers) {
+  constexpr int kThreads = 4;
+  constexpr int kItems = 10000;
+
+  mpsc_queue<std::pair<int, int>> queue;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&queue, t]() {
+        for (int i = 0; i < kItems; ++i)
+          queue.push(std::pair(t, i));
+      });
+  }
+
+  std::vector<int> next(kThreads, 0);
+  int received = 0;
+  while (received < kThreads * kItems) {
+    std::pair<int, int> item;
+    if (!queue.pop(&item))
+      continue;
+    ASSERT_EQ(item.second, next[item.first]);  // per-producer order is preserved
+    ++next[item.first];
+    ++received;
+  }
+
+  for (auto& thread : threads)
+    thread.join();
+  std::pair<int, int> item;
+  EXPECT_FALSE(queue.pop(&item));
+}
+
+} // namespace base
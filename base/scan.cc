@@ -0,0 +1,189 @@
+#include "base/scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BASE_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace base {
+
+namespace {
+
+// Scalar reference implementations. Also used for the tails of the vectorized loops.
+
+const byte* FindScalar(const byte* p, const byte* end, byte c) noexcept {
+  while (p < end && *p != c)
+    ++p;
+  return p;
+}
+
+const byte* Find2Scalar(const byte* p, const byte* end, byte a, byte b) noexcept {
+  while (p < end && *p != a && *p != b)
+    ++p;
+  return p;
+}
+
+void Find2AllScalar(const byte* data, std::size_t size, byte a, byte b, std::vector<std::uint32_t>* offsets, std::uint32_t base) {
+  for (std::size_t i = 0; i < size; ++i)
+    if (data[i] == a || data[i] == b)
+      offsets->push_back(base + i);
+}
+
+/** Appends the offsets of all set bits of \p mask, relative to \p at. */
+inline void PushMask(std::uint32_t mask, std::uint32_t at, std::vector<std::uint32_t>* offsets) {
+  while (mask) {
+    offsets->push_back(at + __builtin_ctz(mask));
+    mask &= mask - 1;
+  }
+}
+
+#ifdef BASE_SCAN_X86
+
+__attribute__((target("sse2")))
+const byte* FindSse2(const byte* p, const byte* end, byte c) noexcept {
+  const __m128i vc = _mm_set1_epi8(c);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vc));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return FindScalar(p, end, c);
+}
+
+__attribute__((target("sse2")))
+const byte* Find2Sse2(const byte* p, const byte* end, byte a, byte b) noexcept {
+  const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return Find2Scalar(p, end, a, b);
+}
+
+__attribute__((target("sse2")))
+void Find2AllSse2(const byte* data, std::size_t size, byte a, byte b, std::vector<std::uint32_t>* offsets, std::uint32_t base) {
+  const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+  std::size_t i = 0;
+  for (; size - i >= 16; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    PushMask(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb))), base + i, offsets);
+  }
+  Find2AllScalar(data + i, size - i, a, b, offsets, base + i);
+}
+
+__attribute__((target("avx2")))
+const byte* FindAvx2(const byte* p, const byte* end, byte c) noexcept {
+  const __m256i vc = _mm256_set1_epi8(c);
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vc));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return FindSse2(p, end, c);
+}
+
+__attribute__((target("avx2")))
+const byte* Find2Avx2(const byte* p, const byte* end, byte a, byte b) noexcept {
+  const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return Find2Sse2(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+void Find2AllAvx2(const byte* data, std::size_t size, byte a, byte b, std::vector<std::uint32_t>* offsets, std::uint32_t base) {
+  const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+  std::size_t i = 0;
+  for (; size - i >= 32; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    PushMask(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))), base + i, offsets);
+  }
+  Find2AllSse2(data + i, size - i, a, b, offsets, base + i);
+}
+
+#endif // BASE_SCAN_X86
+
+struct ScanImpl {
+  scan_isa isa;
+  const byte* (*find)(const byte*, const byte*, byte) noexcept;
+  const byte* (*find2)(const byte*, const byte*, byte, byte) noexcept;
+  void (*find2_all)(const byte*, std::size_t, byte, byte, std::vector<std::uint32_t>*, std::uint32_t);
+};
+
+constexpr ScanImpl kScalar = { scan_isa::scalar, FindScalar, Find2Scalar, Find2AllScalar };
+#ifdef BASE_SCAN_X86
+constexpr ScanImpl kSse2 = { scan_isa::sse2, FindSse2, Find2Sse2, Find2AllSse2 };
+constexpr ScanImpl kAvx2 = { scan_isa::avx2, FindAvx2, Find2Avx2, Find2AllAvx2 };
+#endif
+
+bool Supported(scan_isa isa) noexcept {
+  switch (isa) {
+    case scan_isa::scalar:
+      return true;
+#ifdef BASE_SCAN_X86
+    case scan_isa::sse2:
+      return __builtin_cpu_supports("sse2");
+    case scan_isa::avx2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+const ScanImpl* Lookup(scan_isa isa) noexcept {
+  switch (isa) {
+#ifdef BASE_SCAN_X86
+    case scan_isa::sse2: return &kSse2;
+    case scan_isa::avx2: return &kAvx2;
+#endif
+    default: return &kScalar;
+  }
+}
+
+const ScanImpl* Detect() noexcept {
+#ifdef BASE_SCAN_X86
+  __builtin_cpu_init();
+#endif
+  for (scan_isa isa : { scan_isa::avx2, scan_isa::sse2 })
+    if (Supported(isa))
+      return Lookup(isa);
+  return &kScalar;
+}
+
+const ScanImpl* active = Detect();
+
+} // unnamed namespace
+
+scan_isa scan_isa_active() noexcept {
+  return active->isa;
+}
+
+bool scan_isa_select(scan_isa isa) noexcept {
+  if (!Supported(isa))
+    return false;
+  active = Lookup(isa);
+  return true;
+}
+
+const byte* internal::scan_find_wide(const byte* p, const byte* end, byte c) noexcept {
+  return active->find(p, end, c);
+}
+
+const byte* internal::scan_find2_wide(const byte* p, const byte* end, byte a, byte b) noexcept {
+  return active->find2(p, end, a, b);
+}
+
+void scan_find2_all(const byte* data, std::size_t size, byte a, byte b, std::vector<std::uint32_t>* offsets, std::uint32_t base) {
+  active->find2_all(data, size, a, b, offsets, base);
+}
+
+} // namespace base
@@ -0,0 +1,96 @@
+/** \file
+ * Vectorized byte scanning primitives.
+ */
+
+#ifndef BASE_SCAN_H_
+#define BASE_SCAN_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "base/buffer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace base {
+
+/**
+ * Instruction set variants of the scanning functions.
+ *
+ * The best variant supported by the running CPU is selected automatically at startup. On non-x86
+ * platforms, only the scalar variant exists.
+ */
+enum class scan_isa { scalar, sse2, avx2 };
+
+/** Returns the currently active scanning variant. */
+scan_isa scan_isa_active() noexcept;
+
+/**
+ * Switches the scanning functions to use variant \p isa.
+ *
+ * This is meant for tests and benchmarks. Returns `false` (and leaves the selection unchanged) if
+ * the CPU does not support the variant. Not thread-safe with respect to concurrent scans.
+ */
+bool scan_isa_select(scan_isa isa) noexcept;
+
+namespace internal {
+const byte* scan_find_wide(const byte* p, const byte* end, byte c) noexcept;
+const byte* scan_find2_wide(const byte* p, const byte* end, byte a, byte b) noexcept;
+} // namespace internal
+
+/**
+ * Returns a pointer to the first byte in `[p, end)` equal to \p c, or \p end if there is none.
+ *
+ * The first 16 bytes are checked inline (with SSE2, part of the x86-64 baseline), so finding the
+ * end of a short token, the common case when parsing, does not pay for the dispatch.
+ */
+inline const byte* scan_find(const byte* p, const byte* end, byte c) noexcept {
+#ifdef __SSE2__
+  if (end - p >= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    if (unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c))); mask)
+      return p + __builtin_ctz(mask);
+    return internal::scan_find_wide(p + 16, end, c);
+  }
+#endif
+  while (p < end && *p != c)
+    ++p;
+  return p;
+}
+
+/** Returns a pointer to the first byte in `[p, end)` equal to \p a or \p b, or \p end if there is none. */
+inline const byte* scan_find2(const byte* p, const byte* end, byte a, byte b) noexcept {
+#ifdef __SSE2__
+  if (end - p >= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i eq = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(a)), _mm_cmpeq_epi8(v, _mm_set1_epi8(b)));
+    if (unsigned mask = _mm_movemask_epi8(eq); mask)
+      return p + __builtin_ctz(mask);
+    return internal::scan_find2_wide(p + 16, end, a, b);
+  }
+#endif
+  while (p < end && *p != a && *p != b)
+    ++p;
+  return p;
+}
+
+/**
+ * Finds all bytes equal to \p a or \p b in one pass over a buffer.
+ *
+ * The offsets (relative to \p data, plus \p base) of all matching bytes are appended to \p
+ * offsets, in increasing order. This is meant for framing: scanning a whole read buffer for line
+ * delimiters at once, rather than one line at a time.
+ */
+void scan_find2_all(const byte* data, std::size_t size, byte a, byte b,
+                    std::vector<std::uint32_t>* offsets, std::uint32_t base = 0);
+
+} // namespace base
+
+#endif // BASE_SCAN_H_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,58 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/scan.h"
+#include "benchmark/benchmark.h"
+
+namespace base {
+
+namespace {
+
+/** Fills a 64 KiB buffer with CR-LF terminated lines of typical IRC traffic length. */
+std::string MakeLines() {
+  const char* const kLines[] = {
+    ":nick!~user@host.example.com PRIVMSG #channel :well, that's one way of putting it I guess",
+    ":other!~someone@192.0.2.17 QUIT :*.net *.split",
+    ":irc.example.net 353 bot = #channel :@op +voiced regular another yetanother",
+  };
+  std::string data;
+  for (std::size_t i = 0; data.size() < 65536; ++i) {
+    data += kLines[i % 3];
+    data += "\r\n";
+  }
+  data.resize(65536);
+  return data;
+}
+
+} // unnamed namespace
+
+/** Finds all line delimiters of a full read buffer using the variant given as the argument. */
+void BM_FindLineDelimiters(benchmark::State& state) {
+  auto isa = static_cast<scan_isa>(state.range(0));
+  scan_isa saved = scan_isa_active();
+  if (!scan_isa_select(isa)) {
+    state.SkipWithError("not supported");
+    return;
+  }
+
+  std::string data = MakeLines();
+  std::vector<std::uint32_t> offsets;
+  for (auto _ : state) {
+    offsets.clear();
+    scan_find2_all(reinterpret_cast<const byte*>(data.data()), data.size(), '\r', '\n', &offsets);
+    benchmark::DoNotOptimize(offsets.data());
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+  state.counters["lines"] = benchmark::Counter(state.iterations() * offsets.size() / 2, benchmark::Counter::kIsRate);
+
+  scan_isa_select(saved);
+}
+
+BENCHMARK(BM_FindLineDelimiters)
+    ->ArgName("isa")
+    ->Arg(static_cast<int>(scan_isa::scalar))
+    ->Arg(static_cast<int>(scan_isa::sse2))
+    ->Arg(static_cast<int>(scan_isa::avx2));
+
+} // namespace base
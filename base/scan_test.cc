@@ -0,0 +1,99 @@
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "base/scan.h"
+#include "gtest/gtest.h"
+
+namespace base {
+
+/** Runs each test once for every scanning variant the CPU supports. */
+class ScanTest : public ::testing::TestWithParam<scan_isa> {
+ protected:
+  void SetUp() override {
+    saved_ = scan_isa_active();
+    if (!scan_isa_select(GetParam()))
+      GTEST_SKIP() << "variant not supported by the CPU";
+  }
+
+  void TearDown() override { scan_isa_select(saved_); }
+
+  static const byte* b(const std::string& s) { return reinterpret_cast<const byte*>(s.data()); }
+
+ private:
+  scan_isa saved_;
+};
+
+TEST_P(ScanTest, Find) {
+  std::string s(100, 'x');
+  s[70] = ' ';
+  s[90] = ' ';
+  EXPECT_EQ(scan_find(b(s), b(s) + s.size(), ' '), b(s) + 70);
+  EXPECT_EQ(scan_find(b(s) + 71, b(s) + s.size(), ' '), b(s) + 90);
+  EXPECT_EQ(scan_find(b(s) + 91, b(s) + s.size(), ' '), b(s) + s.size());
+  EXPECT_EQ(scan_find(b(s), b(s) + 70, ' '), b(s) + 70);  // doesn't look past end
+  EXPECT_EQ(scan_find(b(s), b(s), ' '), b(s));
+}
+
+TEST_P(ScanTest, Find2) {
+  std::string s(100, 'x');
+  s[40] = '\n';
+  s[33] = '\r';
+  EXPECT_EQ(scan_find2(b(s), b(s) + s.size(), '\r', '\n'), b(s) + 33);
+  EXPECT_EQ(scan_find2(b(s) + 34, b(s) + s.size(), '\r', '\n'), b(s) + 40);
+  EXPECT_EQ(scan_find2(b(s) + 41, b(s) + s.size(), '\r', '\n'), b(s) + s.size());
+}
+
+TEST_P(ScanTest, Find2All) {
+  std::string s = std::string(40, 'x') + "\r\n" + std::string(3, 'y') + "\n" + std::string(30, 'z') + "\r";
+  std::vector<std::uint32_t> offsets = { 7 };
+  scan_find2_all(b(s), s.size(), '\r', '\n', &offsets, 1000);
+  EXPECT_EQ(offsets, (std::vector<std::uint32_t>{ 7, 1040, 1041, 1045, 1076 }));
+}
+
+TEST_P(ScanTest, MatchesScalar) {
+  std::mt19937 rng(12345);
+  std::uniform_int_distribution<int> byte_dist(0, 15);
+  std::string data(1000, 0);
+  for (auto& c : data)
+    c = "abcdefghijkl \r\n\0"[byte_dist(rng)];
+
+  for (std::size_t start = 0; start < 40; ++start) {
+    for (std::size_t size : { 0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 500, 960 }) {
+      const byte* p = b(data) + start;
+      const byte* end = p + size;
+
+      const byte* expect = p;
+      while (expect < end && *expect != ' ')
+        ++expect;
+      EXPECT_EQ(scan_find(p, end, ' '), expect) << start << '+' << size;
+
+      expect = p;
+      while (expect < end && *expect != '\r' && *expect != '\n')
+        ++expect;
+      EXPECT_EQ(scan_find2(p, end, '\r', '\n'), expect) << start << '+' << size;
+
+      std::vector<std::uint32_t> expect_all, all;
+      for (std::size_t i = 0; i < size; ++i)
+        if (p[i] == '\r' || p[i] == '\n')
+          expect_all.push_back(i);
+      scan_find2_all(p, size, '\r', '\n', &all);
+      EXPECT_EQ(all, expect_all) << start << '+' << size;
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    AllVariants, ScanTest,
+    ::testing::Values(scan_isa::scalar, scan_isa::sse2, scan_isa::avx2),
+    [](const ::testing::TestParamInfo<scan_isa>& info) {
+      switch (info.param) {
+        case scan_isa::scalar: return "scalar";
+        case scan_isa::sse2: return "sse2";
+        case scan_isa::avx2: return "avx2";
+      }
+      return "unknown";
+    });
+
+} // namespace base
@@ -6,12 +6,14 @@
 #define BASE_TIMER_H_
 
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <map>
-#include <set>
+#include <memory>
 #include <utility>
+#include <vector>
 
 #include "base/common.h"
-#include "base/unique_set.h"
 
 namespace base {
 
@@ -51,6 +53,12 @@ struct TimerFd {
  * Periodic tags will be delivered at constant multiples of the rate, so using a rate of (e.g.) 1
  * minute will cause a tag to be delivered right after the start of a new minute.
  *
+ * Internally, the pending timers are kept in a hierarchical timing wheel with one millisecond
+ * ticks, so adding and cancelling a timer take constant time. Expiry is still exact: within the
+ * current tick, only the requests whose time has actually come are delivered. Request objects are
+ * allocated from a pool owned by the timer and reused, and the underlying `timerfd` is only
+ * re-armed when the earliest deadline moves earlier, or after timers have been delivered.
+ *
  * \tparam PeriodicT object type for periodic timers
  * \tparam OneshotT object type for one-shot timers
  */
@@ -59,6 +67,35 @@ class Timer {
  public:
   struct Request;
 
+  /**
+   * Handle to a requested timer, for Cancel().
+   *
+   * Request objects are reused once their timer has expired or been cancelled, so the handle also
+   * records which use of the object it was issued for. Cancelling with a stale handle is therefore
+   * detected, and doesn't affect a newer timer that happens to use the same object.
+   */
+  class Handle {
+   public:
+    /** Constructs an empty handle, which doesn't refer to any timer. */
+    constexpr Handle() noexcept = default;
+    /** Constructs an empty handle, like the default constructor. */
+    constexpr Handle(std::nullptr_t) noexcept {}
+    /** Returns `true` if the handle is not empty. It may still be stale. */
+    explicit operator bool() const noexcept { return req_ != nullptr; }
+    bool operator==(const Handle& other) const noexcept {
+      return req_ == other.req_ && generation_ == other.generation_;
+    }
+    bool operator!=(const Handle& other) const noexcept { return !(*this == other); }
+
+   private:
+    Handle(Request* req, std::uint64_t generation) noexcept : req_(req), generation_(generation) {}
+
+    Request* req_ = nullptr;
+    std::uint64_t generation_ = 0;
+
+    friend class Timer;
+  };
+
   /**
    * Constructs a timer.
    *
@@ -79,16 +116,15 @@ class Timer {
    * PeriodicT constructor, and a pointer to that object is returned. It will be owned by the
    * set. The timer will start delivering the new object at the requested rate.
    *
-   * The return value is a pair of pointers: one to the opaque `Request` type (which should be
-   * considered an arbitrary handle to the timer), and another to the associated data object held by
-   * this class.
+   * The return value is a pair of a Handle to the timer, and a pointer to the associated data object
+   * held by this class.
    *
    * \tparam Args constructor argument types used if a new object is needed
    * \param rate periodic timer rate
    * \param args constructor arguments used if a new object is needed
    */
   template <typename... Args>
-  std::pair<Request*, PeriodicT*> AddPeriodic(TimerDuration rate, Args&&... args);
+  std::pair<Handle, PeriodicT*> AddPeriodic(TimerDuration rate, Args&&... args);
 
   /**
    * Adds a new one-shot timer.
@@ -102,15 +138,17 @@ class Timer {
    * \param args constructor arguments for the new object
    */
   template <typename... Args>
-  std::pair<Request*, OneshotT*> AddDelay(TimerDuration delay, Args&&... args);
+  std::pair<Handle, OneshotT*> AddDelay(TimerDuration delay, Args&&... args);
 
   /**
    * Cancels a previously requested timer.
    *
    * This will destroy the associated data. Note that for a periodic timer, there's only one object
-   * per unique period.
+   * per unique period. If called for the timer currently being delivered by Poll(), the data is
+   * destroyed once the callback returns. Returns `false` if \p timer was no longer pending, or is
+   * empty.
    */
-  bool Cancel(Request* timer);
+  bool Cancel(Handle timer);
 
   /**
    * Delivers the expiring timers, and their attached objects.
@@ -130,6 +168,15 @@ class Timer {
   template <typename F>
   void Poll(F f);
 
+  /**
+   * Delivers the expired timers like Poll(), but without reading the `timerfd` first.
+   *
+   * This is for callers that have already consumed the expiration some other way, such as an
+   * asynchronous read.
+   */
+  template <typename F>
+  void Expire(F f);
+
   /** Returns the file descriptor that Poll() will try to read. */
   int fd() const noexcept { return timerfd_->fd(); }
 
@@ -137,22 +184,57 @@ class Timer {
   struct PeriodicRequest;
   struct OneshotRequest;
 
-  struct RequestOrder {
-    bool operator()(const Request* a, const Request* b) const noexcept;
-  };
+  /** Number of tick counter bits covered by each level of the wheel. */
+  static constexpr int kLevelBits = 8;
+  /** Number of slots in each level of the wheel. */
+  static constexpr std::size_t kSlots = std::size_t(1) << kLevelBits;
+  /** Number of levels in the wheel. Timers further out than this covers go to #far_. */
+  static constexpr int kLevels = 4;
+  /** Number of request objects allocated at once for the pools. */
+  static constexpr std::size_t kPoolBlock = 64;
+  /** Value of #armed_ when the `timerfd` is not known to be armed. */
+  static constexpr TimerPoint kNotArmed = TimerPoint::max();
 
   std::unique_ptr<TimerFd> timerfd_;
-
-  base::unique_set<Request> requests_;
+  /** Time point corresponding to tick 0. */
+  TimerPoint origin_;
+  /** First tick that has not been completely processed by Poll() yet. */
+  std::uint64_t current_ = 0;
+  /** Time point the `timerfd` is armed to expire at, or #kNotArmed. */
+  TimerPoint armed_ = kNotArmed;
+
+  /** Heads of the doubly-linked request lists for each slot of the wheel. */
+  Request* slots_[kLevels][kSlots] = {};
+  /** Number of requests in each level of the wheel. */
+  std::size_t level_size_[kLevels] = {};
+  /** Requests too far in the future to fit in the wheel. */
+  Request* far_ = nullptr;
+
+  std::vector<std::unique_ptr<PeriodicRequest[]>> periodic_pool_;
+  std::vector<std::unique_ptr<OneshotRequest[]>> oneshot_pool_;
+  Request* free_periodic_ = nullptr;
+  Request* free_oneshot_ = nullptr;
   std::map<TimerDuration, PeriodicRequest*> periodic_;
-  std::set<Request*, RequestOrder> queue_;
 
+  template <typename R>
+  R* Allocate(std::vector<std::unique_ptr<R[]>>* pool, Request** free_list);
+  void Release(Request* req);
+  template <typename F>
+  void Deliver(Request* req, F f);
+
+  std::uint64_t TickOf(TimerPoint target) const;
   TimerPoint NextPeriod(TimerDuration rate);
+  void Link(Request* req);
+  void Unlink(Request* req);
+  void Advance(std::uint64_t limit);
+  bool NextTarget(TimerPoint* target) const;
+  void Schedule(Request* req);
   void UpdateTimer();
+  void ArmAt(TimerPoint target);
 };
 
 template <typename PeriodicT, typename OneshotT = PeriodicT>
-using TimerId = typename Timer<PeriodicT, OneshotT>::Request*;
+using TimerId = typename Timer<PeriodicT, OneshotT>::Handle;
 
 } // namespace base
 
@@ -6,7 +6,9 @@
  * event::Loop, that should be the only user of this file.
  */
 
+#include <algorithm>
 #include <cerrno>
+#include <optional>
 
 #include "base/exc.h"
 #include "base/log.h"
@@ -71,32 +73,43 @@ void DefaultTimerFd::Wait() {
 /** Base class for objects holding information about timer requests. */
 template <typename PeriodicT, typename OneshotT>
 struct Timer<PeriodicT, OneshotT>::Request {
-  TimerPoint target;  ///< Time when this timer next elapses.
-  bool periodic;      ///< `true` if the timer is periodic.
-  explicit Request(TimerPoint target, bool periodic) : target(target), periodic(periodic) {}
-  virtual ~Request() = default;
+  /** Lifecycle of a pooled request object. */
+  enum class State {
+    kFree,       ///< in the free list of the pool
+    kPending,    ///< linked in the wheel, waiting to expire
+    kFiring,     ///< detached from the wheel for delivery by Poll()
+    kCancelled,  ///< cancelled while being delivered, to be released after the callback
+  };
+
+  TimerPoint target;              ///< Time when this timer next elapses.
+  std::uint64_t tick = 0;         ///< Wheel tick #target falls in.
+  bool periodic;                  ///< `true` if the timer is periodic.
+  State state = State::kFree;     ///< Current state of the request.
+  std::uint64_t generation = 0;   ///< Number of times the object has been released to the pool.
+  int level = 0;                  ///< Wheel level the request is linked in (#kLevels for Timer::far_).
+  Request** list = nullptr;       ///< Head of the list the request is linked in.
+  Request* prev = nullptr;        ///< Previous request in the same list.
+  Request* next = nullptr;        ///< Next request in the same list (or the free list).
+
+  explicit Request(bool periodic) : periodic(periodic) {}
   DISALLOW_COPY(Request);
 };
 
 /** Periodic timer request. */
 template <typename PeriodicT, typename OneshotT>
 struct Timer<PeriodicT, OneshotT>::PeriodicRequest : public Timer<PeriodicT, OneshotT>::Request {
-  TimerDuration rate;  ///< Repeat rate (period) of this timer.
-  PeriodicT data;      ///< Data associated with this timer.
+  TimerDuration rate;              ///< Repeat rate (period) of this timer.
+  std::optional<PeriodicT> data;   ///< Data associated with this timer, if not free.
 
-  template <typename... Args>
-  explicit PeriodicRequest(TimerPoint target, TimerDuration rate, Args&&... args)
-      : Request(target, true), rate(rate), data(std::forward<Args>(args)...) {}
+  PeriodicRequest() : Request(true) {}
 };
 
 /** One-shot timer request. */
 template <typename PeriodicT, typename OneshotT>
 struct Timer<PeriodicT, OneshotT>::OneshotRequest : public Timer<PeriodicT, OneshotT>::Request {
-  OneshotT data;  ///< Data associated with this timer.
+  std::optional<OneshotT> data;  ///< Data associated with this timer, if not free.
 
-  template <typename... Args>
-  explicit OneshotRequest(TimerPoint target, Args&&... args)
-      : Request(target, false), data(std::forward<Args>(args)...) {}
+  OneshotRequest() : Request(false) {}
 };
 
 template <typename PeriodicT, typename OneshotT>
@@ -105,6 +118,7 @@ Timer<PeriodicT, OneshotT>::Timer(std::unique_ptr<TimerFd> timerfd) {
     timerfd_ = std::move(timerfd);
   else
     timerfd_ = std::make_unique<internal::DefaultTimerFd>();
+  origin_ = timerfd_->now();
 }
 
 template <typename PeriodicT, typename OneshotT>
@@ -112,40 +126,54 @@ Timer<PeriodicT, OneshotT>::~Timer() = default;
 
 template <typename PeriodicT, typename OneshotT>
 template <typename... Args>
-std::pair<typename Timer<PeriodicT, OneshotT>::Request*, PeriodicT*> Timer<PeriodicT, OneshotT>::AddPeriodic(TimerDuration rate, Args&&... args) {
+std::pair<typename Timer<PeriodicT, OneshotT>::Handle, PeriodicT*> Timer<PeriodicT, OneshotT>::AddPeriodic(TimerDuration rate, Args&&... args) {
   if (auto req = periodic_.find(rate); req != periodic_.end())
-    return std::pair(req->second, &req->second->data);
+    return std::pair(Handle(req->second, req->second->generation), &*req->second->data);
 
-  PeriodicRequest* new_req = requests_.insert(std::make_unique<PeriodicRequest>(NextPeriod(rate), rate, std::forward<Args>(args)...));
+  PeriodicRequest* new_req = Allocate(&periodic_pool_, &free_periodic_);
+  new_req->data.emplace(std::forward<Args>(args)...);
+  new_req->rate = rate;
+  new_req->target = NextPeriod(rate);
   periodic_.emplace(rate, new_req);
-  queue_.insert(new_req);
-  UpdateTimer();
+  Schedule(new_req);
 
-  return std::pair(new_req, &new_req->data);
+  return std::pair(Handle(new_req, new_req->generation), &*new_req->data);
 }
 
 template <typename PeriodicT, typename OneshotT>
 template <typename... Args>
-std::pair<typename Timer<PeriodicT, OneshotT>::Request*, OneshotT*> Timer<PeriodicT, OneshotT>::AddDelay(TimerDuration delay, Args&&... args) {
-  OneshotRequest* req = requests_.insert(std::make_unique<OneshotRequest>(timerfd_->now() + delay, std::forward<Args>(args)...));
-  queue_.insert(req);
-  UpdateTimer();
+std::pair<typename Timer<PeriodicT, OneshotT>::Handle, OneshotT*> Timer<PeriodicT, OneshotT>::AddDelay(TimerDuration delay, Args&&... args) {
+  OneshotRequest* req = Allocate(&oneshot_pool_, &free_oneshot_);
+  req->data.emplace(std::forward<Args>(args)...);
+  req->target = timerfd_->now() + delay;
+  Schedule(req);
 
-  return std::pair(req, &req->data);
+  return std::pair(Handle(req, req->generation), &*req->data);
 }
 
 template <typename PeriodicT, typename OneshotT>
-bool Timer<PeriodicT, OneshotT>::Cancel(Request* req) {
-  auto owned_req = requests_.claim(req);
-
-  if (!owned_req)
+bool Timer<PeriodicT, OneshotT>::Cancel(Handle timer) {
+  // Request objects are never returned to the system while the timer exists, so it's safe to look
+  // at a stale handle. The generation tells if the object has been reused since.
+  using State = typename Request::State;
+  Request* req = timer.req_;
+  if (!req || req->generation != timer.generation_)
+    return false;
+  if (req->state != State::kPending && req->state != State::kFiring)
     return false;
 
-  queue_.erase(owned_req.get());
-  if (owned_req->periodic)
-    periodic_.erase(static_cast<PeriodicRequest*>(owned_req.get())->rate);
+  if (req->periodic)
+    periodic_.erase(static_cast<PeriodicRequest*>(req)->rate);
 
-  UpdateTimer();
+  if (req->state == State::kFiring) {
+    req->state = State::kCancelled;  // released by Deliver()
+    return true;
+  }
+
+  // The timerfd is left alone: if this was the earliest timer, the resulting wakeup just finds
+  // nothing to deliver, and is cheaper than re-arming on every cancellation.
+  Unlink(req);
+  Release(req);
   return true;
 }
 
@@ -153,36 +181,111 @@ template <typename PeriodicT, typename OneshotT>
 template <typename F>
 void Timer<PeriodicT, OneshotT>::Poll(F f) {
   timerfd_->Wait();
+  Expire(f);
+}
 
-  TimerPoint now = timerfd_->now();
-  while (!queue_.empty()) {
-    Request* req = *queue_.begin();
-    if (req->target > now)
-      break;
+template <typename PeriodicT, typename OneshotT>
+template <typename F>
+void Timer<PeriodicT, OneshotT>::Expire(F f) {
+  armed_ = TimerPoint::min();  // suppresses re-arming from callbacks; done once at the end instead
 
-    queue_.erase(queue_.begin());
+  TimerPoint now = timerfd_->now();
+  std::uint64_t now_tick = TickOf(now);
+
+  while (true) {
+    // Detach the due requests before delivering any, so that timers added by the callbacks (even
+    // with zero delay) are not delivered in this call.
+    Request* due = nullptr;
+    Request** due_tail = &due;
+    for (Request* req = slots_[0][current_ % kSlots], *next; req; req = next) {
+      next = req->next;
+      if (req->target > now)
+        continue;  // only possible in the current tick
+      Unlink(req);
+      req->state = Request::State::kFiring;
+      *due_tail = req;
+      due_tail = &req->next;
+    }
 
-    if (req->periodic)
-      f(&static_cast<PeriodicRequest*>(req)->data, nullptr);
-    else
-      f(nullptr, &static_cast<OneshotRequest*>(req)->data);
+    bool last = current_ == now_tick;
+    if (!last)
+      Advance(now_tick);
 
-    if (req->periodic) {
-      req->target = NextPeriod(static_cast<PeriodicRequest*>(req)->rate);
-      queue_.insert(req);
-    } else {
-      requests_.erase(req);
+    while (due) {
+      Request* req = due;
+      due = req->next;
+      Deliver(req, f);
     }
+
+    if (last)
+      break;
   }
 
+  armed_ = kNotArmed;
   UpdateTimer();
 }
 
 template <typename PeriodicT, typename OneshotT>
-bool Timer<PeriodicT, OneshotT>::RequestOrder::operator()(const Request* a, const Request* b) const noexcept {
-  if (a->target != b->target)
-    return a->target < b->target;
-  return std::less<const Request*>()(a, b);
+template <typename R>
+R* Timer<PeriodicT, OneshotT>::Allocate(std::vector<std::unique_ptr<R[]>>* pool, Request** free_list) {
+  if (!*free_list) {
+    pool->push_back(std::make_unique<R[]>(kPoolBlock));
+    R* block = pool->back().get();
+    for (std::size_t i = 0; i < kPoolBlock; ++i) {
+      block[i].next = *free_list;
+      *free_list = &block[i];
+    }
+  }
+
+  R* req = static_cast<R*>(*free_list);
+  *free_list = req->next;
+  req->next = nullptr;
+  return req;
+}
+
+template <typename PeriodicT, typename OneshotT>
+void Timer<PeriodicT, OneshotT>::Release(Request* req) {
+  req->state = Request::State::kFree;
+  ++req->generation;
+  if (req->periodic) {
+    static_cast<PeriodicRequest*>(req)->data.reset();
+    req->next = free_periodic_;
+    free_periodic_ = req;
+  } else {
+    static_cast<OneshotRequest*>(req)->data.reset();
+    req->next = free_oneshot_;
+    free_oneshot_ = req;
+  }
+}
+
+template <typename PeriodicT, typename OneshotT>
+template <typename F>
+void Timer<PeriodicT, OneshotT>::Deliver(Request* req, F f) {
+  using State = typename Request::State;
+
+  if (req->state == State::kCancelled) {
+    Release(req);  // cancelled by an earlier callback in the same batch
+    return;
+  }
+
+  if (req->periodic)
+    f(&*static_cast<PeriodicRequest*>(req)->data, nullptr);
+  else
+    f(nullptr, &*static_cast<OneshotRequest*>(req)->data);
+
+  if (req->periodic && req->state == State::kFiring) {
+    req->target = NextPeriod(static_cast<PeriodicRequest*>(req)->rate);
+    Schedule(req);
+  } else {
+    Release(req);
+  }
+}
+
+template <typename PeriodicT, typename OneshotT>
+std::uint64_t Timer<PeriodicT, OneshotT>::TickOf(TimerPoint target) const {
+  if (target <= origin_)
+    return 0;
+  return (target - origin_) / std::chrono::milliseconds(1);
 }
 
 template <typename PeriodicT, typename OneshotT>
@@ -194,15 +297,130 @@ TimerPoint Timer<PeriodicT, OneshotT>::NextPeriod(TimerDuration rate) {
   return timerfd_->now() + std::chrono::system_clock::duration(count_delay);
 }
 
+template <typename PeriodicT, typename OneshotT>
+void Timer<PeriodicT, OneshotT>::Link(Request* req) {
+  if (req->tick < current_)
+    req->tick = current_;
+
+  // A request goes to the lowest level where its tick shares all the higher digits with the current
+  // tick. It will be cascaded down a level whenever the current tick reaches its slot.
+  Request** list = &far_;
+  req->level = kLevels;
+  for (int level = 0; level < kLevels; ++level) {
+    int shift = kLevelBits * (level + 1);
+    if ((req->tick >> shift) == (current_ >> shift)) {
+      list = &slots_[level][(req->tick >> (kLevelBits * level)) % kSlots];
+      req->level = level;
+      ++level_size_[level];
+      break;
+    }
+  }
+
+  req->list = list;
+  req->prev = nullptr;
+  req->next = *list;
+  if (*list)
+    (*list)->prev = req;
+  *list = req;
+}
+
+template <typename PeriodicT, typename OneshotT>
+void Timer<PeriodicT, OneshotT>::Unlink(Request* req) {
+  if (req->prev)
+    req->prev->next = req->next;
+  else
+    *req->list = req->next;
+  if (req->next)
+    req->next->prev = req->prev;
+
+  if (req->level < kLevels)
+    --level_size_[req->level];
+  req->list = nullptr;
+  req->prev = req->next = nullptr;
+}
+
+template <typename PeriodicT, typename OneshotT>
+void Timer<PeriodicT, OneshotT>::Advance(std::uint64_t limit) {
+  CHECK(current_ < limit);
+
+  // Step to the next tick, or further: if all levels up to some level are empty, there's nothing to
+  // do until the next time a slot of the level above it needs to be cascaded.
+  std::uint64_t next = current_ + 1;
+  for (int level = 0; level < kLevels && !level_size_[level]; ++level) {
+    int shift = kLevelBits * (level + 1);
+    next = ((current_ >> shift) + 1) << shift;
+  }
+  current_ = std::min(next, limit);
+
+  if (current_ % (std::uint64_t(1) << (kLevelBits * kLevels)) == 0) {
+    Request* far = far_;
+    far_ = nullptr;
+    while (far) {
+      Request* req = far;
+      far = req->next;
+      Link(req);
+    }
+  }
+
+  for (int level = kLevels - 1; level > 0; --level) {
+    if (current_ % (std::uint64_t(1) << (kLevelBits * level)) != 0)
+      continue;  // not at a boundary of this level
+    Request** slot = &slots_[level][(current_ >> (kLevelBits * level)) % kSlots];
+    while (Request* req = *slot) {
+      Unlink(req);
+      Link(req);
+    }
+  }
+}
+
+template <typename PeriodicT, typename OneshotT>
+bool Timer<PeriodicT, OneshotT>::NextTarget(TimerPoint* target) const {
+  // Everything in a lower level expires before anything in a higher level, and within a level, the
+  // slots ahead of the current one are in order. So the first non-empty slot holds the minimum.
+  const Request* list = nullptr;
+  for (int level = 0; level < kLevels && !list; ++level) {
+    if (!level_size_[level])
+      continue;
+    std::size_t first = (current_ >> (kLevelBits * level)) % kSlots + (level ? 1 : 0);
+    for (std::size_t slot = first; slot < kSlots && !list; ++slot)
+      list = slots_[level][slot];
+  }
+  if (!list)
+    list = far_;
+  if (!list)
+    return false;
+
+  *target = TimerPoint::max();
+  for (const Request* req = list; req; req = req->next)
+    *target = std::min(*target, req->target);
+  return true;
+}
+
+template <typename PeriodicT, typename OneshotT>
+void Timer<PeriodicT, OneshotT>::Schedule(Request* req) {
+  req->state = Request::State::kPending;
+  req->tick = TickOf(req->target);
+  Link(req);
+
+  if (req->target < armed_)
+    ArmAt(req->target);
+}
+
 template <typename PeriodicT, typename OneshotT>
 void Timer<PeriodicT, OneshotT>::UpdateTimer() {
+  TimerPoint target;
+  if (NextTarget(&target)) // TODO: disarm timer if armed? maybe keep track.
+    ArmAt(target);
+}
+
+template <typename PeriodicT, typename OneshotT>
+void Timer<PeriodicT, OneshotT>::ArmAt(TimerPoint target) {
   using namespace std::chrono_literals;
   constexpr TimerDuration kSlack = 1ms;
 
-  if (queue_.empty()) // TODO: disarm timer if armed? maybe keep track.
-    return;
+  armed_ = target;
 
-  TimerDuration delay = ((*queue_.begin())->target - timerfd_->now()) + kSlack;
+  TimerDuration delay = (target - timerfd_->now()) + kSlack;
   if (delay < kSlack)
     delay = kSlack;
 
@@ -0,0 +1,156 @@
+#include <chrono>
+#include <vector>
+
+#include "base/timer.h"
+#include "base/timer_impl.h"
+#include "gtest/gtest.h"
+
+namespace base {
+
+using namespace std::chrono_literals;
+
+class FakeTimerFd : public TimerFd {
+ public:
+  FakeTimerFd(TimerPoint* now, std::vector<TimerDuration>* armed) : now_(now), armed_(armed) {}
+  void Arm(TimerDuration delay) override { armed_->push_back(delay); }
+  void Wait() override {}
+  TimerPoint now() const noexcept override { return *now_; }
+  int fd() const noexcept override { return -1; }
+
+ private:
+  TimerPoint* now_;
+  std::vector<TimerDuration>* armed_;
+};
+
+struct TimerTest : public ::testing::Test {
+  TimerPoint now = TimerPoint(TimerDuration(5544332211));
+  std::vector<TimerDuration> armed;
+  Timer<int> timer{std::make_unique<FakeTimerFd>(&now, &armed)};
+
+  /** Advances the fake clock by \p delta and returns the timers delivered by Poll(). */
+  std::vector<int> Advance(TimerDuration delta) {
+    now += delta;
+    std::vector<int> fired;
+    timer.Poll([&](int* periodic, int* oneshot) { fired.push_back(periodic ? -*periodic : *oneshot); });
+    return fired;
+  }
+};
+
+TEST_F(TimerTest, DeliversInOrder) {
+  timer.AddDelay(5ms, 2);
+  timer.AddDelay(1ms, 1);
+  timer.AddDelay(300ms, 3);    // second level
+  timer.AddDelay(70000ms, 4);  // third level
+
+  EXPECT_EQ(Advance(1ms), std::vector<int>({1}));
+  EXPECT_EQ(Advance(3ms), std::vector<int>());
+  EXPECT_EQ(Advance(1ms), std::vector<int>({2}));
+  EXPECT_EQ(Advance(294ms), std::vector<int>());
+  EXPECT_EQ(Advance(1ms), std::vector<int>({3}));
+  EXPECT_EQ(Advance(69699ms), std::vector<int>());
+  EXPECT_EQ(Advance(1ms), std::vector<int>({4}));
+}
+
+TEST_F(TimerTest, NeverEarly) {
+  timer.AddDelay(1500us, 1);
+
+  EXPECT_EQ(Advance(1ms), std::vector<int>());
+  EXPECT_EQ(Advance(499us), std::vector<int>());
+  EXPECT_EQ(Advance(1us), std::vector<int>({1}));
+}
+
+TEST_F(TimerTest, LongGap) {
+  timer.AddDelay(2ms, 1);
+  timer.AddDelay(100000ms, 2);
+  timer.AddDelay(1000h, 3);  // beyond the range of the wheel (about 50 days)
+
+  EXPECT_EQ(Advance(2000h), std::vector<int>({1, 2, 3}));
+}
+
+TEST_F(TimerTest, FarFuture) {
+  timer.AddDelay(60 * 24h, 1);  // beyond the range of the wheel
+
+  EXPECT_EQ(Advance(60 * 24h - 1ms), std::vector<int>());
+  EXPECT_EQ(Advance(1ms), std::vector<int>({1}));
+}
+
+TEST_F(TimerTest, Cancel) {
+  auto [a, a_data] = timer.AddDelay(1ms, 1);
+  auto [b, b_data] = timer.AddDelay(1ms, 2);
+
+  EXPECT_TRUE(timer.Cancel(a));
+  EXPECT_FALSE(timer.Cancel(a));
+  EXPECT_EQ(Advance(1ms), std::vector<int>({2}));
+  EXPECT_FALSE(timer.Cancel(b));
+  EXPECT_FALSE(timer.Cancel(nullptr));
+}
+
+TEST_F(TimerTest, CancelStaleHandle) {
+  auto [a, a_data] = timer.AddDelay(1ms, 1);
+  EXPECT_EQ(Advance(1ms), std::vector<int>({1}));
+
+  // the pool hands out the request object just released again
+  auto [b, b_data] = timer.AddDelay(1ms, 2);
+  ASSERT_EQ(a_data, b_data);
+  EXPECT_FALSE(timer.Cancel(a));
+  EXPECT_EQ(Advance(1ms), std::vector<int>({2}));
+}
+
+TEST_F(TimerTest, CancelFromCallback) {
+  std::vector<Timer<int>::Handle> ids;
+  for (int i = 1; i <= 3; ++i)
+    ids.push_back(timer.AddDelay(1ms, i).first);
+
+  now += 1ms;
+  int delivered = 0;
+  timer.Poll([&](int*, int* oneshot) {
+      ++delivered;
+      for (auto id : ids)
+        timer.Cancel(id);
+    });
+  EXPECT_EQ(delivered, 1);
+}
+
+TEST_F(TimerTest, ZeroDelayFromCallback) {
+  timer.AddDelay(1ms, 1);
+
+  now += 1ms;
+  std::vector<int> fired;
+  timer.Poll([&](int*, int* oneshot) {
+      fired.push_back(*oneshot);
+      timer.AddDelay(0ms, *oneshot + 1);
+    });
+  EXPECT_EQ(fired, std::vector<int>({1}));
+}
+
+TEST_F(TimerTest, ArmsOnlyWhenHeadMoves) {
+  timer.AddDelay(10ms, 1);
+  EXPECT_EQ(armed.size(), 1);
+  timer.AddDelay(20ms, 2);
+  EXPECT_EQ(armed.size(), 1);
+  timer.AddDelay(5ms, 3);
+  EXPECT_EQ(armed.size(), 2);
+  EXPECT_EQ(armed.back(), 5ms + 1ms);  // includes 1ms of slack
+
+  auto [id, data] = timer.AddDelay(30ms, 4);
+  timer.Cancel(id);
+  EXPECT_EQ(armed.size(), 2);
+
+  EXPECT_EQ(Advance(5ms), std::vector<int>({3}));
+  EXPECT_EQ(armed.size(), 3);
+  EXPECT_EQ(armed.back(), 5ms + 1ms);
+}
+
+TEST_F(TimerTest, Periodic) {
+  auto [a, a_data] = timer.AddPeriodic(1s, 7);
+  auto [b, b_data] = timer.AddPeriodic(1s, 8);
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(*b_data, 7);
+
+  EXPECT_EQ(Advance(1s), std::vector<int>({-7}));
+  EXPECT_EQ(Advance(1s), std::vector<int>({-7}));
+  EXPECT_TRUE(timer.Cancel(a));
+  EXPECT_EQ(Advance(1s), std::vector<int>());
+}
+
+} // namespace base
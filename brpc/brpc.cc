@@ -1,16 +1,37 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+
 #include <google/protobuf/io/coded_stream.h>
 
 #include "base/common.h"
 #include "brpc/brpc.h"
 #include "proto/util.h"
 
+extern "C" {
+#include <unistd.h>
+}
+
 namespace brpc {
 
 namespace {
 constexpr std::size_t kMaxBytesReadAtOnce = 65536u;
 constexpr std::size_t kMaxVarintLen = 10;
+/** Maximum number of buffers to pass to one `writev(2)` call. */
+constexpr int kMaxWriteIov = 16;
 } // unnamed namespace
 
+RpcFrame EncodeFrame(const google::protobuf::Message& message) {
+  const std::size_t message_size = message.ByteSizeLong();
+  const std::size_t header_size = google::protobuf::io::CodedOutputStream::VarintSize64(message_size);
+
+  auto frame = std::make_shared<std::string>(header_size + message_size, '\0');
+  auto* buffer = reinterpret_cast<google::protobuf::uint8*>(frame->data());
+  google::protobuf::io::CodedOutputStream::WriteVarint64ToArray(message_size, buffer);
+  message.SerializeWithCachedSizesToArray(buffer + header_size);
+  return frame;
+}
+
 RpcCall::RpcCall(
     event::Loop* loop,
     RpcServer* server,
@@ -49,9 +70,13 @@ RpcCall::~RpcCall() {
     Close(base::make_error("RpcCall: active call destroyed"));
 }
 
-void RpcCall::Send(const google::protobuf::Message& message) {
+bool RpcCall::Send(const google::protobuf::Message& message) {
   if (state_ != State::kConnecting && state_ != State::kReady)
-    return;
+    return false;
+  if (limits_.high_water > 0 && limits_.overflow == RpcWriteLimits::Overflow::kDropOldest)
+    return Send(EncodeFrame(message));  // only whole frames can be dropped from the buffer
+  if (!Admit())
+    return false;
 
   const std::size_t message_size = message.ByteSizeLong();
   const std::size_t header_size = google::protobuf::io::CodedOutputStream::VarintSize64(message_size);
@@ -71,11 +96,86 @@ void RpcCall::Send(const google::protobuf::Message& message) {
 
     if (coded.HadError()) {
       Close(base::make_error("RpcCall: protobuf serialization failed"));
-      return;
+      return false;
     }
   }
 
   Flush();
+  CheckWritable();
+  return true;
+}
+
+bool RpcCall::Send(RpcFrame frame) {
+  if (state_ != State::kConnecting && state_ != State::kReady)
+    return false;
+  if (!Admit())
+    return false;
+
+  std::size_t ring_before = write_buffer_.size() - frames_ring_;
+  frames_ring_ += ring_before;
+  frames_bytes_ += frame->size();
+  frames_.push_back(PendingFrame{std::move(frame), ring_before, 0});
+
+  Flush();
+  CheckWritable();
+  return true;
+}
+
+void RpcCall::SetWriteLimits(const RpcWriteLimits& limits) {
+  CHECK(limits.low_water <= limits.high_water);
+  limits_ = limits;
+  CheckWritable();
+}
+
+bool RpcCall::Admit() {
+  if (limits_.high_water == 0 || buffered() < limits_.high_water)
+    return true;
+
+  switch (limits_.overflow) {
+    case RpcWriteLimits::Overflow::kPause:
+      return true;
+
+    case RpcWriteLimits::Overflow::kDropNewest:
+      ++dropped_;
+      return false;
+
+    case RpcWriteLimits::Overflow::kDropOldest: {
+      // a partially written frame has to be finished, but any after it can go; the buffered bytes
+      // in front of a dropped frame move on to the next one
+      std::size_t i = !frames_.empty() && frames_.front().written > 0 ? 1 : 0;
+      while (i < frames_.size() && buffered() >= limits_.high_water) {
+        const PendingFrame& f = frames_[i];
+        if (i + 1 < frames_.size())
+          frames_[i + 1].ring_before += f.ring_before;
+        else
+          frames_ring_ -= f.ring_before;
+        frames_bytes_ -= f.frame->size();
+        frames_.erase(frames_.begin() + i);
+        ++dropped_;
+      }
+      return true;
+    }
+
+    case RpcWriteLimits::Overflow::kDisconnect:
+      ++dropped_;
+      Close(base::make_error("RpcCall: write buffer overflow"));
+      return false;
+  }
+  return true;
+}
+
+void RpcCall::CheckWritable() {
+  if (state_ == State::kClosed || !endpoint_)
+    return;
+
+  std::size_t size = buffered();
+  if (writable_ && limits_.high_water > 0 && size >= limits_.high_water) {
+    writable_ = false;
+    endpoint_->RpcWritable(this, false);
+  } else if (!writable_ && (limits_.high_water == 0 || size <= limits_.low_water)) {
+    writable_ = true;
+    endpoint_->RpcWritable(this, true);
+  }
 }
 
 void RpcCall::Close(base::error_ptr error, bool flush) {
@@ -88,12 +188,15 @@ void RpcCall::Close(base::error_ptr error, bool flush) {
   }
 
   read_buffer_.clear();
-  if (state_ != State::kFlushing && flush && !write_buffer_.empty()) {
+  if (state_ != State::kFlushing && flush && !write_empty()) {
     state_ = State::kFlushing;
     socket_->WantRead(false);
     return;
   }
   write_buffer_.clear();
+  frames_.clear();
+  frames_ring_ = 0;
+  frames_bytes_ = 0;
 
   state_ = State::kClosed;
   if (socket_)
@@ -109,7 +212,8 @@ void RpcCall::ConnectionOpen() {
   Flush();
   read_message_ = endpoint_->RpcOpen(this);
 
-  socket_->WantRead(true);
+  if (socket_)  // not closed by RpcOpen, e.g. on a write buffer overflow
+    socket_->WantRead(true);
 }
 
 void RpcCall::ConnectionFailed(base::error_ptr error) {
@@ -121,10 +225,11 @@ void RpcCall::CanRead() {
   bool eof = false;
 
   while (total_read < kMaxBytesReadAtOnce) {
-    base::byte_view chunk = read_buffer_.push_free();
-    base::io_result got = socket_->Read(chunk.data(), chunk.size());
-    if (got.size() < chunk.size())
-      read_buffer_.unpush(chunk.size() - got.size());
+    struct iovec space[2];
+    std::size_t free_size = read_buffer_.push_free_iov(space);
+    base::io_result got = socket_->Readv(space, 2);
+    if (got.size() < free_size)
+      read_buffer_.unpush(free_size - got.size());
     if (got.at_eof()) {
       eof = true;
       break;
@@ -133,7 +238,7 @@ void RpcCall::CanRead() {
       return;
     }
     total_read += got.size();
-    if (got.size() < chunk.size())
+    if (got.size() < free_size)
       break;  // likely no more bytes available right now
   }
 
@@ -209,6 +314,7 @@ void RpcCall::CanRead() {
 
 void RpcCall::CanWrite() {
   Flush();
+  CheckWritable();
 }
 
 void RpcCall::Flush() {
@@ -216,22 +322,57 @@ void RpcCall::Flush() {
     return;
 
   if (socket_->safe_to_write()) {
-    while (!write_buffer_.empty()) {
-      base::byte_view chunk = write_buffer_.next();
-      base::io_result wrote = socket_->Write(chunk.data(), chunk.size());
+    while (!write_empty()) {
+      // gather the buffered bytes up to the first frame, and then as many frames as follow each
+      // other directly
+
+      struct iovec used[kMaxWriteIov];
+      int count = 0;
+      std::size_t ring = frames_.empty() ? write_buffer_.size() : frames_.front().ring_before;
+      if (ring > 0) {
+        write_buffer_.front_iov(used, ring);
+        count = used[1].iov_len > 0 ? 2 : 1;
+      }
+      for (std::size_t i = 0; i < frames_.size() && count < kMaxWriteIov; ++i) {
+        const PendingFrame& f = frames_[i];
+        if (i > 0 && f.ring_before > 0)
+          break;
+        used[count].iov_base = const_cast<char*>(f.frame->data()) + f.written;
+        used[count].iov_len = f.frame->size() - f.written;
+        ++count;
+      }
+
+      base::io_result wrote = socket_->Writev(used, count);
       if (!wrote.ok()) {
         Close(wrote.error());
         return;
       }
       if (wrote.size() == 0)
         break;
-      write_buffer_.pop(wrote.size());
+
+      std::size_t left = wrote.size();
+      std::size_t from_ring = std::min(left, ring);
+      write_buffer_.pop(from_ring);
+      left -= from_ring;
+      if (!frames_.empty()) {
+        frames_.front().ring_before -= from_ring;
+        frames_ring_ -= from_ring;
+      }
+      while (left > 0) {
+        PendingFrame& f = frames_.front();
+        std::size_t from_frame = std::min(left, f.frame->size() - f.written);
+        f.written += from_frame;
+        frames_bytes_ -= from_frame;
+        left -= from_frame;
+        if (f.written == f.frame->size())
+          frames_.pop_front();
+      }
     }
   }
 
-  socket_->WantWrite(!write_buffer_.empty());
+  socket_->WantWrite(!write_empty());
 
-  if (state_ == State::kFlushing && write_buffer_.empty())
+  if (state_ == State::kFlushing && write_empty())
     Close(/* error: */ nullptr, /* flush: */ false);
 }
 
@@ -252,12 +393,63 @@ void RpcCall::LoopFinished() {
     std::get<RpcClient*>(host_)->CloseCall(this);
 }
 
+RpcServer::RpcServer(event::Loop* loop, RpcDispatcher* dispatcher) : dispatcher_(dispatcher) {
+  shards_.push_back(std::make_unique<Shard>(this, loop));
+}
+
+RpcServer::RpcServer(event::LoopGroup* group, RpcDispatcher* dispatcher) : group_(group), dispatcher_(dispatcher) {
+  for (int i = 0; i < group->size(); ++i)
+    shards_.push_back(std::make_unique<Shard>(this, group->loop(i)));
+}
+
+RpcServer::~RpcServer() {
+  // CHECK() throws, which can't leave a destructor
+  if (group_ && group_->running()) {
+    LOG(FATAL) << "RpcServer destroyed while its loop group is still running";
+    std::abort();
+  }
+}
+
 base::error_ptr RpcServer::Start(const std::string& path) {
-  auto ret = event::ListenUnix(loop_, this, path);
+  Shard* first = shards_.front().get();
+  auto ret = event::ListenUnix(first->loop, first, path);
   if (!ret.ok())
     return ret.error();
-  socket_ = ret.ptr();
+  first->socket = ret.ptr();
+
+  for (std::size_t i = 1; i < shards_.size(); ++i) {
+    int fd = dup(first->socket->fd());
+    if (fd == -1)
+      return base::make_os_error("dup", errno);
+    auto ret = event::ListenFd(shards_[i]->loop, shards_[i].get(), fd);
+    if (!ret.ok())
+      return ret.error();
+    shards_[i]->socket = ret.ptr();
+  }
+
   return nullptr;
 }
 
+void RpcServer::Shard::Accepted(std::unique_ptr<event::Socket> socket) {
+  calls.emplace(loop, server, std::move(socket), server->dispatcher_);
+  if (server->group_)
+    server->group_->AddLoad(loop, 1);
+}
+
+void RpcServer::Shard::AcceptError(base::error_ptr error) {
+  // TODO: consider differentiating this as a fatal error
+  server->dispatcher_->RpcError(std::move(error));
+}
+
+void RpcServer::CloseCall(RpcCall* call) {
+  for (auto& shard : shards_) {
+    if (shard->loop == call->loop()) {
+      shard->calls.erase(call);
+      if (group_)
+        group_->AddLoad(shard->loop, -1);
+      return;
+    }
+  }
+}
+
 } // namespace brpc
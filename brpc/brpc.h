@@ -8,14 +8,18 @@
  * definition. TODO: write detailed docs.
  */
 
+#include <deque>
 #include <memory>
 #include <optional>
+#include <string>
+#include <vector>
 
 #include <google/protobuf/message.h>
 
 #include "base/buffer.h"
 #include "base/common.h"
 #include "base/unique_set.h"
+#include "event/loop_group.h"
 #include "event/socket.h"
 
 namespace brpc {
@@ -27,6 +31,13 @@ struct RpcEndpoint {
   virtual std::unique_ptr<google::protobuf::Message> RpcOpen(RpcCall* call) = 0;
   virtual void RpcMessage(RpcCall* call, const google::protobuf::Message& message) = 0;
   virtual void RpcClose(RpcCall* call, base::error_ptr error) = 0;
+  /**
+   * Called when the call crosses one of its water marks (see RpcWriteLimits): with \p writable
+   * `false` when the data waiting to be written reaches the high water mark, and with `true` once
+   * it has drained to the low water mark. Producers can use it to pause. May be called from within
+   * RpcCall::Send(). The default does nothing.
+   */
+  virtual void RpcWritable(RpcCall* call, bool writable) {}
 
   RpcEndpoint() = default;
   DISALLOW_COPY(RpcEndpoint);
@@ -46,6 +57,49 @@ struct RpcDispatcher {
 class RpcServer;
 class RpcClient;
 
+/**
+ * Message encoded for the wire, complete with its length header.
+ *
+ * A frame is immutable, and can be sent on any number of calls with RpcCall::Send(RpcFrame). Each
+ * call only holds a reference to it until written, so a message going out to many calls is
+ * serialized once, and never copied into their write buffers.
+ */
+using RpcFrame = std::shared_ptr<const std::string>;
+
+/** Encodes \p message into a frame. */
+RpcFrame EncodeFrame(const google::protobuf::Message& message);
+
+/**
+ * Limits on the data an RpcCall holds waiting to be written, for peers that don't keep up.
+ *
+ * Once the buffered data reaches #high_water bytes, the call stops being writable, which is
+ * reported to the endpoint, and the overflow policy applies to further messages. When the data
+ * drains to #low_water bytes, the call becomes writable again.
+ */
+struct RpcWriteLimits {
+  /** What to do with messages sent while the call is not writable. */
+  enum class Overflow {
+    /**
+     * Buffer them anyway. The call itself never holds back or drops anything: the producer is
+     * expected to stop sending (or drop its own messages) between RpcEndpoint::RpcWritable() calls
+     * with `false` and `true`.
+     */
+    kPause,
+    /** Drop the new message. */
+    kDropNewest,
+    /** Drop the oldest messages not yet started on, to make room for the new one. */
+    kDropOldest,
+    /** Close the call with an error. */
+    kDisconnect,
+  };
+
+  /** Buffered bytes at which the call stops being writable. 0 means no limit. */
+  std::size_t high_water = 0;
+  /** Buffered bytes at which the call becomes writable again. */
+  std::size_t low_water = 0;
+  Overflow overflow = Overflow::kPause;
+};
+
 /** Active RPC call. Handles both the client and server ends. */
 class RpcCall : public event::Socket::Watcher, public event::Finishable {
  public:
@@ -67,9 +121,31 @@ class RpcCall : public event::Socket::Watcher, public event::Finishable {
 
   ~RpcCall();
 
-  void Send(const google::protobuf::Message& message);
+  /**
+   * Sends \p message. Returns `false` if it was not accepted: the call is not open, or the overflow
+   * policy of the call dropped it or closed the call. Older messages dropped to make room for it
+   * are only counted in dropped().
+   */
+  bool Send(const google::protobuf::Message& message);
+  /**
+   * Sends a message encoded by EncodeFrame(), in order with any other sent messages. Returns `false`
+   * if it was not accepted, like the above.
+   */
+  bool Send(RpcFrame frame);
   void Close(base::error_ptr error = nullptr, bool flush = true);
 
+  /** Sets the limits on buffered data. The default is no limits. */
+  void SetWriteLimits(const RpcWriteLimits& limits);
+  /** Returns `false` if the buffered data has reached the high water mark, and not yet drained. */
+  bool writable() const noexcept { return writable_; }
+  /** Returns the number of bytes waiting to be written. */
+  std::size_t buffered() const noexcept { return write_buffer_.size() + frames_bytes_; }
+  /** Returns the number of messages dropped by the overflow policy. */
+  std::uint64_t dropped() const noexcept { return dropped_; }
+
+  /** Returns the loop the call runs on. The call must only be used from that loop's thread. */
+  event::Loop* loop() const noexcept { return loop_; }
+
   void ConnectionOpen() override;
   void ConnectionFailed(base::error_ptr error) override;
   void CanRead() override;
@@ -96,39 +172,86 @@ class RpcCall : public event::Socket::Watcher, public event::Finishable {
   base::ring_buffer read_buffer_;
   base::ring_buffer write_buffer_;
 
+  /** Frame waiting to be written, after the bytes of #write_buffer_ sent before it. */
+  struct PendingFrame {
+    RpcFrame frame;
+    /** Bytes at the front of #write_buffer_ (after any earlier frames) that go before this frame. */
+    std::size_t ring_before;
+    /** Bytes of the frame already written. */
+    std::size_t written;
+  };
+  std::deque<PendingFrame> frames_;
+  /** Sum of PendingFrame::ring_before in #frames_. The bytes of #write_buffer_ past this go last. */
+  std::size_t frames_ring_ = 0;
+  /** Bytes of #frames_ still to be written. */
+  std::size_t frames_bytes_ = 0;
+
+  RpcWriteLimits limits_;
+  bool writable_ = true;
+  std::uint64_t dropped_ = 0;
+
   std::optional<std::size_t> message_size_;  // set if we should read a message next
   std::unique_ptr<google::protobuf::Message> read_message_;
 
   base::error_ptr close_error_ = nullptr;
 
+  /** Returns `true` if there's nothing left to write. */
+  bool write_empty() const noexcept { return write_buffer_.empty() && frames_.empty(); }
+  /** Applies the overflow policy before sending a message. Returns `false` if it should be dropped. */
+  bool Admit();
+  /** Reports crossing the water marks to the endpoint. */
+  void CheckWritable();
   void Flush();
   void LoopFinished() override;
 };
 
-class RpcServer : public event::ServerSocket::Watcher {
+/**
+ * Server accepting RPC calls.
+ *
+ * The server runs either on a single event loop, or on all the loops of an event::LoopGroup. In the
+ * latter case, every loop accepts connections from the same listening socket, and serves the calls
+ * it accepted. The dispatcher (and the endpoints it returns) will then be called concurrently from
+ * the group's threads.
+ *
+ * The server's sockets and calls belong to the loops they were accepted on, so a server on a loop
+ * group must only be destroyed once the group has been stopped and joined (LoopGroup::Stop() and
+ * LoopGroup::Join()). The destructor checks this.
+ */
+class RpcServer {
  public:
-  RpcServer(event::Loop* loop, RpcDispatcher* dispatcher) : loop_(loop), dispatcher_(dispatcher) {}
+  RpcServer(event::Loop* loop, RpcDispatcher* dispatcher);
+  RpcServer(event::LoopGroup* group, RpcDispatcher* dispatcher);
+  ~RpcServer();
 
-  base::error_ptr Start(const std::string& path);
+  DISALLOW_COPY(RpcServer);
 
-  void Accepted(std::unique_ptr<event::Socket> socket) override {
-    calls_.emplace(loop_, this, std::move(socket), dispatcher_);
-  }
-
-  void AcceptError(base::error_ptr error) override {
-    // TODO: consider differentiating this as a fatal error
-    dispatcher_->RpcError(std::move(error));
-  }
+  /**
+   * Starts listening on the Unix domain socket \p path.
+   *
+   * For a server on a loop group, this must be done before the group is started.
+   */
+  base::error_ptr Start(const std::string& path);
 
  private:
   friend class RpcCall;
 
-  event::Loop* loop_;
+  /** Per-loop state of the server. */
+  struct Shard : public event::ServerSocket::Watcher {
+    RpcServer* server;
+    event::Loop* loop;
+    std::unique_ptr<event::ServerSocket> socket;
+    base::unique_set<RpcCall> calls;
+
+    Shard(RpcServer* s, event::Loop* l) : server(s), loop(l) {}
+    void Accepted(std::unique_ptr<event::Socket> socket) override;
+    void AcceptError(base::error_ptr error) override;
+  };
+
+  event::LoopGroup* group_ = nullptr;
   RpcDispatcher* dispatcher_;
-  std::unique_ptr<event::ServerSocket> socket_;
-  base::unique_set<RpcCall> calls_;
+  std::vector<std::unique_ptr<Shard>> shards_;
 
-  void CloseCall(RpcCall* call) { calls_.erase(call); }
+  void CloseCall(RpcCall* call);
 };
 
 class RpcClient {
@@ -54,19 +54,26 @@ const char kInterfaceMethodBidi[] =
     "    virtual void $method$Open($method$Call* call) = 0;\n"
     "    virtual void $method$Message($method$Call* call, const $reqType$& req) = 0;\n"
     "    virtual void $method$Close($method$Call* call, ::base::error_ptr error) = 0;\n"
+    "    virtual void $method$Writable($method$Call* call, bool writable) {}\n"
     "    virtual ~$method$Handler() = default;\n"
     "  };\n"
     "  class $method$Call : public ::brpc::RpcEndpoint {\n"
     "   public:\n"
     "    $method$Call(::brpc::RpcCall* call) : call_(call) {}\n"
-    "    void Send(const $respType$& resp) { call_->Send(resp); }\n"
+    "    bool Send(const $respType$& resp) { return call_->Send(resp); }\n"
+    "    bool Send(::brpc::RpcFrame frame) { return call_->Send(::std::move(frame)); }\n"
     "    void Close() { call_->Close(); }\n"
+    "    void SetWriteLimits(const ::brpc::RpcWriteLimits& limits) { call_->SetWriteLimits(limits); }\n"
+    "    bool writable() const { return call_->writable(); }\n"
+    "    ::std::size_t buffered() const { return call_->buffered(); }\n"
+    "    ::std::uint64_t dropped() const { return call_->dropped(); }\n"
     "   private:\n"
     "    ::brpc::RpcCall* call_;\n"
     "    ::base::optional_ptr<$method$Handler> handler_;\n"
     "    ::std::unique_ptr<::google::protobuf::Message> RpcOpen(::brpc::RpcCall*) override;\n"
     "    void RpcMessage(::brpc::RpcCall* call, const ::google::protobuf::Message& message) override;\n"
     "    void RpcClose(::brpc::RpcCall* call, ::base::error_ptr error) override;\n"
+    "    void RpcWritable(::brpc::RpcCall* call, bool writable) override;\n"
     "    friend class $service$Server;\n"
     "  };\n"
     "  virtual ::base::optional_ptr<$method$Handler> $method$($method$Call* call) = 0;\n\n";
@@ -84,12 +91,16 @@ const char kInterfaceOutlineBidi[] =
     "}\n\n"
     "inline void $service$Interface::$method$Call::RpcClose(::brpc::RpcCall*, ::base::error_ptr error) {\n"
     "  handler_->$method$Close(this, ::std::move(error));\n"
+    "}\n\n"
+    "inline void $service$Interface::$method$Call::RpcWritable(::brpc::RpcCall*, bool writable) {\n"
+    "  handler_->$method$Writable(this, writable);\n"
     "}\n\n";
 
 const char kServerHeader[] =
     "class $service$Server : public ::brpc::RpcDispatcher {\n"
     " public:\n"
     "  $service$Server(::event::Loop* loop, ::base::optional_ptr<$service$Interface> impl) : server_(loop, this), impl_(::std::move(impl)) {}\n"
+    "  $service$Server(::event::LoopGroup* group, ::base::optional_ptr<$service$Interface> impl) : server_(group, this), impl_(::std::move(impl)) {}\n"
     "  ::base::error_ptr Start(const ::std::string& path) { return server_.Start(path); }\n"
     " private:\n";
 const char kServerEndpointSimple[] =
@@ -164,19 +175,26 @@ const char kClientPublicMethodBidi[] =
     "    virtual void $method$Open($method$Call* call) = 0;\n"
     "    virtual void $method$Message($method$Call* call, const $respType$& req) = 0;\n"
     "    virtual void $method$Close($method$Call* call, ::base::error_ptr error) = 0;\n"
+    "    virtual void $method$Writable($method$Call* call, bool writable) {}\n"
     "    virtual ~$method$Receiver() = default;\n"
     "  };\n"
     "  class $method$Call : public ::brpc::RpcEndpoint {\n"
     "   public:\n"
     "    $method$Call(::base::optional_ptr<$method$Receiver> receiver) : receiver_(::std::move(receiver)) {}\n"
-    "    void Send(const $reqType$& req) { call_->Send(req); }\n"
+    "    bool Send(const $reqType$& req) { return call_->Send(req); }\n"
+    "    bool Send(::brpc::RpcFrame frame) { return call_->Send(::std::move(frame)); }\n"
     "    void Close() { call_->Close(); }\n"
+    "    void SetWriteLimits(const ::brpc::RpcWriteLimits& limits) { call_->SetWriteLimits(limits); }\n"
+    "    bool writable() const { return call_->writable(); }\n"
+    "    ::std::size_t buffered() const { return call_->buffered(); }\n"
+    "    ::std::uint64_t dropped() const { return call_->dropped(); }\n"
     "   private:\n"
     "    ::brpc::RpcCall* call_;\n"
     "    ::base::optional_ptr<$method$Receiver> receiver_;\n"
     "    ::std::unique_ptr<::google::protobuf::Message> RpcOpen(::brpc::RpcCall* call) override;\n"
     "    void RpcMessage(::brpc::RpcCall* call, const ::google::protobuf::Message& message) override;\n"
     "    void RpcClose(::brpc::RpcCall* call, ::base::error_ptr error) override;\n"
+    "    void RpcWritable(::brpc::RpcCall* call, bool writable) override;\n"
     "  };\n"
     "  $method$Call* $method$(::base::optional_ptr<$method$Receiver> receiver);\n\n";
 const char kClientPrivateHeader[] =
@@ -227,6 +245,9 @@ const char kClientOutlineBidi[] =
     "inline void $service$Client::$method$Call::RpcClose(::brpc::RpcCall*, ::base::error_ptr error) {\n"
     "  receiver_->$method$Close(this, ::std::move(error));\n"
     "}\n\n"
+    "inline void $service$Client::$method$Call::RpcWritable(::brpc::RpcCall*, bool writable) {\n"
+    "  receiver_->$method$Writable(this, writable);\n"
+    "}\n\n"
     "inline $service$Client::$method$Call* $service$Client::$method$(::base::optional_ptr<$method$Receiver> receiver) {\n"
     "  ::std::unique_ptr<$method$Call> call = ::std::make_unique<$method$Call>(::std::move(receiver));\n"
     "  $method$Call* call_ref = call.get();\n"
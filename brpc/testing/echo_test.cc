@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
 #include "brpc/testing/echo_service.brpc.h"
 #include "gtest/gtest.h"
 
@@ -11,7 +16,10 @@ class StreamTestService : public EchoServiceInterface::StreamHandler {
   void StreamMessage(EchoServiceInterface::StreamCall* call, const EchoRequest& req) override {
     EchoResponse resp;
     resp.set_payload(req.payload());
-    call->Send(resp);
+    if (req.payload() == "shared")
+      call->Send(brpc::EncodeFrame(resp));
+    else
+      call->Send(resp);
   }
 
   void StreamClose(EchoServiceInterface::StreamCall* call, base::error_ptr error) override {
@@ -97,4 +105,194 @@ TEST_F(PingTest, Roundtrip) {
   EXPECT_TRUE(ok);
 }
 
+TEST_F(PingTest, LoopGroupServer) {
+  event::LoopGroup group(2);
+  EchoServiceServer server(&group, base::borrow(&kTestService));
+  auto server_error = server.Start("test_group.sock");
+  if (server_error) FAIL() << *server_error;
+  group.Start();
+
+  EchoServiceClient client;
+  client.target().loop(&loop).unix("test_group.sock");
+
+  EchoRequest req;
+  req.set_payload("hello world");
+  client.Ping(req, base::borrow(this));
+
+  RunFor(2);
+  EXPECT_TRUE(ok);
+
+  group.Stop();
+  group.Join();
+}
+
+struct StreamTest : public LoopTimeoutTest, public EchoServiceClient::StreamReceiver {
+  std::vector<std::string> payloads;
+
+  void StreamOpen(EchoServiceClient::StreamCall* call) override {
+    EchoRequest req;
+    req.set_payload("plain");
+    call->Send(req);
+    req.set_payload("shared");
+    brpc::RpcFrame frame = brpc::EncodeFrame(req);
+    call->Send(frame);
+    call->Send(frame);
+    req.set_payload("last");
+    call->Send(req);
+  }
+
+  void StreamMessage(EchoServiceClient::StreamCall* call, const EchoResponse& resp) override {
+    payloads.push_back(resp.payload());
+    if (payloads.size() == 4)
+      call->Close();
+  }
+
+  void StreamClose(EchoServiceClient::StreamCall* call, base::error_ptr error) override {
+    if (error)
+      FAIL() << "Stream error: " << *error;
+    Stop();
+  }
+};
+
+TEST_F(StreamTest, SharedFrames) {
+  EchoServiceServer server(&loop, base::borrow(&kTestService));
+  auto server_error = server.Start("test_stream.sock");
+  if (server_error) FAIL() << *server_error;
+
+  EchoServiceClient client;
+  client.target().loop(&loop).unix("test_stream.sock");
+  client.Stream(base::borrow(this));
+
+  RunFor(2);
+  EXPECT_EQ(payloads, (std::vector<std::string>{"plain", "shared", "shared", "last"}));
+}
+
+struct WriteLimitTest : public LoopTimeoutTest, public EchoServiceClient::StreamReceiver {
+  static constexpr int kMessages = 100;
+  static constexpr std::size_t kPadding = 64 << 10;
+
+  brpc::RpcWriteLimits limits;
+  /** Padding of the first message, which can be made larger than the socket buffer. */
+  std::size_t first_padding = kPadding;
+
+  std::vector<bool> sent;
+  std::size_t max_buffered = 0;
+  std::uint64_t dropped = 0;
+  std::vector<int> received;
+  std::vector<bool> writable;
+  std::string close_error;
+
+  void Run(RpcWriteLimits::Overflow overflow) {
+    limits.high_water = 4 * kPadding;
+    limits.low_water = kPadding;
+    limits.overflow = overflow;
+
+    EchoServiceServer server(&loop, base::borrow(&kTestService));
+    auto server_error = server.Start("test_limit.sock");
+    if (server_error) FAIL() << *server_error;
+
+    EchoServiceClient client;
+    client.target().loop(&loop).unix("test_limit.sock");
+    client.Stream(base::borrow(this));
+
+    RunFor(5);
+  }
+
+  void StreamOpen(EchoServiceClient::StreamCall* call) override {
+    call->SetWriteLimits(limits);
+
+    // the server runs on this same loop, so it can't read anything before this callback returns,
+    // and the socket buffer fills up quickly
+    EchoRequest req;
+    for (int i = 0; i < kMessages; ++i) {
+      req.set_payload(std::to_string(i) + ":" + std::string(i == 0 ? first_padding : kPadding, 'x'));
+      sent.push_back(call->Send(req));
+      max_buffered = std::max(max_buffered, call->buffered());
+    }
+    dropped = call->dropped();
+  }
+
+  void StreamMessage(EchoServiceClient::StreamCall* call, const EchoResponse& resp) override {
+    received.push_back(std::stoi(resp.payload()));
+    if (received.size() == kMessages - dropped)
+      call->Close();
+  }
+
+  void StreamClose(EchoServiceClient::StreamCall* call, base::error_ptr error) override {
+    if (error)
+      error->format(&close_error);
+    Stop();
+  }
+
+  void StreamWritable(EchoServiceClient::StreamCall* call, bool w) override {
+    writable.push_back(w);
+  }
+};
+
+TEST_F(WriteLimitTest, Pause) {
+  Run(RpcWriteLimits::Overflow::kPause);
+  EXPECT_EQ(close_error, "");
+
+  EXPECT_EQ(dropped, 0);
+  EXPECT_GT(max_buffered, limits.high_water);  // nothing is held back by the call itself
+  ASSERT_EQ(received.size(), kMessages);
+  for (int i = 0; i < kMessages; ++i)
+    EXPECT_EQ(received[i], i);
+  EXPECT_EQ(writable, (std::vector<bool>{false, true}));
+}
+
+TEST_F(WriteLimitTest, DropNewest) {
+  Run(RpcWriteLimits::Overflow::kDropNewest);
+  EXPECT_EQ(close_error, "");
+
+  ASSERT_GT(dropped, 0);
+  EXPECT_LE(max_buffered, limits.high_water + kPadding + 16);
+  // everything after the first dropped message is dropped too, as nothing drains meanwhile
+  std::size_t kept = kMessages - dropped;
+  for (int i = 0; i < kMessages; ++i)
+    EXPECT_EQ(sent[i], (std::size_t) i < kept) << i;
+  ASSERT_EQ(received.size(), kept);
+  for (std::size_t i = 0; i < kept; ++i)
+    EXPECT_EQ(received[i], i);
+  EXPECT_EQ(writable, (std::vector<bool>{false, true}));
+}
+
+TEST_F(WriteLimitTest, DropOldest) {
+  Run(RpcWriteLimits::Overflow::kDropOldest);
+  EXPECT_EQ(close_error, "");
+
+  EXPECT_GT(dropped, 0);
+  EXPECT_EQ(sent, std::vector<bool>(kMessages, true));  // older messages were dropped instead
+  EXPECT_LE(max_buffered, limits.high_water + kPadding + 16);
+  ASSERT_EQ(received.size(), kMessages - dropped);
+  ASSERT_FALSE(received.empty());
+  for (std::size_t i = 1; i < received.size(); ++i)
+    EXPECT_LT(received[i - 1], received[i]);
+  EXPECT_EQ(received.back(), kMessages - 1);  // the newest one is never dropped
+  EXPECT_EQ(writable, (std::vector<bool>{false, true}));
+}
+
+TEST_F(WriteLimitTest, DropOldestKeepsPartialFrame) {
+  // the first message doesn't fit in the socket buffer, so it stays partially written in front
+  first_padding = 8 << 20;
+  Run(RpcWriteLimits::Overflow::kDropOldest);
+  EXPECT_EQ(close_error, "");
+
+  EXPECT_EQ(dropped, kMessages - 2);
+  EXPECT_EQ(sent, std::vector<bool>(kMessages, true));
+  EXPECT_EQ(received, (std::vector<int>{0, kMessages - 1}));
+  EXPECT_EQ(writable, (std::vector<bool>{false, true}));
+}
+
+TEST_F(WriteLimitTest, Disconnect) {
+  Run(RpcWriteLimits::Overflow::kDisconnect);
+
+  EXPECT_NE(close_error.find("overflow"), std::string::npos) << close_error;
+  EXPECT_EQ(dropped, 1);
+  EXPECT_TRUE(received.empty());
+  ASSERT_FALSE(sent.empty());
+  EXPECT_TRUE(sent[0]);
+  EXPECT_FALSE(sent.back());
+}
+
 } // namespace brpc::testing
@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <cerrno>
+#include <cstdint>
+#include <unordered_set>
 
 #include "base/exc.h"
 #include "base/log.h"
@@ -7,9 +10,15 @@
 #include "base/timer_impl.h"
 
 extern "C" {
+#include <linux/io_uring.h>
 #include <poll.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 }
 
@@ -17,15 +26,598 @@ namespace event {
 
 namespace internal {
 
-/** Client event data sent over the pipe. */
-struct ClientEventData {
-  ClientId id;        ///< Client event identifier.
-  Client::Data data;  ///< Payload data.
-  ClientEventData() = default;
-  /** Initializes client event data with id \p i and payload \p d. */
-  ClientEventData(ClientId i, Client::Data d) : id(i), data(d) {}
+/** Event bit for a descriptor observed for reading. */
+constexpr int kReadEvent = 1;
+/** Event bit for a descriptor observed for writing. */
+constexpr int kWriteEvent = 2;
+
+/** Backend interface for waiting on a set of file descriptors. */
+class Poller {
+ public:
+  virtual ~Poller() = default;
+  /**
+   * Changes the set of events observed for \p fd from \p old_events to \p new_events.
+   *
+   * Both are combinations of #kReadEvent and #kWriteEvent. An \p old_events of 0 means the
+   * descriptor is new, and a \p new_events of 0 means it should no longer be observed.
+   */
+  virtual void Update(int fd, int old_events, int new_events) = 0;
+  /**
+   * Blocks until at least one descriptor is ready, or the wait is interrupted.
+   *
+   * Appends an (fd, events) pair to \p ready for each descriptor that is ready. Error and hangup
+   * conditions are reported as #kReadEvent (and also #kWriteEvent for errors), like `poll(2)`.
+   * Completions of Uring requests, if any, are appended to \p completions; the wait also ends if
+   * one of those is available.
+   */
+  virtual void Wait(std::vector<std::pair<int, int>>* ready, std::vector<UringCompletion>* completions) = 0;
+  /** Returns the completion-based I/O interface of the poller, or `nullptr` if not supported. */
+  virtual Uring* uring() { return nullptr; }
 };
 
+/** Poller based on `poll(2)`, or an injected replacement. */
+class PollPoller : public Poller {
+ public:
+  explicit PollPoller(Loop::PollFunc* poll) : poll_(poll) {}
+  void Update(int fd, int old_events, int new_events) override;
+  void Wait(std::vector<std::pair<int, int>>* ready, std::vector<UringCompletion>* completions) override;
+
+ private:
+  Loop::PollFunc* poll_;
+  std::vector<struct pollfd> pollfds_;
+  /** Index of each observed descriptor in #pollfds_. */
+  std::unordered_map<int, std::size_t> index_;
+};
+
+void PollPoller::Update(int fd, int old_events, int new_events) {
+  short events = (new_events & kReadEvent ? POLLIN : 0) | (new_events & kWriteEvent ? POLLOUT : 0);
+
+  if (!old_events) {
+    index_.emplace(fd, pollfds_.size());
+    pollfds_.push_back(pollfd{fd, events, 0});
+    return;
+  }
+
+  auto it = index_.find(fd);
+  CHECK(it != index_.end());
+
+  if (new_events) {
+    pollfds_[it->second].events = events;
+    return;
+  }
+
+  // removal: move the last entry into the freed slot
+  std::size_t idx = it->second;
+  index_.erase(it);
+  if (idx != pollfds_.size() - 1) {
+    pollfds_[idx] = pollfds_.back();
+    index_[pollfds_[idx].fd] = idx;
+  }
+  pollfds_.pop_back();
+}
+
+void PollPoller::Wait(std::vector<std::pair<int, int>>* ready, std::vector<UringCompletion>*) {
+  int changed = poll_(pollfds_.data(), pollfds_.size(), -1);
+  if (changed == -1 && errno != EINTR)
+    throw base::Exception("poll", errno);
+  if (changed <= 0)
+    return;
+
+  // TODO POLLNVAL?
+  for (const struct pollfd& pfd : pollfds_) {
+    int events = 0;
+    if (pfd.revents & (POLLIN|POLLERR|POLLHUP))
+      events |= kReadEvent;
+    if (pfd.revents & (POLLOUT|POLLERR))
+      events |= kWriteEvent;
+    if (events)
+      ready->emplace_back(pfd.fd, events);
+  }
+}
+
+/** Poller based on `epoll(7)`. */
+class EpollPoller : public Poller {
+ public:
+  EpollPoller();
+  ~EpollPoller() { close(epoll_fd_); }
+  void Update(int fd, int old_events, int new_events) override;
+  void Wait(std::vector<std::pair<int, int>>* ready, std::vector<UringCompletion>* completions) override;
+
+ private:
+  static constexpr std::size_t kInitialEvents = 64;
+  static constexpr std::size_t kMaxEvents = 4096;
+
+  int epoll_fd_;
+  /** Buffer for `epoll_wait`. Grows (up to #kMaxEvents) whenever a call fills it up. */
+  std::vector<struct epoll_event> events_;
+};
+
+EpollPoller::EpollPoller() : events_(kInitialEvents) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ == -1)
+    throw base::Exception("epoll_create1", errno);
+}
+
+void EpollPoller::Update(int fd, int old_events, int new_events) {
+  std::uint32_t events = 0;
+  if (new_events & kReadEvent)
+    events |= EPOLLIN;
+  if (new_events & kWriteEvent)
+    events |= EPOLLOUT;
+
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.fd = fd;
+
+  int op = !old_events ? EPOLL_CTL_ADD : !new_events ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+  if (epoll_ctl(epoll_fd_, op, fd, &ev) == -1) {
+    if (op == EPOLL_CTL_DEL && (errno == EBADF || errno == ENOENT))
+      return;  // already implicitly removed by closing the descriptor
+    throw base::Exception("epoll_ctl", errno);
+  }
+}
+
+void EpollPoller::Wait(std::vector<std::pair<int, int>>* ready, std::vector<UringCompletion>*) {
+  int got = epoll_wait(epoll_fd_, events_.data(), events_.size(), -1);
+  if (got == -1 && errno != EINTR)
+    throw base::Exception("epoll_wait", errno);
+  if (got <= 0)
+    return;
+
+  for (int i = 0; i < got; ++i) {
+    const struct epoll_event& ev = events_[i];
+    int events = 0;
+    if (ev.events & (EPOLLIN|EPOLLERR|EPOLLHUP))
+      events |= kReadEvent;
+    if (ev.events & (EPOLLOUT|EPOLLERR))
+      events |= kWriteEvent;
+    if (events)
+      ready->emplace_back(ev.data.fd, events);
+  }
+
+  if ((std::size_t) got == events_.size() && events_.size() < kMaxEvents)
+    events_.resize(2 * events_.size());
+}
+
+/**
+ * Poller based on `io_uring(7)`.
+ *
+ * Every observed descriptor has one single-shot `IORING_OP_POLL_ADD` request in flight. Interest
+ * changes and re-arming of completed polls are only queued as submission entries, and get submitted
+ * in the same `io_uring_enter(2)` call that waits for the next completions, so one wakeup costs a
+ * single system call regardless of how many descriptors were touched. Multishot polls are not used
+ * for this: they are edge-triggered, while Loop clients rely on level-triggered readiness.
+ *
+ * The poller also implements the Uring interface for completion-based I/O, if the kernel supports
+ * provided buffer rings (Linux 5.19). The `user_data` of a request tells the two kinds apart: poll
+ * requests have the lowest bit set (see PollData()), other requests point to their UringOp, and
+ * requests whose completion is ignored (removals and cancellations) use 0.
+ */
+class UringPoller : public Poller, public Uring {
+ public:
+  /** Sets up the ring. Throws base::Exception if the kernel lacks (usable) io_uring support. */
+  UringPoller();
+  ~UringPoller();
+  void Update(int fd, int old_events, int new_events) override;
+  void Wait(std::vector<std::pair<int, int>>* ready, std::vector<UringCompletion>* completions) override;
+  Uring* uring() override { return buffers_ != MAP_FAILED ? this : nullptr; }
+
+  void Nop(UringOp* op) override;
+  void Read(int fd, void* buf, std::size_t count, UringOp* op) override;
+  void Recv(int fd, void* buf, std::size_t count, UringOp* op) override;
+  bool RecvMultishot(int fd, UringOp* op) override;
+  void DisableRecvMultishot() override { recv_multishot_ = false; }
+  void Send(int fd, const void* buf, std::size_t count, UringOp* op) override;
+  void AcceptMultishot(int fd, UringOp* op) override;
+  void Cancel(UringOp* op) override;
+  void Submit() override;
+  unsigned char* Buffer(unsigned id) override { return buffers_ + id * kBufferSize; }
+  void RecycleBuffer(unsigned id) override;
+  void Adopt(UringOrphan* orphan) override { orphans_.insert(orphan); }
+  void Release(UringOrphan* orphan) override { orphans_.erase(orphan); delete orphan; }
+
+ private:
+  static constexpr unsigned kEntries = 1024;
+  /** Number of registered receive buffers. Must be a power of 2. */
+  static constexpr unsigned kBuffers = 256;
+  /** Buffer group ID of the registered receive buffers. */
+  static constexpr std::uint16_t kBufferGroup = 0;
+
+  struct FdState {
+    int events = 0;
+    /** Tag of the most recently queued poll request. Completions with other tags are stale. */
+    std::uint32_t tag = 0;
+    /** `true` if the poll request identified by #tag has not completed yet. */
+    bool armed = false;
+  };
+
+  static std::uint64_t PollData(int fd, std::uint32_t tag) {
+    return (std::uint64_t) tag << 32 | (std::uint32_t) fd << 1 | 1;
+  }
+
+  /** Unmaps the rings and buffers and closes the ring descriptor, whichever have been set up. */
+  void Release();
+  /** Registers the provided buffer ring, if supported. Leaves #buffers_ unmapped if not. */
+  void SetupBuffers();
+  /** Returns a free submission queue entry, submitting already queued ones if full. */
+  struct io_uring_sqe* NextSqe();
+  /** Returns a free submission queue entry for a request of \p op, and counts it as in flight. */
+  struct io_uring_sqe* OpSqe(std::uint8_t opcode, int fd, UringOp* op);
+  /** Queues a new poll request for \p fd. */
+  void Arm(int fd, FdState* state);
+  /** Handles the completion queue entries available. */
+  void Reap(std::vector<std::pair<int, int>>* ready, std::vector<UringCompletion>* completions);
+  /** Handles one completion queue entry of a poll request. */
+  void Complete(const struct io_uring_cqe& cqe, std::vector<std::pair<int, int>>* ready);
+  int Enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, nullptr, 0);
+  }
+  int Register(unsigned opcode, void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, ring_fd_, opcode, arg, nr_args);
+  }
+
+  int ring_fd_ = -1;
+  void* sq_ring_ = MAP_FAILED;
+  std::size_t sq_ring_size_ = 0;
+  void* cq_ring_ = MAP_FAILED;
+  std::size_t cq_ring_size_ = 0;
+  struct io_uring_sqe* sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+  std::size_t sqes_size_ = 0;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_array_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  /** Number of submission queue entries not yet passed to the kernel. */
+  unsigned pending_ = 0;
+  std::uint32_t next_tag_ = 1;
+  std::unordered_map<int, FdState> fds_;
+
+  /** Provided buffer ring shared with the kernel, if set up. */
+  struct io_uring_buf_ring* buf_ring_ = static_cast<struct io_uring_buf_ring*>(MAP_FAILED);
+  /** Memory of the #kBuffers receive buffers, if set up. */
+  unsigned char* buffers_ = static_cast<unsigned char*>(MAP_FAILED);
+  /** Local copy of the tail index of #buf_ring_. */
+  std::uint16_t buf_tail_ = 0;
+  /** `false` if the kernel has rejected a multishot receive. */
+  bool recv_multishot_ = true;
+  /** Number of UringOp requests that have not delivered their final completion yet. */
+  std::size_t inflight_ = 0;
+  std::unordered_set<UringOrphan*> orphans_;
+};
+
+UringPoller::UringPoller() {
+  struct io_uring_params params = {};
+  ring_fd_ = syscall(__NR_io_uring_setup, kEntries, &params);
+  if (ring_fd_ == -1)
+    throw base::Exception("io_uring_setup", errno);
+
+  if (!(params.features & IORING_FEAT_NODROP)) {
+    // without this, a burst of completions could silently lose readiness notifications
+    Release();
+    throw base::Exception("io_uring: IORING_FEAT_NODROP not supported");
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  sqes_size_ = params.sq_entries * sizeof (struct io_uring_sqe);
+
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ != MAP_FAILED && (params.features & IORING_FEAT_SINGLE_MMAP))
+    cq_ring_ = sq_ring_;
+  else if (sq_ring_ != MAP_FAILED)
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+  if (cq_ring_ != MAP_FAILED)
+    sqes_ = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) {
+    int error = errno;
+    Release();
+    throw base::Exception("mmap(io_uring)", error);
+  }
+
+  char* sq = static_cast<char*>(sq_ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+
+  char* cq = static_cast<char*>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  SetupBuffers();
+}
+
+UringPoller::~UringPoller() {
+  // The kernel may still be writing to buffers of the requests in flight, so they need to be
+  // cancelled, and their completions waited for, before any of the memory can be released.
+  if (inflight_ > 0) {
+    struct io_uring_sqe* sqe = NextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+  }
+  while (inflight_ > 0) {
+    int ret = Enter(pending_, 1, IORING_ENTER_GETEVENTS);
+    if (ret == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      LOG(ERROR) << "io_uring_enter failed while cancelling requests: " << base::os_error(errno);
+      break;
+    }
+    if (ret > 0)
+      pending_ -= ret;
+
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+      if (cqe.user_data && !(cqe.user_data & 1) && !(cqe.flags & IORING_CQE_F_MORE))
+        --inflight_;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+  for (UringOrphan* orphan : orphans_)
+    delete orphan;
+  Release();
+}
+
+void UringPoller::Release() {
+  if (buffers_ != MAP_FAILED)
+    munmap(buffers_, kBuffers * kBufferSize);
+  if (buf_ring_ != MAP_FAILED)
+    munmap(buf_ring_, kBuffers * sizeof (struct io_uring_buf));
+  if (sqes_ != MAP_FAILED)
+    munmap(sqes_, sqes_size_);
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+    munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_ != MAP_FAILED)
+    munmap(sq_ring_, sq_ring_size_);
+  if (ring_fd_ != -1)
+    close(ring_fd_);
+}
+
+void UringPoller::SetupBuffers() {
+  void* ring = mmap(nullptr, kBuffers * sizeof (struct io_uring_buf), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    LOG(WARNING) << "io_uring: can't allocate buffer ring: " << base::os_error(errno);
+    return;
+  }
+
+  struct io_uring_buf_reg reg = {};
+  reg.ring_addr = reinterpret_cast<std::uintptr_t>(ring);
+  reg.ring_entries = kBuffers;
+  reg.bgid = kBufferGroup;
+  if (Register(IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+    // expected before Linux 5.19: sockets will just use poll requests
+    LOG(INFO) << "io_uring: provided buffer rings not supported: " << base::os_error(errno);
+    munmap(ring, kBuffers * sizeof (struct io_uring_buf));
+    return;
+  }
+  buf_ring_ = static_cast<struct io_uring_buf_ring*>(ring);
+
+  // The buffer memory is only committed as it gets used.
+  buffers_ = static_cast<unsigned char*>(mmap(nullptr, kBuffers * kBufferSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0));
+  if (buffers_ == MAP_FAILED) {
+    LOG(WARNING) << "io_uring: can't allocate receive buffers: " << base::os_error(errno);
+    return;
+  }
+  for (unsigned id = 0; id < kBuffers; ++id)
+    RecycleBuffer(id);
+}
+
+void UringPoller::RecycleBuffer(unsigned id) {
+  // The first entry overlaps with the ring header holding the tail, so the fields must be set one
+  // by one, leaving the `resv` field alone. The entries are indexed from the start of the ring
+  // directly: in C++, the flexible `bufs` array of the header does not start at offset 0.
+  struct io_uring_buf* buf =
+      reinterpret_cast<struct io_uring_buf*>(buf_ring_) + (buf_tail_ & (kBuffers - 1));
+  buf->addr = reinterpret_cast<std::uintptr_t>(Buffer(id));
+  buf->len = kBufferSize;
+  buf->bid = id;
+  ++buf_tail_;
+  __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* UringPoller::NextSqe() {
+  unsigned tail = *sq_tail_;
+  while (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+    int ret = Enter(pending_, 0, 0);
+    if (ret == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      throw base::Exception("io_uring_enter", errno);
+    if (ret > 0)
+      pending_ -= ret;
+  }
+
+  unsigned idx = tail & sq_mask_;
+  struct io_uring_sqe* sqe = &sqes_[idx];
+  *sqe = {};
+  sq_array_[idx] = idx;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++pending_;
+  return sqe;
+}
+
+struct io_uring_sqe* UringPoller::OpSqe(std::uint8_t opcode, int fd, UringOp* op) {
+  struct io_uring_sqe* sqe = NextSqe();
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = reinterpret_cast<std::uintptr_t>(op);
+  ++inflight_;
+  return sqe;
+}
+
+void UringPoller::Nop(UringOp* op) {
+  OpSqe(IORING_OP_NOP, -1, op);
+}
+
+void UringPoller::Read(int fd, void* buf, std::size_t count, UringOp* op) {
+  struct io_uring_sqe* sqe = OpSqe(IORING_OP_READ, fd, op);
+  sqe->addr = reinterpret_cast<std::uintptr_t>(buf);
+  sqe->len = count;
+  sqe->off = -1;  // current position
+}
+
+void UringPoller::Recv(int fd, void* buf, std::size_t count, UringOp* op) {
+  struct io_uring_sqe* sqe = OpSqe(IORING_OP_RECV, fd, op);
+  sqe->addr = reinterpret_cast<std::uintptr_t>(buf);
+  sqe->len = count;
+}
+
+bool UringPoller::RecvMultishot(int fd, UringOp* op) {
+  if (!recv_multishot_)
+    return false;
+  struct io_uring_sqe* sqe = OpSqe(IORING_OP_RECV, fd, op);
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  return true;
+}
+
+void UringPoller::Send(int fd, const void* buf, std::size_t count, UringOp* op) {
+  struct io_uring_sqe* sqe = OpSqe(IORING_OP_SEND, fd, op);
+  sqe->addr = reinterpret_cast<std::uintptr_t>(buf);
+  sqe->len = count;
+  sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void UringPoller::AcceptMultishot(int fd, UringOp* op) {
+  struct io_uring_sqe* sqe = OpSqe(IORING_OP_ACCEPT, fd, op);
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+void UringPoller::Cancel(UringOp* op) {
+  struct io_uring_sqe* sqe = NextSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<std::uintptr_t>(op);
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+  Submit();
+}
+
+void UringPoller::Submit() {
+  while (pending_ > 0) {
+    int ret = Enter(pending_, 0, 0);
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret == -1 && (errno == EAGAIN || errno == EBUSY))
+      return;  // left for the next wait
+    if (ret == -1)
+      throw base::Exception("io_uring_enter", errno);
+    pending_ -= ret;
+  }
+}
+
+void UringPoller::Arm(int fd, FdState* state) {
+  state->tag = next_tag_++;
+  if (!next_tag_)
+    next_tag_ = 1;  // tag 0 is never used, to keep poll requests distinct from ignored ones
+  state->armed = true;
+
+  struct io_uring_sqe* sqe = NextSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll_events = (state->events & kReadEvent ? POLLIN : 0) | (state->events & kWriteEvent ? POLLOUT : 0);
+  sqe->user_data = PollData(fd, state->tag);
+}
+
+void UringPoller::Update(int fd, int old_events, int new_events) {
+  FdState* state = &fds_[fd];
+
+  if (state->armed) {
+    struct io_uring_sqe* sqe = NextSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = PollData(fd, state->tag);
+    state->armed = false;
+  }
+
+  if (!new_events) {
+    fds_.erase(fd);
+    // The poll request holds a reference to the file. The caller is likely to close the descriptor
+    // next, and for a socket, the connection should really be closed then, not on the next wait.
+    Submit();
+    return;
+  }
+
+  state->events = new_events;
+  Arm(fd, state);
+}
+
+void UringPoller::Wait(std::vector<std::pair<int, int>>* ready, std::vector<UringCompletion>* completions) {
+  // The kernel may return after submitting without anything completed (e.g., to run task work),
+  // so the wait is repeated until something is actually reported, or a signal interrupts it.
+  while (true) {
+    int ret = Enter(pending_, 1, IORING_ENTER_GETEVENTS);
+    if (ret == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      throw base::Exception("io_uring_enter", errno);
+    if (ret > 0)
+      pending_ -= ret;
+
+    Reap(ready, completions);
+    if (!ready->empty() || !completions->empty() || (ret == -1 && errno == EINTR))
+      break;
+  }
+}
+
+void UringPoller::Reap(std::vector<std::pair<int, int>>* ready, std::vector<UringCompletion>* completions) {
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+    if (!cqe.user_data)
+      continue;  // poll removal or cancellation
+    if (cqe.user_data & 1) {
+      Complete(cqe, ready);
+      continue;
+    }
+    completions->push_back(UringCompletion{reinterpret_cast<UringOp*>(cqe.user_data), cqe.res, cqe.flags});
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+      --inflight_;
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+void UringPoller::Complete(const struct io_uring_cqe& cqe, std::vector<std::pair<int, int>>* ready) {
+  int fd = (int) ((std::uint32_t) cqe.user_data >> 1);
+  std::uint32_t tag = cqe.user_data >> 32;
+
+  auto it = fds_.find(fd);
+  if (it == fds_.end() || it->second.tag != tag)
+    return;  // stale: removed or re-armed since
+  FdState* state = &it->second;
+  state->armed = false;
+
+  int events = 0;
+  if (cqe.res < 0) {
+    // The poll itself failed (e.g., the descriptor was closed without removing it first). Report
+    // it like an error condition, so that the callbacks get to find out by doing their I/O.
+    events = kReadEvent | kWriteEvent;
+  } else {
+    if (cqe.res & (POLLIN|POLLERR|POLLHUP))
+      events |= kReadEvent;
+    if (cqe.res & (POLLOUT|POLLERR))
+      events |= kWriteEvent;
+  }
+  if (events)
+    ready->emplace_back(fd, events);
+
+  // Re-arming here (rather than after the callbacks) is fine: if a callback changes the interest,
+  // the request just queued is cancelled as part of the update.
+  Arm(fd, state);
+}
+
 class SignalFdImpl : public Loop::SignalFd {
  public:
   SignalFdImpl();
@@ -90,39 +682,59 @@ int SignalFdImpl::Read() {
 
 } // namespace internal
 
-Loop::Loop()
-    : Loop(&::poll, std::unique_ptr<base::TimerFd>(), std::make_unique<internal::SignalFdImpl>())
+namespace {
+
+std::unique_ptr<internal::Poller> MakePoller(Loop::Backend backend) {
+  switch (backend) {
+    case Loop::Backend::kPoll: return std::make_unique<internal::PollPoller>(&::poll);
+    case Loop::Backend::kEpoll: return std::make_unique<internal::EpollPoller>();
+    case Loop::Backend::kUring:
+      try {
+        return std::make_unique<internal::UringPoller>();
+      } catch (const base::Exception& e) {
+        LOG(WARNING) << "io_uring not available, falling back to epoll: " << e.what();
+        return std::make_unique<internal::EpollPoller>();
+      }
+  }
+  FATAL("unknown event loop backend");
+}
+
+} // unnamed namespace
+
+Loop::Loop(Backend backend)
+    : Loop(MakePoller(backend), std::unique_ptr<base::TimerFd>(), std::make_unique<internal::SignalFdImpl>())
 {}
 
 Loop::Loop(PollFunc* poll, std::unique_ptr<base::TimerFd> timer, std::unique_ptr<SignalFd> signal_fd)
-    : poll_(poll),
+    : Loop(std::make_unique<internal::PollPoller>(poll), std::move(timer), std::move(signal_fd))
+{}
+
+Loop::Loop(std::unique_ptr<internal::Poller> poller, std::unique_ptr<base::TimerFd> timer, std::unique_ptr<SignalFd> signal_fd)
+    : poller_(std::move(poller)),
+      uring_(poller_->uring()),
       timer_(std::move(timer)),
       signal_fd_(std::move(signal_fd))
 {
-  ReadFd(timer_.fd(), base::borrow(&read_timer_callback_));
+  if (uring_)
+    uring_->Read(timer_.fd(), &timer_expirations_, sizeof timer_expirations_, &timer_read_op_);
+  else
+    ReadFd(timer_.fd(), base::borrow(&read_timer_callback_));
 
   AddSignal(SIGTERM, base::borrow(&handle_sigterm_callback_));
   ReadFd(signal_fd_->fd(), base::borrow(&read_signal_callback_));
 }
 
+Loop::~Loop() = default;
+
 void Loop::ReadFd(int fd, base::optional_ptr<FdReader> callback) {
   auto&& fd_info = GetFd(fd);
   if (callback) {
     CHECK(fd_info->reader.empty());
     fd_info->reader.Set(std::move(callback));
-    if (!pollfds_.empty()) {
-      struct pollfd *pfd = &pollfds_[fd_info->pollfd_index];
-      pfd->events |= POLLIN;
-      if (pfd->fd < 0) pfd->fd = -pfd->fd;
-    }
+    UpdateFd(fd, fd_info, fd_info->events | internal::kReadEvent);
   } else {
     fd_info->reader.Clear();
-    if (fd_info->reader.empty() && fd_info->writer.empty()) {
-      fds_.erase(fd);
-      pollfds_.clear();
-    } else if (!pollfds_.empty()) {
-      pollfds_[fd_info->pollfd_index].events &= ~POLLIN;
-    }
+    UpdateFd(fd, fd_info, fd_info->events & ~internal::kReadEvent);
   }
 }
 
@@ -131,19 +743,10 @@ void Loop::WriteFd(int fd, base::optional_ptr<FdWriter> callback) {
   if (callback) {
     CHECK(fd_info->writer.empty());
     fd_info->writer.Set(std::move(callback));
-    if (!pollfds_.empty()) {
-      struct pollfd *pfd = &pollfds_[fd_info->pollfd_index];
-      pfd->events |= POLLOUT;
-      if (pfd->fd < 0) pfd->fd = -pfd->fd;
-    }
+    UpdateFd(fd, fd_info, fd_info->events | internal::kWriteEvent);
   } else {
     fd_info->writer.Clear();
-    if (fd_info->reader.empty() && fd_info->writer.empty()) {
-      fds_.erase(fd);
-      pollfds_.clear();
-    } else if (!pollfds_.empty()) {
-      pollfds_[fd_info->pollfd_index].events &= ~POLLOUT;
-    }
+    UpdateFd(fd, fd_info, fd_info->events & ~internal::kWriteEvent);
   }
 }
 
@@ -173,10 +776,11 @@ ClientId Loop::AddClient(base::optional_ptr<Client> callback) {
   ClientId id = next_client_id_++;
 
   clients_.Add(id, std::move(callback));
-  if (client_pipe_[0] == -1) {
-    if (pipe(client_pipe_) == -1)
-      throw base::Exception("pipe(client)", errno);
-    ReadFd(client_pipe_[0], base::borrow(&read_client_event_callback_));
+  if (client_event_fd_ == -1) {
+    client_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (client_event_fd_ == -1)
+      throw base::Exception("eventfd(client)", errno);
+    ReadFd(client_event_fd_, base::borrow(&read_client_event_callback_));
   }
 
   return id;
@@ -186,85 +790,54 @@ bool Loop::RemoveClient(ClientId client) {
   bool removed = clients_.Remove(client);
 
   if (removed && clients_.empty()) {
-    CHECK(client_pipe_[0] != -1);
-    ReadFd(client_pipe_[0]);
-    close(client_pipe_[0]);
-    close(client_pipe_[1]);
-    client_pipe_[0] = -1;
+    CHECK(client_event_fd_ != -1);
+    ReadFd(client_event_fd_);
+    close(client_event_fd_);
+    client_event_fd_ = -1;
+    client_event_pending_ = false;
   }
 
   return removed;
 }
 
 void Loop::PostClientEvent(ClientId client, Client::Data data) {
-  if (client_pipe_[0] != -1) {
-    internal::ClientEventData payload(client, data);
-    ssize_t wrote = write(client_pipe_[1], &payload, sizeof payload);
-    if (wrote == -1)
-      throw base::Exception("write(client)", errno);
-    if (wrote != sizeof payload)
-      throw base::Exception("write(client): short write");
+  if (client_event_fd_ != -1) {
+    client_events_.push(internal::ClientEventData(client, data));
+    // Only the first event since the last drain needs to wake up the loop.
+    if (!client_event_pending_.exchange(true, std::memory_order_acq_rel)) {
+      std::uint64_t one = 1;
+      if (write(client_event_fd_, &one, sizeof one) == -1)
+        throw base::Exception("write(client)", errno);
+    }
   }
 }
 
 void Loop::Poll() {
   CHECK(!fds_.empty());
 
-  if (pollfds_.empty()) {
-    pollfds_.resize(fds_.size());
-
-    std::size_t pollfd_index = 0;
-    for (auto&& fd_item : fds_) {
-      int fd = fd_item.first;
-      Fd* fd_info = &fd_item.second;
-
-      int events = 0;
-      if (!fd_info->reader.empty())
-        events |= POLLIN;
-      if (!fd_info->writer.empty())
-        events |= POLLOUT;
-
-      fd_info->pollfd_index = pollfd_index;
-
-      struct pollfd* pfd = &pollfds_[pollfd_index];
-      pfd->fd = events ? fd : -fd;
-      pfd->events = events;
-
-      ++pollfd_index;
-    }
-  }
-
-  int changed = poll_(pollfds_.data(), pollfds_.size(), -1);
-  if (changed == -1 && errno != EINTR)
-    throw base::Exception("poll", errno);
-
-  if (changed > 0) {
-    // Calling the callbacks may add or remove descriptors, which
-    // could invalidate iterators to fds_ or pollfds_. Collect a
-    // separate list of file descriptors on which callbacks need to be
-    // invoked, first.
+  // Calling the callbacks may add or remove descriptors, which could invalidate iterators to fds_
+  // or the poller's own structures. The poller therefore reports a separate list of ready file
+  // descriptors first, and the callbacks are only invoked after that.
 
-    std::vector<std::pair<int, bool /* write? */>> events;
+  ready_.clear();
+  completions_.clear();
+  poller_->Wait(&ready_, &completions_);
 
-    // TODO POLLNVAL?
-    for (const struct pollfd& pfd : pollfds_) {
-      if (pfd.revents & (POLLIN|POLLERR|POLLHUP))
-        events.emplace_back(pfd.fd, false);
-      if (pfd.revents & (POLLOUT|POLLERR))
-        events.emplace_back(pfd.fd, true);
-    }
-
-    for (const auto& event : events) {
-      int fd = event.first;
+  for (const internal::UringCompletion& completion : completions_)
+    completion.op->Completed(completion.res, completion.flags);
 
+  for (const auto& [fd, events] : ready_) {
+    if (events & internal::kReadEvent) {
       const auto fd_entry = fds_.find(fd);
       if (fd_entry == fds_.end())
         continue; // no longer relevant
-
-      if (event.second)
-        fd_entry->second.writer.Call(&FdWriter::CanWrite, fd);
-      else
-        fd_entry->second.reader.Call(&FdReader::CanRead, fd);
+      fd_entry->second.reader.Call(&FdReader::CanRead, fd);
+    }
+    if (events & internal::kWriteEvent) {
+      const auto fd_entry = fds_.find(fd);  // the read callback may have removed it
+      if (fd_entry == fds_.end())
+        continue; // no longer relevant
+      fd_entry->second.writer.Call(&FdWriter::CanWrite, fd);
     }
   }
 
@@ -278,22 +851,51 @@ TimerId Loop::Delay_(base::TimerDuration delay, base::optional_ptr<Timed> callba
 }
 
 Loop::Fd* Loop::GetFd(int fd) {
-  auto [fd_data, inserted] = fds_.try_emplace(fd);
+  return &fds_.try_emplace(fd).first->second;
+}
+
+void Loop::UpdateFd(int fd, Fd* fd_info, int events) {
+  if (events == fd_info->events) {
+    if (!events)
+      fds_.erase(fd);  // removing a descriptor that was never observed
+    return;
+  }
 
-  if (inserted)
-    pollfds_.clear();
+  poller_->Update(fd, fd_info->events, events);
 
-  return &fd_data->second;
+  if (events)
+    fd_info->events = events;
+  else
+    fds_.erase(fd);
 }
 
+namespace {
+
+void DeliverTimer(base::CallbackSet<Timed>* periodic, base::CallbackPtr<Timed>* oneshot) {
+  CHECK(periodic || oneshot);
+  if (periodic)
+    periodic->Call(&Timed::TimerExpired, true);
+  else
+    oneshot->Call(&Timed::TimerExpired, false);
+}
+
+} // unnamed namespace
+
 void Loop::ReadTimer(int) {
-  timer_.Poll([&](base::CallbackSet<Timed>* periodic, base::CallbackPtr<Timed>* oneshot) {
-      CHECK(periodic || oneshot);
-      if (periodic)
-        periodic->Call(&Timed::TimerExpired, true);
-      else
-        oneshot->Call(&Timed::TimerExpired, false);
-    });
+  timer_.Poll(&DeliverTimer);
+}
+
+void Loop::TimerRead(int res, unsigned) {
+  // The next read is queued before the callbacks run, so that it stays in place even if one of
+  // them throws. It can't complete before the timer is re-armed anyway.
+  uring_->Read(timer_.fd(), &timer_expirations_, sizeof timer_expirations_, &timer_read_op_);
+
+  if (res < 0 && res != -EINTR && res != -EAGAIN)
+    throw base::Exception("read(timerfd)", -res);
+  if (res < 0)
+    return;
+
+  timer_.Expire(&DeliverTimer);
 }
 
 void Loop::ReadSignal(int) {
@@ -316,15 +918,18 @@ void Loop::ReadSignal(int) {
 }
 
 void Loop::ReadClientEvent(int) {
-  internal::ClientEventData payload;
-
-  ssize_t got = read(client_pipe_[0], &payload, sizeof payload);
-  if (got == -1)
+  std::uint64_t count;
+  if (read(client_event_fd_, &count, sizeof count) == -1 && errno != EAGAIN)
     throw base::Exception("read(client)", errno);
-  if (got != sizeof payload)
-    throw base::Exception("read(client): short read");
 
-  clients_.Call(payload.id, &Client::Event, payload.data);
+  // Clearing the flag before draining means an event posted concurrently either gets drained now,
+  // or signals the eventfd again. The acquire half pairs with the release in PostClientEvent, so
+  // everything pushed before the flag was set is visible.
+  client_event_pending_.exchange(false, std::memory_order_acq_rel);
+
+  internal::ClientEventData payload;
+  while (client_events_.pop(&payload))
+    clients_.Call(payload.id, &Client::Event, payload.data);
 }
 
 } // namespace event
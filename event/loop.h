@@ -5,6 +5,7 @@
 #ifndef EVENT_LOOP_H_
 #define EVENT_LOOP_H_
 
+#include <atomic>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
@@ -12,12 +13,15 @@
 #include <map>
 #include <mutex>
 #include <tuple>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "base/callback.h"
 #include "base/common.h"
+#include "base/mpsc_queue.h"
 #include "base/timer.h"
+#include "base/unique_set.h"
 
 extern "C" {
 #include <poll.h>  // nfds_t
@@ -144,6 +148,123 @@ using ClientId = std::uint64_t;
 
 namespace internal {
 
+class Poller;
+class Uring;
+
+/** Interface for receiving the completions of requests submitted through Uring. */
+struct UringOp {
+  /**
+   * Called with the result \p res and the `IORING_CQE_F_*` \p flags of a completion.
+   *
+   * A request only stops using the op (and its buffers) once a completion without the
+   * `IORING_CQE_F_MORE` flag has been delivered.
+   */
+  virtual void Completed(int res, unsigned flags) = 0;
+
+ protected:
+  ~UringOp() = default;
+};
+
+/**
+ * Member function pointer adapter for UringOp.
+ *
+ * \tparam T object type the callback member function belongs to
+ * \tparam method member function pointer to the callback
+ */
+template <typename T, void (T::*method)(int, unsigned)>
+struct UringOpM : public UringOp {
+  /** Object whose method will be called. */
+  T* parent;
+  /** Constructs an op for object \p p, which must outlive this object. */
+  explicit UringOpM(T* p) : parent(p) {}
+  /** Implements UringOp::Completed by calling the callback. */
+  void Completed(int res, unsigned flags) override { (parent->*method)(res, flags); }
+};
+
+/**
+ * Object owning requests that may need to outlive their original user.
+ *
+ * For example, a socket closed with data still waiting to be sent hands over its pending requests
+ * to the ring with Uring::Adopt(). The ring deletes any adopted objects that are left when the loop
+ * is destroyed, after all requests have been cancelled.
+ */
+struct UringOrphan {
+  virtual ~UringOrphan() = default;
+};
+
+/**
+ * Completion-based I/O through the io_uring backend of a Loop.
+ *
+ * Requests are only queued by these methods, and submitted to the kernel as part of the next wait
+ * of the loop (or an explicit Submit()), so any number of them costs a single system call. The
+ * results are delivered to the UringOp of the request from Loop::Poll(), after the wait, in the
+ * same way as readiness callbacks.
+ *
+ * Receives without an explicit buffer use buffers registered with the kernel in advance (a
+ * provided buffer ring), and are multishot: a single request keeps delivering data as it arrives.
+ *
+ * \sa Loop::uring()
+ */
+class Uring {
+ public:
+  /** Queues a request that completes right away, for deferring work to the next loop iteration. */
+  virtual void Nop(UringOp* op) = 0;
+  /** Queues a read of up to \p count bytes from \p fd into \p buf. */
+  virtual void Read(int fd, void* buf, std::size_t count, UringOp* op) = 0;
+  /** Queues a single receive of up to \p count bytes from socket \p fd into \p buf. */
+  virtual void Recv(int fd, void* buf, std::size_t count, UringOp* op) = 0;
+  /**
+   * Queues a multishot receive from socket \p fd into the registered buffers.
+   *
+   * Each completion carries an `IORING_CQE_F_BUFFER` flag identifying the buffer holding the data.
+   * See Buffer() and RecycleBuffer(). Returns `false` (without queueing anything) if the kernel
+   * has turned out not to support multishot receives.
+   */
+  virtual bool RecvMultishot(int fd, UringOp* op) = 0;
+  /** Disables RecvMultishot(), after the kernel rejected a request with `EINVAL`. */
+  virtual void DisableRecvMultishot() = 0;
+  /** Queues a send of \p count bytes of \p buf to socket \p fd. */
+  virtual void Send(int fd, const void* buf, std::size_t count, UringOp* op) = 0;
+  /** Queues a multishot accept, producing non-blocking and close-on-exec descriptors. */
+  virtual void AcceptMultishot(int fd, UringOp* op) = 0;
+  /** Cancels all pending requests of \p op. The cancellation is submitted immediately. */
+  virtual void Cancel(UringOp* op) = 0;
+  /** Submits all queued requests now, without waiting for anything. */
+  virtual void Submit() = 0;
+
+  /** Returns the registered buffer with index \p id. The size is #kBufferSize. */
+  virtual unsigned char* Buffer(unsigned id) = 0;
+  /** Returns the registered buffer with index \p id back to the kernel for new receives. */
+  virtual void RecycleBuffer(unsigned id) = 0;
+
+  /** Takes ownership of \p orphan. */
+  virtual void Adopt(UringOrphan* orphan) = 0;
+  /** Destroys a previously adopted \p orphan, once it has no more pending requests. */
+  virtual void Release(UringOrphan* orphan) = 0;
+
+  /** Size of each registered receive buffer. */
+  static constexpr std::size_t kBufferSize = 16384;
+
+ protected:
+  ~Uring() = default;
+};
+
+/** Completion reported by Uring, waiting to be delivered. */
+struct UringCompletion {
+  UringOp* op;     ///< Receiver of the completion.
+  int res;         ///< Result of the request.
+  unsigned flags;  ///< `IORING_CQE_F_*` flags.
+};
+
+/** Client event data passed through the client event queue. */
+struct ClientEventData {
+  ClientId id;        ///< Client event identifier.
+  Client::Data data;  ///< Payload data.
+  ClientEventData() = default;
+  /** Initializes client event data with id \p i and payload \p d. */
+  ClientEventData(ClientId i, Client::Data d) : id(i), data(d) {}
+};
+
 using SignalMap = std::unordered_multimap<int, SignalRecord*>;
 struct SignalRecord {
   base::CallbackPtr<event::Signal> callback;
@@ -167,17 +288,45 @@ class Loop {
     virtual ~SignalFd() = default;
   };
 
-  /** Constructs a new event loop. */
-  Loop();
+  /** Mechanism used for waiting on the observed file descriptors. */
+  enum class Backend {
+    /**
+     * `poll(2)`: every wakeup scans the full descriptor array. Simple, and can be overridden for
+     * tests, but scales linearly with the number of observed descriptors.
+     */
+    kPoll,
+    /**
+     * `epoll(7)`: interest is registered incrementally as descriptors are added, modified or
+     * removed, and a wakeup only reports the descriptors that are actually ready.
+     */
+    kEpoll,
+    /**
+     * `io_uring(7)`: I/O is submitted as requests, and completed in batches by the same system
+     * call that waits for the next events. Stream sockets receive into registered buffers, send,
+     * and accept new connections this way, without separate readiness notifications and system
+     * calls; timers are waited for with a read of the `timerfd`. Other descriptors are observed
+     * with poll requests batched the same way.
+     *
+     * Falls back to #kEpoll if the kernel does not support io_uring (or it has been disabled), and
+     * to readiness notifications for sockets if it does, but is too old (before Linux 5.19) for
+     * the completion-based operations.
+     */
+    kUring,
+  };
+
+  /** Constructs a new event loop, using \p backend for waiting on file descriptors. */
+  explicit Loop(Backend backend = Backend::kEpoll);
   /**
    * Constructs a new event loop for testing.
    *
    * The \p poll, \p timer and \p signal_fd arguments override the default implementations used by
-   * the event loop. This is intended to be done only in tests.
+   * the event loop. This is intended to be done only in tests. The loop always uses the
+   * Backend::kPoll backend, calling \p poll in place of `poll(2)`.
    */
   Loop(PollFunc* poll, std::unique_ptr<base::TimerFd> timer, std::unique_ptr<SignalFd> signal_fd);
 
   DISALLOW_COPY(Loop);
+  ~Loop();
 
   /**
    * Starts or stops observing \p fd for reading.
@@ -258,7 +407,9 @@ class Loop {
   /**
    * Triggers the callback of a registered client event.
    *
-   * Unlike most methods of this class, this method can be safely called from any thread.
+   * Unlike most methods of this class, this method can be safely called from any thread. It never
+   * blocks: the event is appended to a lock-free queue, and the loop is woken up through an
+   * `eventfd(2)` only if it isn't already due to drain the queue.
    */
   void PostClientEvent(ClientId client, Client::Data data = {0});
 
@@ -277,6 +428,14 @@ class Loop {
   /** Returns the current time of the clock used by scheduling timers. */
   base::TimerPoint now() const noexcept { return base::TimerClock::now(); /* TODO test now */ }
 
+  /**
+   * Returns the completion-based I/O interface of the loop.
+   *
+   * This is only available (not `nullptr`) if the loop uses Backend::kUring, and the kernel
+   * supports everything needed. It's meant for the socket implementations of this library.
+   */
+  internal::Uring* uring() const noexcept { return uring_; }
+
  private:
   CALLBACK_F1(FdReaderF, FdReader, CanRead, int);
   CALLBACK_F1(FdWriterF, FdWriter, CanWrite, int);
@@ -285,15 +444,23 @@ class Loop {
   struct Fd {
     base::CallbackPtr<FdReader> reader;
     base::CallbackPtr<FdWriter> writer;
-    std::size_t pollfd_index;
+    /** Event bits (internal::kReadEvent, internal::kWriteEvent) currently registered in #poller_. */
+    int events = 0;
   };
 
-  PollFunc* poll_;
+  std::unique_ptr<internal::Poller> poller_;
+  /** Completion-based I/O interface of #poller_, if supported. */
+  internal::Uring* uring_ = nullptr;
 
-  std::map<int, Fd> fds_;
-  std::vector<struct pollfd> pollfds_;
+  std::unordered_map<int, Fd> fds_;
+  /** Scratch space for the (fd, events) pairs reported by #poller_, reused across calls. */
+  std::vector<std::pair<int, int>> ready_;
+  /** Scratch space for the completions reported by #poller_, reused across calls. */
+  std::vector<internal::UringCompletion> completions_;
 
   Timer timer_;
+  /** Expiration count read from the `timerfd` by a Uring request, when #uring_ is set. */
+  std::uint64_t timer_expirations_ = 0;
 
   base::CallbackQueue<Finishable> finishable_;
 
@@ -303,19 +470,29 @@ class Loop {
 
   base::CallbackMap<ClientId, Client> clients_;
   ClientId next_client_id_ = 1;
-  int client_pipe_[2] = {-1, -1};
+  /** Queued client events, from any thread. */
+  base::mpsc_queue<internal::ClientEventData> client_events_;
+  /** `eventfd(2)` used to wake up the loop for client events, or -1 if there are no clients. */
+  int client_event_fd_ = -1;
+  /** `true` if #client_event_fd_ has been signaled, but the queue hasn't been drained yet. */
+  std::atomic<bool> client_event_pending_{false};
 
   bool stop_ = false;  ///< `true` if a stop request is pending
 
+  Loop(std::unique_ptr<internal::Poller> poller, std::unique_ptr<base::TimerFd> timer, std::unique_ptr<SignalFd> signal_fd);
+
   TimerId Delay_(base::TimerDuration delay, base::optional_ptr<Timed> callback);
   Fd* GetFd(int fd);
+  void UpdateFd(int fd, Fd* fd_info, int events);
   void ReadTimer(int);
+  void TimerRead(int res, unsigned flags);
   void ReadSignal(int);
   void ReadClientEvent(int);
 
   void HandleSigTerm(int) { Stop(); }
 
   FdReaderM<Loop, &Loop::ReadTimer> read_timer_callback_{this};
+  internal::UringOpM<Loop, &Loop::TimerRead> timer_read_op_{this};
   FdReaderM<Loop, &Loop::ReadSignal> read_signal_callback_{this};
   FdReaderM<Loop, &Loop::ReadClientEvent> read_client_event_callback_{this};
   SignalM<Loop, &Loop::HandleSigTerm> handle_sigterm_callback_{this};
@@ -0,0 +1,213 @@
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "event/loop.h"
+#include "event/socket.h"
+
+extern "C" {
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+}
+
+namespace event {
+
+/**
+ * Measures the cost of one Loop::Poll() call when exactly one out of \p N observed descriptors is
+ * ready. The poll backend pays for scanning all of them; the epoll backend should stay flat.
+ */
+template <Loop::Backend backend>
+void BM_PollOneReady(benchmark::State& state) {
+  const int n = state.range(0);
+
+  struct rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  if (limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  Loop loop(backend);
+  std::vector<int> fds;
+  for (int i = 0; i < n; ++i) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+      state.SkipWithError("eventfd failed (descriptor limit too low?)");
+      break;
+    }
+    fds.push_back(fd);
+    loop.ReadFd(fd, [](int fd) { std::uint64_t v; (void) !read(fd, &v, sizeof v); });
+  }
+
+  std::size_t next = 0;
+  for (auto _ : state) {
+    if (fds.empty())
+      break;
+    std::uint64_t one = 1;
+    (void) !write(fds[next], &one, sizeof one);
+    next = (next + 1) % fds.size();
+    loop.Poll();
+  }
+
+  for (int fd : fds) {
+    loop.ReadFd(fd);
+    close(fd);
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_PollOneReady, Loop::Backend::kPoll)->Arg(10)->Arg(1000)->Arg(10000);
+BENCHMARK_TEMPLATE(BM_PollOneReady, Loop::Backend::kEpoll)->Arg(10)->Arg(1000)->Arg(10000);
+BENCHMARK_TEMPLATE(BM_PollOneReady, Loop::Backend::kUring)->Arg(10)->Arg(1000)->Arg(10000);
+
+/**
+ * Measures client event throughput (events/s) from \p N producer threads posting to one loop, which
+ * drains them as fast as it can.
+ */
+void BM_ClientEvents(benchmark::State& state) {
+  const int producers = state.range(0);
+  constexpr long kEventsPerProducer = 100000;
+
+  struct Counter {
+    long events = 0;
+    void Event(long) { ++events; }
+  };
+
+  Loop loop;
+  Counter counter;
+  ClientLong<Counter, &Counter::Event> client(&loop, &counter);
+
+  for (auto _ : state) {
+    counter.events = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < producers; ++i) {
+      threads.emplace_back([&client]() {
+          for (long n = 0; n < kEventsPerProducer; ++n)
+            client(n);
+        });
+    }
+    while (counter.events < producers * kEventsPerProducer)
+      loop.Poll();
+    for (auto& thread : threads)
+      thread.join();
+  }
+
+  state.SetItemsProcessed(state.iterations() * producers * kEventsPerProducer);
+}
+
+BENCHMARK(BM_ClientEvents)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+/**
+ * Measures request/response throughput over \p N loopback TCP connections, all served by the same
+ * loop: each client sends a message, which the server echoes back. One iteration is a round trip
+ * on every connection. With the io_uring backend, the sockets use completion-based I/O.
+ */
+template <Loop::Backend backend>
+void BM_Echo(benchmark::State& state) {
+  const int n = state.range(0);
+  constexpr std::size_t kMessageSize = 1024;
+
+  struct Echo : public Socket::Watcher {
+    std::unique_ptr<Socket> socket;
+    char buf[kMessageSize];
+    void ConnectionOpen() override {}
+    void ConnectionFailed(base::error_ptr) override {}
+    void CanRead() override {
+      auto got = socket->Read(buf, sizeof buf);
+      if (got.ok() && got.size() > 0)
+        socket->Write(buf, got.size());  // the send buffer never fills up with one message in flight
+    }
+    void CanWrite() override {}
+  };
+
+  struct Server : public ServerSocket::Watcher {
+    std::vector<std::unique_ptr<Echo>> echoes;
+    void Accepted(std::unique_ptr<Socket> socket) override {
+      auto echo = std::make_unique<Echo>();
+      echo->socket = std::move(socket);
+      echo->socket->SetWatcher(echo.get());
+      echo->socket->WantRead(true);
+      echoes.push_back(std::move(echo));
+    }
+    void AcceptError(base::error_ptr) override {}
+  };
+
+  struct Client : public Socket::Watcher {
+    std::unique_ptr<Socket> socket;
+    bool open = false;
+    std::size_t received = 0;
+    void ConnectionOpen() override { open = true; }
+    void ConnectionFailed(base::error_ptr) override {}
+    void CanRead() override {
+      char buf[kMessageSize];
+      auto got = socket->Read(buf, sizeof buf);
+      if (got.ok())
+        received += got.size();
+    }
+    void CanWrite() override {}
+  };
+
+  Loop loop(backend);
+  Server server;
+  auto listener = ListenInet(&loop, &server, 0, ListenOptions().host("127.0.0.1"));
+  if (!listener.ok()) {
+    state.SkipWithError("listen failed");
+    return;
+  }
+  auto listener_ptr = listener.ptr();
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof addr;
+  getsockname(listener_ptr->fd(), (struct sockaddr*) &addr, &addr_len);
+  std::string port = std::to_string(ntohs(addr.sin_port));
+
+  std::vector<std::unique_ptr<Client>> clients;
+  for (int i = 0; i < n; ++i) {
+    auto client = std::make_unique<Client>();
+    auto socket = Socket::Builder().loop(&loop).host("127.0.0.1").port(port).Build(client.get());
+    if (!socket.ok()) {
+      state.SkipWithError("socket failed");
+      return;
+    }
+    client->socket = socket.ptr();
+    client->socket->Start();
+    clients.push_back(std::move(client));
+  }
+  auto connected = [&]() {
+    if (server.echoes.size() < (std::size_t) n)
+      return false;
+    for (const auto& client : clients) {
+      if (!client->open)
+        return false;
+    }
+    return true;
+  };
+  while (!connected())
+    loop.Poll();
+  for (auto& client : clients)
+    client->socket->WantRead(true);
+
+  char message[kMessageSize] = {};
+  for (auto _ : state) {
+    for (auto& client : clients) {
+      client->received = 0;
+      client->socket->Write(message, sizeof message);
+    }
+    for (auto& client : clients) {
+      while (client->received < kMessageSize)
+        loop.Poll();
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * n);
+  state.SetBytesProcessed(state.iterations() * n * kMessageSize);
+}
+
+BENCHMARK_TEMPLATE(BM_Echo, Loop::Backend::kEpoll)->Arg(1)->Arg(16)->Arg(256);
+BENCHMARK_TEMPLATE(BM_Echo, Loop::Backend::kUring)->Arg(1)->Arg(16)->Arg(256);
+
+} // namespace event
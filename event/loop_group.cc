@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <limits>
+
+#include "base/log.h"
+#include "event/loop_group.h"
+
+extern "C" {
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+}
+
+namespace event {
+
+LoopGroup::LoopGroup(int size, Loop::Backend backend, Placement placement) : placement_(placement) {
+  if (size <= 0)
+    size = std::max(1u, std::thread::hardware_concurrency());
+
+  for (int i = 0; i < size; ++i) {
+    auto& w = workers_.emplace_back(std::make_unique<Worker>(backend, this));
+    w->loop.AddSignal(SIGTERM, base::borrow(&w->sigterm));
+    index_.emplace(&w->loop, i);
+  }
+}
+
+LoopGroup::~LoopGroup() {
+  Stop();
+  Join();
+}
+
+void LoopGroup::Start() {
+  int cpus = std::thread::hardware_concurrency();
+
+  for (std::size_t i = 0; i < workers_.size(); ++i) {
+    Worker* w = workers_[i].get();
+    CHECK(!w->thread.joinable());
+    w->thread = std::thread([w]() { w->loop.Run(); });
+
+    if (cpus > 1) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(i % cpus, &cpu_set);
+      int ret = pthread_setaffinity_np(w->thread.native_handle(), sizeof cpu_set, &cpu_set);
+      if (ret != 0)
+        LOG(WARNING) << "failed to pin event loop thread " << i << " to CPU " << (i % cpus) << ": error " << ret;
+    }
+  }
+}
+
+void LoopGroup::Stop() {
+  for (auto& w : workers_)
+    w->stop(0);
+}
+
+void LoopGroup::Join() {
+  for (auto& w : workers_) {
+    if (w->thread.joinable())
+      w->thread.join();
+  }
+}
+
+bool LoopGroup::running() const noexcept {
+  return std::any_of(workers_.begin(), workers_.end(), [](auto& w) { return w->thread.joinable(); });
+}
+
+Loop* LoopGroup::Next() {
+  if (placement_ == Placement::kRoundRobin)
+    return &workers_[next_.fetch_add(1, std::memory_order_relaxed) % workers_.size()]->loop;
+
+  Worker* best = nullptr;
+  long best_load = std::numeric_limits<long>::max();
+  for (auto& w : workers_) {
+    long load = w->load.load(std::memory_order_relaxed);
+    if (load < best_load) {
+      best = w.get();
+      best_load = load;
+    }
+  }
+  return &best->loop;
+}
+
+void LoopGroup::AddLoad(Loop* loop, long delta) {
+  worker(loop)->load.fetch_add(delta, std::memory_order_relaxed);
+}
+
+void LoopGroup::Post(Loop* loop, std::unique_ptr<Task> task) {
+  Worker* w = worker(loop);
+  w->tasks.push(std::move(task));
+  w->tasks_ready(0);
+}
+
+void LoopGroup::Worker::RunTasks(long) {
+  std::unique_ptr<Task> task;
+  while (tasks.pop(&task))
+    task->Run();
+}
+
+LoopGroup::Worker* LoopGroup::worker(Loop* loop) const {
+  auto it = index_.find(loop);
+  CHECK(it != index_.end());
+  return workers_[it->second].get();
+}
+
+} // namespace event
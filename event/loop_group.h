@@ -0,0 +1,163 @@
+/** \file
+ * Group of event loops running on separate threads.
+ */
+
+#ifndef EVENT_LOOP_GROUP_H_
+#define EVENT_LOOP_GROUP_H_
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/common.h"
+#include "base/mpsc_queue.h"
+#include "event/loop.h"
+
+namespace event {
+
+/**
+ * Set of event loops, each running on its own thread (pinned to its own CPU core, if possible).
+ *
+ * Objects tied to a Loop (sockets, RPC calls, timers, ...) must still only be touched from the
+ * thread of that loop. The group helps with spreading such objects over the loops: Next() picks a
+ * loop for a new object, and Post() runs a function on the thread of a given loop, which is the
+ * safe way to create an object on, or hand one over to, another loop.
+ *
+ * Typical use is to construct the group, set up anything that needs to be registered on all
+ * loops (e.g., brpc::RpcServer::Start()), and then call Start(). Stop() can be called from any
+ * thread (including the group's own), and a `SIGTERM` delivered to the process also stops the
+ * whole group.
+ */
+class LoopGroup {
+ public:
+  /** Policy for picking a loop in Next(). */
+  enum class Placement {
+    /** Cycle through the loops in order. */
+    kRoundRobin,
+    /** Pick the loop with the smallest load, as reported with AddLoad(). */
+    kLeastLoaded,
+  };
+
+  /**
+   * Constructs a group of \p size loops, using \p backend for waiting on file descriptors.
+   *
+   * If \p size is 0, one loop per available CPU core is created. The loops are constructed
+   * immediately, but their threads are only started by Start().
+   */
+  explicit LoopGroup(int size = 0, Loop::Backend backend = Loop::Backend::kEpoll, Placement placement = Placement::kRoundRobin);
+
+  DISALLOW_COPY(LoopGroup);
+
+  /** Stops the loops and waits for their threads, if still running, and destroys the loops. */
+  ~LoopGroup();
+
+  /** Starts one thread for each loop, running Loop::Run() until stopped. */
+  void Start();
+
+  /**
+   * Asks every loop of the group to stop, without waiting.
+   *
+   * Safe to call from any thread. Use Join() (from a thread not in the group) to wait for the
+   * threads to actually finish. Tasks posted with Post() that a loop did not get to before stopping
+   * stay queued: they run if the group is started again, and are destroyed with the group otherwise.
+   */
+  void Stop();
+
+  /** Waits until all the threads of the group have finished. */
+  void Join();
+
+  /**
+   * Returns `true` if the threads have been started, and not yet joined.
+   *
+   * Only meaningful on the thread that calls Start() and Join().
+   */
+  bool running() const noexcept;
+
+  /** Returns the number of loops in the group. */
+  int size() const noexcept { return workers_.size(); }
+
+  /** Returns the loop at index \p i. */
+  Loop* loop(int i) const { return &workers_[i]->loop; }
+
+  /**
+   * Picks a loop for a new object, according to the placement policy.
+   *
+   * Safe to call from any thread. The returned loop may be running on another thread: use Post()
+   * to actually create the object.
+   */
+  Loop* Next();
+
+  /**
+   * Adjusts the load counter of \p loop by \p delta.
+   *
+   * The counters are only used by the Placement::kLeastLoaded policy. What the load means is up to
+   * the caller; a typical choice is the number of active connections. Safe to call from any thread.
+   */
+  void AddLoad(Loop* loop, long delta);
+
+  /** Interface for functions passed to Post(). */
+  struct Task {
+    virtual ~Task() = default;
+    /** Called on the thread of the loop the task was posted to. */
+    virtual void Run() = 0;
+  };
+
+  /** Runs \p task on the thread of \p loop, which must be one of this group's. Safe to call from any thread. */
+  void Post(Loop* loop, std::unique_ptr<Task> task);
+
+  /**
+   * Runs the callable \p f on the thread of \p loop.
+   *
+   * Unlike `std::function`, \p f need not be copyable, so it can take ownership of objects being
+   * handed over to the other loop, e.g. `group.Post(loop, [s = std::move(socket)]() mutable { ... })`.
+   */
+  template <typename F>
+  void Post(Loop* loop, F&& f) {
+    Post(loop, std::unique_ptr<Task>(std::make_unique<TaskF<std::decay_t<F>>>(std::forward<F>(f))));
+  }
+
+ private:
+  template <typename F>
+  struct TaskF : public Task {
+    F f;
+    explicit TaskF(F&& f) : f(std::move(f)) {}
+    explicit TaskF(const F& f) : f(f) {}
+    void Run() override { f(); }
+  };
+
+  void HandleSigTerm(int) { Stop(); }
+
+  struct Worker {
+    Loop loop;
+    std::thread thread;
+    std::atomic<long> load{0};
+    /** Tasks waiting to run. Owned here rather than by the loop's event queue, so that ones left over are freed. */
+    base::mpsc_queue<std::unique_ptr<Task>> tasks;
+    void RunTasks(long);
+    void StopLoop(long) { loop.Stop(); }
+    ClientLong<Worker, &Worker::RunTasks> tasks_ready{&loop, this};
+    ClientLong<Worker, &Worker::StopLoop> stop{&loop, this};
+    SignalM<LoopGroup, &LoopGroup::HandleSigTerm> sigterm;
+    Worker(Loop::Backend backend, LoopGroup* group) : loop(backend), sigterm(group) {}
+  };
+
+  Worker* worker(Loop* loop) const;
+
+  Placement placement_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  /** Index of each loop in #workers_. Not modified after construction. */
+  std::unordered_map<Loop*, int> index_;
+  /** Counter for Placement::kRoundRobin. */
+  std::atomic<unsigned> next_{0};
+};
+
+} // namespace event
+
+#endif // EVENT_LOOP_GROUP_H_
+
+// Local Variables:
+// mode: c++
+// End:
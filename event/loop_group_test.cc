@@ -0,0 +1,92 @@
+#include <atomic>
+#include <memory>
+#include <set>
+#include <thread>
+
+#include "event/loop_group.h"
+#include "gtest/gtest.h"
+
+namespace event {
+
+TEST(LoopGroupTest, PostRunsOnLoopThread) {
+  LoopGroup group(3);
+  group.Start();
+
+  std::atomic<int> done{0};
+  std::thread::id ids[3];
+  for (int i = 0; i < 3; ++i) {
+    group.Post(group.loop(i), [&ids, &done, i]() {
+        ids[i] = std::this_thread::get_id();
+        ++done;
+      });
+  }
+  while (done < 3)
+    std::this_thread::yield();
+
+  std::set<std::thread::id> distinct(std::begin(ids), std::end(ids));
+  EXPECT_EQ(distinct.size(), 3);
+  EXPECT_EQ(distinct.count(std::this_thread::get_id()), 0);
+
+  group.Stop();
+  group.Join();
+}
+
+TEST(LoopGroupTest, PostMoveOnly) {
+  LoopGroup group(1);
+  group.Start();
+
+  std::atomic<int> result{0};
+  auto value = std::make_unique<int>(42);
+  group.Post(group.loop(0), [v = std::move(value), &result]() { result = *v; });
+  while (!result)
+    std::this_thread::yield();
+  EXPECT_EQ(result, 42);
+}
+
+TEST(LoopGroupTest, StopFromLoop) {
+  LoopGroup group(2);
+  group.Start();
+  group.Post(group.loop(1), [&group]() { group.Stop(); });
+  group.Join();
+}
+
+TEST(LoopGroupTest, Running) {
+  LoopGroup group(2);
+  EXPECT_FALSE(group.running());
+  group.Start();
+  EXPECT_TRUE(group.running());
+  group.Stop();
+  EXPECT_TRUE(group.running());
+  group.Join();
+  EXPECT_FALSE(group.running());
+}
+
+TEST(LoopGroupTest, FreesQueuedTasks) {
+  auto value = std::make_shared<int>(42);
+  {
+    LoopGroup group(1);
+    group.Post(group.loop(0), [value]() { FAIL() << "task should not run"; });
+    EXPECT_EQ(value.use_count(), 2);
+  }
+  EXPECT_EQ(value.use_count(), 1);
+}
+
+TEST(LoopGroupTest, RoundRobin) {
+  LoopGroup group(3);
+  EXPECT_EQ(group.Next(), group.loop(0));
+  EXPECT_EQ(group.Next(), group.loop(1));
+  EXPECT_EQ(group.Next(), group.loop(2));
+  EXPECT_EQ(group.Next(), group.loop(0));
+}
+
+TEST(LoopGroupTest, LeastLoaded) {
+  LoopGroup group(3, Loop::Backend::kEpoll, LoopGroup::Placement::kLeastLoaded);
+  group.AddLoad(group.loop(0), 2);
+  group.AddLoad(group.loop(1), 1);
+  group.AddLoad(group.loop(2), 3);
+  EXPECT_EQ(group.Next(), group.loop(1));
+  group.AddLoad(group.loop(1), 5);
+  EXPECT_EQ(group.Next(), group.loop(0));
+}
+
+} // namespace event
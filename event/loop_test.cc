@@ -1,10 +1,15 @@
 #include <chrono>
 #include <list>
+#include <thread>
 
 #include "event/loop.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+extern "C" {
+#include <unistd.h>
+}
+
 namespace event {
 
 using ::testing::_;
@@ -144,6 +149,22 @@ TEST_F(BasicPollTest, ReadWrite) {
   loop.Poll();
 }
 
+TEST_F(BasicPollTest, RemoveOne) {
+  loop.ReadFd(1);
+
+  EXPECT_CALL(reader, CanRead(3));
+  EXPECT_CALL(writer, CanWrite(2));
+  EXPECT_CALL(writer, CanWrite(3));
+  read_fds = {1, 2, 3};
+  write_fds = {1, 2, 3};
+  loop.Poll();
+
+  std::vector<int> polled;
+  for (const auto& pfd : last_poll)
+    polled.push_back(pfd.fd);
+  EXPECT_EQ(polled, std::vector<int>({2, 3, kFakeTimerFd, kFakeSignalFd}));
+}
+
 TEST_F(LoopTest, CallbackFunction) {
   int read_fd = 0, write_fd = 0;
 
@@ -184,4 +205,115 @@ TEST_F(LoopTest, TimerTriggering) {
   EXPECT_EQ(1, calls);
 }
 
+struct BackendTest : public ::testing::TestWithParam<Loop::Backend> {
+  BackendTest() {
+    for (auto& p : pipes)
+      EXPECT_EQ(pipe(p), 0);
+  }
+  ~BackendTest() {
+    for (auto& p : pipes) {
+      close(p[0]);
+      close(p[1]);
+    }
+  }
+  Loop loop{GetParam()};
+  int pipes[3][2];
+  MockReader reader;
+  MockWriter writer;
+};
+
+TEST_P(BackendTest, ReadReady) {
+  for (auto& p : pipes)
+    loop.ReadFd(p[0], base::borrow(&reader));
+  ASSERT_EQ(write(pipes[1][1], "x", 1), 1);
+
+  EXPECT_CALL(reader, CanRead(pipes[1][0]));
+  loop.Poll();
+}
+
+TEST_P(BackendTest, WriteReady) {
+  loop.ReadFd(pipes[0][0], base::borrow(&reader));
+  loop.WriteFd(pipes[0][1], base::borrow(&writer));
+
+  EXPECT_CALL(reader, CanRead(_)).Times(0);
+  EXPECT_CALL(writer, CanWrite(pipes[0][1]));
+  loop.Poll();
+}
+
+TEST_P(BackendTest, ModifyAndRemove) {
+  loop.ReadFd(pipes[0][0], base::borrow(&reader));
+  loop.ReadFd(pipes[1][0], base::borrow(&reader));
+  loop.WriteFd(pipes[2][1], base::borrow(&writer));
+  loop.ReadFd(pipes[0][0]);
+  ASSERT_EQ(write(pipes[0][1], "x", 1), 1);
+  ASSERT_EQ(write(pipes[1][1], "x", 1), 1);
+
+  EXPECT_CALL(reader, CanRead(pipes[1][0]));
+  EXPECT_CALL(writer, CanWrite(pipes[2][1]));
+  loop.Poll();
+
+  loop.WriteFd(pipes[2][1]);
+  loop.ReadFd(pipes[0][0], base::borrow(&reader));
+
+  EXPECT_CALL(reader, CanRead(pipes[0][0]));
+  EXPECT_CALL(reader, CanRead(pipes[1][0]));
+  EXPECT_CALL(writer, CanWrite(_)).Times(0);
+  loop.Poll();
+}
+
+TEST_P(BackendTest, LevelTriggered) {
+  loop.ReadFd(pipes[0][0], base::borrow(&reader));
+  ASSERT_EQ(write(pipes[0][1], "x", 1), 1);
+
+  EXPECT_CALL(reader, CanRead(pipes[0][0])).Times(2);
+  loop.Poll();
+  loop.Poll();
+}
+
+struct ClientCounter {
+  long events = 0;
+  long sum = 0;
+  void Event(long n) { ++events; sum += n; }
+};
+
+TEST_P(BackendTest, ClientEventsDrainedTogether) {
+  ClientCounter counter;
+  ClientLong<ClientCounter, &ClientCounter::Event> client(&loop, &counter);
+
+  client(1);
+  client(2);
+  client(3);
+  loop.Poll();
+
+  EXPECT_EQ(counter.events, 3);
+  EXPECT_EQ(counter.sum, 6);
+}
+
+TEST_P(BackendTest, ClientEventsFromThreads) {
+  constexpr int kThreads = 4;
+  constexpr int kEvents = 1000;
+
+  ClientCounter counter;
+  ClientLong<ClientCounter, &ClientCounter::Event> client(&loop, &counter);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&client]() {
+        for (int i = 1; i <= kEvents; ++i)
+          client(i);
+      });
+  }
+  while (counter.events < kThreads * kEvents)
+    loop.Poll();
+  for (auto& thread : threads)
+    thread.join();
+
+  EXPECT_EQ(counter.events, kThreads * kEvents);
+  EXPECT_EQ(counter.sum, kThreads * (kEvents * (kEvents + 1) / 2));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Backends, BackendTest,
+    ::testing::Values(Loop::Backend::kEpoll, Loop::Backend::kUring));
+
 } // namespace event
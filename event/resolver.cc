@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cstring>
+
+#include "base/log.h"
+#include "event/resolver.h"
+
+extern "C" {
+#include <sys/socket.h>
+#include <sys/types.h>
+}
+
+namespace event {
+
+namespace {
+
+std::string LookupKey(const std::string& host, const std::string& port, int kind) {
+  std::string key;
+  key.reserve(host.size() + port.size() + 8);
+  key += host; key += '\0';
+  key += port; key += '\0';
+  key += std::to_string(kind);
+  return key;
+}
+
+} // unnamed namespace
+
+Resolver::Resolver(const ResolverOptions& options) : options_(options) {
+  CHECK(options_.threads() > 0);
+}
+
+Resolver::~Resolver() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  queue_cv_.notify_all();
+  for (auto& worker : workers_)
+    worker.join();
+}
+
+Resolver* Resolver::Default() {
+  // Deliberately never destroyed: a worker may be stuck in a slow lookup at process exit.
+  static Resolver* resolver = new Resolver();
+  return resolver;
+}
+
+std::unique_ptr<Resolver::Request> Resolver::Resolve(Loop* loop, const std::string& host, const std::string& port, int kind, Receiver* receiver) {
+  std::unique_ptr<Request> request(new Request(this, loop, receiver));
+  std::string key = LookupKey(host, port, kind);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.requests;
+
+  auto cached = cache_.find(key);
+  if (cached != cache_.end()) {
+    if (cached->second.expires > Clock::now()) {
+      ++stats_.cache_hits;
+      if (metric_cache_hits_)
+        metric_cache_hits_->Increment();
+      lru_.splice(lru_.begin(), lru_, cached->second.lru);
+      request->addrs_ = cached->second.addrs;
+      request->error_ = cached->second.error;
+      request->done_(0);
+      return request;
+    }
+    lru_.erase(cached->second.lru);
+    cache_.erase(cached);
+  }
+  if (metric_cache_misses_)
+    metric_cache_misses_->Increment();
+
+  auto& lookup = in_flight_[key];
+  if (lookup) {
+    ++stats_.joined;
+  } else {
+    lookup = std::make_shared<Lookup>();
+    lookup->key = key;
+    lookup->host = host;
+    lookup->port = port;
+    lookup->kind = kind;
+    queue_.push_back(lookup);
+    if (idle_workers_ == 0 && workers_.size() < (std::size_t) options_.threads())
+      workers_.emplace_back(&Resolver::Work, this);
+    else
+      queue_cv_.notify_one();
+  }
+  lookup->waiters.push_back(request.get());
+  request->lookup_ = lookup;
+
+  return request;
+}
+
+Resolver::Stats Resolver::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void Resolver::ExportMetrics(std::shared_ptr<prometheus::Registry> registry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(!metric_registry_);
+  metric_registry_ = std::move(registry);
+
+  metric_cache_hits_ = &prometheus::BuildCounter()
+      .Name("event_resolver_cache_hits")
+      .Help("How many host name lookups were answered from the cache?")
+      .Register(*metric_registry_)
+      .Add({});
+  metric_cache_misses_ = &prometheus::BuildCounter()
+      .Name("event_resolver_cache_misses")
+      .Help("How many host name lookups were not found in the cache?")
+      .Register(*metric_registry_)
+      .Add({});
+  metric_lookup_errors_ = &prometheus::BuildCounter()
+      .Name("event_resolver_lookup_errors")
+      .Help("How many getaddrinfo calls have failed?")
+      .Register(*metric_registry_)
+      .Add({});
+  const prometheus::Histogram::BucketBoundaries buckets = { 0.0001, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10 };
+  metric_lookup_seconds_ = &prometheus::BuildHistogram()
+      .Name("event_resolver_lookup_seconds")
+      .Help("How long did getaddrinfo calls take?")
+      .Register(*metric_registry_)
+      .Add({}, buckets);
+}
+
+void Resolver::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true) {
+    ++idle_workers_;
+    queue_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+    --idle_workers_;
+    if (stopping_)
+      return;
+
+    std::shared_ptr<Lookup> lookup = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+
+    auto start = Clock::now();
+    Addrs addrs;
+    int error;
+    if (options_.lookup()) {
+      error = options_.lookup()(lookup->host, lookup->port, lookup->kind, &addrs);
+    } else {
+      struct addrinfo hints;
+      std::memset(&hints, 0, sizeof hints);
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = lookup->kind;
+      hints.ai_protocol = 0;
+      hints.ai_flags = AI_ADDRCONFIG;
+
+      struct addrinfo* list = nullptr;
+      error = getaddrinfo(lookup->host.c_str(), lookup->port.c_str(), &hints, &list);
+      if (error == 0 && list)
+        addrs = Addrs(list, &freeaddrinfo);
+    }
+    auto now = Clock::now();
+
+    if (error == 0 && !addrs)
+      error = EAI_NONAME;
+    else if (error != 0)
+      addrs.reset();
+
+    lock.lock();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start);
+    ++stats_.lookups;
+    if (error)
+      ++stats_.lookup_errors;
+    stats_.lookup_time += elapsed;
+    stats_.max_lookup_time = std::max(stats_.max_lookup_time, elapsed);
+    if (metric_lookup_seconds_) {
+      if (error)
+        metric_lookup_errors_->Increment();
+      metric_lookup_seconds_->Observe(std::chrono::duration<double>(elapsed).count());
+    }
+
+    Store(lookup->key, addrs, error, now);
+    in_flight_.erase(lookup->key);
+
+    for (Request* request : lookup->waiters) {
+      request->addrs_ = addrs;
+      request->error_ = error;
+      request->lookup_.reset();
+      request->done_(0);
+    }
+    lookup->waiters.clear();
+  }
+}
+
+void Resolver::Store(const std::string& key, const Addrs& addrs, int error, Clock::time_point now) {
+  int ttl_ms = error ? options_.negative_ttl_ms() : options_.ttl_ms();
+  if (ttl_ms <= 0 || options_.max_entries() == 0)
+    return;
+
+  auto it = cache_.find(key);
+  if (it == cache_.end()) {
+    if (cache_.size() >= options_.max_entries()) {
+      cache_.erase(lru_.back());
+      lru_.pop_back();
+    }
+    lru_.push_front(key);
+    it = cache_.emplace(key, CacheEntry{}).first;
+    it->second.lru = lru_.begin();
+  } else {
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+  }
+
+  it->second.addrs = addrs;
+  it->second.error = error;
+  it->second.expires = now + std::chrono::milliseconds(ttl_ms);
+}
+
+Resolver::Request::Request(Resolver* resolver, Loop* loop, Receiver* receiver)
+    : resolver_(resolver), receiver_(base::borrow(receiver)), done_(loop, this)
+{}
+
+Resolver::Request::~Request() {
+  std::lock_guard<std::mutex> lock(resolver_->mutex_);
+  if (lookup_) {
+    auto& waiters = lookup_->waiters;
+    waiters.erase(std::remove(waiters.begin(), waiters.end(), this), waiters.end());
+  }
+}
+
+void Resolver::Request::Done(long) {
+  if (error_)
+    receiver_.Call(&Receiver::Resolved, nullptr, std::make_unique<internal::addr_error>(error_));
+  else
+    receiver_.Call(&Receiver::Resolved, std::move(addrs_), nullptr);
+}
+
+namespace internal {
+
+void addr_error::format(std::string* str) const {
+  auto err = gai_strerror(errcode_);
+  *str += "getaddrinfo: "; *str += (err ? err : "unknown error");
+}
+
+void addr_error::format(std::ostream* str) const {
+  auto err = gai_strerror(errcode_);
+  *str << "getaddrinfo: " << (err ? err : "unknown error");
+}
+
+} // namespace internal
+
+} // namespace event
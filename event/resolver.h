@@ -0,0 +1,253 @@
+/** \file
+ * Shared asynchronous host name resolver.
+ */
+
+#ifndef EVENT_RESOLVER_H_
+#define EVENT_RESOLVER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <prometheus/counter.h>
+#include <prometheus/histogram.h>
+#include <prometheus/registry.h>
+
+#include "base/callback.h"
+#include "base/common.h"
+#include "base/exc.h"
+#include "event/loop.h"
+
+extern "C" {
+#include <netdb.h>
+}
+
+namespace event {
+
+/** Options for constructing a Resolver. */
+class ResolverOptions {
+ public:
+  /**
+   * Function type for doing lookups instead of `getaddrinfo(3)`.
+   *
+   * Called with a host, port and socket type. Returns 0 and sets the last argument to a non-empty
+   * address list, or returns an `EAI_*` error code.
+   */
+  using LookupFunction = std::function<int(const std::string&, const std::string&, int, std::shared_ptr<const struct addrinfo>*)>;
+
+  /** Sets the maximum number of worker threads running `getaddrinfo(3)`. The default is 4. */
+  ResolverOptions& threads(int v) { threads_ = v; return *this; }
+  /** Gets the maximum number of worker threads. */
+  int threads() const noexcept { return threads_; }
+  /** Sets how long successful results are cached. 0 disables caching them. The default is 60 s. */
+  ResolverOptions& ttl_ms(int v) { ttl_ms_ = v; return *this; }
+  /** Gets how long successful results are cached. */
+  int ttl_ms() const noexcept { return ttl_ms_; }
+  /** Sets how long failed lookups are cached. 0 disables caching them. The default is 5 s. */
+  ResolverOptions& negative_ttl_ms(int v) { negative_ttl_ms_ = v; return *this; }
+  /** Gets how long failed lookups are cached. */
+  int negative_ttl_ms() const noexcept { return negative_ttl_ms_; }
+  /** Sets the maximum number of cached results. The default is 1024. */
+  ResolverOptions& max_entries(std::size_t v) { max_entries_ = v; return *this; }
+  /** Gets the maximum number of cached results. */
+  std::size_t max_entries() const noexcept { return max_entries_; }
+  /** Sets a function to call on the worker threads instead of `getaddrinfo(3)`, e.g. for tests. */
+  ResolverOptions& lookup(LookupFunction v) { lookup_ = std::move(v); return *this; }
+  /** Gets the function replacing `getaddrinfo(3)`, if any. */
+  const LookupFunction& lookup() const noexcept { return lookup_; }
+
+ private:
+  int threads_ = 4;
+  int ttl_ms_ = 60000;
+  int negative_ttl_ms_ = 5000;
+  std::size_t max_entries_ = 1024;
+  LookupFunction lookup_;
+};
+
+/**
+ * Host name resolver shared by any number of loops.
+ *
+ * Lookups are done with the blocking `getaddrinfo(3)` call on a bounded pool of worker threads,
+ * which are started on demand. Concurrent requests for the same name share a single lookup, and
+ * results (including failures) are cached for a configurable time. The system resolver does not
+ * report record TTLs, so a fixed time is used for all entries. When the cache is full, the least
+ * recently used entry is evicted.
+ *
+ * Resolve() must be called on the thread of the loop it is passed, and the result is delivered on
+ * that loop. Everything else is safe to call from any thread.
+ */
+class Resolver {
+ public:
+  /** Result of a successful lookup: a (shared, read-only) `getaddrinfo(3)` result list. */
+  using Addrs = std::shared_ptr<const struct addrinfo>;
+
+  /** Callback interface for receiving lookup results. */
+  struct Receiver : public virtual base::Callback {
+    /**
+     * Called with the result of a Resolve() request.
+     *
+     * Exactly one of \p addrs (a non-empty address list) and \p error is set.
+     */
+    virtual void Resolved(Addrs addrs, base::error_ptr error) = 0;
+  };
+
+  class Request;
+
+  /** Counters describing the work done by a resolver. */
+  struct Stats {
+    /** Number of Resolve() calls. */
+    std::uint64_t requests = 0;
+    /** Number of requests answered from the cache. */
+    std::uint64_t cache_hits = 0;
+    /** Number of requests that joined an identical lookup already in progress. */
+    std::uint64_t joined = 0;
+    /** Number of `getaddrinfo(3)` calls made. */
+    std::uint64_t lookups = 0;
+    /** Number of `getaddrinfo(3)` calls that failed. */
+    std::uint64_t lookup_errors = 0;
+    /** Total time spent in `getaddrinfo(3)`. */
+    std::chrono::nanoseconds lookup_time{0};
+    /** Longest time spent in a single `getaddrinfo(3)` call. */
+    std::chrono::nanoseconds max_lookup_time{0};
+  };
+
+  /** Constructs a resolver. No threads are started until the first lookup. */
+  explicit Resolver(const ResolverOptions& options = ResolverOptions());
+  DISALLOW_COPY(Resolver);
+
+  /**
+   * Stops the worker threads, waiting for any lookups in progress to finish.
+   *
+   * All Request objects must have been destroyed before the resolver.
+   */
+  ~Resolver();
+
+  /** Returns the process-wide resolver with default options, used by sockets unless overridden. */
+  static Resolver* Default();
+
+  /**
+   * Starts resolving \p host and \p port for sockets of type \p kind (e.g., `SOCK_STREAM`).
+   *
+   * The result is delivered to \p receiver through a client event on \p loop, never during this
+   * call, even if it was cached. Destroying the returned Request before then cancels the delivery;
+   * the lookup itself still finishes, and its result is cached.
+   */
+  std::unique_ptr<Request> Resolve(Loop* loop, const std::string& host, const std::string& port, int kind, Receiver* receiver);
+
+  /** Returns a snapshot of the counters. */
+  Stats stats() const;
+
+  /**
+   * Exports metrics about the resolver to \p registry.
+   *
+   * The metrics are counters of cache hits and misses (a request joining a lookup in progress is a
+   * miss) and of failed lookups, and a histogram of the `getaddrinfo(3)` latency. Only the work done
+   * after this call is counted. The resolver keeps a reference to the registry. Call at most once.
+   */
+  void ExportMetrics(std::shared_ptr<prometheus::Registry> registry);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Lookup {
+    std::string key;
+    std::string host;
+    std::string port;
+    int kind;
+    /** Requests waiting for the result. */
+    std::vector<Request*> waiters;
+  };
+
+  struct CacheEntry {
+    Addrs addrs;
+    /** `getaddrinfo(3)` error code, or 0 on success. */
+    int error;
+    Clock::time_point expires;
+    /** Position of the key in #lru_. */
+    std::list<std::string>::iterator lru;
+  };
+
+  /** Worker thread main loop. */
+  void Work();
+  /** Adds a lookup result to the cache, evicting the least recently used entry if it's full. Called with #mutex_ held. */
+  void Store(const std::string& key, const Addrs& addrs, int error, Clock::time_point now);
+
+  const ResolverOptions options_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable queue_cv_;
+  /** Lookups waiting for a worker thread. */
+  std::deque<std::shared_ptr<Lookup>> queue_;
+  /** Lookups queued or in progress, by key. */
+  std::unordered_map<std::string, std::shared_ptr<Lookup>> in_flight_;
+  std::unordered_map<std::string, CacheEntry> cache_;
+  /** Keys of #cache_, most recently used first. */
+  std::list<std::string> lru_;
+  std::vector<std::thread> workers_;
+  /** Number of worker threads waiting for work. */
+  int idle_workers_ = 0;
+  bool stopping_ = false;
+  Stats stats_;
+
+  std::shared_ptr<prometheus::Registry> metric_registry_;
+  prometheus::Counter* metric_cache_hits_ = nullptr;
+  prometheus::Counter* metric_cache_misses_ = nullptr;
+  prometheus::Counter* metric_lookup_errors_ = nullptr;
+  prometheus::Histogram* metric_lookup_seconds_ = nullptr;
+};
+
+/** Handle for a pending Resolver::Resolve() request. Destroying it cancels the request. */
+class Resolver::Request {
+ public:
+  DISALLOW_COPY(Request);
+  ~Request();
+
+ private:
+  Request(Resolver* resolver, Loop* loop, Receiver* receiver);
+
+  /** Called on the loop when the result has been stored in this object. */
+  void Done(long);
+
+  Resolver* resolver_;
+  base::CallbackPtr<Receiver> receiver_;
+  /** The lookup this request is waiting for, if any. Guarded by the resolver's mutex. */
+  std::shared_ptr<Lookup> lookup_;
+  Addrs addrs_;
+  int error_ = 0;
+  ClientLong<Request, &Request::Done> done_;
+
+  friend class Resolver;
+};
+
+namespace internal {
+
+/** Error type for `getaddrinfo(3)` failures. */
+class addr_error : public base::error {
+ public:
+  explicit addr_error(int errcode) : errcode_(errcode) {}
+
+  void format(std::string* str) const override;
+  void format(std::ostream* str) const override;
+
+ private:
+  int errcode_;
+};
+
+} // namespace internal
+
+} // namespace event
+
+#endif // EVENT_RESOLVER_H_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,167 @@
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <prometheus/registry.h>
+
+#include "event/loop.h"
+#include "event/resolver.h"
+#include "gtest/gtest.h"
+
+extern "C" {
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+}
+
+namespace event {
+
+struct ResolverTest : public ::testing::Test, public Resolver::Receiver, public Timed {
+  struct Result {
+    Resolver::Addrs addrs;
+    std::string error;
+  };
+
+  Loop loop;
+  std::vector<Result> results;
+  bool timed_out = false;
+
+  void Resolved(Resolver::Addrs addrs, base::error_ptr error) override {
+    Result result{std::move(addrs), ""};
+    if (error)
+      error->format(&result.error);
+    results.push_back(std::move(result));
+  }
+
+  void TimerExpired(bool) override { timed_out = true; }
+
+  /** Runs the loop until \p count results have been delivered, or a timeout. */
+  void RunUntil(std::size_t count) {
+    TimerId timer = loop.Delay(std::chrono::seconds(5), base::borrow(this));
+    while (results.size() < count && !timed_out)
+      loop.Poll();
+    if (!timed_out)
+      loop.CancelTimer(timer);
+    ASSERT_EQ(results.size(), count);
+  }
+};
+
+TEST_F(ResolverTest, Numeric) {
+  Resolver resolver;
+  auto request = resolver.Resolve(&loop, "127.0.0.1", "80", SOCK_STREAM, this);
+  EXPECT_TRUE(results.empty());
+
+  RunUntil(1);
+  ASSERT_TRUE(results[0].addrs) << results[0].error;
+  EXPECT_EQ(results[0].addrs->ai_family, AF_INET);
+}
+
+TEST_F(ResolverTest, CachesResults) {
+  Resolver resolver;
+  auto first = resolver.Resolve(&loop, "127.0.0.1", "80", SOCK_STREAM, this);
+  RunUntil(1);
+  auto second = resolver.Resolve(&loop, "127.0.0.1", "80", SOCK_STREAM, this);
+  EXPECT_EQ(results.size(), 1);  // delivered asynchronously even when cached
+  RunUntil(2);
+
+  EXPECT_EQ(results[0].addrs, results[1].addrs);
+  auto stats = resolver.stats();
+  EXPECT_EQ(stats.requests, 2);
+  EXPECT_EQ(stats.lookups, 1);
+  EXPECT_EQ(stats.cache_hits, 1);
+}
+
+TEST_F(ResolverTest, SharesLookups) {
+  Resolver resolver;
+  auto first = resolver.Resolve(&loop, "127.0.0.1", "80", SOCK_STREAM, this);
+  auto second = resolver.Resolve(&loop, "127.0.0.1", "80", SOCK_STREAM, this);
+  RunUntil(2);
+
+  auto stats = resolver.stats();
+  EXPECT_EQ(stats.lookups, 1);
+  EXPECT_EQ(stats.cache_hits + stats.joined, 1);
+}
+
+TEST_F(ResolverTest, NegativeCache) {
+  Resolver resolver;
+  auto first = resolver.Resolve(&loop, "127.0.0.1", "no-such-service", SOCK_STREAM, this);
+  RunUntil(1);
+  auto second = resolver.Resolve(&loop, "127.0.0.1", "no-such-service", SOCK_STREAM, this);
+  RunUntil(2);
+
+  EXPECT_FALSE(results[0].addrs);
+  EXPECT_FALSE(results[0].error.empty());
+  EXPECT_FALSE(results[1].addrs);
+  EXPECT_EQ(results[1].error, results[0].error);
+  auto stats = resolver.stats();
+  EXPECT_EQ(stats.lookups, 1);
+  EXPECT_EQ(stats.lookup_errors, 1);
+  EXPECT_EQ(stats.cache_hits, 1);
+}
+
+TEST_F(ResolverTest, EvictsLeastRecentlyUsed) {
+  Resolver resolver(ResolverOptions().max_entries(2));
+  std::vector<std::unique_ptr<Resolver::Request>> requests;
+  auto resolve = [&](const char* port) {
+    requests.push_back(resolver.Resolve(&loop, "127.0.0.1", port, SOCK_STREAM, this));
+    RunUntil(requests.size());
+  };
+
+  resolve("80");
+  resolve("81");
+  resolve("80");  // hit, makes 81 the least recently used entry
+  resolve("82");  // evicts 81
+  EXPECT_EQ(resolver.stats().lookups, 3);
+  resolve("80");
+  EXPECT_EQ(resolver.stats().lookups, 3);
+  resolve("81");
+  EXPECT_EQ(resolver.stats().lookups, 4);
+}
+
+TEST_F(ResolverTest, ExportsMetrics) {
+  auto registry = std::make_shared<prometheus::Registry>();
+  Resolver resolver;
+  resolver.ExportMetrics(registry);
+
+  auto first = resolver.Resolve(&loop, "127.0.0.1", "80", SOCK_STREAM, this);
+  RunUntil(1);
+  auto second = resolver.Resolve(&loop, "127.0.0.1", "80", SOCK_STREAM, this);
+  RunUntil(2);
+  auto failed = resolver.Resolve(&loop, "127.0.0.1", "no-such-service", SOCK_STREAM, this);
+  RunUntil(3);
+
+  std::map<std::string, prometheus::ClientMetric> metrics;
+  for (const auto& family : registry->Collect()) {
+    ASSERT_EQ(family.metric.size(), 1) << family.name;
+    metrics[family.name] = family.metric[0];
+  }
+  EXPECT_EQ(metrics["event_resolver_cache_hits"].counter.value, 1);
+  EXPECT_EQ(metrics["event_resolver_cache_misses"].counter.value, 2);
+  EXPECT_EQ(metrics["event_resolver_lookup_errors"].counter.value, 1);
+  EXPECT_EQ(metrics["event_resolver_lookup_seconds"].histogram.sample_count, 2);
+}
+
+TEST_F(ResolverTest, CachingDisabled) {
+  Resolver resolver(ResolverOptions().ttl_ms(0));
+  auto first = resolver.Resolve(&loop, "127.0.0.1", "80", SOCK_STREAM, this);
+  RunUntil(1);
+  auto second = resolver.Resolve(&loop, "127.0.0.1", "80", SOCK_STREAM, this);
+  RunUntil(2);
+
+  EXPECT_EQ(resolver.stats().lookups, 2);
+}
+
+TEST_F(ResolverTest, Cancel) {
+  Resolver resolver;
+  auto cancelled = resolver.Resolve(&loop, "127.0.0.1", "80", SOCK_STREAM, this);
+  cancelled.reset();
+  auto other = resolver.Resolve(&loop, "127.0.0.1", "81", SOCK_STREAM, this);
+  RunUntil(1);
+
+  ASSERT_TRUE(results[0].addrs) << results[0].error;
+  EXPECT_EQ(ntohs(((struct sockaddr_in*) results[0].addrs->ai_addr)->sin_port), 81);
+}
+
+} // namespace event
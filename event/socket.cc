@@ -1,8 +1,9 @@
+#include <algorithm>
 #include <chrono>
 #include <cstring>
+#include <deque>
 #include <memory>
-#include <mutex>
-#include <thread>
+#include <vector>
 
 #include <openssl/ssl.h>
 
@@ -12,10 +13,13 @@
 #include "event/socket.h"
 
 extern "C" {
-#include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 }
@@ -35,35 +39,18 @@ namespace event {
 
 namespace internal {
 
-class addr_error : public base::error {
- public:
-  explicit addr_error(int errcode) : errcode_(errcode) {}
-
-  void format(std::string* str) const override;
-  void format(std::ostream* str) const override;
-
- private:
-  int errcode_;
-};
-
-void addr_error::format(std::string* str) const {
-  auto err = gai_strerror(errcode_);
-  *str += "getaddrinfo: "; *str += (err ? err : "unknown error");
-}
-
-void addr_error::format(std::ostream* str) const {
-  auto err = gai_strerror(errcode_);
-  *str << "getaddrinfo: " << (err ? err : "unknown error");
-}
-
 /**
  * Plain TCP socket.
  */
-class BasicSocket : public Socket, public FdReader, public FdWriter {
+class BasicSocket : public Socket, public FdReader, public FdWriter, public Resolver::Receiver {
  public:
-  BasicSocket(const Builder& opt, Family family, Watcher* watcher);
+  /**
+   * Constructs a client socket. If \p completion is `false`, the socket sticks to readiness
+   * notifications even if the loop supports completion-based I/O (see Stream).
+   */
+  BasicSocket(const Builder& opt, Family family, Watcher* watcher, bool completion = true);
   // Internal constructor for ServerSocket use only.
-  BasicSocket(Loop* loop, int fd);
+  BasicSocket(Loop* loop, int fd, bool stream);
 
   DISALLOW_COPY(BasicSocket);
   ~BasicSocket();
@@ -75,6 +62,8 @@ class BasicSocket : public Socket, public FdReader, public FdWriter {
   void WantWrite(bool enabled) override;
   base::io_result Read(void* buf, std::size_t count) override;
   base::io_result Write(const void* buf, std::size_t count) override;
+  base::io_result Readv(const struct iovec* iov, int iovcnt) override;
+  base::io_result Writev(const struct iovec* iov, int iovcnt) override;
   bool safe_to_read() const noexcept override { return true; }
   bool safe_to_write() const noexcept override { return true; }
 
@@ -82,6 +71,8 @@ class BasicSocket : public Socket, public FdReader, public FdWriter {
   int fd() const noexcept { return socket_; }
 
  private:
+  class Stream;
+
   enum State {
     kInitialized,
     kResolving,
@@ -90,63 +81,58 @@ class BasicSocket : public Socket, public FdReader, public FdWriter {
     kFailed,
   };
 
-  struct AddrinfoDeleter {
-    void operator()(struct addrinfo* addrs) {
-      freeaddrinfo(addrs);
-    }
-  };
-
-  using AddrinfoPtr = std::unique_ptr<struct addrinfo, AddrinfoDeleter>;
-
-  struct ResolveData {
-    /** Constructs a new resolve data block for resolving host \p h, port \p p, kind \p k. */
-    ResolveData(BasicSocket* s, const std::string& h, const std::string& p, int k)
-        : socket(s), host(h), port(p), kind(k)
-    {}
-
-    /**
-     * Pointer to the associated connection. If the name resolution is abandoned, this field may be
-     * `nullptr`. It will only be modified while #mutex is held, so that the thread can be sure the
-     * client event doesn't get destroyed when it's trying to signal the results. */
-    BasicSocket* socket;
-    const std::string host;
-    const std::string port;
-    int kind;
-
-    /** Pointer to a getaddrinfo(2) result list, once the results are ready. */
-    AddrinfoPtr addrs;
-    /** Error message from name resolution, if it failed. */
-    base::error_ptr error;
-
-    /** Mutex guarding the #connection field. */
-    std::mutex mutex;
-  };
-
   Loop* loop_;
   base::CallbackPtr<Watcher> watcher_;
 
   State state_ = kInitialized;
 
-  /** Shared state between the main and name resolution threads, only set in `kResolving` state. */
-  std::shared_ptr<ResolveData> resolve_data_;
-  /** Client event for posting the name resolution result. */
+  /** Resolver used for inet sockets, or `nullptr` for unix sockets. */
+  Resolver* resolver_ = nullptr;
+  /** Host name and port to resolve, for an inet socket. */
+  std::string host_, port_;
+  /** Socket kind, as passed to the resolver. */
+  int kind_;
+  /** Pending name resolution request, only set in `kResolving` state. */
+  std::unique_ptr<Resolver::Request> resolve_request_;
   /** Name resolution timeout in milliseconds. */
   int resolve_timeout_ms_ = Socket::Builder::kDefaultResolveTimeoutMs;
-  /** Timer for timing out the name resolution thread, only valid in `kResolving` state. */
+  /** Timer for timing out the name resolution, only valid in `kResolving` state. */
   event::TimerId resolve_timer_ = kNoTimer;
 
-  /** Result list from `getaddrinfo`. Only valid in `kConnecting` state, for an inet socket. */
-  AddrinfoPtr connect_addr_inet_;
+  /** Result list from the resolver. Only valid in `kConnecting` state, for an inet socket. */
+  Resolver::Addrs connect_addr_inet_;
   /** Address data built explicitly. Only valid in `kConnecting` state, for a unix socket. */
   std::unique_ptr<std::pair<struct sockaddr_un, struct addrinfo>> connect_addr_unix_;
-  /** Address we're currently trying to connect to, in `kConnecting` state. */
-  struct addrinfo* connect_addr_ = nullptr;
-  /** Connection timeout in milliseconds. */
+  /** Addresses to try, with address families interleaved. Only valid in `kConnecting` state. */
+  std::vector<const struct addrinfo*> connect_addrs_;
+  /** Index of the next address in #connect_addrs_ to start a connection attempt for. */
+  std::size_t next_addr_ = 0;
+
+  /** A connection attempt in progress. */
+  struct Attempt {
+    int fd;
+    const struct addrinfo* addr;
+    TimerPoint deadline;
+  };
+  /** Connection attempts in progress, oldest first. Only used in `kConnecting` state. */
+  std::vector<Attempt> attempts_;
+  /** Error of the most recent failed attempt, reported if none of them succeed. */
+  base::error_ptr connect_error_;
+
+  /** Connection timeout (of each attempt) in milliseconds. */
   int connect_timeout_ms_ = Socket::Builder::kDefaultConnectTimeoutMs;
-  /** Timer for timing out the connection attempt, only valid in `kConnecting` state. */
+  /** Delay before starting the next attempt in parallel with the previous ones, in milliseconds. */
+  int connect_stagger_ms_ = Socket::Builder::kDefaultConnectStaggerMs;
+  /** Timer for timing out the oldest connection attempt, only valid in `kConnecting` state. */
   event::TimerId connect_timer_ = kNoTimer;
-
-  /** Socket file descriptor, only valid (not -1) in `kConnecting` or `kOpen` states. */
+  /** Timer for starting the next connection attempt, only valid in `kConnecting` state. */
+  event::TimerId stagger_timer_ = kNoTimer;
+  /** TCP keepalive idle time in milliseconds, or 0 to leave keepalive off. */
+  int keepalive_ms_ = 0;
+  /** `TCP_USER_TIMEOUT` in milliseconds, or 0 for the system default. */
+  int user_timeout_ms_ = 0;
+
+  /** Socket file descriptor, only valid (not -1) in `kOpen` state. */
   int socket_ = -1;
 
   /** `true` if the descriptor is being polled for reading. */
@@ -154,76 +140,413 @@ class BasicSocket : public Socket, public FdReader, public FdWriter {
   /** `true` if the descriptor is being polled for writing. */
   bool write_requested_ = false;
 
+  /** `true` if the socket should use completion-based I/O once open, if the loop supports it. */
+  bool completion_ = false;
   /**
-   * Performs a blocking hostname resolution (in a separate thread).
-   *
-   * This method is intended to be called in a separate thread. It will take shared ownership of the
-   * \p data block, and use that to communicate the results back.
+   * Completion-based I/O state, only set in `kOpen` state if in use. The descriptor is then owned
+   * by it, and #read_requested_ and #write_requested_ only control the callbacks it makes.
    */
-  static void Resolve(std::shared_ptr<ResolveData> data);
-  /** Called when name resolution thread signals resolve data is ready. */
-  void Resolved(long);
+  Stream* stream_ = nullptr;
+
+  /** Starts using completion-based I/O for the open socket, if enabled and supported. */
+  void StartStream();
+
+  /** Called when the resolver has finished looking up the host name. */
+  void Resolved(Resolver::Addrs addrs, base::error_ptr error) override;
   /** Called if the name resolution timeout expires. */
   void ResolveTimeout();
 
-  /** Called to start a connection attempt to the current address. */
-  void Connect();
-  /** Called when the asynchronous connect operation has finished. */
-  void ConnectDone();
-  /** Called if the connection attempt timeout expires. */
+  /** Orders the addresses of the list \p addrs for connecting, and starts the first attempt. */
+  void Connect(const struct addrinfo* addrs);
+  /**
+   * Starts connection attempts until one is in progress, or the addresses run out.
+   *
+   * If no attempts remain in progress either, reports the connection as failed.
+   */
+  void ConnectNext();
+  /** Applies the configured TCP options to the new socket \p fd. Failures are only logged. */
+  void SetTcpOptions(int fd);
+  /** Called when the attempt using \p fd has connected to \p addr, and won the race. */
+  void ConnectDone(int fd, const struct addrinfo* addr);
+  /** Abandons the connection attempt at index \p i of #attempts_ after it failed with \p error. */
+  void ConnectFailed(std::size_t i, base::error_ptr error);
+  /** Closes all connection attempts in progress, and cancels the related timers. */
+  void ConnectCancel();
+  /** (Re)arms #connect_timer_ for the oldest attempt in progress. */
+  void ArmConnectTimer();
+  /** Called if the oldest connection attempt timeout expires. */
   void ConnectTimeout();
-  /** Called to skip to the next available address when connection fails. */
-  void ConnectNext(base::error_ptr error);
+  /** Called when it's time to start the next connection attempt in parallel. */
+  void ConnectStagger();
 
   /** Called when the underlying socket is ready to read, according to poll. */
   void CanRead(int fd) override;
   /** Called when the underlying socket is ready to write, according to poll. */
   void CanWrite(int fd) override;
 
-  event::ClientLong<BasicSocket, &BasicSocket::Resolved> resolved_callback_{loop_, this};
   event::TimedM<BasicSocket, &BasicSocket::ResolveTimeout> resolve_timeout_callback_{this};
   event::TimedM<BasicSocket, &BasicSocket::ConnectTimeout> connect_timeout_callback_{this};
+  event::TimedM<BasicSocket, &BasicSocket::ConnectStagger> connect_stagger_callback_{this};
 };
 
-BasicSocket::BasicSocket(const Builder& opt, Family family, Watcher* watcher)
+/**
+ * Completion-based I/O of an open stream socket, used if the loop provides Loop::uring().
+ *
+ * Incoming data is received with a multishot receive into the registered buffers of the ring, and
+ * queued until read. Written data is copied to a send buffer, which is sent with one request at a
+ * time. The socket counts as readable when something (data, end of file or an error) is queued,
+ * and as writable when there's room in the send buffer. The watcher callbacks are made when that
+ * happens, and then repeated with a no-op request on every loop iteration for as long as the
+ * condition holds and the interest is enabled, like readiness notifications would be.
+ *
+ * The object is separate from BasicSocket so that it can outlive it: a closed socket hands it over
+ * to the ring, and it finishes sending what's left in the send buffer, and closes the descriptor
+ * once none of its requests are in flight.
+ */
+class BasicSocket::Stream : public UringOrphan {
+ public:
+  Stream(BasicSocket* owner, Uring* uring, int fd);
+  DISALLOW_COPY(Stream);
+  ~Stream();
+
+  /** Detaches the stream from its socket, which is being destroyed. */
+  void Orphan();
+  /** Arranges for the callbacks the socket is interested in to be made, if any are due. */
+  void Notify();
+
+  base::io_result Readv(const struct iovec* iov, int iovcnt);
+  base::io_result Writev(const struct iovec* iov, int iovcnt);
+
+ private:
+  /** Number of received buffers after which receiving is paused until some of them are read. */
+  static constexpr std::size_t kMaxChunks = 4;
+  /** Size of the send buffer. */
+  static constexpr std::size_t kSendBufferSize = 65536;
+  /** Buffer ID denoting #own_buffer_ in a Chunk. */
+  static constexpr unsigned kOwnBuffer = ~0u;
+
+  /** Received data not read yet. */
+  struct Chunk {
+    /** Registered buffer holding the data, or #kOwnBuffer. */
+    unsigned id;
+    /** Offset of the first unread byte in the buffer. */
+    std::size_t start;
+    /** Offset just past the last byte of data in the buffer. */
+    std::size_t end;
+  };
+
+  /** Socket using this stream, or `nullptr` once it has been orphaned. */
+  BasicSocket* owner_;
+  Uring* uring_;
+  int fd_;
+
+  std::deque<Chunk> chunks_;
+  /** Buffer for single receives, used if the registered buffers have run out. */
+  std::unique_ptr<unsigned char[]> own_buffer_;
+  /** `true` if a receive request is in flight. */
+  bool recv_armed_ = false;
+  /** `true` if the receive request in flight has been cancelled. */
+  bool recv_cancelled_ = false;
+  /** `true` if the receive request in flight is a multishot one. */
+  bool recv_multishot_ = false;
+  /** `true` if the next receive should be a single one into #own_buffer_. */
+  bool recv_single_ = false;
+  /** `true` once the peer has closed its side of the connection. */
+  bool recv_eof_ = false;
+  /** Error (an `errno` value) that ended receiving, or 0. */
+  int recv_error_ = 0;
+
+  /** Data of the send request in flight, if any. */
+  std::vector<unsigned char> send_buffer_;
+  /** Number of bytes of #send_buffer_ sent so far. */
+  std::size_t send_offset_ = 0;
+  /** Data written while a send request was in flight. */
+  std::vector<unsigned char> send_queue_;
+  /** Error (an `errno` value) that ended sending, or 0. */
+  int send_error_ = 0;
+
+  /** `true` if a no-op request to repeat the callbacks is in flight. */
+  bool kick_armed_ = false;
+  /** `true` while callbacks are being made, which might orphan (but must not destroy) the stream. */
+  bool dispatching_ = false;
+
+  bool readable() const noexcept { return !chunks_.empty() || recv_eof_ || recv_error_; }
+  std::size_t buffered() const noexcept { return send_buffer_.size() - send_offset_ + send_queue_.size(); }
+  bool writable() const noexcept { return send_error_ || buffered() < kSendBufferSize; }
+
+  /** Starts a new receive request, unless one is in flight or there's enough data queued. */
+  void Recv();
+  /** Starts a new send request for the queued data, unless one is in flight. */
+  void Send();
+  /** Makes the watcher callbacks that are due, and schedules them to be repeated if needed. */
+  void Dispatch();
+  /** Closes the descriptor and destroys the stream, if it's orphaned and no longer busy. */
+  void MaybeFinish();
+
+  void Received(int res, unsigned flags);
+  void Sent(int res, unsigned flags);
+  void Kicked(int res, unsigned flags);
+
+  UringOpM<Stream, &Stream::Received> recv_op_{this};
+  UringOpM<Stream, &Stream::Sent> send_op_{this};
+  UringOpM<Stream, &Stream::Kicked> kick_op_{this};
+};
+
+BasicSocket::Stream::Stream(BasicSocket* owner, Uring* uring, int fd)
+    : owner_(owner), uring_(uring), fd_(fd)
+{
+  Recv();
+}
+
+BasicSocket::Stream::~Stream() {
+  close(fd_);
+}
+
+void BasicSocket::Stream::Orphan() {
+  owner_ = nullptr;
+  uring_->Adopt(this);
+
+  for (const Chunk& chunk : chunks_) {
+    if (chunk.id != kOwnBuffer)
+      uring_->RecycleBuffer(chunk.id);
+  }
+  chunks_.clear();
+  if (recv_armed_ && !recv_cancelled_) {
+    recv_cancelled_ = true;
+    uring_->Cancel(&recv_op_);
+  }
+
+  MaybeFinish();
+}
+
+void BasicSocket::Stream::MaybeFinish() {
+  if (!owner_ && !dispatching_ && !recv_armed_ && send_buffer_.empty() && !kick_armed_)
+    uring_->Release(this);
+}
+
+void BasicSocket::Stream::Notify() {
+  if (kick_armed_)
+    return;
+  if ((owner_->read_requested_ && readable()) || (owner_->write_requested_ && writable())) {
+    kick_armed_ = true;
+    uring_->Nop(&kick_op_);
+  }
+}
+
+void BasicSocket::Stream::Dispatch() {
+  dispatching_ = true;
+  if (owner_ && owner_->read_requested_ && readable())
+    owner_->watcher_.Call(&Watcher::CanRead);
+  if (owner_ && owner_->write_requested_ && writable())
+    owner_->watcher_.Call(&Watcher::CanWrite);
+  dispatching_ = false;
+
+  if (owner_)
+    Notify();
+  else
+    MaybeFinish();
+}
+
+void BasicSocket::Stream::Kicked(int, unsigned) {
+  kick_armed_ = false;
+  Dispatch();
+}
+
+void BasicSocket::Stream::Recv() {
+  if (recv_armed_ || recv_eof_ || recv_error_ || chunks_.size() >= kMaxChunks)
+    return;
+
+  if (!recv_single_ && uring_->RecvMultishot(fd_, &recv_op_)) {
+    recv_armed_ = true;
+    recv_cancelled_ = false;
+    recv_multishot_ = true;
+    return;
+  }
+
+  // The single receive can only reuse the buffer once its previous contents have been read.
+  for (const Chunk& chunk : chunks_) {
+    if (chunk.id == kOwnBuffer)
+      return;
+  }
+  if (!own_buffer_)
+    own_buffer_ = std::make_unique<unsigned char[]>(Uring::kBufferSize);
+  uring_->Recv(fd_, own_buffer_.get(), Uring::kBufferSize, &recv_op_);
+  recv_armed_ = true;
+  recv_cancelled_ = false;
+  recv_multishot_ = false;
+}
+
+void BasicSocket::Stream::Received(int res, unsigned flags) {
+  bool more = flags & IORING_CQE_F_MORE;
+  if (!more)
+    recv_armed_ = false;
+
+  if (res > 0) {
+    unsigned id = flags & IORING_CQE_F_BUFFER ? flags >> IORING_CQE_BUFFER_SHIFT : kOwnBuffer;
+    if (!owner_) {
+      if (id != kOwnBuffer)
+        uring_->RecycleBuffer(id);
+    } else {
+      chunks_.push_back(Chunk{id, 0, (std::size_t) res});
+      if (id == kOwnBuffer)
+        recv_single_ = false;  // try the registered buffers again next time
+    }
+  } else if (res == 0) {
+    recv_eof_ = true;
+  } else if (res == -ENOBUFS) {
+    recv_single_ = true;  // all registered buffers are waiting to be read
+  } else if (res == -EINVAL && recv_multishot_) {
+    uring_->DisableRecvMultishot();  // kernel too old for multishot receives (before Linux 6.0)
+  } else if (res != -ECANCELED) {
+    recv_error_ = -res;
+  }
+
+  if (!owner_) {
+    MaybeFinish();
+    return;
+  }
+
+  if (!more)
+    Recv();
+  else if (chunks_.size() >= kMaxChunks && !recv_cancelled_) {
+    // Nobody is reading: stop taking up registered buffers. Recv() restarts once there's room.
+    recv_cancelled_ = true;
+    uring_->Cancel(&recv_op_);
+  }
+
+  Dispatch();
+}
+
+base::io_result BasicSocket::Stream::Readv(const struct iovec* iov, int iovcnt) {
+  std::size_t total = 0;
+
+  for (int i = 0; i < iovcnt && !chunks_.empty(); ++i) {
+    unsigned char* dst = static_cast<unsigned char*>(iov[i].iov_base);
+    std::size_t left = iov[i].iov_len;
+    while (left > 0 && !chunks_.empty()) {
+      Chunk& chunk = chunks_.front();
+      unsigned char* src = chunk.id == kOwnBuffer ? own_buffer_.get() : uring_->Buffer(chunk.id);
+      std::size_t n = std::min(left, chunk.end - chunk.start);
+      std::memcpy(dst, src + chunk.start, n);
+      chunk.start += n;
+      dst += n;
+      left -= n;
+      total += n;
+      if (chunk.start == chunk.end) {
+        if (chunk.id != kOwnBuffer)
+          uring_->RecycleBuffer(chunk.id);
+        chunks_.pop_front();
+      }
+    }
+  }
+
+  if (total > 0) {
+    Recv();
+    return base::io_result::ok(total);
+  }
+  if (recv_error_)
+    return base::io_result::os_error("recv", recv_error_);
+  if (recv_eof_)
+    return base::io_result::eof();
+  return base::io_result::ok(0);
+}
+
+void BasicSocket::Stream::Send() {
+  if (!send_buffer_.empty() || send_queue_.empty())
+    return;
+  send_buffer_.swap(send_queue_);
+  send_offset_ = 0;
+  uring_->Send(fd_, send_buffer_.data(), send_buffer_.size(), &send_op_);
+}
+
+void BasicSocket::Stream::Sent(int res, unsigned) {
+  if (res < 0) {
+    send_error_ = -res;
+    send_buffer_.clear();
+    send_offset_ = 0;
+    send_queue_.clear();
+  } else {
+    send_offset_ += res;
+    if (send_offset_ < send_buffer_.size()) {
+      uring_->Send(fd_, send_buffer_.data() + send_offset_, send_buffer_.size() - send_offset_, &send_op_);
+    } else {
+      send_buffer_.clear();
+      send_offset_ = 0;
+      Send();
+    }
+  }
+
+  if (!owner_) {
+    MaybeFinish();
+    return;
+  }
+  Dispatch();
+}
+
+base::io_result BasicSocket::Stream::Writev(const struct iovec* iov, int iovcnt) {
+  if (send_error_)
+    return base::io_result::os_error("send", send_error_);
+
+  std::size_t room = kSendBufferSize - std::min(buffered(), kSendBufferSize);
+  std::size_t total = 0;
+  for (int i = 0; i < iovcnt && total < room; ++i) {
+    const unsigned char* src = static_cast<const unsigned char*>(iov[i].iov_base);
+    std::size_t n = std::min(iov[i].iov_len, room - total);
+    send_queue_.insert(send_queue_.end(), src, src + n);
+    total += n;
+  }
+
+  Send();
+  return base::io_result::ok(total);
+}
+
+BasicSocket::BasicSocket(const Builder& opt, Family family, Watcher* watcher, bool completion)
     : loop_(opt.loop_), watcher_(base::borrow(watcher)),
-      resolve_timeout_ms_(opt.resolve_timeout_ms_), connect_timeout_ms_(opt.connect_timeout_ms_)
+      resolve_timeout_ms_(opt.resolve_timeout_ms_),
+      connect_timeout_ms_(opt.connect_timeout_ms_), connect_stagger_ms_(opt.connect_stagger_ms_),
+      keepalive_ms_(opt.keepalive_ms_), user_timeout_ms_(opt.user_timeout_ms_),
+      completion_(completion && opt.kind_ == Socket::STREAM)
 {
   if (family == INET) {
-    resolve_data_ = std::make_shared<ResolveData>(this, opt.host_, opt.port_, opt.kind_);
+    resolver_ = opt.resolver_ ? opt.resolver_ : Resolver::Default();
+    host_ = opt.host_;
+    port_ = opt.port_;
+    kind_ = opt.kind_;
   } else if (family == UNIX) {
     connect_addr_unix_ = std::make_unique<std::pair<struct sockaddr_un, struct addrinfo>>();
     struct sockaddr_un* addr = &connect_addr_unix_->first;
-    connect_addr_ = &connect_addr_unix_->second;
+    struct addrinfo* ai = &connect_addr_unix_->second;
 
     addr->sun_family = AF_UNIX;
     // TODO: deal gracefully with the case where input is too long [-Wstringop-truncation]
     std::strncpy(addr->sun_path, opt.unix_.c_str(), sizeof addr->sun_path);
 
-    connect_addr_->ai_family = AF_UNIX;
-    connect_addr_->ai_socktype = opt.kind_;
-    connect_addr_->ai_protocol = 0;
-    connect_addr_->ai_addrlen = sizeof (struct sockaddr_un);
-    connect_addr_->ai_addr = (struct sockaddr*) addr;
-    connect_addr_->ai_next = nullptr;
+    ai->ai_family = AF_UNIX;
+    ai->ai_socktype = opt.kind_;
+    ai->ai_protocol = 0;
+    ai->ai_addrlen = sizeof (struct sockaddr_un);
+    ai->ai_addr = (struct sockaddr*) addr;
+    ai->ai_next = nullptr;
   }
 }
 
-BasicSocket::BasicSocket(Loop* loop, int fd)
-    : loop_(loop), state_(kOpen), socket_(fd)
-{}
+BasicSocket::BasicSocket(Loop* loop, int fd, bool stream)
+    : loop_(loop), state_(kOpen), socket_(fd), completion_(stream)
+{
+  StartStream();
+}
 
 BasicSocket::~BasicSocket() {
-  if (resolve_data_) {
-    std::shared_ptr<ResolveData> data(std::move(resolve_data_));
-    std::unique_lock<std::mutex> lock(data->mutex);
-    data->socket = nullptr;
-  }
+  resolve_request_.reset();
 
   if (resolve_timer_)
     loop_->CancelTimer(resolve_timer_);
 
-  if (socket_ != -1) {
+  ConnectCancel();
+
+  if (stream_) {
+    stream_->Orphan();  // closes the descriptor when done
+  } else if (socket_ != -1) {
     loop_->ReadFd(socket_);
     loop_->WriteFd(socket_);
     close(socket_);
@@ -233,141 +556,203 @@ BasicSocket::~BasicSocket() {
 void BasicSocket::Start() {
   CHECK(state_ == kInitialized);
 
-  if (resolve_data_) {
-    LOG(DEBUG) << "resolving host: " << resolve_data_->host << ':' << resolve_data_->port;
+  if (resolver_) {
+    LOG(DEBUG) << "resolving host: " << host_ << ':' << port_;
     state_ = kResolving;
     resolve_timer_ = loop_->Delay(std::chrono::milliseconds(resolve_timeout_ms_), base::borrow(&resolve_timeout_callback_));
-    std::thread(&Resolve, resolve_data_).detach();
+    resolve_request_ = resolver_->Resolve(loop_, host_, port_, kind_, this);
   } else if (connect_addr_unix_) {
-    state_ = kConnecting;
-    Connect();
+    Connect(&connect_addr_unix_->second);
   } else {
     state_ = kFailed;
     watcher_.Call(&Watcher::ConnectionFailed, base::make_os_error("internal error"));
   }
 }
 
-void BasicSocket::Resolve(std::shared_ptr<ResolveData> data) {
-  struct addrinfo hints;
-  std::memset(&hints, 0, sizeof hints);
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = data->kind;
-  hints.ai_protocol = 0;
-  hints.ai_flags = AI_ADDRCONFIG;
-
-  struct addrinfo *addrs;
-  int ret = getaddrinfo(data->host.c_str(), data->port.c_str(), &hints, &addrs);
-  if (ret != 0) {
-    data->error = std::make_unique<addr_error>(ret);
-  } else if (!addrs) {
-    data->error = base::make_os_error("getaddrinfo: no addresses");
-  } else {
-    data->addrs = AddrinfoPtr(addrs);
-  }
-
-  std::unique_lock<std::mutex> lock(data->mutex);
-  if (!data->socket)
-    return;  // attempt abandoned
-  data->socket->resolved_callback_(0);
-}
-
-void BasicSocket::Resolved(long) {
+void BasicSocket::Resolved(Resolver::Addrs addrs, base::error_ptr error) {
   CHECK(state_ == kResolving);
 
-  connect_addr_inet_ = std::move(resolve_data_->addrs);
-  auto error = std::move(resolve_data_->error);
-  resolve_data_.reset();
+  resolve_request_.reset();
   loop_->CancelTimer(resolve_timer_);
   resolve_timer_ = event::kNoTimer;
 
-  if (!connect_addr_inet_) {
+  if (!addrs) {
     state_ = kFailed;
     watcher_.Call(&Watcher::ConnectionFailed, std::move(error));
     return;
   }
 
-  state_ = kConnecting;
-  connect_addr_ = connect_addr_inet_.get();
-  Connect();
+  connect_addr_inet_ = std::move(addrs);
+  Connect(connect_addr_inet_.get());
 }
 
 void BasicSocket::ResolveTimeout() {
   resolve_timer_ = event::kNoTimer;
-  {
-    std::shared_ptr<ResolveData> data(std::move(resolve_data_));
-    std::unique_lock<std::mutex> lock(data->mutex);
-    data->socket = nullptr;
-  }
+  resolve_request_.reset();
   state_ = kFailed;
   watcher_.Call(&Watcher::ConnectionFailed, base::make_os_error("name lookup timeout"));
 }
 
-void BasicSocket::Connect() {
-  CHECK(connect_addr_);
-  LOG(DEBUG) << "connecting to " << *connect_addr_;
+std::vector<const struct addrinfo*> InterleaveAddrs(const struct addrinfo* addrs) {
+  // Alternating the families means that if one of them is unreachable as a whole, it only delays
+  // every other attempt.
+  std::vector<const struct addrinfo*> primary, secondary;
+  for (const struct addrinfo* addr = addrs; addr; addr = addr->ai_next)
+    (addr->ai_family == addrs->ai_family ? primary : secondary).push_back(addr);
+
+  std::vector<const struct addrinfo*> ordered;
+  for (std::size_t i = 0; i < primary.size() || i < secondary.size(); ++i) {
+    if (i < primary.size())
+      ordered.push_back(primary[i]);
+    if (i < secondary.size())
+      ordered.push_back(secondary[i]);
+  }
+  return ordered;
+}
+
+void BasicSocket::Connect(const struct addrinfo* addrs) {
+  connect_addrs_ = InterleaveAddrs(addrs);
+  next_addr_ = 0;
 
-  socket_ = socket(connect_addr_->ai_family, connect_addr_->ai_socktype, connect_addr_->ai_protocol);
-  if (socket_ == -1) {
-    ConnectNext(base::make_os_error("socket", errno));
-    return;
+  state_ = kConnecting;
+  ConnectNext();
+}
+
+void BasicSocket::ConnectNext() {
+  if (stagger_timer_ != kNoTimer) {
+    loop_->CancelTimer(stagger_timer_);
+    stagger_timer_ = kNoTimer;
   }
-  if (fcntl(socket_, F_SETFL, O_NONBLOCK) == -1) {
-    ConnectNext(base::make_os_error("fcntl(O_NONBLOCK)", errno));
+
+  while (next_addr_ < connect_addrs_.size()) {
+    const struct addrinfo* addr = connect_addrs_[next_addr_++];
+    LOG(DEBUG) << "connecting to " << *addr;
+
+    int fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addr->ai_protocol);
+    if (fd == -1) {
+      connect_error_ = base::make_os_error("socket", errno);
+      continue;
+    }
+    if ((addr->ai_family == AF_INET || addr->ai_family == AF_INET6) && addr->ai_socktype == SOCK_STREAM)
+      SetTcpOptions(fd);
+
+    int ret = connect(fd, addr->ai_addr, addr->ai_addrlen);
+    if (ret == 0) {
+      // somehow connected immediately
+      ConnectDone(fd, addr);
+      return;
+    } else if (errno != EINPROGRESS) {
+      connect_error_ = base::make_os_error("connect", errno);
+      close(fd);
+      LOG(WARNING) << "connecting to " << *addr << " failed (" << *connect_error_ << ")";
+      continue;
+    }
+
+    // async connect started
+    attempts_.push_back(Attempt{fd, addr, loop_->now() + std::chrono::milliseconds(connect_timeout_ms_)});
+    loop_->WriteFd(fd, base::borrow(this));
+    if (attempts_.size() == 1)
+      ArmConnectTimer();
+    if (next_addr_ < connect_addrs_.size())
+      stagger_timer_ = loop_->Delay(std::chrono::milliseconds(connect_stagger_ms_), base::borrow(&connect_stagger_callback_));
     return;
   }
 
-  int ret = connect(socket_, connect_addr_->ai_addr, connect_addr_->ai_addrlen);
-  if (ret == -1 && errno == EINPROGRESS) {
-    // async connect started
-    loop_->WriteFd(socket_, base::borrow(this));
-    connect_timer_ = loop_->Delay(std::chrono::milliseconds(connect_timeout_ms_), base::borrow(&connect_timeout_callback_));
-  } else if (ret == 0) {
-    // somehow connected immediately
-    ConnectDone();
-  } else {
-    ConnectNext(base::make_os_error("connect", errno));
+  if (attempts_.empty()) {
+    connect_addrs_.clear();
+    connect_addr_inet_.reset();
+    connect_addr_unix_.reset();
+    state_ = kFailed;
+    watcher_.Call(&Watcher::ConnectionFailed, std::move(connect_error_));
   }
 }
 
-void BasicSocket::ConnectDone() {
-  LOG(DEBUG) << "connected to " << *connect_addr_;
+void BasicSocket::SetTcpOptions(int fd) {
+  auto set_option = [fd](int level, int name, int value, const char* what) {
+    if (setsockopt(fd, level, name, &value, sizeof value) == -1)
+      LOG(WARNING) << "failed to set socket option (" << *base::make_os_error(what, errno) << ")";
+  };
+  if (keepalive_ms_ > 0) {
+    int interval_s = (keepalive_ms_ + 999) / 1000;
+    set_option(SOL_SOCKET, SO_KEEPALIVE, 1, "setsockopt(SO_KEEPALIVE)");
+    set_option(IPPROTO_TCP, TCP_KEEPIDLE, interval_s, "setsockopt(TCP_KEEPIDLE)");
+    set_option(IPPROTO_TCP, TCP_KEEPINTVL, interval_s, "setsockopt(TCP_KEEPINTVL)");
+  }
+  if (user_timeout_ms_ > 0)
+    set_option(IPPROTO_TCP, TCP_USER_TIMEOUT, user_timeout_ms_, "setsockopt(TCP_USER_TIMEOUT)");
+}
 
+void BasicSocket::ConnectDone(int fd, const struct addrinfo* addr) {
+  LOG(DEBUG) << "connected to " << *addr;
+
+  ConnectCancel();
+  connect_addrs_.clear();
   connect_addr_inet_.reset();
   connect_addr_unix_.reset();
-  connect_addr_ = nullptr;
+  connect_error_.reset();
 
+  socket_ = fd;
   state_ = kOpen;
+  StartStream();
   watcher_.Call(&Watcher::ConnectionOpen);
 }
 
-void BasicSocket::ConnectTimeout() {
-  connect_timer_ = event::kNoTimer;
-  loop_->WriteFd(socket_);
-  ConnectNext(base::make_os_error("connect timed out"));
+void BasicSocket::StartStream() {
+  if (completion_ && loop_->uring())
+    stream_ = new Stream(this, loop_->uring(), socket_);
+}
+
+void BasicSocket::ConnectFailed(std::size_t i, base::error_ptr error) {
+  Attempt attempt = attempts_[i];
+  attempts_.erase(attempts_.begin() + i);
+  loop_->WriteFd(attempt.fd);
+  close(attempt.fd);
+  if (i == 0)
+    ArmConnectTimer();
+
+  LOG(WARNING) << "connecting to " << *attempt.addr << " failed (" << *error << ")";
+  connect_error_ = std::move(error);
+
+  // don't wait for the stagger delay if the previous attempt has already failed
+  ConnectNext();
 }
 
-void BasicSocket::ConnectNext(base::error_ptr error) {
+void BasicSocket::ConnectCancel() {
+  for (const Attempt& attempt : attempts_) {
+    loop_->WriteFd(attempt.fd);
+    close(attempt.fd);
+  }
+  attempts_.clear();
+
   if (connect_timer_ != kNoTimer) {
     loop_->CancelTimer(connect_timer_);
     connect_timer_ = kNoTimer;
   }
-
-  if (socket_ != -1) {
-    close(socket_);
-    socket_ = -1;
+  if (stagger_timer_ != kNoTimer) {
+    loop_->CancelTimer(stagger_timer_);
+    stagger_timer_ = kNoTimer;
   }
+}
 
-  if (connect_addr_->ai_next) {
-    LOG(WARNING)
-        << "connecting to " << *connect_addr_ << " failed (" << *error
-        << ") - trying next address";
-    connect_addr_ = connect_addr_->ai_next;
-    Connect();
-    return;
+void BasicSocket::ArmConnectTimer() {
+  if (connect_timer_ != kNoTimer) {
+    loop_->CancelTimer(connect_timer_);
+    connect_timer_ = kNoTimer;
   }
+  if (!attempts_.empty()) {
+    auto delay = std::max(attempts_.front().deadline - loop_->now(), TimerDuration::zero());
+    connect_timer_ = loop_->Delay(delay, base::borrow(&connect_timeout_callback_));
+  }
+}
 
-  state_ = kFailed;
-  watcher_.Call(&Watcher::ConnectionFailed, std::move(error));
+void BasicSocket::ConnectTimeout() {
+  connect_timer_ = event::kNoTimer;
+  ConnectFailed(0, base::make_os_error("connect timed out"));
+}
+
+void BasicSocket::ConnectStagger() {
+  stagger_timer_ = event::kNoTimer;
+  ConnectNext();
 }
 
 void BasicSocket::CanRead(int fd) {
@@ -378,31 +763,34 @@ void BasicSocket::CanRead(int fd) {
 }
 
 void BasicSocket::CanWrite(int fd) {
-  CHECK(fd == socket_);
   CHECK(state_ == kConnecting || state_ == kOpen);
 
   if (state_ == kConnecting) {
-    // async connect finished
+    // async connect finished for one of the attempts
 
-    loop_->WriteFd(socket_);
-    loop_->CancelTimer(connect_timer_);
-    connect_timer_ = event::kNoTimer;
+    auto attempt = std::find_if(attempts_.begin(), attempts_.end(), [fd](const Attempt& a) { return a.fd == fd; });
+    CHECK(attempt != attempts_.end());
+    std::size_t i = attempt - attempts_.begin();
 
     int error;
     socklen_t error_len = sizeof error;
 
-    if (getsockopt(socket_, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1) {
-      ConnectNext(base::make_os_error("getsockopt(SO_ERROR)", errno));
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1) {
+      ConnectFailed(i, base::make_os_error("getsockopt(SO_ERROR)", errno));
       return;
     } else if (error != 0) {
-      ConnectNext(base::make_os_error("connect", error));
+      ConnectFailed(i, base::make_os_error("connect", error));
       return;
     }
 
-    ConnectDone();
+    const struct addrinfo* addr = attempt->addr;
+    loop_->WriteFd(fd);
+    attempts_.erase(attempt);
+    ConnectDone(fd, addr);
     return;
   }
 
+  CHECK(fd == socket_);
   watcher_.Call(&Watcher::CanWrite);
 }
 
@@ -410,6 +798,12 @@ void BasicSocket::WantRead(bool enabled) {
   CHECK(state_ == kOpen);
   CHECK(!watcher_.empty());
 
+  if (stream_) {
+    read_requested_ = enabled;
+    stream_->Notify();
+    return;
+  }
+
   if (read_requested_ != enabled) {
     if (enabled)
       loop_->ReadFd(socket_, base::borrow(this));
@@ -423,6 +817,12 @@ void BasicSocket::WantWrite(bool enabled) {
   CHECK(state_ == kOpen);
   CHECK(!watcher_.empty());
 
+  if (stream_) {
+    write_requested_ = enabled;
+    stream_->Notify();
+    return;
+  }
+
   if (write_requested_ != enabled) {
     if (enabled)
       loop_->WriteFd(socket_, base::borrow(this));
@@ -435,6 +835,11 @@ void BasicSocket::WantWrite(bool enabled) {
 base::io_result BasicSocket::Read(void* buf, std::size_t count) {
   CHECK(state_ == kOpen);
 
+  if (stream_) {
+    struct iovec iov = { buf, count };
+    return stream_->Readv(&iov, 1);
+  }
+
   ssize_t ret = read(socket_, buf, count);
 
   if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
@@ -451,6 +856,11 @@ base::io_result BasicSocket::Read(void* buf, std::size_t count) {
 base::io_result BasicSocket::Write(const void* buf, std::size_t count) {
   CHECK(state_ == kOpen);
 
+  if (stream_) {
+    struct iovec iov = { const_cast<void*>(buf), count };
+    return stream_->Writev(&iov, 1);
+  }
+
   ssize_t ret = write(socket_, buf, count);
 
   if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
@@ -462,6 +872,42 @@ base::io_result BasicSocket::Write(const void* buf, std::size_t count) {
   return base::io_result::ok(ret);
 }
 
+base::io_result BasicSocket::Readv(const struct iovec* iov, int iovcnt) {
+  CHECK(state_ == kOpen);
+
+  if (stream_)
+    return stream_->Readv(iov, iovcnt);
+
+  ssize_t ret = readv(socket_, iov, iovcnt);
+
+  if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return base::io_result::ok(0);
+
+  if (ret == -1)
+    return base::io_result::os_error("readv", errno);
+  if (ret == 0)
+    return base::io_result::eof();
+
+  return base::io_result::ok(ret);
+}
+
+base::io_result BasicSocket::Writev(const struct iovec* iov, int iovcnt) {
+  CHECK(state_ == kOpen);
+
+  if (stream_)
+    return stream_->Writev(iov, iovcnt);
+
+  ssize_t ret = writev(socket_, iov, iovcnt);
+
+  if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return base::io_result::ok(0);  // can't write any data without blocking
+
+  if (ret == -1)
+    return base::io_result::os_error("writev", errno);
+
+  return base::io_result::ok(ret);
+}
+
 /**
  * BoringSSL TLS socket.
  */
@@ -480,6 +926,8 @@ class TlsSocket : public Socket, public Socket::Watcher {
   void WantWrite(bool enabled) override;
   base::io_result Read(void* buf, std::size_t count) override;
   base::io_result Write(const void* buf, std::size_t count) override;
+  base::io_result Readv(const struct iovec* iov, int iovcnt) override;
+  base::io_result Writev(const struct iovec* iov, int iovcnt) override;
 
   bool safe_to_read() const noexcept override {
     return pending_ != kWantReadForWrite && pending_ != kWantWriteForWrite;
@@ -498,8 +946,13 @@ class TlsSocket : public Socket, public Socket::Watcher {
     kWantWriteForWrite,
   };
 
+  /** Largest amount of data Writev() coalesces into a single `SSL_write` call: one TLS record. */
+  static constexpr std::size_t kWriteBatchSize = SSL3_RT_MAX_PLAIN_LENGTH;
+
   BasicSocket socket_;
   base::CallbackPtr<Socket::Watcher> watcher_;
+  /** Scratch buffer for Writev(). */
+  std::vector<unsigned char> write_batch_;
 
   bssl::UniquePtr<SSL_CTX> ssl_ctx_;
   bssl::UniquePtr<SSL> ssl_;
@@ -544,7 +997,8 @@ base::io_result tls_error_result(const char* what, int tls_code = SSL_ERROR_SSL,
 }
 
 TlsSocket::TlsSocket(const Socket::Builder& opt, BasicSocket::Family family, Socket::Watcher* watcher)
-    : socket_(opt, family, this), watcher_(base::borrow(watcher))
+    // SSL reads and writes the descriptor directly, so it must stay in readiness mode.
+    : socket_(opt, family, this, false), watcher_(base::borrow(watcher))
 {
   ssl_ctx_ = bssl::UniquePtr<SSL_CTX>(SSL_CTX_new(TLS_method()));
   SSL_CTX_set_mode(ssl_ctx_.get(), SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
@@ -663,6 +1117,55 @@ base::io_result TlsSocket::Write(const void* buf, std::size_t count) {
   return base::io_result::ok(ret);
 }
 
+base::io_result TlsSocket::Readv(const struct iovec* iov, int iovcnt) {
+  std::size_t total = 0;
+
+  for (int i = 0; i < iovcnt; ++i) {
+    if (iov[i].iov_len == 0)
+      continue;
+    // once some bytes have been read, only continue with data already decrypted by the library,
+    // so that the call never ends in a pending state after having returned data
+    if (total > 0 && SSL_pending(ssl_.get()) == 0)
+      break;
+
+    base::io_result got = Read(iov[i].iov_base, iov[i].iov_len);
+    if (!got.ok()) {
+      if (total > 0)
+        break;
+      return got;
+    }
+    total += got.size();
+    if (got.size() < iov[i].iov_len)
+      break;
+  }
+
+  return base::io_result::ok(total);
+}
+
+base::io_result TlsSocket::Writev(const struct iovec* iov, int iovcnt) {
+  while (iovcnt > 0 && iov->iov_len == 0) {
+    ++iov;
+    --iovcnt;
+  }
+  while (iovcnt > 0 && iov[iovcnt - 1].iov_len == 0)
+    --iovcnt;
+  if (iovcnt == 0)
+    return base::io_result::ok(0);
+  if (iovcnt == 1 || iov->iov_len >= kWriteBatchSize)
+    return Write(iov->iov_base, iov->iov_len);
+
+  // Coalesce up to one TLS record, to avoid sending a short record per buffer. The contents are
+  // a deterministic function of the buffers, so a retry with the same buffers will pass the same
+  // bytes to SSL_write, as required.
+  write_batch_.clear();
+  for (int i = 0; i < iovcnt && write_batch_.size() < kWriteBatchSize; ++i) {
+    auto* data = static_cast<const unsigned char*>(iov[i].iov_base);
+    std::size_t len = std::min(iov[i].iov_len, kWriteBatchSize - write_batch_.size());
+    write_batch_.insert(write_batch_.end(), data, data + len);
+  }
+  return Write(write_batch_.data(), write_batch_.size());
+}
+
 void TlsSocket::ConnectionOpen() {
   ssl_ = bssl::UniquePtr<SSL>(SSL_new(ssl_ctx_.get()));
   SSL_set_connect_state(ssl_.get());
@@ -766,68 +1269,190 @@ class BasicServerSocket : public ServerSocket, public FdReader {
       Loop* loop,
       Watcher* watcher,
       int domain, int type, int proto,
-      struct sockaddr* bind_addr, socklen_t bind_addr_len);
+      struct sockaddr* bind_addr, socklen_t bind_addr_len,
+      const ListenOptions& options);
 
   BasicServerSocket(Loop* loop, Watcher* watcher, int socket);
 
   ~BasicServerSocket();
 
+  int fd() const noexcept override { return socket_; }
   void CanRead(int fd) override;
 
  private:
+  /** Maximum number of connections accepted per readiness notification. */
+  static constexpr int kMaxAcceptBatch = 64;
+
+  /**
+   * Multishot accept request, used instead of readiness notifications if the loop provides
+   * Loop::uring().
+   *
+   * The request can still be in flight when the server socket is destroyed, so this is a separate
+   * object, handed over to the ring in that case.
+   */
+  struct Acceptor : public UringOp, public UringOrphan {
+    /** Server socket accepting the connections, or `nullptr` once it has been destroyed. */
+    BasicServerSocket* owner;
+    Uring* uring;
+    /** `true` if the request is in flight. */
+    bool armed = false;
+    /** `true` while the result is being handled, which might destroy the server socket. */
+    bool dispatching = false;
+
+    Acceptor(BasicServerSocket* o, Uring* u) : owner(o), uring(u) {}
+    void Completed(int res, unsigned flags) override;
+  };
+
   Loop* loop_;
   base::CallbackPtr<Watcher> watcher_;
   int socket_;
+  /** `true` if the accepted connections are stream sockets. */
+  bool stream_ = false;
+  /** Multishot accept request, if in use. */
+  Acceptor* acceptor_ = nullptr;
+  /** Cleared when the object is destroyed. CanRead() holds a reference, to notice if a callback did that. */
+  std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
+
+  /** Handles the result \p res of a multishot accept request. */
+  void AcceptDone(int res);
 };
 
 base::maybe_ptr<ServerSocket> BasicServerSocket::Create(
     Loop* loop,
     Watcher* watcher,
     int domain, int type, int proto,
-    struct sockaddr* bind_addr, socklen_t bind_addr_len)
+    struct sockaddr* bind_addr, socklen_t bind_addr_len,
+    const ListenOptions& options)
 {
-  int s = socket(domain, type, proto);
+  int s = socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, proto);
   if (s == -1)
     return base::maybe_os_error<ServerSocket>("socket", errno);
-  if (fcntl(s, F_SETFL, O_NONBLOCK) == -1) {
-    close(s);
-    return base::maybe_os_error<ServerSocket>("fcntl(O_NONBLOCK)", errno);
+
+  auto set_option = [s](int level, int name, int value, const char* what) -> base::error_ptr {
+    if (setsockopt(s, level, name, &value, sizeof value) == -1) {
+      close(s);
+      return base::make_os_error(what, errno);
+    }
+    return nullptr;
+  };
+  bool inet = domain == AF_INET || domain == AF_INET6;
+  if (inet) {
+    if (auto error = set_option(SOL_SOCKET, SO_REUSEADDR, 1, "setsockopt(SO_REUSEADDR)"))
+      return base::maybe_error<ServerSocket>(std::move(error));
+    if (options.reuse_port()) {
+      if (auto error = set_option(SOL_SOCKET, SO_REUSEPORT, 1, "setsockopt(SO_REUSEPORT)"))
+        return base::maybe_error<ServerSocket>(std::move(error));
+    }
+  }
+  if (domain == AF_INET6 && options.host().empty()) {
+    if (auto error = set_option(IPPROTO_IPV6, IPV6_V6ONLY, 0, "setsockopt(IPV6_V6ONLY)"))
+      return base::maybe_error<ServerSocket>(std::move(error));
   }
+
   if (bind(s, bind_addr, bind_addr_len) == -1) {
     close(s);
     return base::maybe_os_error<ServerSocket>("bind", errno);
   }
-  if (listen(s, SOMAXCONN) == -1) {
+  if (listen(s, options.backlog()) == -1) {
     close(s);
     return base::maybe_os_error<ServerSocket>("listen", errno);
   }
+
+  if (inet && options.defer_accept_s() > 0) {
+    if (auto error = set_option(IPPROTO_TCP, TCP_DEFER_ACCEPT, options.defer_accept_s(), "setsockopt(TCP_DEFER_ACCEPT)"))
+      return base::maybe_error<ServerSocket>(std::move(error));
+  }
+
   return base::maybe_ok<BasicServerSocket>(loop, watcher, s);
 }
 
 BasicServerSocket::BasicServerSocket(Loop* loop, Watcher* watcher, int socket)
     : loop_(loop), watcher_(base::borrow(watcher)), socket_(socket)
 {
-  loop->ReadFd(socket_, base::borrow(this));
+  int type;
+  socklen_t type_len = sizeof type;
+  if (getsockopt(socket_, SOL_SOCKET, SO_TYPE, &type, &type_len) == 0)
+    stream_ = type == SOCK_STREAM;
+
+  if (Uring* uring = loop->uring()) {
+    acceptor_ = new Acceptor(this, uring);
+    acceptor_->armed = true;
+    uring->AcceptMultishot(socket_, acceptor_);
+  } else {
+    loop->ReadFd(socket_, base::borrow(this));
+  }
 }
 
 BasicServerSocket::~BasicServerSocket() {
-  loop_->ReadFd(socket_);
+  *alive_ = false;
+
+  if (acceptor_) {
+    acceptor_->owner = nullptr;
+    acceptor_->uring->Adopt(acceptor_);
+    if (acceptor_->armed)
+      acceptor_->uring->Cancel(acceptor_);  // released by the final completion
+    else if (!acceptor_->dispatching)
+      acceptor_->uring->Release(acceptor_);
+  } else {
+    loop_->ReadFd(socket_);
+  }
   close(socket_);
 }
 
-void BasicServerSocket::CanRead(int fd) {
-  CHECK(fd == socket_);
-  int ret = accept(fd, nullptr, nullptr);
+void BasicServerSocket::Acceptor::Completed(int res, unsigned flags) {
+  if (!(flags & IORING_CQE_F_MORE))
+    armed = false;
 
-  if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
-    return;  // try again in the next loop
-  if (ret == -1) {
-    watcher_.Call(&Watcher::AcceptError, base::make_os_error("accept", errno));
+  if (owner) {
+    dispatching = true;
+    owner->AcceptDone(res);
+    dispatching = false;
+  } else if (res >= 0) {
+    close(res);  // accepted after the server socket was destroyed
+  }
+
+  if (!owner) {
+    if (!armed)
+      uring->Release(this);
+  } else if (!armed) {
+    // the kernel may end a multishot request (e.g., after an error); keep accepting
+    armed = true;
+    uring->AcceptMultishot(owner->socket_, this);
+  }
+}
+
+void BasicServerSocket::AcceptDone(int res) {
+  if (res >= 0) {
+    watcher_.Call(&Watcher::Accepted, std::make_unique<BasicSocket>(loop_, res, stream_));
     return;
   }
+  if (res == -ECANCELED || res == -EINTR || res == -ECONNABORTED || res == -EAGAIN)
+    return;
+  watcher_.Call(&Watcher::AcceptError, base::make_os_error("accept4", -res));
+}
 
-  auto new_socket = std::make_unique<BasicSocket>(loop_, ret);
-  watcher_.Call(&Watcher::Accepted, std::move(new_socket));
+void BasicServerSocket::CanRead(int fd) {
+  CHECK(fd == socket_);
+
+  std::shared_ptr<bool> alive = alive_;
+
+  for (int i = 0; i < kMaxAcceptBatch; ++i) {
+    int ret = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;  // backlog drained
+    if (ret == -1 && (errno == EINTR || errno == ECONNABORTED))
+      continue;
+    if (ret == -1) {
+      watcher_.Call(&Watcher::AcceptError, base::make_os_error("accept4", errno));
+      break;
+    }
+
+    auto new_socket = std::make_unique<BasicSocket>(loop_, ret, stream_);
+    watcher_.Call(&Watcher::Accepted, std::move(new_socket));
+    if (!*alive)
+      return;  // destroyed by the callback
+  }
 }
 
 } // namespace internal
@@ -864,8 +1489,47 @@ base::maybe_ptr<Socket> Socket::Builder::Build(Socket::Watcher* watcher) const {
   return base::maybe_ok<internal::BasicSocket>(*this, family, watcher);
 }
 
-base::maybe_ptr<ServerSocket> ListenInet(Loop* loop, ServerSocket::Watcher* watcher, int port) {
-  return base::maybe_error<ServerSocket>("TODO: ListenInet not implemented");
+base::maybe_ptr<ServerSocket> ListenInet(Loop* loop, ServerSocket::Watcher* watcher, int port, const ListenOptions& options) {
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+  struct addrinfo* addrs;
+  std::string port_str = std::to_string(port);
+  int ret = getaddrinfo(options.host().empty() ? nullptr : options.host().c_str(), port_str.c_str(), &hints, &addrs);
+  if (ret != 0)
+    return base::maybe_error<ServerSocket>(std::make_unique<internal::addr_error>(ret));
+  std::unique_ptr<struct addrinfo, decltype(&freeaddrinfo)> addrs_owner(addrs, &freeaddrinfo);
+
+  // For the wildcard address, prefer a dual-stack IPv6 socket, which also accepts IPv4 clients.
+  struct addrinfo* addr = addrs;
+  if (options.host().empty()) {
+    for (struct addrinfo* a = addrs; a; a = a->ai_next) {
+      if (a->ai_family == AF_INET6) {
+        addr = a;
+        break;
+      }
+    }
+  }
+
+  auto server = internal::BasicServerSocket::Create(
+      loop, watcher,
+      addr->ai_family, addr->ai_socktype, addr->ai_protocol,
+      addr->ai_addr, addr->ai_addrlen,
+      options);
+  if (!server.ok() && addr->ai_family == AF_INET6 && options.host().empty()) {
+    // IPv6 may be disabled: fall back to the first IPv4 address
+    for (struct addrinfo* a = addrs; a; a = a->ai_next) {
+      if (a->ai_family == AF_INET)
+        return internal::BasicServerSocket::Create(
+            loop, watcher,
+            a->ai_family, a->ai_socktype, a->ai_protocol,
+            a->ai_addr, a->ai_addrlen,
+            options);
+    }
+  }
+  return server;
 }
 
 base::maybe_ptr<ServerSocket> ListenUnix(Loop* loop, ServerSocket::Watcher* watcher, const std::string& path, Socket::Kind kind) {
@@ -882,7 +1546,13 @@ base::maybe_ptr<ServerSocket> ListenUnix(Loop* loop, ServerSocket::Watcher* watc
   return internal::BasicServerSocket::Create(
       loop, watcher,
       AF_UNIX, kind, 0,
-      (struct sockaddr*) &addr, sizeof addr);
+      (struct sockaddr*) &addr, sizeof addr,
+      ListenOptions());
+}
+
+base::maybe_ptr<ServerSocket> ListenFd(Loop* loop, ServerSocket::Watcher* watcher, int fd) {
+  return base::maybe_ok<internal::BasicServerSocket>(loop, watcher, fd);
 }
 
 } // namespace event
+
@@ -6,14 +6,20 @@
 #define EVENT_SOCKET_H_
 
 #include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "base/callback.h"
 #include "base/exc.h"
 #include "event/loop.h"
+#include "event/resolver.h"
 
 extern "C" {
+#include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 }
 
 namespace event {
@@ -97,9 +103,30 @@ struct Socket {
    * your mind afterwards. If the return value indicates that not all bytes were written, the next
    * time you call this method, you must pass in the same contents, to avoid unpredictable
    * behavior. Some of the bytes may already have been copied to the library data structures.
+   *
+   * A plain stream socket on a loop using Loop::Backend::kUring copies the bytes to a send buffer
+   * of the socket, which is sent asynchronously (even after the socket is destroyed). An error in
+   * sending is then only reported by a later call.
    */
   virtual base::io_result Write(const void* buf, std::size_t count) = 0;
 
+  /**
+   * Attempts to read from the socket into the \p iovcnt buffers of \p iov, like `readv(2)`.
+   *
+   * This behaves otherwise like #Read(), including the rules for TLS sockets. The buffers are
+   * filled in order, so that the two free regions of a base::ring_buffer (see
+   * base::ring_buffer::push_free_iov()) can be filled with a single call even when they wrap around.
+   */
+  virtual base::io_result Readv(const struct iovec* iov, int iovcnt) = 0;
+
+  /**
+   * Attempts to write the contents of the \p iovcnt buffers of \p iov to the socket, like `writev(2)`.
+   *
+   * This behaves otherwise like #Write(), including the rules for TLS sockets: if not all bytes
+   * were written, the next call must start with the same contents.
+   */
+  virtual base::io_result Writev(const struct iovec* iov, int iovcnt) = 0;
+
   /**
    * Returns `true` if it's okay to try reading from the socket.
    *
@@ -159,6 +186,14 @@ struct Socket::Watcher : public virtual base::Callback {
 namespace internal {
 class BasicSocket;
 class TlsSocket;
+
+/**
+ * Orders a `getaddrinfo(3)` result list for connection attempts.
+ *
+ * The address families are interleaved as in RFC 8305 (section 4), starting with the family of the
+ * first address; the order within each family is preserved.
+ */
+std::vector<const struct addrinfo*> InterleaveAddrs(const struct addrinfo* addrs);
 } // namespace internal
 
 /** Options to construct a socket. */
@@ -193,14 +228,38 @@ class Socket::Builder {
   Builder& client_cert(const std::string& v) { client_cert_ = v; return *this; }
   /** Sets the file name to read a client private key from. */
   Builder& client_key(const std::string& v) { client_key_ = v; return *this; }
+  /** Sets the resolver for host names. The default is the shared Resolver::Default(). */
+  Builder& resolver(Resolver* v) { resolver_ = v; return *this; }
   /** Overrides the default name resolution timeout. */
   Builder& resolve_timeout_ms(int v) { if (v) resolve_timeout_ms_ = v; return *this; }
   /** Overrides the default connect timeout. */
   Builder& connect_timeout_ms(int v) { if (v) connect_timeout_ms_ = v; return *this; }
+  /**
+   * Overrides the default delay before trying the next address in parallel.
+   *
+   * If a host name resolves to several addresses, connection attempts are started one after another
+   * (alternating between IPv6 and IPv4) without waiting for the previous ones to time out, as in
+   * RFC 8305 ("Happy Eyeballs"). A new attempt is started when this delay expires, or immediately
+   * if the previous one fails. The first connection to succeed is used, and the others are closed.
+   */
+  Builder& connect_stagger_ms(int v) { if (v) connect_stagger_ms_ = v; return *this; }
+  /**
+   * Enables TCP keepalive probes for an inet stream socket, once the connection has been idle for
+   * \p v milliseconds (rounded up to whole seconds), and at the same interval after that. Zero (the
+   * default) leaves keepalive off.
+   */
+  Builder& keepalive_ms(int v) { keepalive_ms_ = v; return *this; }
+  /**
+   * Sets the `TCP_USER_TIMEOUT` of an inet stream socket: how long sent data (or keepalive probes)
+   * may go unacknowledged before the connection is considered failed. Zero (the default) leaves the
+   * system default.
+   */
+  Builder& user_timeout_ms(int v) { user_timeout_ms_ = v; return *this; }
 
  private:
   static constexpr int kDefaultResolveTimeoutMs = 30000;
   static constexpr int kDefaultConnectTimeoutMs = 60000;
+  static constexpr int kDefaultConnectStaggerMs = 250;
 
   Loop* loop_ = nullptr;
   Socket::Watcher* watcher_ = nullptr;
@@ -208,11 +267,15 @@ class Socket::Builder {
   std::string port_ = "";
   std::string unix_ = "";
   Socket::Kind kind_ = Socket::STREAM;
+  Resolver* resolver_ = nullptr;
   bool tls_ = false;
   std::string client_cert_ = "";
   std::string client_key_ = "";
   int resolve_timeout_ms_ = kDefaultResolveTimeoutMs;
   int connect_timeout_ms_ = kDefaultConnectTimeoutMs;
+  int connect_stagger_ms_ = kDefaultConnectStaggerMs;
+  int keepalive_ms_ = 0;
+  int user_timeout_ms_ = 0;
 
   friend class internal::BasicSocket;
   friend class internal::TlsSocket;
@@ -224,6 +287,9 @@ struct ServerSocket {
   DISALLOW_COPY(ServerSocket);
   virtual ~ServerSocket() {}
 
+  /** Returns the listening socket descriptor, e.g. for sharing it with ListenFd(). */
+  virtual int fd() const noexcept = 0;
+
  protected:
   ServerSocket() {}
 };
@@ -247,10 +313,51 @@ struct ServerSocket::Watcher : public virtual base::Callback {
   virtual void AcceptError(base::error_ptr error) = 0;
 };
 
+/** Options for listening server sockets. */
+class ListenOptions {
+ public:
+  /** Sets the local address to bind to. By default, binds to all IPv4 and IPv6 addresses. */
+  ListenOptions& host(const std::string& v) { host_ = v; return *this; }
+  /** Gets the local address to bind to. */
+  const std::string& host() const noexcept { return host_; }
+  /** Sets the `listen(2)` backlog. The default is `SOMAXCONN`. */
+  ListenOptions& backlog(int v) { backlog_ = v; return *this; }
+  /** Gets the `listen(2)` backlog. */
+  int backlog() const noexcept { return backlog_; }
+  /**
+   * Enables `SO_REUSEPORT`, which lets several sockets (e.g., one per loop of a LoopGroup) bind the
+   * same port. The kernel then distributes new connections between them.
+   */
+  ListenOptions& reuse_port(bool v) { reuse_port_ = v; return *this; }
+  /** Gets whether `SO_REUSEPORT` is enabled. */
+  bool reuse_port() const noexcept { return reuse_port_; }
+  /**
+   * Enables `TCP_DEFER_ACCEPT`: connections are only reported as accepted once the client has sent
+   * some data, or \p v seconds have passed. 0 (the default) disables the option.
+   */
+  ListenOptions& defer_accept_s(int v) { defer_accept_s_ = v; return *this; }
+  /** Gets the `TCP_DEFER_ACCEPT` timeout. */
+  int defer_accept_s() const noexcept { return defer_accept_s_; }
+
+ private:
+  std::string host_ = "";
+  int backlog_ = SOMAXCONN;
+  bool reuse_port_ = false;
+  int defer_accept_s_ = 0;
+};
+
+/**
+ * Starts listening for TCP connections on \p port.
+ *
+ * On each readiness notification, the server socket accepts connections until the backlog is
+ * empty (or a batch limit is reached, to keep other descriptors of the loop from starving). On a
+ * loop using Loop::Backend::kUring, a multishot accept request is used instead.
+ */
 base::maybe_ptr<ServerSocket> ListenInet(
     Loop* loop,
     ServerSocket::Watcher* watcher,
-    int port);
+    int port,
+    const ListenOptions& options = ListenOptions());
 
 base::maybe_ptr<ServerSocket> ListenUnix(
     Loop* loop,
@@ -258,6 +365,19 @@ base::maybe_ptr<ServerSocket> ListenUnix(
     const std::string& path,
     Socket::Kind kind = Socket::STREAM);
 
+/**
+ * Starts accepting connections from an already listening socket \p fd.
+ *
+ * The returned object takes ownership of \p fd, which should be in non-blocking mode. This is
+ * mostly useful for sharing one listening socket between several loops (e.g., those of a
+ * LoopGroup): pass a `dup(2)` of ServerSocket::fd() for each. Each connection is accepted by one
+ * of them, and the resulting Socket is owned by that server socket's loop.
+ */
+base::maybe_ptr<ServerSocket> ListenFd(
+    Loop* loop,
+    ServerSocket::Watcher* watcher,
+    int fd);
+
 } // namespace event
 
 #endif // EVENT_SOCKET_H_
@@ -0,0 +1,447 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "event/loop.h"
+#include "event/resolver.h"
+#include "event/socket.h"
+#include "gtest/gtest.h"
+
+extern "C" {
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+}
+
+namespace event {
+
+struct AcceptCounter : public ServerSocket::Watcher {
+  std::vector<std::unique_ptr<Socket>> accepted;
+  std::unique_ptr<ServerSocket>* destroy_on_accept = nullptr;
+
+  void Accepted(std::unique_ptr<Socket> socket) override {
+    accepted.push_back(std::move(socket));
+    if (destroy_on_accept)
+      destroy_on_accept->reset();
+  }
+
+  void AcceptError(base::error_ptr error) override {
+    FAIL() << "accept error: " << *error;
+  }
+};
+
+int LocalPort(ServerSocket* server) {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof addr;
+  if (getsockname(server->fd(), (struct sockaddr*) &addr, &len) == -1)
+    return -1;
+  if (addr.ss_family == AF_INET6)
+    return ntohs(((struct sockaddr_in6*) &addr)->sin6_port);
+  return ntohs(((struct sockaddr_in*) &addr)->sin_port);
+}
+
+/** Returns a listening socket on a free local port, and stores the port in \p port. */
+int ListenLocal(int backlog, int* port) {
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof addr;
+  if (bind(s, (struct sockaddr*) &addr, sizeof addr) == -1 || listen(s, backlog) == -1
+      || getsockname(s, (struct sockaddr*) &addr, &len) == -1) {
+    close(s);
+    return -1;
+  }
+  *port = ntohs(addr.sin_port);
+  return s;
+}
+
+/** Returns the number of file descriptors open in this process. */
+int CountFds() {
+  int count = 0;
+  DIR* dir = opendir("/proc/self/fd");
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.')
+      ++count;
+  }
+  closedir(dir);
+  return count - 1;  // the directory itself
+}
+
+int ConnectLocal(int port) {
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(s, (struct sockaddr*) &addr, sizeof addr) == -1) {
+    close(s);
+    return -1;
+  }
+  return s;
+}
+
+struct ListenInetTest : public ::testing::TestWithParam<Loop::Backend> {
+  Loop loop{GetParam()};
+  AcceptCounter watcher;
+  std::vector<int> clients;
+
+  ~ListenInetTest() {
+    for (int s : clients)
+      close(s);
+  }
+
+  void Connect(int port, int count) {
+    for (int i = 0; i < count; ++i) {
+      int s = ConnectLocal(port);
+      ASSERT_NE(s, -1);
+      clients.push_back(s);
+    }
+  }
+};
+
+TEST_P(ListenInetTest, AcceptsBatch) {
+  auto server = ListenInet(&loop, &watcher, 0, ListenOptions().host("127.0.0.1"));
+  ASSERT_TRUE(server.ok()) << *server.error();
+  auto listener = server.ptr();
+  int port = LocalPort(listener.get());
+  ASSERT_GT(port, 0);
+
+  Connect(port, 5);
+  loop.Poll();
+  EXPECT_EQ(watcher.accepted.size(), 5);
+}
+
+TEST_P(ListenInetTest, DualStack) {
+  auto server = ListenInet(&loop, &watcher, 0);
+  ASSERT_TRUE(server.ok()) << *server.error();
+  auto listener = server.ptr();
+  int port = LocalPort(listener.get());
+  ASSERT_GT(port, 0);
+
+  Connect(port, 1);
+  loop.Poll();
+  EXPECT_EQ(watcher.accepted.size(), 1);
+}
+
+TEST_P(ListenInetTest, ReusePort) {
+  auto opts = ListenOptions().host("127.0.0.1").reuse_port(true);
+  auto first = ListenInet(&loop, &watcher, 0, opts);
+  ASSERT_TRUE(first.ok()) << *first.error();
+  auto first_listener = first.ptr();
+  int port = LocalPort(first_listener.get());
+  ASSERT_GT(port, 0);
+  auto second = ListenInet(&loop, &watcher, port, opts);
+  ASSERT_TRUE(second.ok()) << *second.error();
+  auto third = ListenInet(&loop, &watcher, port, ListenOptions().host("127.0.0.1"));
+  EXPECT_FALSE(third.ok());
+
+  Connect(port, 16);
+  loop.Poll();
+  EXPECT_EQ(watcher.accepted.size(), 16);
+}
+
+TEST_P(ListenInetTest, DestroyedInCallback) {
+  auto server = ListenInet(&loop, &watcher, 0, ListenOptions().host("127.0.0.1"));
+  ASSERT_TRUE(server.ok()) << *server.error();
+  std::unique_ptr<ServerSocket> owned = server.ptr();
+  int port = LocalPort(owned.get());
+  ASSERT_GT(port, 0);
+  watcher.destroy_on_accept = &owned;
+
+  Connect(port, 3);
+  loop.Poll();
+  EXPECT_EQ(watcher.accepted.size(), 1);
+  EXPECT_FALSE(owned);
+}
+
+struct ConnectTest : public ListenInetTest, public Socket::Watcher {
+  bool open = false;
+  std::string error;
+
+  void ConnectionOpen() override { open = true; }
+  void ConnectionFailed(base::error_ptr e) override { e->format(&error); }
+  void CanRead() override {}
+  void CanWrite() override {}
+
+  void RunUntilDone() {
+    for (int i = 0; i < 100 && !open && error.empty(); ++i)
+      loop.Poll();
+  }
+};
+
+TEST_P(ConnectTest, Connects) {
+  auto server = ListenInet(&loop, &watcher, 0, ListenOptions().host("127.0.0.1"));
+  ASSERT_TRUE(server.ok()) << *server.error();
+  auto listener = server.ptr();
+  int port = LocalPort(listener.get());
+
+  auto socket = Socket::Builder().loop(&loop).host("127.0.0.1").port(std::to_string(port)).Build(this);
+  ASSERT_TRUE(socket.ok()) << *socket.error();
+  auto client = socket.ptr();
+  client->Start();
+  RunUntilDone();
+
+  EXPECT_TRUE(open) << error;
+}
+
+TEST_P(ConnectTest, Refused) {
+  int port;
+  {
+    auto server = ListenInet(&loop, &watcher, 0, ListenOptions().host("127.0.0.1"));
+    ASSERT_TRUE(server.ok()) << *server.error();
+    port = LocalPort(server.ptr().get());
+  }
+
+  auto socket = Socket::Builder().loop(&loop).host("127.0.0.1").port(std::to_string(port)).Build(this);
+  ASSERT_TRUE(socket.ok()) << *socket.error();
+  auto client = socket.ptr();
+  client->Start();
+  RunUntilDone();
+
+  EXPECT_FALSE(open);
+  EXPECT_NE(error.find("connect"), std::string::npos) << error;
+}
+
+TEST_P(ConnectTest, HappyEyeballs) {
+  // A listening socket with a full accept queue drops incoming SYNs, so connecting to it hangs.
+  int blackhole_port, live_port;
+  int blackhole = ListenLocal(0, &blackhole_port);
+  ASSERT_NE(blackhole, -1);
+  int queued = ConnectLocal(blackhole_port);
+  ASSERT_NE(queued, -1);
+  int live = ListenLocal(16, &live_port);
+  ASSERT_NE(live, -1);
+  clients.insert(clients.end(), {blackhole, queued, live});
+
+  struct Addr {
+    struct addrinfo info;
+    struct sockaddr_in sin;
+  };
+  auto addrs = std::make_shared<std::vector<Addr>>(2);
+  int ports[2] = {blackhole_port, live_port};
+  for (int i = 0; i < 2; ++i) {
+    Addr& a = (*addrs)[i];
+    a.sin.sin_family = AF_INET;
+    a.sin.sin_port = htons(ports[i]);
+    a.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    a.info.ai_family = AF_INET;
+    a.info.ai_socktype = SOCK_STREAM;
+    a.info.ai_addr = (struct sockaddr*) &a.sin;
+    a.info.ai_addrlen = sizeof a.sin;
+    a.info.ai_next = i == 0 ? &(*addrs)[1].info : nullptr;
+  }
+  Resolver resolver(ResolverOptions().lookup(
+      [addrs](const std::string&, const std::string&, int, std::shared_ptr<const struct addrinfo>* result) {
+        *result = std::shared_ptr<const struct addrinfo>(addrs, &(*addrs)[0].info);
+        return 0;
+      }));
+
+  constexpr auto kStagger = std::chrono::milliseconds(200);
+  auto socket = Socket::Builder().loop(&loop).host("eyeballs.test").port("1").resolver(&resolver)
+      .connect_stagger_ms(kStagger.count()).connect_timeout_ms(10000).Build(this);
+  ASSERT_TRUE(socket.ok()) << *socket.error();
+  auto client = socket.ptr();
+
+  int fds = CountFds();
+  int max_fds = fds;
+  auto start = std::chrono::steady_clock::now();
+  client->Start();
+  for (int i = 0; i < 100 && !open && error.empty(); ++i) {
+    loop.Poll();
+    max_fds = std::max(max_fds, CountFds());
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  ASSERT_TRUE(open) << error;
+  // the second attempt started after the stagger delay, while the first one was still pending
+  EXPECT_GE(elapsed, kStagger);
+  EXPECT_LT(elapsed, kStagger + std::chrono::milliseconds(300));
+  EXPECT_EQ(max_fds, fds + 2);
+  // the blackholed attempt was closed, leaving only the winning connection
+  EXPECT_EQ(CountFds(), fds + 1);
+}
+
+/** Echoes everything received on an accepted socket back to the sender. */
+struct Echo : public Socket::Watcher {
+  std::unique_ptr<Socket> socket;
+  std::vector<char> pending;
+  bool eof = false;
+
+  void ConnectionOpen() override {}
+  void ConnectionFailed(base::error_ptr) override {}
+
+  void CanRead() override {
+    char buf[4096];
+    auto ret = socket->Read(buf, sizeof buf);
+    if (ret.at_eof()) {
+      eof = true;
+      socket->WantRead(false);
+      return;
+    }
+    ASSERT_TRUE(ret.ok()) << *ret.error();
+    pending.insert(pending.end(), buf, buf + ret.size());
+    Flush();
+  }
+
+  void CanWrite() override { Flush(); }
+
+  void Flush() {
+    if (!pending.empty()) {
+      auto ret = socket->Write(pending.data(), pending.size());
+      ASSERT_TRUE(ret.ok()) << *ret.error();
+      pending.erase(pending.begin(), pending.begin() + ret.size());
+    }
+    // stop reading while the peer isn't keeping up, like a real server would
+    socket->WantRead(pending.size() < 65536 && !eof);
+    socket->WantWrite(!pending.empty());
+  }
+};
+
+struct EchoTest : public ConnectTest {
+  Echo echo;
+  std::unique_ptr<ServerSocket> listener;
+  int port = 0;
+
+  void Listen() {
+    auto server = ListenInet(&loop, &watcher, 0, ListenOptions().host("127.0.0.1"));
+    ASSERT_TRUE(server.ok()) << *server.error();
+    listener = server.ptr();
+    port = LocalPort(listener.get());
+    ASSERT_GT(port, 0);
+  }
+
+  /** Runs the loop until a connection has been accepted, and starts echoing on it. */
+  void AcceptEcho() {
+    for (int i = 0; i < 100 && watcher.accepted.empty(); ++i)
+      loop.Poll();
+    ASSERT_EQ(watcher.accepted.size(), 1);
+    echo.socket = std::move(watcher.accepted[0]);
+    echo.socket->SetWatcher(&echo);
+    echo.socket->WantRead(true);
+  }
+
+  /** Runs one loop iteration, which returns within a millisecond even if nothing happens. */
+  void PollBriefly() {
+    loop.Delay(std::chrono::milliseconds(1), [](bool) {});
+    loop.Poll();
+  }
+};
+
+TEST_P(EchoTest, RoundTrip) {
+  Listen();
+  auto socket = Socket::Builder().loop(&loop).host("127.0.0.1").port(std::to_string(port)).Build(this);
+  ASSERT_TRUE(socket.ok()) << *socket.error();
+  auto client = socket.ptr();
+  client->Start();
+  RunUntilDone();
+  ASSERT_TRUE(open) << error;
+  AcceptEcho();
+
+  // large enough to fill the socket buffers and the registered receive buffers several times over
+  constexpr std::size_t kSize = 8 << 20;
+  std::vector<char> sent(kSize), received;
+  for (std::size_t i = 0; i < kSize; ++i)
+    sent[i] = (char) (i * 7 + i / 4096);
+
+  std::size_t written = 0;
+  for (int i = 0; i < 100000 && received.size() < kSize; ++i) {
+    if (written < kSize) {
+      auto ret = client->Write(sent.data() + written, kSize - written);
+      ASSERT_TRUE(ret.ok()) << *ret.error();
+      written += ret.size();
+    }
+    char buf[65536];
+    auto ret = client->Read(buf, sizeof buf);
+    ASSERT_TRUE(ret.ok()) << *ret.error();
+    received.insert(received.end(), buf, buf + ret.size());
+    PollBriefly();
+  }
+
+  ASSERT_EQ(received.size(), kSize);
+  EXPECT_TRUE(received == sent);
+}
+
+TEST_P(EchoTest, ReadsEof) {
+  Listen();
+  Connect(port, 1);
+  AcceptEcho();
+
+  ASSERT_EQ(write(clients[0], "hello", 5), 5);
+  shutdown(clients[0], SHUT_WR);
+  for (int i = 0; i < 100 && !echo.eof; ++i)
+    PollBriefly();
+  EXPECT_TRUE(echo.eof);
+
+  // the echo may only be sent by the next iteration
+  std::string got;
+  for (int i = 0; i < 100 && got.size() < 5; ++i) {
+    PollBriefly();
+    char buf[16];
+    ssize_t ret = recv(clients[0], buf, sizeof buf, MSG_DONTWAIT);
+    if (ret > 0)
+      got.append(buf, ret);
+  }
+  EXPECT_EQ(got, "hello");
+}
+
+TEST_P(EchoTest, SendsPendingDataAfterClose) {
+  Listen();
+  Connect(port, 1);
+  AcceptEcho();
+
+  // more than fits in the socket buffers right away, so some of it is still pending at the close
+  std::vector<char> data(1 << 20, 'x');
+  std::size_t written = 0;
+  for (int i = 0; i < 100 && written < data.size(); ++i) {
+    auto ret = echo.socket->Write(data.data() + written, data.size() - written);
+    ASSERT_TRUE(ret.ok()) << *ret.error();
+    written += ret.size();
+    if (written < data.size())
+      PollBriefly();
+  }
+  echo.socket.reset();
+
+  std::size_t got = 0;
+  for (int i = 0; i < 10000; ++i) {
+    PollBriefly();
+    char buf[65536];
+    ssize_t ret = recv(clients[0], buf, sizeof buf, MSG_DONTWAIT);
+    if (ret == 0)
+      break;
+    if (ret > 0)
+      got += ret;
+    else
+      ASSERT_EQ(errno, EAGAIN);
+  }
+  EXPECT_EQ(got, written);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Backends, ListenInetTest,
+    ::testing::Values(Loop::Backend::kEpoll, Loop::Backend::kUring));
+INSTANTIATE_TEST_SUITE_P(
+    Backends, ConnectTest,
+    ::testing::Values(Loop::Backend::kEpoll, Loop::Backend::kUring));
+INSTANTIATE_TEST_SUITE_P(
+    Backends, EchoTest,
+    ::testing::Values(Loop::Backend::kEpoll, Loop::Backend::kUring));
+
+TEST(InterleaveAddrsTest, AlternatesFamilies) {
+  struct addrinfo addrs[5] = {};
+  int families[5] = {AF_INET6, AF_INET6, AF_INET6, AF_INET, AF_INET};
+  for (int i = 0; i < 5; ++i) {
+    addrs[i].ai_family = families[i];
+    addrs[i].ai_next = i < 4 ? &addrs[i + 1] : nullptr;
+  }
+
+  std::vector<const struct addrinfo*> expected = {&addrs[0], &addrs[3], &addrs[1], &addrs[4], &addrs[2]};
+  EXPECT_EQ(internal::InterleaveAddrs(addrs), expected);
+  std::vector<const struct addrinfo*> tail = {&addrs[3], &addrs[4]};
+  EXPECT_EQ(internal::InterleaveAddrs(&addrs[3]), tail);
+}
+
+} // namespace event
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <memory>
 #include <vector>
 
@@ -7,12 +9,24 @@
 
 #include "base/exc.h"
 #include "base/log.h"
+#include "event/resolver.h"
 #include "irc/config.pb.h"
 #include "irc/bot/bot.h"
 #include "irc/bot/config.pb.h"
 
 namespace irc::bot::internal {
 
+namespace {
+
+/** Default interval for resynchronizing the channel membership of all channels. */
+constexpr auto kDefaultNamesResync = std::chrono::hours(1);
+/** Default limit for concurrent connection handshakes. */
+constexpr int kDefaultMaxHandshakes = 4;
+/** Default number of worker threads for asynchronous modules. */
+constexpr int kDefaultModuleThreads = 4;
+
+} // unnamed namespace
+
 BotCore::BotCore(event::Loop* loop) {
   if (loop) {
     loop_ = loop;
@@ -66,26 +80,69 @@ void BotCore::Start(const google::protobuf::Message& config) {
   if (irc_configs.empty())
     throw base::Exception("could not find any connection configurations");
 
+  std::chrono::seconds names_resync = kDefaultNamesResync;
+  int max_handshakes = kDefaultMaxHandshakes;
+  int module_threads = kDefaultModuleThreads;
   std::map<std::string, std::string> metric_labels;
   if (bot_config) {
+    if (bot_config->names_resync_s() != 0)
+      names_resync = std::chrono::seconds(std::max(bot_config->names_resync_s(), 0));
+    if (bot_config->max_handshakes() != 0)
+      max_handshakes = bot_config->max_handshakes();
+    if (bot_config->module_threads() > 0)
+      module_threads = bot_config->module_threads();
     if (!bot_config->metrics_addr().empty()) {
       metric_exposer_ = std::make_unique<prometheus::Exposer>(bot_config->metrics_addr());
       metric_registry_ = std::make_shared<prometheus::Registry>();
       metric_exposer_->RegisterCollectable(metric_registry_);
+      event::Resolver::Default()->ExportMetrics(metric_registry_);
     }
   }
 
+  if (max_handshakes > 0)
+    handshake_limiter_ = std::make_unique<irc::HandshakeLimiter>(loop_, max_handshakes);
+
   for (const irc::Config* irc_config : irc_configs) {
     prometheus::Registry *registry = metric_registry();
     if (registry)
       metric_labels["net"] = irc_config->net();
-    conns_.emplace_back(std::make_unique<BotConnection>(this, *irc_config, loop_, registry, metric_labels));
+    conns_.emplace_back(std::make_unique<BotConnection>(this, conns_.size(), *irc_config, loop_, names_resync, handshake_limiter_.get(), registry, metric_labels));
   }
 
+  std::vector<std::string> nets;
+  for (const auto& conn : conns_)
+    nets.push_back(conn->net_);
+  dispatch_ = DispatchIndex(std::move(nets));
+
+  prometheus::Family<prometheus::Counter>* metric_dropped = nullptr;
   for (const auto& module_config : module_configs) {
     auto module = (*module_config.first)(*module_config.second, this);
+    Module* subscriber = module.get();
+
+    AsyncOptions async = module->async();
+    if (async.enabled) {
+      if (!worker_pool_) {
+        worker_pool_ = std::make_unique<WorkerPool>(module_threads);
+        posted_send_ = std::make_unique<event::ClientPtr<PostedSend, BotCore, &BotCore::PostedSendReceived>>(loop_, this);
+      }
+      prometheus::Counter* dropped = nullptr;
+      if (prometheus::Registry* registry = metric_registry()) {
+        if (!metric_dropped) {
+          metric_dropped = &prometheus::BuildCounter()
+              .Name("irc_bot_module_dropped_messages")
+              .Help("How many messages were dropped because an asynchronous module couldn't keep up?")
+              .Register(*registry);
+        }
+        dropped = &metric_dropped->Add({{"module", module_config.second->GetDescriptor()->full_name()}});
+      }
+      async_modules_.push_back(std::make_unique<AsyncModule>(module.get(), worker_pool_.get(), async, dropped));
+      subscriber = async_modules_.back().get();
+    }
+
+    dispatch_.Add(subscriber, module->subscriptions());
     modules_.push_back(std::move(module));
   }
+  dispatch_.Build();
 }
 
 int BotCore::Run(const google::protobuf::Message& config) {
@@ -102,19 +159,21 @@ Connection* BotCore::conn(const std::string_view net) {
 }
 
 void BotCore::SendOn(BotConnection* conn, const irc::Message& msg) {
-  for (const auto& module : modules_)
-    module->MessageSent(conn, msg);
+  std::string_view target = msg.nargs() > 0 ? std::string_view(msg.arg(0)) : std::string_view();
+  dispatch_.Dispatch(Subscription::kSent, conn->index_, msg.command_id(), target, conn->irc_->casemap(),
+                     [conn, &msg](Module* module) { module->MessageSent(conn, msg); });
 
   conn->irc_->Send(msg);
 }
 
-void BotCore::ReceiveOn(BotConnection* conn, const irc::Message& msg) {
-  for (const auto& module : modules_)
-    module->MessageReceived(conn, msg);
+void BotCore::ReceiveOn(BotConnection* conn, const irc::MessageView& msg) {
+  std::string_view target = msg.nargs() > 0 ? msg.arg(0) : std::string_view();
+  dispatch_.Dispatch(Subscription::kReceived, conn->index_, msg.command_id(), target, conn->irc_->casemap(),
+                     [conn, &msg](Module* module) { module->MessageReceived(conn, msg); });
 
   if (LOG_ENABLED(DEBUG)) {
     std::string debug(msg.command());
-    for (const std::string& arg : msg.args()) {
+    for (std::string_view arg : msg.args()) {
       debug += ' ';
       debug += arg;
     }
@@ -122,82 +181,129 @@ void BotCore::ReceiveOn(BotConnection* conn, const irc::Message& msg) {
   }
 }
 
-BotConnection::BotConnection(BotCore* core, const irc::Config& cfg, event::Loop* loop, prometheus::Registry* metric_registry, const std::map<std::string, std::string>& metric_labels)
-    : core_(core), net_(cfg.net())
+void AsyncConnection::Send(const irc::Message& msg) {
+  (*conn_->core_->posted_send_)(std::make_unique<BotCore::PostedSend>(BotCore::PostedSend{conn_, msg}));
+}
+
+bool AsyncConnection::on_channel(const std::string_view nick, const std::string_view chan) {
+  throw base::Exception("on_channel is not available to asynchronous modules");
+}
+
+const std::string& AsyncConnection::net() {
+  return conn_->net_;
+}
+
+const irc::CaseMap& AsyncConnection::casemap() {
+  return *conn_->casemap_;
+}
+
+void AsyncModule::MessageReceived(Connection* conn, const irc::MessageView& message) {
+  Post([module = module_, conn = &static_cast<BotConnection*>(conn)->async_conn_, message = message.ToMessage()]() {
+    module->MessageReceived(conn, irc::MessageView(message));
+  });
+}
+
+void AsyncModule::MessageSent(Connection* conn, const irc::Message& message) {
+  Post([module = module_, conn = &static_cast<BotConnection*>(conn)->async_conn_, message]() {
+    module->MessageSent(conn, message);
+  });
+}
+
+BotConnection::BotConnection(BotCore* core, int index, const irc::Config& cfg, event::Loop* loop, std::chrono::seconds names_resync, irc::HandshakeLimiter* handshake_limiter, prometheus::Registry* metric_registry, const std::map<std::string, std::string>& metric_labels)
+    : core_(core), loop_(loop), index_(index), net_(cfg.net()), names_resync_(names_resync)
 {
   irc_ = std::make_unique<irc::Connection>(cfg, loop, metric_registry, metric_labels);
   irc_->AddReader(base::borrow(this));
+  irc_->set_handshake_limiter(handshake_limiter);
   irc_->Start();
 }
 
-bool BotConnection::on_channel(const std::string_view nick, const std::string_view chan) {
-  auto info = nicks_.find(nick);
-  return info != nicks_.end() && info->second->on_channel(chan);
-}
-
-void BotConnection::RawReceived(const irc::Message& msg) {
-  // TODO: implement periodic NAMES queries to handle desync
-
-  if (msg.command_is("JOIN") && msg.nargs() == 1 && !msg.prefix_nick().empty()) {
-    auto chan = &*chans_.emplace(msg.arg(0)).first;
-    TrackJoin(msg.prefix_nick(), chan);
-  } else if (msg.command_is("PART") && msg.nargs() >= 1 && !msg.prefix_nick().empty()) {
-    auto chan = &*chans_.emplace(msg.arg(0)).first;
-    TrackPart(msg.prefix_nick(), chan);
-  } else if (msg.command_is("KICK") && msg.nargs() >= 2) {
-    auto chan = &*chans_.emplace(msg.arg(0)).first;
-    TrackPart(msg.arg(1), chan);
-  } else if (msg.command_is("353") && msg.nargs() == 4) {
-    auto chan = &*chans_.emplace(msg.arg(2)).first;
-    std::string_view tail = msg.arg(3);
-    while (!tail.empty()) {
-      while (tail.find_last_of(" @+", 0) == 0)
-        tail.remove_prefix(1);
-      std::string_view nick_name = tail;
-      if (auto sep = nick_name.find(' '); sep != nick_name.npos)
-        nick_name = nick_name.substr(0, sep);
-      if (nick_name.empty())
-        break;
-      TrackJoin(nick_name, chan);
-      tail.remove_prefix(nick_name.size());
-    }
-  }
+BotConnection::~BotConnection() {
+  if (names_resync_timer_ != event::kNoTimer)
+    loop_->CancelTimer(names_resync_timer_);
+}
 
-  core_->ReceiveOn(this, msg);
+void BotConnection::ConnectionReady(const irc::Config::Server& server) {
+  if (names_resync_.count() > 0 && names_resync_timer_ == event::kNoTimer)
+    names_resync_timer_ = loop_->Delay(names_resync_, base::borrow(&names_resync_timer_callback_));
+}
 
-  if (msg.command_is("NICK") && msg.nargs() == 1 && !msg.prefix_nick().empty()) {
-    if (auto old = nicks_.find(msg.prefix_nick()); old != nicks_.end()) {
-      std::unique_ptr<Nick> nick = std::move(old->second);
-      nicks_.erase(old);
-      nick->name = msg.arg(0);
-      nicks_.emplace(nick->name, std::move(nick));
-    } else {
-      auto nick = std::make_unique<Nick>(msg.prefix_nick());
-      nicks_.emplace(nick->name, std::move(nick));
-    }
-  } else if (msg.command_is("QUIT") && !msg.prefix_nick().empty()) {
-    nicks_.erase(msg.prefix_nick());
+void BotConnection::ConnectionLost(const irc::Config::Server& server) {
+  members_.Clear();
+  names_resync_queue_.clear();
+  if (names_resync_timer_ != event::kNoTimer) {
+    loop_->CancelTimer(names_resync_timer_);
+    names_resync_timer_ = event::kNoTimer;
   }
 }
 
-void BotConnection::TrackJoin(const std::string_view nick_name, const std::string* chan) {
-  if (auto old = nicks_.find(nick_name); old != nicks_.end()) {
-    if (!old->second->on_channel(*chan))
-      old->second->chans.push_back(chan);
+void BotConnection::NamesResyncTimer() {
+  names_resync_timer_ = event::kNoTimer;
+
+  // query one channel at a time, spread evenly over the interval, so that a resync never floods
+  // the send queue ahead of real traffic
+
+  if (names_resync_queue_.empty()) {
+    names_resync_queue_ = members_.channels();
+    std::reverse(names_resync_queue_.begin(), names_resync_queue_.end());
   } else {
-    auto nick = std::make_unique<Nick>(nick_name);
-    nick->chans.push_back(chan);
-    nicks_.emplace(nick->name, std::move(nick));
+    irc_->Send({ "NAMES", names_resync_queue_.back() });
+    names_resync_queue_.pop_back();
   }
+
+  auto delay = names_resync_;
+  if (!names_resync_queue_.empty())
+    delay /= names_resync_queue_.size() + 1;
+  names_resync_timer_ = loop_->Delay(std::max(delay, std::chrono::seconds(1)), base::borrow(&names_resync_timer_callback_));
 }
 
-void BotConnection::TrackPart(const std::string_view nick_name, const std::string* chan) {
-  if (auto old = nicks_.find(nick_name); old != nicks_.end()) {
-    auto& nick_chans = old->second->chans;
-    if (auto ex = std::find(nick_chans.begin(), nick_chans.end(), chan); ex != nick_chans.end())
-      nick_chans.erase(ex);
-    if (nick_chans.empty())
-      nicks_.erase(old);
+void BotConnection::RawReceived(const irc::MessageView& msg) {
+  switch (msg.command_id()) {
+    case irc::Command::kJoin:
+      if (msg.nargs() >= 1 && !msg.prefix_nick().empty())
+        members_.Join(msg.prefix_nick(), msg.arg(0));
+      break;
+    case irc::Command::kPart:
+      if (msg.nargs() >= 1 && !msg.prefix_nick().empty()) {
+        if (is_self(msg.prefix_nick()))
+          members_.DropChannel(msg.arg(0));
+        else
+          members_.Part(msg.prefix_nick(), msg.arg(0));
+      }
+      break;
+    case irc::Command::kKick:
+      if (msg.nargs() >= 2) {
+        if (is_self(msg.arg(1)))
+          members_.DropChannel(msg.arg(0));
+        else
+          members_.Part(msg.arg(1), msg.arg(0));
+      }
+      break;
+    case irc::Command::kRplNamReply:
+      if (msg.nargs() == 4)
+        members_.AddNames(msg.arg(2), msg.arg(3));
+      break;
+    case irc::Command::kRplEndOfNames:
+      if (msg.nargs() >= 2)
+        members_.EndNames(msg.arg(1));
+      break;
+    default:
+      break;
+  }
+
+  core_->ReceiveOn(this, msg);
+
+  switch (msg.command_id()) {
+    case irc::Command::kNick:
+      if (msg.nargs() == 1 && !msg.prefix_nick().empty())
+        members_.Rename(msg.prefix_nick(), msg.arg(0));
+      break;
+    case irc::Command::kQuit:
+      if (!msg.prefix_nick().empty())
+        members_.Quit(msg.prefix_nick());
+      break;
+    default:
+      break;
   }
 }
 
@@ -5,26 +5,34 @@
 #ifndef IRC_BOT_BOT_H_
 #define IRC_BOT_BOT_H_
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
 
 #include <google/protobuf/message.h>
+#include <prometheus/counter.h>
 #include <prometheus/exposer.h>
 #include <prometheus/registry.h>
 
 #include "event/loop.h"
 #include "irc/bot/config.pb.h"
 #include "irc/connection.h"
+#include "irc/handshake_limiter.h"
 #include "irc/message.h"
+#include "irc/bot/dispatch.h"
+#include "irc/bot/membership.h"
 #include "irc/bot/module.h"
+#include "irc/bot/worker_pool.h"
 #include "proto/util.h"
 
 namespace irc::bot {
 
 namespace internal {
 
+class AsyncModule;
 class BotConnection;
 
 class BotCore : public ModuleHost {
@@ -45,8 +53,15 @@ class BotCore : public ModuleHost {
   prometheus::Registry* metric_registry() override { return metric_registry_.get(); }
 
  private:
+  /** Message sent by an asynchronous module, on its way to the loop thread. */
+  struct PostedSend {
+    BotConnection* conn;
+    irc::Message msg;
+  };
+
   void SendOn(BotConnection* conn, const irc::Message& msg);
-  void ReceiveOn(BotConnection* conn, const irc::Message& msg);
+  void ReceiveOn(BotConnection* conn, const irc::MessageView& msg);
+  void PostedSendReceived(std::unique_ptr<PostedSend> send) { SendOn(send->conn, send->msg); }
 
   std::unordered_map<std::string, ModuleFactory> module_registry_;
 
@@ -56,41 +71,107 @@ class BotCore : public ModuleHost {
   std::unique_ptr<prometheus::Exposer> metric_exposer_;
   std::shared_ptr<prometheus::Registry> metric_registry_;
 
+  std::unique_ptr<irc::HandshakeLimiter> handshake_limiter_;
   std::vector<std::unique_ptr<BotConnection>> conns_;
   std::vector<std::unique_ptr<Module>> modules_;
+  /** Modules subscribed to each message, with networks numbered as in #conns_. */
+  DispatchIndex dispatch_;
+
+  /** Worker threads of asynchronous modules, if there are any. */
+  std::unique_ptr<WorkerPool> worker_pool_;
+  std::unique_ptr<event::ClientPtr<PostedSend, BotCore, &BotCore::PostedSendReceived>> posted_send_;
+  /** Queues of the asynchronous modules, which stand in for them in #dispatch_. */
+  std::vector<std::unique_ptr<AsyncModule>> async_modules_;
 
+  friend class AsyncConnection;
   friend class BotConnection;
 };
 
+/** Stand-in for a BotConnection that asynchronous modules can use from a worker thread. */
+class AsyncConnection : public Connection {
+ public:
+  explicit AsyncConnection(BotConnection* conn) : conn_(conn) {}
+  // Connection
+  void Send(const irc::Message& msg) override;
+  bool on_channel(const std::string_view nick, const std::string_view chan) override;
+  const std::string& net() override;
+  const irc::CaseMap& casemap() override;
+
+ private:
+  BotConnection* conn_;
+};
+
+/** Adapter that queues the messages of a module for a worker thread. */
+class AsyncModule : public Module {
+ public:
+  AsyncModule(Module* module, WorkerPool* pool, const AsyncOptions& options, prometheus::Counter* metric_dropped)
+      : module_(module), queue_(pool, options.max_queued, options.overflow), metric_dropped_(metric_dropped)
+  {}
+  // Module
+  void MessageReceived(Connection* conn, const irc::MessageView& message) override;
+  void MessageSent(Connection* conn, const irc::Message& message) override;
+
+ private:
+  /** Queues \p task, counting any message dropped to make it fit. */
+  template <typename F>
+  void Post(F&& task) {
+    if (!queue_.Post(std::forward<F>(task)) && metric_dropped_)
+      metric_dropped_->Increment();
+  }
+
+  Module* module_;
+  WorkerPool::Queue queue_;
+  prometheus::Counter* metric_dropped_;
+};
+
 class BotConnection : public Connection, public irc::Connection::Reader {
  public:
-  BotConnection(BotCore* core, const irc::Config& cfg, event::Loop* loop, prometheus::Registry* metric_registry, const std::map<std::string, std::string>& metric_labels);
+  BotConnection(BotCore* core, int index, const irc::Config& cfg, event::Loop* loop, std::chrono::seconds names_resync, irc::HandshakeLimiter* handshake_limiter, prometheus::Registry* metric_registry, const std::map<std::string, std::string>& metric_labels);
+  ~BotConnection();
   // Connection
   void Send(const irc::Message& msg) override { core_->SendOn(this, msg); }
-  bool on_channel(const std::string_view nick, const std::string_view chan) override;
+  bool on_channel(const std::string_view nick, const std::string_view chan) override { return members_.on_channel(nick, chan); }
   const std::string& net() override { return net_; }
+  const irc::CaseMap& casemap() override { return *casemap_; }
   // irc::Connection::Reader
-  void RawReceived(const irc::Message& msg) override;
+  void RawReceived(const irc::MessageView& msg) override;
+  void ConnectionReady(const irc::Config::Server& server) override;
+  void ConnectionLost(const irc::Config::Server& server) override;
+  void NickChanged(const std::string& nick) override { nick_ = nick; }
+  void ChannelLeft(const std::string& channel) override { members_.DropChannel(channel); }
+  void CaseMappingChanged(const irc::CaseMap& casemap) override { members_.SetCaseMap(&casemap); casemap_ = &casemap; }
 
  private:
-  struct Nick {
-    Nick(const std::string_view n) : name(n) {}
-    bool on_channel(const std::string_view chan) { return std::find_if(chans.begin(), chans.end(), [chan](auto ch){ return *ch == chan; }) != chans.end(); }
-    std::string name;
-    std::vector<const std::string*> chans;
-  };
+  /** Sends a NAMES query for the next channel due to be resynchronized. */
+  void NamesResyncTimer();
+  /** Returns `true` if \p nick is our own nick. */
+  bool is_self(std::string_view nick) const { return irc_->casemap().Equal(nick, nick_); }
 
   BotCore* core_;
+  event::Loop* loop_;
 
-  void TrackJoin(const std::string_view nick_name, const std::string* chan);
-  void TrackPart(const std::string_view nick_name, const std::string* chan);
-
+  /** Position of this connection in BotCore::conns_. */
+  const int index_;
   const std::string net_;
-  std::unordered_map<std::string_view, std::unique_ptr<Nick>> nicks_;
-  std::unordered_set<std::string> chans_;
+  std::string nick_;
+  MembershipIndex members_;
+  /** Casemapping of the network. Atomic, for asynchronous modules. */
+  std::atomic<const irc::CaseMap*> casemap_{&irc::CaseMap::Get(irc::CaseMapping::kRfc1459)};
+
+  /** Interval in which every channel is queried once, or zero if disabled. */
+  const std::chrono::seconds names_resync_;
+  /** Channels still to be queried in the current resync round. */
+  std::vector<std::string> names_resync_queue_;
+  event::TimerId names_resync_timer_ = event::kNoTimer;
+  event::TimedM<BotConnection, &BotConnection::NamesResyncTimer> names_resync_timer_callback_{this};
 
   std::unique_ptr<irc::Connection> irc_;
 
+  /** What asynchronous modules get instead of this connection. */
+  AsyncConnection async_conn_{this};
+
+  friend class AsyncConnection;
+  friend class AsyncModule;
   friend class BotCore;
 };
 
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <string_view>
 
 #include "irc/bot/remote_service.brpc.h"
 #include "irc/bot/remote_service.pb.h"
@@ -19,14 +20,35 @@ struct CmdWatchReceiver : public RemoteServiceClient::WatchReceiver {
 };
 
 static int CmdWatch(RemoteServiceClient* client, int argc, char** argv) {
-  if (argc < 1) {
-    std::cerr << "usage: ... watch <net> [<net2> ...]\n";
+  auto recv = std::make_unique<CmdWatchReceiver>();
+  WatchRequest& req = recv->req;
+
+  int i = 0;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    std::string_view flag = argv[i];
+    if (flag == "--command")
+      req.add_commands(argv[i + 1]);
+    else if (flag == "--target")
+      req.add_targets(argv[i + 1]);
+    else if (flag == "--prefix")
+      req.add_prefixes(argv[i + 1]);
+    else if (flag == "--regex")
+      req.set_trailing_regex(argv[i + 1]);
+    else
+      break;
+  }
+  if (i >= argc || argv[i][0] == '-') {
+    std::cerr << "usage: ... watch [<flag> <value> ...] <net> [<net2> ...]\n";
+    std::cerr << "flags (each but --regex can be repeated, and a message must pass all kinds):\n";
+    std::cerr << "  --command <cmd>   only messages with the command (e.g., PRIVMSG, 001)\n";
+    std::cerr << "  --target <chan>   only messages with the first argument (e.g., a channel)\n";
+    std::cerr << "  --prefix <mask>   only messages from a prefix matching the mask (e.g., nick!*@*)\n";
+    std::cerr << "  --regex <re>      only messages whose last argument contains a match\n";
     return 1;
   }
 
-  auto recv = std::make_unique<CmdWatchReceiver>();
-  for (int i = 0; i < argc; i++)
-    recv->req.add_nets(argv[i]);
+  for (; i < argc; i++)
+    req.add_nets(argv[i]);
 
   client->Watch(base::own(std::move(recv)));
   return 0;
@@ -0,0 +1,70 @@
+#include <algorithm>
+
+#include "base/exc.h"
+#include "irc/bot/dispatch.h"
+
+namespace irc::bot {
+
+DispatchIndex::DispatchIndex(std::vector<std::string> nets) : nets_(std::move(nets)) {
+  Build();
+}
+
+void DispatchIndex::Add(Module* module, std::vector<Subscription> subscriptions) {
+  for (const auto& sub : subscriptions)
+    for (Command command : sub.commands)
+      if (static_cast<std::size_t>(command) >= kSlots)
+        throw base::Exception("can't subscribe to unknown commands");
+  modules_.emplace_back(module, std::move(subscriptions));
+}
+
+void DispatchIndex::Build() {
+  // number the commands anyone is interested in
+
+  std::vector<Command> named;
+  slots_.fill(0);
+  for (const auto& [module, subs] : modules_) {
+    for (const auto& sub : subs) {
+      for (Command command : sub.commands) {
+        auto& slot = slots_[static_cast<std::size_t>(command)];
+        if (slot == 0) {
+          named.push_back(command);
+          slot = named.size();
+        }
+      }
+    }
+  }
+  lists_ = named.size() + 1;
+
+  // fill in the lists of each direction and network in turn
+
+  offsets_.clear();
+  entries_.clear();
+  for (auto dir : { Subscription::kReceived, Subscription::kSent }) {
+    for (std::size_t net = 0; net < nets_.size(); ++net) {
+      for (std::size_t list = 0; list < lists_; ++list) {
+        offsets_.push_back(entries_.size());
+        for (const auto& [module, subs] : modules_) {
+          for (const auto& sub : subs) {
+            if (!(sub.direction & dir))
+              continue;
+            if (!sub.nets.empty() && std::find(sub.nets.begin(), sub.nets.end(), nets_[net]) == sub.nets.end())
+              continue;
+            if (!sub.commands.empty() && (list == 0 || std::find(sub.commands.begin(), sub.commands.end(), named[list - 1]) == sub.commands.end()))
+              continue;
+            entries_.push_back(Entry{module, sub.channels.empty() ? nullptr : &sub.channels});
+          }
+        }
+      }
+    }
+  }
+  offsets_.push_back(entries_.size());
+}
+
+bool DispatchIndex::MatchChannel(const std::vector<std::string>& channels, std::string_view target, const CaseMap& casemap) {
+  for (const auto& channel : channels)
+    if (casemap.Equal(channel, target))
+      return true;
+  return false;
+}
+
+} // namespace irc::bot
@@ -0,0 +1,100 @@
+/** \file
+ * Message dispatch index for bot modules.
+ */
+
+#ifndef IRC_BOT_DISPATCH_H_
+#define IRC_BOT_DISPATCH_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "base/common.h"
+#include "irc/bot/module.h"
+#include "irc/casemap.h"
+#include "irc/command.h"
+
+namespace irc::bot {
+
+/**
+ * Index from messages to the modules subscribed to them.
+ *
+ * Every command that is named by some subscription gets a list of subscribers per network and
+ * direction, which also includes the subscriptions to all commands, in the order the modules were
+ * added. The remaining commands share one more list, of just the subscriptions to all commands.
+ * Finding the list of a message is then an array lookup, and only the channel filters (if any) are
+ * left to check per subscriber.
+ */
+class DispatchIndex {
+ public:
+  /** Constructs an empty index for the networks \p nets, which are referred to by position. */
+  explicit DispatchIndex(std::vector<std::string> nets = {});
+  DISALLOW_COPY(DispatchIndex);
+  DispatchIndex(DispatchIndex&&) = default;
+  DispatchIndex& operator=(DispatchIndex&&) = default;
+
+  /** Adds the subscriptions of \p module. Takes effect after the next Build(). */
+  void Add(Module* module, std::vector<Subscription> subscriptions);
+  /** Rebuilds the lookup tables. */
+  void Build();
+
+  /**
+   * Calls \p deliver with each module subscribed to a message.
+   *
+   * The message was received from (if \p dir is Subscription::kReceived) or sent to (if it's
+   * Subscription::kSent) network number \p net, with the command \p command and first argument
+   * \p target (empty if none), which is compared with channel filters using \p casemap. Modules
+   * are delivered to in the order they were added, and at most once.
+   */
+  template <typename F>
+  void Dispatch(Subscription::Direction dir, int net, Command command, std::string_view target, const CaseMap& casemap, F&& deliver) const {
+    auto list = static_cast<std::size_t>(command) < slots_.size() ? slots_[static_cast<std::size_t>(command)] : std::uint16_t(0);
+    std::size_t at = (((dir == Subscription::kSent ? 1 : 0) * nets_.size() + net) * lists_) + list;
+    const Module* last = nullptr;
+    for (std::uint32_t i = offsets_[at], end = offsets_[at + 1]; i < end; ++i) {
+      const Entry& entry = entries_[i];
+      if (entry.module == last || (entry.channels && !MatchChannel(*entry.channels, target, casemap)))
+        continue;
+      last = entry.module;
+      deliver(entry.module);
+    }
+  }
+
+  /** Returns the number of modules added. */
+  std::size_t module_count() const noexcept { return modules_.size(); }
+
+ private:
+  /** Subscriber of one list: a module, plus its channel filter (`nullptr` if none). */
+  struct Entry {
+    Module* module;
+    const std::vector<std::string>* channels;
+  };
+
+  /** Returns `true` if \p target is one of \p channels under \p casemap. */
+  static bool MatchChannel(const std::vector<std::string>& channels, std::string_view target, const CaseMap& casemap);
+
+  /** Size of #slots_: covers numerics and known textual commands, with room to grow. */
+  static constexpr std::size_t kSlots = 2048;
+
+  std::vector<std::string> nets_;
+  /** Added modules with their subscriptions, in order. */
+  std::vector<std::pair<Module*, std::vector<Subscription>>> modules_;
+
+  /** List number of each command value; 0 is the list for commands nobody named. */
+  std::array<std::uint16_t, kSlots> slots_ = {};
+  /** Number of lists per network and direction. */
+  std::size_t lists_ = 1;
+  /** Start of each list in #entries_, indexed by direction, network and list number. */
+  std::vector<std::uint32_t> offsets_;
+  std::vector<Entry> entries_;
+};
+
+} // namespace irc::bot
+
+#endif // IRC_BOT_DISPATCH_H_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,121 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "irc/bot/dispatch.h"
+#include "irc/message.h"
+#include "benchmark/benchmark.h"
+
+namespace irc::bot {
+
+namespace {
+
+const CaseMap& kRfc1459 = CaseMap::Get(CaseMapping::kRfc1459);
+
+struct NullConnection : public Connection {
+  void Send(const Message& message) override {}
+  bool on_channel(const std::string_view nick, const std::string_view chan) override { return false; }
+  const std::string& net() override { return net_; }
+  const CaseMap& casemap() override { return kRfc1459; }
+  std::string net_ = "net";
+};
+
+/** A module interested in one command, which it checks for itself like modules used to. */
+struct CommandModule : public Module {
+  explicit CommandModule(Command command) : command(command) {}
+  void MessageReceived(Connection* conn, const MessageView& message) override {
+    if (command == Command::kUnknown || message.command_id() == command)
+      ++hits;
+  }
+  std::vector<Subscription> subscriptions() const override {
+    if (command == Command::kUnknown)
+      return {Subscription()};
+    Subscription sub;
+    sub.commands = {command};
+    return {sub};
+  }
+  Command command;
+  int hits = 0;
+};
+
+/**
+ * Returns \p count modules: the first one interested in everything (say, a remote control), a
+ * quarter of the rest in PRIVMSG, and the others in one of a few rarer commands.
+ */
+std::vector<std::unique_ptr<CommandModule>> MakeModules(int count) {
+  const Command rare[] = { Command::kKick, Command::kTopic, Command::kInvite, Command::kJoin, Command::kNick, Command::kPart };
+  std::vector<std::unique_ptr<CommandModule>> modules;
+  for (int i = 0; i < count; ++i)
+    modules.push_back(std::make_unique<CommandModule>(i == 0 ? Command::kUnknown : i % 4 == 1 ? Command::kPrivmsg : rare[i % 6]));
+  return modules;
+}
+
+/** Returns a mix of received lines, somewhat like a busy network: mostly chatter. */
+std::vector<std::string> MakeLines() {
+  std::vector<std::string> lines;
+  for (int i = 0; i < 64; ++i) {
+    std::string nick = ":user" + std::to_string(i) + "!u@host ";
+    std::string chan = "#channel" + std::to_string(i % 8);
+    switch (i % 8) {
+      case 0: lines.push_back(nick + "JOIN " + chan); break;
+      case 1: lines.push_back(nick + "QUIT :bye"); break;
+      case 2: lines.push_back("PING :server"); break;
+      case 3: lines.push_back(nick + "MODE " + chan + " +v user1"); break;
+      default: lines.push_back(nick + "PRIVMSG " + chan + " :hello there, how are things"); break;
+    }
+  }
+  return lines;
+}
+
+std::vector<MessageView> ParseLines(const std::vector<std::string>& lines) {
+  std::vector<MessageView> views(lines.size());
+  for (std::size_t i = 0; i < lines.size(); ++i)
+    views[i].Parse(lines[i].c_str());
+  return views;
+}
+
+} // unnamed namespace
+
+/** The previous dispatch: every line goes to every module. */
+void BM_DispatchAll(benchmark::State& state) {
+  auto modules = MakeModules(state.range(0));
+  auto lines = MakeLines();
+  auto views = ParseLines(lines);
+  NullConnection conn;
+
+  std::size_t i = 0;
+  for (auto _ : state) {
+    const MessageView& msg = views[i++ & 63];
+    for (const auto& module : modules)
+      module->MessageReceived(&conn, msg);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_DispatchAll)->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+/** Lines delivered through a DispatchIndex to the subscribed modules only. */
+void BM_DispatchIndexed(benchmark::State& state) {
+  auto modules = MakeModules(state.range(0));
+  auto lines = MakeLines();
+  auto views = ParseLines(lines);
+  NullConnection conn;
+
+  DispatchIndex index({"net"});
+  for (const auto& module : modules)
+    index.Add(module.get(), module->subscriptions());
+  index.Build();
+
+  std::size_t i = 0;
+  for (auto _ : state) {
+    const MessageView& msg = views[i++ & 63];
+    std::string_view target = msg.nargs() > 0 ? msg.arg(0) : std::string_view();
+    index.Dispatch(Subscription::kReceived, 0, msg.command_id(), target, kRfc1459,
+                   [&conn, &msg](Module* module) { module->MessageReceived(&conn, msg); });
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_DispatchIndexed)->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+} // namespace irc::bot
@@ -0,0 +1,85 @@
+#include <string>
+#include <vector>
+
+#include "base/exc.h"
+#include "irc/bot/dispatch.h"
+#include "gtest/gtest.h"
+
+namespace irc::bot {
+
+namespace {
+
+const CaseMap& kRfc1459 = CaseMap::Get(CaseMapping::kRfc1459);
+
+struct TestModule : public Module {};
+
+/** Returns the modules a message is delivered to. */
+std::vector<Module*> Deliver(const DispatchIndex& index, Subscription::Direction dir, int net, Command command, std::string_view target = "") {
+  std::vector<Module*> out;
+  index.Dispatch(dir, net, command, target, kRfc1459, [&out](Module* m) { out.push_back(m); });
+  return out;
+}
+
+Subscription Sub(std::vector<Command> commands, std::vector<std::string> nets = {}, std::vector<std::string> channels = {}) {
+  Subscription sub;
+  sub.commands = std::move(commands);
+  sub.nets = std::move(nets);
+  sub.channels = std::move(channels);
+  return sub;
+}
+
+} // unnamed namespace
+
+TEST(DispatchIndexTest, Commands) {
+  TestModule all, privmsg, join;
+  DispatchIndex index({"net"});
+  index.Add(&privmsg, {Sub({Command::kPrivmsg, Command::kNotice})});
+  index.Add(&all, all.subscriptions());
+  index.Add(&join, {Sub({Command::kJoin})});
+  index.Build();
+
+  using V = std::vector<Module*>;
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 0, Command::kPrivmsg), (V{&privmsg, &all}));
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 0, Command::kNotice), (V{&privmsg, &all}));
+  EXPECT_EQ(Deliver(index, Subscription::kSent, 0, Command::kJoin), (V{&all, &join}));
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 0, Command::kRplWelcome), V{&all});
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 0, Command::kUnknown), V{&all});
+
+  EXPECT_THROW(index.Add(&join, {Sub({Command::kUnknown})}), base::Exception);
+}
+
+TEST(DispatchIndexTest, Filters) {
+  TestModule a, b, c;
+  DispatchIndex index({"one", "two"});
+  index.Add(&a, {Sub({Command::kPrivmsg}, {"two"})});
+  index.Add(&b, {Sub({Command::kPrivmsg}, {}, {"#chan"})});
+  Subscription sent = Sub({});
+  sent.direction = Subscription::kSent;
+  index.Add(&c, {sent});
+  index.Build();
+
+  using V = std::vector<Module*>;
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 0, Command::kPrivmsg, "#other"), V{});
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 1, Command::kPrivmsg, "#other"), V{&a});
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 0, Command::kPrivmsg, "#CHAN"), V{&b});
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 1, Command::kPrivmsg, "#chan"), (V{&a, &b}));
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 0, Command::kPrivmsg), V{});
+  EXPECT_EQ(Deliver(index, Subscription::kSent, 0, Command::kPrivmsg, "#chan"), (V{&b, &c}));
+  EXPECT_EQ(Deliver(index, Subscription::kSent, 0, Command::kMode, "#chan"), V{&c});
+}
+
+TEST(DispatchIndexTest, DeliversOnce) {
+  TestModule a, b;
+  DispatchIndex index({"net"});
+  index.Add(&a, {Sub({Command::kPrivmsg}, {}, {"#a"}), Sub({Command::kPrivmsg, Command::kJoin}), Sub({})});
+  index.Add(&b, {});  // not interested in anything
+  index.Build();
+
+  using V = std::vector<Module*>;
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 0, Command::kPrivmsg, "#a"), V{&a});
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 0, Command::kPrivmsg, "#b"), V{&a});
+  EXPECT_EQ(Deliver(index, Subscription::kReceived, 0, Command::kPart), V{&a});
+  EXPECT_EQ(index.module_count(), 2);
+}
+
+} // namespace irc::bot
@@ -0,0 +1,419 @@
+#include <algorithm>
+
+#include "irc/bot/membership.h"
+
+namespace irc::bot {
+
+namespace {
+
+/** Membership prefixes that may precede a nick in a RPL_NAMREPLY (with `multi-prefix`, several). */
+constexpr std::string_view kNamesPrefixes = "~&@%+";
+
+/** Smallest hash table size. Must be a power of 2. */
+constexpr std::size_t kMinSlots = 16;
+
+template <typename T>
+void EraseValue(std::vector<T>* vec, T value) {
+  vec->erase(std::remove(vec->begin(), vec->end(), value), vec->end());
+}
+
+} // unnamed namespace
+
+// IdList
+
+MembershipIndex::IdList& MembershipIndex::IdList::operator=(IdList&& other) noexcept {
+  if (this != &other) {
+    Free();
+    Take(&other);
+  }
+  return *this;
+}
+
+bool MembershipIndex::IdList::contains(Id id) const noexcept {
+  return std::find(begin(), end(), id) != end();
+}
+
+void MembershipIndex::IdList::push_back(Id id) {
+  if (size_ == cap_) {
+    Id* grown = new Id[2 * cap_];
+    std::copy(begin(), end(), grown);
+    Free();
+    heap_ = grown;
+    cap_ *= 2;
+  }
+  data()[size_++] = id;
+}
+
+void MembershipIndex::IdList::erase(Id id) noexcept {
+  Id* ids = data();
+  for (Id i = 0; i < size_; ++i) {
+    if (ids[i] == id) {
+      ids[i] = ids[--size_];
+      return;
+    }
+  }
+}
+
+void MembershipIndex::IdList::Take(IdList* other) noexcept {
+  size_ = other->size_;
+  cap_ = other->cap_;
+  if (cap_ > kInline)
+    heap_ = other->heap_;
+  else
+    std::copy(other->inline_, other->inline_ + kInline, inline_);
+  other->size_ = 0;
+  other->cap_ = kInline;
+}
+
+// NameTable
+
+template <typename Info>
+bool MembershipIndex::NameTable::Find(const std::vector<Info>& infos, const CaseMap& casemap, std::string_view name, std::uint32_t hash, Id* id) const {
+  if (slots_.empty())
+    return false;
+  std::size_t mask = slots_.size() - 1;
+  for (std::size_t i = hash & mask; ; i = (i + 1) & mask) {
+    Id slot = slots_[i];
+    if (slot == kEmpty)
+      return false;
+    if (infos[slot].hash == hash && casemap.Equal(infos[slot].name, name)) {
+      *id = slot;
+      return true;
+    }
+  }
+}
+
+template <typename Info>
+void MembershipIndex::NameTable::Insert(const std::vector<Info>& infos, Id id) {
+  if (2 * (size_ + 1) > slots_.size()) {
+    std::vector<Id> old(std::max(kMinSlots, 2 * slots_.size()), kEmpty);
+    old.swap(slots_);
+    size_ = 0;
+    for (Id slot : old)
+      if (slot != kEmpty)
+        Insert(infos, slot);
+  }
+
+  std::size_t mask = slots_.size() - 1, i = infos[id].hash & mask;
+  while (slots_[i] != kEmpty)
+    i = (i + 1) & mask;
+  slots_[i] = id;
+  ++size_;
+}
+
+template <typename Info>
+void MembershipIndex::NameTable::Erase(const std::vector<Info>& infos, Id id) {
+  std::size_t mask = slots_.size() - 1, i = infos[id].hash & mask;
+  while (slots_[i] != id)
+    i = (i + 1) & mask;
+
+  // backward shift deletion: pull later entries of the probe run into the hole, unless their home
+  // slot lies cyclically after the hole (in which case moving them would make them unreachable)
+  for (std::size_t j = (i + 1) & mask; slots_[j] != kEmpty; j = (j + 1) & mask) {
+    std::size_t home = infos[slots_[j]].hash & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      slots_[i] = slots_[j];
+      i = j;
+    }
+  }
+  slots_[i] = kEmpty;
+  --size_;
+}
+
+// MembershipIndex
+
+MembershipIndex::MembershipIndex(const CaseMap* casemap) : casemap_(casemap) {}
+
+void MembershipIndex::SetCaseMap(const CaseMap* casemap) {
+  casemap_ = casemap;
+
+  // rehash all the live names, merging those that now collide into whichever has the lower ID
+
+  nick_ids_.clear();
+  for (Id dup = 0; dup < nicks_.size(); ++dup) {
+    NickInfo& info = nicks_[dup];
+    if (info.name.empty())
+      continue;
+    info.hash = casemap_->Hash(info.name);
+    Id keep;
+    if (!nick_ids_.Find(nicks_, *casemap_, info.name, info.hash, &keep)) {
+      nick_ids_.Insert(nicks_, dup);
+      continue;
+    }
+    IdList chans = std::move(info.chans);
+    for (Id chan : chans) {
+      ChannelInfo& chan_info = channels_[chan];
+      // the merged nick counts as listed in a NAMES reply in progress if either of them was
+      bool listed = chan_info.in_names && std::find(chan_info.listed.begin(), chan_info.listed.end(), dup) != chan_info.listed.end();
+      RemoveMember(&chan_info, dup);
+      Add(keep, chan);
+      if (listed)
+        chan_info.listed.push_back(keep);
+    }
+    nicks_[dup] = NickInfo();
+    free_nicks_.push_back(dup);
+  }
+
+  channel_ids_.clear();
+  for (Id dup = 0; dup < channels_.size(); ++dup) {
+    ChannelInfo& info = channels_[dup];
+    if (info.name.empty())
+      continue;
+    info.hash = casemap_->Hash(info.name);
+    Id keep;
+    if (!channel_ids_.Find(channels_, *casemap_, info.name, info.hash, &keep)) {
+      channel_ids_.Insert(channels_, dup);
+      continue;
+    }
+    // a NAMES reply in progress for either of them continues for the merged channel, with the
+    // nicks listed so far in both
+    ChannelInfo& keep_info = channels_[keep];
+    if (info.in_names && !keep_info.in_names) {
+      keep_info.in_names = true;
+      keep_info.listed.clear();
+    }
+    std::vector<Id> members = std::move(info.members);
+    for (Id nick : members) {
+      nicks_[nick].chans.erase(dup);
+      Add(nick, keep);
+    }
+    if (info.in_names)
+      keep_info.listed.insert(keep_info.listed.end(), info.listed.begin(), info.listed.end());
+    channels_[dup] = ChannelInfo();
+    free_channels_.push_back(dup);
+  }
+}
+
+void MembershipIndex::Join(std::string_view nick, std::string_view chan) {
+  Id nick_id = InternNick(nick), chan_id = InternChannel(chan);
+  Add(nick_id, chan_id);
+  if (ChannelInfo& info = channels_[chan_id]; info.in_names)
+    info.listed.push_back(nick_id);
+}
+
+void MembershipIndex::Part(std::string_view nick, std::string_view chan) {
+  Id nick_id, chan_id;
+  if (!FindNick(nick, &nick_id) || !FindChannel(chan, &chan_id))
+    return;
+  Remove(nick_id, chan_id);
+  MaybeFreeNick(nick_id);
+  MaybeFreeChannel(chan_id);
+}
+
+void MembershipIndex::Quit(std::string_view nick) {
+  Id nick_id;
+  if (!FindNick(nick, &nick_id))
+    return;
+  IdList chans = std::move(nicks_[nick_id].chans);
+  for (Id chan : chans) {
+    RemoveMember(&channels_[chan], nick_id);
+    MaybeFreeChannel(chan);
+  }
+  MaybeFreeNick(nick_id);
+}
+
+void MembershipIndex::Rename(std::string_view from, std::string_view to) {
+  Id nick_id, other_id;
+  if (!FindNick(from, &nick_id))
+    return;
+  if (!casemap_->Equal(from, to) && FindNick(to, &other_id))
+    Quit(to);  // stale entry, the server says the name was free
+
+  nick_ids_.Erase(nicks_, nick_id);
+  nicks_[nick_id].name = to;
+  nicks_[nick_id].hash = casemap_->Hash(to);
+  nick_ids_.Insert(nicks_, nick_id);
+}
+
+void MembershipIndex::DropChannel(std::string_view chan) {
+  Id chan_id;
+  if (!FindChannel(chan, &chan_id))
+    return;
+  ChannelInfo& info = channels_[chan_id];
+  std::vector<Id> members = std::move(info.members);
+  info.members.clear();
+  info.listed.clear();
+  info.in_names = false;
+  for (Id nick : members) {
+    nicks_[nick].chans.erase(chan_id);
+    MaybeFreeNick(nick);
+  }
+  MaybeFreeChannel(chan_id);
+}
+
+void MembershipIndex::Clear() {
+  nick_ids_.clear();
+  nicks_.clear();
+  free_nicks_.clear();
+  channel_ids_.clear();
+  channels_.clear();
+  free_channels_.clear();
+}
+
+void MembershipIndex::AddNames(std::string_view chan, std::string_view names) {
+  Id chan_id = InternChannel(chan);
+  if (!channels_[chan_id].in_names) {
+    channels_[chan_id].in_names = true;
+    channels_[chan_id].listed.clear();
+  }
+
+  while (!names.empty()) {
+    std::size_t end = names.find(' ');
+    std::string_view nick = names.substr(0, end);
+    names.remove_prefix(end == names.npos ? names.size() : end + 1);
+
+    nick.remove_prefix(std::min(nick.find_first_not_of(kNamesPrefixes), nick.size()));
+    nick = nick.substr(0, nick.find('!'));  // userhost-in-names
+    if (nick.empty())
+      continue;
+
+    Id nick_id = InternNick(nick);
+    Add(nick_id, chan_id);
+    channels_[chan_id].listed.push_back(nick_id);
+  }
+}
+
+void MembershipIndex::EndNames(std::string_view chan) {
+  Id chan_id;
+  if (!FindChannel(chan, &chan_id))
+    return;
+  ChannelInfo& info = channels_[chan_id];
+  if (!info.in_names) {
+    DropChannel(chan);  // nobody was listed
+    return;
+  }
+
+  // every listed nick was also added as a member, so the new member list is just the listed set;
+  // anyone else must have left without us noticing
+
+  std::sort(info.listed.begin(), info.listed.end());
+  info.listed.erase(std::unique(info.listed.begin(), info.listed.end()), info.listed.end());
+  std::sort(info.members.begin(), info.members.end());
+
+  auto listed = info.listed.begin();
+  for (Id nick : info.members) {
+    while (listed != info.listed.end() && *listed < nick)
+      ++listed;
+    if (listed != info.listed.end() && *listed == nick)
+      continue;
+    nicks_[nick].chans.erase(chan_id);
+    MaybeFreeNick(nick);
+  }
+
+  info.members.swap(info.listed);
+  info.members.shrink_to_fit();
+  std::vector<Id>().swap(info.listed);
+  info.in_names = false;
+  MaybeFreeChannel(chan_id);
+}
+
+bool MembershipIndex::on_channel(std::string_view nick, std::string_view chan) const {
+  Id nick_id, chan_id;
+  return FindNick(nick, &nick_id) && FindChannel(chan, &chan_id) && nicks_[nick_id].chans.contains(chan_id);
+}
+
+std::size_t MembershipIndex::member_count(std::string_view chan) const {
+  Id chan_id;
+  return FindChannel(chan, &chan_id) ? channels_[chan_id].members.size() : 0;
+}
+
+std::vector<std::string> MembershipIndex::channels() const {
+  std::vector<std::string> names;
+  names.reserve(channel_ids_.size());
+  for (const ChannelInfo& info : channels_)
+    if (!info.name.empty())
+      names.push_back(info.name);
+  return names;
+}
+
+MembershipIndex::Id MembershipIndex::InternNick(std::string_view nick) {
+  std::uint32_t hash = casemap_->Hash(nick);
+  Id id;
+  if (nick_ids_.Find(nicks_, *casemap_, nick, hash, &id))
+    return id;
+  if (!free_nicks_.empty()) {
+    id = free_nicks_.back();
+    free_nicks_.pop_back();
+  } else {
+    id = nicks_.size();
+    nicks_.emplace_back();
+  }
+  nicks_[id].name = nick;
+  nicks_[id].hash = hash;
+  nick_ids_.Insert(nicks_, id);
+  return id;
+}
+
+MembershipIndex::Id MembershipIndex::InternChannel(std::string_view chan) {
+  std::uint32_t hash = casemap_->Hash(chan);
+  Id id;
+  if (channel_ids_.Find(channels_, *casemap_, chan, hash, &id))
+    return id;
+  if (!free_channels_.empty()) {
+    id = free_channels_.back();
+    free_channels_.pop_back();
+  } else {
+    id = channels_.size();
+    channels_.emplace_back();
+  }
+  channels_[id].name = chan;
+  channels_[id].hash = hash;
+  channel_ids_.Insert(channels_, id);
+  return id;
+}
+
+bool MembershipIndex::FindNick(std::string_view nick, Id* id) const {
+  return nick_ids_.Find(nicks_, *casemap_, nick, casemap_->Hash(nick), id);
+}
+
+bool MembershipIndex::FindChannel(std::string_view chan, Id* id) const {
+  return channel_ids_.Find(channels_, *casemap_, chan, casemap_->Hash(chan), id);
+}
+
+void MembershipIndex::Add(Id nick, Id chan) {
+  IdList& chans = nicks_[nick].chans;
+  if (chans.contains(chan))
+    return;
+  chans.push_back(chan);
+
+  ChannelInfo& info = channels_[chan];
+  if (info.in_names)
+    info.members.push_back(nick);  // sorted at EndNames()
+  else
+    info.members.insert(std::lower_bound(info.members.begin(), info.members.end(), nick), nick);
+}
+
+void MembershipIndex::Remove(Id nick, Id chan) {
+  IdList& chans = nicks_[nick].chans;
+  if (!chans.contains(chan))
+    return;
+  chans.erase(chan);
+  RemoveMember(&channels_[chan], nick);
+}
+
+void MembershipIndex::RemoveMember(ChannelInfo* chan, Id nick) {
+  if (chan->in_names) {
+    EraseValue(&chan->members, nick);
+    EraseValue(&chan->listed, nick);
+  } else if (auto it = std::lower_bound(chan->members.begin(), chan->members.end(), nick); it != chan->members.end() && *it == nick) {
+    chan->members.erase(it);
+  }
+}
+
+void MembershipIndex::MaybeFreeNick(Id nick) {
+  if (!nicks_[nick].chans.empty())
+    return;
+  nick_ids_.Erase(nicks_, nick);
+  nicks_[nick] = NickInfo();
+  free_nicks_.push_back(nick);
+}
+
+void MembershipIndex::MaybeFreeChannel(Id chan) {
+  if (!channels_[chan].members.empty() || channels_[chan].in_names)
+    return;
+  channel_ids_.Erase(channels_, chan);
+  channels_[chan] = ChannelInfo();
+  free_channels_.push_back(chan);
+}
+
+} // namespace irc::bot
@@ -0,0 +1,199 @@
+/** \file
+ * Channel membership tracking.
+ */
+
+#ifndef IRC_BOT_MEMBERSHIP_H_
+#define IRC_BOT_MEMBERSHIP_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "base/common.h"
+#include "irc/casemap.h"
+
+namespace irc::bot {
+
+/**
+ * Index of which nicks are on which channels.
+ *
+ * Nicks and channels are interned into small integer IDs, which are recycled once a name is no
+ * longer referenced, and looked up through open-addressing tables of IDs. Each channel keeps a
+ * sorted vector of member nick IDs, and each nick a short (inline up to two) list of the channel
+ * IDs it's on, so a membership costs 8 bytes on top of about 64 bytes per nick. Lookups by name
+ * don't allocate.
+ *
+ * Channel member lists are replaced wholesale by NAMES replies: the nicks of all RPL_NAMREPLY (353)
+ * lines up to the RPL_ENDOFNAMES (366) are appended unsorted, and sorted and reconciled with the
+ * previous member list once at the end. This keeps both the initial burst when joining a large
+ * channel and periodic resyncs linearithmic in the size of the channel.
+ */
+class MembershipIndex {
+ public:
+  /** Constructs an empty index, comparing names using \p casemap. */
+  explicit MembershipIndex(const CaseMap* casemap = &CaseMap::Get(CaseMapping::kRfc1459));
+
+  DISALLOW_COPY(MembershipIndex);
+
+  /** Switches to different casemapping rules, merging any names that become equal. */
+  void SetCaseMap(const CaseMap* casemap);
+
+  /** Records that \p nick has joined \p chan. */
+  void Join(std::string_view nick, std::string_view chan);
+  /** Records that \p nick has left \p chan. */
+  void Part(std::string_view nick, std::string_view chan);
+  /** Records that \p nick has left all channels. */
+  void Quit(std::string_view nick);
+  /** Records a nick change from \p from to \p to. */
+  void Rename(std::string_view from, std::string_view to);
+  /** Forgets all members of \p chan, e.g., when we have left it ourselves. */
+  void DropChannel(std::string_view chan);
+  /** Forgets everything. */
+  void Clear();
+
+  /**
+   * Adds the space-separated nicks of a RPL_NAMREPLY trailing argument to \p chan, starting a NAMES
+   * reply for the channel if one isn't already in progress. Membership prefixes (`@`, `+` and so
+   * on) are ignored.
+   */
+  void AddNames(std::string_view chan, std::string_view names);
+  /**
+   * Completes a NAMES reply (RPL_ENDOFNAMES). Members of \p chan that were neither listed in the
+   * reply nor joined while it was in progress are removed.
+   */
+  void EndNames(std::string_view chan);
+
+  /** Returns `true` if \p nick is known to be on \p chan. */
+  bool on_channel(std::string_view nick, std::string_view chan) const;
+
+  /** Returns the number of distinct nicks tracked. */
+  std::size_t nick_count() const { return nick_ids_.size(); }
+  /** Returns the number of channels tracked. */
+  std::size_t channel_count() const { return channel_ids_.size(); }
+  /** Returns the number of known members of \p chan. */
+  std::size_t member_count(std::string_view chan) const;
+  /** Returns the names of all tracked channels. */
+  std::vector<std::string> channels() const;
+
+ private:
+  using Id = std::uint32_t;
+
+  /** Unordered list of IDs, stored inline while short. Most nicks are only on a channel or two. */
+  class IdList {
+   public:
+    IdList() noexcept {}
+    IdList(IdList&& other) noexcept { Take(&other); }
+    IdList& operator=(IdList&& other) noexcept;
+    DISALLOW_COPY(IdList);
+    ~IdList() { Free(); }
+
+    const Id* begin() const noexcept { return data(); }
+    const Id* end() const noexcept { return data() + size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    bool contains(Id id) const noexcept;
+
+    void push_back(Id id);
+    /** Removes \p id if present. Doesn't preserve order. */
+    void erase(Id id) noexcept;
+    void clear() noexcept { Free(); size_ = 0; cap_ = kInline; }
+
+   private:
+    static constexpr Id kInline = 2;
+
+    const Id* data() const noexcept { return cap_ > kInline ? heap_ : inline_; }
+    Id* data() noexcept { return cap_ > kInline ? heap_ : inline_; }
+    void Take(IdList* other) noexcept;
+    void Free() noexcept { if (cap_ > kInline) delete[] heap_; }
+
+    Id size_ = 0;
+    Id cap_ = kInline;
+    union {
+      Id inline_[kInline];
+      Id* heap_;
+    };
+  };
+
+  /** Open-addressing hash table from names to the IDs of the records (in a vector) holding them. */
+  class NameTable {
+   public:
+    /** Looks up \p name with hash \p hash. Returns `false` if not found. */
+    template <typename Info>
+    bool Find(const std::vector<Info>& infos, const CaseMap& casemap, std::string_view name, std::uint32_t hash, Id* id) const;
+    /** Adds record \p id, which must not be in the table. */
+    template <typename Info>
+    void Insert(const std::vector<Info>& infos, Id id);
+    /** Removes record \p id, which must be in the table. */
+    template <typename Info>
+    void Erase(const std::vector<Info>& infos, Id id);
+
+    std::size_t size() const noexcept { return size_; }
+    void clear() noexcept { slots_.clear(); size_ = 0; }
+
+   private:
+    static constexpr Id kEmpty = ~Id(0);
+
+    std::vector<Id> slots_;
+    std::size_t size_ = 0;
+  };
+
+  struct NickInfo {
+    /** Nick name. Empty for a free ID. */
+    std::string name;
+    /** Hash of #name under the current casemap. */
+    std::uint32_t hash = 0;
+    /** Channels the nick is on. */
+    IdList chans;
+  };
+
+  struct ChannelInfo {
+    /** Channel name. Empty for a free ID. */
+    std::string name;
+    /** Hash of #name under the current casemap. */
+    std::uint32_t hash = 0;
+    /** `true` if a NAMES reply is in progress. */
+    bool in_names = false;
+    /** Member nick IDs. Sorted, except for a tail appended while a NAMES reply is in progress. */
+    std::vector<Id> members;
+    /** Nick IDs listed or joined during an in-progress NAMES reply, unsorted. */
+    std::vector<Id> listed;
+  };
+
+  /** Returns the ID of \p nick, interning it if necessary. */
+  Id InternNick(std::string_view nick);
+  /** Returns the ID of \p chan, interning it if necessary. */
+  Id InternChannel(std::string_view chan);
+  /** Looks up the ID of \p nick. Returns `false` if not known. */
+  bool FindNick(std::string_view nick, Id* id) const;
+  /** Looks up the ID of \p chan. Returns `false` if not known. */
+  bool FindChannel(std::string_view chan, Id* id) const;
+
+  /** Adds the membership (nick, chan) if it doesn't exist yet. */
+  void Add(Id nick, Id chan);
+  /** Removes the membership (nick, chan) if it exists. */
+  void Remove(Id nick, Id chan);
+  /** Removes \p nick from the member lists of \p chan, but not the channel from the nick. */
+  void RemoveMember(ChannelInfo* chan, Id nick);
+  /** Releases a nick ID if it's not on any channel. */
+  void MaybeFreeNick(Id nick);
+  /** Releases a channel ID if it has no members and no NAMES reply is in progress. */
+  void MaybeFreeChannel(Id chan);
+
+  const CaseMap* casemap_;
+
+  NameTable nick_ids_;
+  std::vector<NickInfo> nicks_;
+  std::vector<Id> free_nicks_;
+
+  NameTable channel_ids_;
+  std::vector<ChannelInfo> channels_;
+  std::vector<Id> free_channels_;
+};
+
+} // namespace irc::bot
+
+#endif // IRC_BOT_MEMBERSHIP_H_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "irc/bot/membership.h"
+#include "benchmark/benchmark.h"
+
+extern "C" {
+#include <malloc.h>
+}
+
+namespace {
+
+/**
+ * Bytes currently allocated from malloc, including its per-chunk overhead.
+ *
+ * Measured with `mallinfo2()` rather than by replacing the global allocation operators, so that
+ * every allocation path is covered. The benchmarks are single-threaded, so deltas are exact.
+ */
+std::size_t live_bytes() {
+  return mallinfo2().uordblks;
+}
+
+} // unnamed namespace
+
+namespace irc::bot {
+
+namespace {
+
+/** The previous BotConnection layout: a heap object per nick, holding pointers to channel names. */
+class LegacyIndex {
+ public:
+  void AddNames(std::string_view chan_name, std::string_view names) {
+    const std::string* chan = &*chans_.emplace(chan_name).first;
+    while (!names.empty()) {
+      std::size_t end = names.find(' ');
+      std::string_view nick_name = names.substr(0, end);
+      names.remove_prefix(end == names.npos ? names.size() : end + 1);
+      if (auto old = nicks_.find(nick_name); old != nicks_.end()) {
+        if (std::find(old->second->chans.begin(), old->second->chans.end(), chan) == old->second->chans.end())
+          old->second->chans.push_back(chan);
+      } else {
+        auto nick = std::make_unique<Nick>(nick_name);
+        nick->chans.push_back(chan);
+        nicks_.emplace(nick->name, std::move(nick));
+      }
+    }
+  }
+  void EndNames(std::string_view) {}
+
+  bool on_channel(std::string_view nick, std::string_view chan) const {
+    auto info = nicks_.find(nick);
+    if (info == nicks_.end())
+      return false;
+    auto chan_info = chans_.find(std::string(chan));
+    return chan_info != chans_.end() && std::find(info->second->chans.begin(), info->second->chans.end(), &*chan_info) != info->second->chans.end();
+  }
+
+ private:
+  struct Nick {
+    explicit Nick(std::string_view n) : name(n) {}
+    std::string name;
+    std::vector<const std::string*> chans;
+  };
+
+  const CaseMap* casemap_ = &CaseMap::Get(CaseMapping::kRfc1459);
+  CaseMap::Map<std::string_view, std::unique_ptr<Nick>> nicks_ = casemap_->MakeMap<std::string_view, std::unique_ptr<Nick>>();
+  CaseMap::Set<std::string> chans_ = casemap_->MakeSet<std::string>();
+};
+
+/** Number of channels the members are spread over; every nick is on two of them. */
+constexpr int kChannels = 8;
+
+/** Builds RPL_NAMREPLY payloads listing \p members nicks, each on two of the #kChannels channels. */
+std::vector<std::pair<std::string, std::string>> MakeNames(int members) {
+  std::vector<std::pair<std::string, std::string>> lines;
+  for (int c = 0; c < kChannels; ++c) {
+    std::string chan = "#channel" + std::to_string(c), line;
+    for (int i = 0; i < members; ++i) {
+      if (i % (kChannels / 2) != c % (kChannels / 2))
+        continue;
+      if (line.size() > 400) {
+        lines.emplace_back(chan, std::move(line));
+        line.clear();
+      }
+      if (!line.empty())
+        line += ' ';
+      line += (i % 10 == 0 ? "@user" : "user") + std::to_string(i);
+    }
+    lines.emplace_back(chan, std::move(line));
+  }
+  return lines;
+}
+
+template <typename Index>
+void Load(Index* index, const std::vector<std::pair<std::string, std::string>>& names) {
+  for (const auto& [chan, line] : names)
+    index->AddNames(chan, line);
+  for (int c = 0; c < kChannels; ++c)
+    index->EndNames("#channel" + std::to_string(c));
+}
+
+} // unnamed namespace
+
+/** Loads a full set of NAMES replies into an empty index, reporting the retained bytes per membership. */
+template <typename Index>
+void BM_NamesBurst(benchmark::State& state) {
+  int members = state.range(0);
+  auto names = MakeNames(members);
+
+  std::size_t retained = 0;
+  for (auto _ : state) {
+    std::size_t before = live_bytes();
+    auto index = std::make_unique<Index>();
+    Load(index.get(), names);
+    retained = live_bytes() - before;
+    state.PauseTiming();
+    index.reset();
+    state.ResumeTiming();
+  }
+
+  // every nick is on two channels
+  state.SetItemsProcessed(state.iterations() * members * 2);
+  state.counters["bytes_per_member"] = static_cast<double>(retained) / (members * 2);
+}
+
+BENCHMARK_TEMPLATE(BM_NamesBurst, LegacyIndex)->Arg(1000)->Arg(50000);
+BENCHMARK_TEMPLATE(BM_NamesBurst, MembershipIndex)->Arg(1000)->Arg(50000);
+
+/** Membership queries against a loaded index, half of them for channels the nick is not on. */
+template <typename Index>
+void BM_OnChannel(benchmark::State& state) {
+  int members = state.range(0);
+  Index index;
+  Load(&index, MakeNames(members));
+
+  std::vector<std::pair<std::string, std::string>> queries;
+  for (int i = 0; i < 1024; ++i) {
+    int n = i * 7919 % members;
+    queries.emplace_back("user" + std::to_string(n), "#channel" + std::to_string(i % kChannels));
+  }
+
+  std::size_t i = 0;
+  for (auto _ : state) {
+    const auto& [nick, chan] = queries[i++ & 1023];
+    benchmark::DoNotOptimize(index.on_channel(nick, chan));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_OnChannel, LegacyIndex)->Arg(50000);
+BENCHMARK_TEMPLATE(BM_OnChannel, MembershipIndex)->Arg(50000);
+
+} // namespace irc::bot
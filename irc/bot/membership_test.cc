@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "irc/bot/membership.h"
+#include "gtest/gtest.h"
+
+namespace irc::bot {
+
+TEST(MembershipIndexTest, JoinPart) {
+  MembershipIndex index;
+  index.Join("alice", "#a");
+  index.Join("alice", "#b");
+  index.Join("bob", "#a");
+  EXPECT_TRUE(index.on_channel("alice", "#a"));
+  EXPECT_TRUE(index.on_channel("alice", "#b"));
+  EXPECT_TRUE(index.on_channel("bob", "#a"));
+  EXPECT_FALSE(index.on_channel("bob", "#b"));
+  EXPECT_FALSE(index.on_channel("carol", "#a"));
+  EXPECT_EQ(index.member_count("#a"), 2);
+
+  index.Join("bob", "#a");
+  EXPECT_EQ(index.member_count("#a"), 2);
+
+  index.Part("alice", "#a");
+  EXPECT_FALSE(index.on_channel("alice", "#a"));
+  EXPECT_TRUE(index.on_channel("alice", "#b"));
+  index.Part("alice", "#b");
+  EXPECT_EQ(index.nick_count(), 1);
+  EXPECT_EQ(index.channel_count(), 1);
+
+  index.Part("bob", "#a");
+  EXPECT_EQ(index.nick_count(), 0);
+  EXPECT_EQ(index.channel_count(), 0);
+}
+
+TEST(MembershipIndexTest, CaseInsensitive) {
+  MembershipIndex index;
+  index.Join("Nick[a]", "#Chan");
+  EXPECT_TRUE(index.on_channel("nick{A}", "#chan"));
+  index.Part("NICK[A]", "#CHAN");
+  EXPECT_EQ(index.nick_count(), 0);
+}
+
+TEST(MembershipIndexTest, QuitAndRename) {
+  MembershipIndex index;
+  index.Join("alice", "#a");
+  index.Join("alice", "#b");
+  index.Join("bob", "#b");
+
+  index.Rename("alice", "carol");
+  EXPECT_FALSE(index.on_channel("alice", "#a"));
+  EXPECT_TRUE(index.on_channel("carol", "#a"));
+  EXPECT_TRUE(index.on_channel("carol", "#b"));
+
+  index.Rename("carol", "Carol");
+  EXPECT_TRUE(index.on_channel("CAROL", "#a"));
+
+  index.Rename("bob", "carol");  // replaces the stale entry
+  EXPECT_TRUE(index.on_channel("carol", "#b"));
+  EXPECT_FALSE(index.on_channel("carol", "#a"));
+  EXPECT_EQ(index.nick_count(), 1);
+  EXPECT_EQ(index.member_count("#b"), 1);
+
+  index.Quit("carol");
+  EXPECT_EQ(index.nick_count(), 0);
+  EXPECT_EQ(index.channel_count(), 0);
+}
+
+TEST(MembershipIndexTest, NamesReply) {
+  MembershipIndex index;
+  index.AddNames("#a", "@alice +bob");
+  index.AddNames("#a", "@+carol dave!d@host.example ");
+  EXPECT_TRUE(index.on_channel("alice", "#a"));
+  EXPECT_TRUE(index.on_channel("carol", "#a"));
+  EXPECT_TRUE(index.on_channel("dave", "#a"));
+  index.EndNames("#a");
+  EXPECT_EQ(index.member_count("#a"), 4);
+  EXPECT_EQ(index.nick_count(), 4);
+}
+
+TEST(MembershipIndexTest, NamesResync) {
+  MembershipIndex index;
+  for (const char* nick : {"alice", "bob", "carol", "dave"})
+    index.Join(nick, "#a");
+  index.Join("bob", "#b");
+
+  index.AddNames("#a", "alice bob");
+  index.Join("eve", "#a");    // joined during the reply: kept
+  index.Part("alice", "#a");  // left during the reply: not resurrected
+  index.EndNames("#a");
+
+  EXPECT_FALSE(index.on_channel("alice", "#a"));
+  EXPECT_TRUE(index.on_channel("bob", "#a"));
+  EXPECT_FALSE(index.on_channel("carol", "#a"));
+  EXPECT_FALSE(index.on_channel("dave", "#a"));
+  EXPECT_TRUE(index.on_channel("eve", "#a"));
+  EXPECT_TRUE(index.on_channel("bob", "#b"));
+  EXPECT_EQ(index.member_count("#a"), 2);
+  EXPECT_EQ(index.nick_count(), 2);
+
+  index.EndNames("#b");  // no names listed at all
+  EXPECT_FALSE(index.on_channel("bob", "#b"));
+  EXPECT_EQ(index.channel_count(), 1);
+}
+
+TEST(MembershipIndexTest, DropChannel) {
+  MembershipIndex index;
+  index.Join("alice", "#a");
+  index.Join("alice", "#b");
+  index.Join("bob", "#a");
+  index.DropChannel("#a");
+  EXPECT_EQ(index.channels(), std::vector<std::string>{"#b"});
+  EXPECT_TRUE(index.on_channel("alice", "#b"));
+  EXPECT_EQ(index.nick_count(), 1);
+}
+
+TEST(MembershipIndexTest, IdReuse) {
+  MembershipIndex index;
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < 100; ++i)
+      index.Join("nick" + std::to_string(i), "#chan" + std::to_string(i % 7));
+    for (int i = 0; i < 100; i += 2)
+      index.Quit("nick" + std::to_string(i));
+    for (int i = 1; i < 100; i += 2)
+      EXPECT_TRUE(index.on_channel("nick" + std::to_string(i), "#chan" + std::to_string(i % 7)));
+    EXPECT_EQ(index.nick_count(), 50);
+    index.Clear();
+  }
+}
+
+TEST(MembershipIndexTest, SetCaseMap) {
+  MembershipIndex index(&CaseMap::Get(CaseMapping::kAscii));
+  index.Join("nick[a]", "#x[y]");
+  index.Join("nick{a}", "#x{y}");
+  index.Join("nick{a}", "#other");
+  EXPECT_EQ(index.nick_count(), 2);
+  EXPECT_EQ(index.channel_count(), 3);
+
+  index.SetCaseMap(&CaseMap::Get(CaseMapping::kRfc1459));
+  EXPECT_EQ(index.nick_count(), 1);
+  EXPECT_EQ(index.channel_count(), 2);
+  EXPECT_TRUE(index.on_channel("NICK[A]", "#X{Y}"));
+  EXPECT_TRUE(index.on_channel("nick[a]", "#other"));
+  EXPECT_EQ(index.member_count("#x[y]"), 1);
+
+  index.Quit("nick[a]");
+  EXPECT_EQ(index.nick_count(), 0);
+  EXPECT_EQ(index.channel_count(), 0);
+}
+
+TEST(MembershipIndexTest, SetCaseMapDuringNames) {
+  MembershipIndex index(&CaseMap::Get(CaseMapping::kAscii));
+  index.Join("nick[a]", "#chan");
+  index.Join("nick{a}", "#chan");
+  index.AddNames("#chan", "other");
+  index.AddNames("#x[y]", "first");
+  index.AddNames("#x{y}", "second");
+
+  index.SetCaseMap(&CaseMap::Get(CaseMapping::kRfc1459));
+  index.EndNames("#chan");
+  index.EndNames("#x[y]");
+
+  // neither spelling of the merged nick was listed, so it's gone
+  EXPECT_FALSE(index.on_channel("nick[a]", "#chan"));
+  EXPECT_EQ(index.member_count("#chan"), 1);
+  // the names listed for both spellings of the merged channel are kept
+  EXPECT_TRUE(index.on_channel("first", "#x[y]"));
+  EXPECT_TRUE(index.on_channel("second", "#x[y]"));
+  EXPECT_EQ(index.member_count("#x{y}"), 2);
+  EXPECT_EQ(index.channel_count(), 2);
+  EXPECT_EQ(index.nick_count(), 3);
+}
+
+} // namespace irc::bot
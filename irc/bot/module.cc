@@ -2,7 +2,10 @@
 
 namespace irc::bot {
 
+void Module::MessageReceived(Connection* conn, const MessageView& message) { MessageReceived(conn, message.ToMessage()); }
 void Module::MessageReceived(Connection* conn, const Message& message) {}
 void Module::MessageSent(Connection* conn, const Message& message) {}
+std::vector<Subscription> Module::subscriptions() const { return {Subscription()}; }
+AsyncOptions Module::async() const { return AsyncOptions(); }
 
 } // namespace irc::bot
@@ -6,12 +6,17 @@
 #define IRC_BOT_MODULE_H_
 
 #include <functional>
+#include <string>
+#include <vector>
 
 #include <google/protobuf/descriptor.h>
 #include <prometheus/registry.h>
 
 #include "event/loop.h"
+#include "irc/casemap.h"
+#include "irc/command.h"
 #include "irc/message.h"
+#include "irc/bot/worker_pool.h"
 
 namespace irc::bot {
 
@@ -23,6 +28,8 @@ struct Connection {
   virtual bool on_channel(const std::string_view nick, const std::string_view chan) = 0;
   /** Returns the configured network name for this connection. */
   virtual const std::string& net() = 0;
+  /** Returns the casemapping rules currently in effect on the network. */
+  virtual const CaseMap& casemap() = 0;
 
   virtual ~Connection() = default;
 };
@@ -35,9 +42,82 @@ struct ModuleHost {
   virtual ~ModuleHost() = default;
 };
 
+/**
+ * Declares which messages a module wants to see.
+ *
+ * Each of the filters accepts everything when left empty. A message matches if it passes all of
+ * them. The channel filter looks at the first argument of the message, which is the channel for
+ * the usual channel commands (`PRIVMSG`, `NOTICE`, `JOIN`, `PART`, `MODE`, `TOPIC`, `KICK`), and
+ * compares it under the casemapping of the network; messages without arguments don't pass it.
+ */
+struct Subscription {
+  /** Directions of messages, as a bit set. */
+  enum Direction : unsigned {
+    kReceived = 1,
+    kSent = 2,
+    kBoth = kReceived | kSent,
+  };
+
+  /** Whether to deliver received messages, sent messages, or both. */
+  Direction direction = kBoth;
+  /** Commands to deliver. Textual commands not interned in Command can't be selected. */
+  std::vector<Command> commands;
+  /** Networks (as in Connection::net()) to deliver messages of. */
+  std::vector<std::string> nets;
+  /** Channels to deliver messages for. */
+  std::vector<std::string> channels;
+};
+
+/**
+ * Asks for a module to be run on a worker thread rather than the event loop thread.
+ *
+ * Messages for an asynchronous module are copied into a queue of its own, and delivered from there
+ * in order, one at a time, by a pool of worker threads shared by all such modules. The Connection
+ * passed to the callbacks is then a stand-in that is safe to use from the worker thread: Send()
+ * hands the message back to the event loop, net() and casemap() work as usual, but on_channel() throws
+ * base::Exception, since membership is only known on the loop thread. The same goes for the rest
+ * of ModuleHost, which should only be used in the constructor.
+ */
+struct AsyncOptions {
+  /** Whether to run the module asynchronously at all. */
+  bool enabled = false;
+  /** Maximum number of messages waiting for the module. */
+  std::size_t max_queued = 1024;
+  /**
+   * What to do with a message for the module while its queue is full. Dropped messages are
+   * counted; Overflow::kBlock stalls the whole event loop until the module catches up.
+   */
+  WorkerPool::Overflow overflow = WorkerPool::Overflow::kDropNewest;
+};
+
 struct Module {
+  /**
+   * Called for every received message. The view is only valid for the duration of the call.
+   *
+   * The default implementation passes a copy (MessageView::ToMessage()) to the Message overload, so
+   * a module can override either one. Overriding this one avoids the copy.
+   */
+  virtual void MessageReceived(Connection* conn, const MessageView& message);
+  /** Called with a copy of every received message, unless the MessageView overload is overridden. */
   virtual void MessageReceived(Connection* conn, const Message& message);
   virtual void MessageSent(Connection* conn, const Message& message);
+
+  /**
+   * Returns the messages the module wants to receive through MessageReceived() and MessageSent().
+   *
+   * Called once, after the module has been constructed. A message is delivered once if it matches
+   * any of the subscriptions. The default is a single subscription to everything.
+   */
+  virtual std::vector<Subscription> subscriptions() const;
+
+  /**
+   * Returns whether and how to run the module on a worker thread.
+   *
+   * Called once, after the module has been constructed. The default is to run it on the event loop
+   * thread, in which case the callbacks must never block.
+   */
+  virtual AsyncOptions async() const;
+
   virtual ~Module() = default;
 };
 
@@ -1,6 +1,5 @@
-#include <algorithm>
-
-#include <google/protobuf/repeated_field.h>
+#include <cstdint>
+#include <string>
 
 #include "irc/bot/remote.h"
 
@@ -15,11 +14,12 @@ void EventToMessage(const IrcEvent& event, Message* message) {
   args->insert(args->end(), event.args().begin(), event.args().end());
 }
 
-void MessageToEvent(const Message& message, IrcEvent* event, bool sent) {
-  event->set_prefix(message.prefix());
-  event->set_command(message.command());
-  std::copy(message.args().begin(), message.args().end(),
-            google::protobuf::RepeatedFieldBackInserter(event->mutable_args()));
+template <typename M>
+void MessageToEvent(const M& message, IrcEvent* event, bool sent) {
+  event->set_prefix(std::string(message.prefix()));
+  event->set_command(std::string(message.command()));
+  for (const auto& arg : message.args())
+    event->add_args(std::string(arg));
   if (sent)
     event->set_direction(IrcEvent::SENT);
 }
@@ -29,6 +29,30 @@ void MessageToEvent(const Message& message, IrcEvent* event, bool sent) {
 Remote::Remote(const RemoteConfig& config, irc::bot::ModuleHost* host)
     : host_(host), server_(host->loop(), base::borrow(this))
 {
+  watch_limits_.high_water = config.watch_high_water_bytes() > 0 ? config.watch_high_water_bytes() : 1 << 20;
+  watch_limits_.low_water = config.watch_low_water_bytes() > 0 ? config.watch_low_water_bytes() : watch_limits_.high_water / 2;
+  if (watch_limits_.low_water > watch_limits_.high_water)
+    throw base::Exception("watch_low_water_bytes is over watch_high_water_bytes");
+  switch (config.watch_overflow()) {
+    case RemoteConfig::DROP_NEWEST: watch_limits_.overflow = brpc::RpcWriteLimits::Overflow::kDropNewest; break;
+    case RemoteConfig::DISCONNECT: watch_limits_.overflow = brpc::RpcWriteLimits::Overflow::kDisconnect; break;
+    case RemoteConfig::DROP_UNTIL_DRAINED: watch_limits_.overflow = brpc::RpcWriteLimits::Overflow::kPause; break;
+    default: watch_limits_.overflow = brpc::RpcWriteLimits::Overflow::kDropOldest; break;
+  }
+
+  if (prometheus::Registry* registry = host->metric_registry()) {
+    metric_dropped_events_ = &prometheus::BuildCounter()
+        .Name("irc_bot_remote_dropped_events")
+        .Help("How many events were not delivered to remote watchers that had fallen behind?")
+        .Register(*registry)
+        .Add({});
+    metric_buffered_bytes_ = &prometheus::BuildGauge()
+        .Name("irc_bot_remote_buffered_bytes")
+        .Help("How many bytes of events are waiting to be written to remote watchers?")
+        .Register(*registry)
+        .Add({});
+  }
+
   auto err = server_.Start(config.socket_path());
   if (err)
     throw new base::Exception(*err);
@@ -38,15 +62,52 @@ base::optional_ptr<Remote::WatchHandler> Remote::Watch(WatchCall* call) {
   return base::borrow(watchers_.emplace(call, this));
 }
 
-void Remote::ActiveWatcher::WatchMessage(WatchCall*, const ::irc::bot::WatchRequest& req) {
+void Remote::ActiveWatcher::WatchOpen(WatchCall* call) {
+  call->SetWriteLimits(remote_->watch_limits_);
+}
+
+void Remote::ActiveWatcher::WatchMessage(WatchCall* call, const ::irc::bot::WatchRequest& req) {
   nets_.clear();
+  try {
+    filter_ = WatchFilter(req);
+  } catch (const base::Exception& e) {
+    LOG(WARNING) << "remote: " << e.what();
+    remote_->UpdateSubscribers();
+    call->Close();
+    return;
+  }
   nets_.insert(nets_.end(), req.nets().begin(), req.nets().end());
+  remote_->UpdateSubscribers();
 }
 
 void Remote::ActiveWatcher::WatchClose(WatchCall* call, ::base::error_ptr error) {
   if (error)
     LOG(WARNING) << "remote: " << *error;
-  remote_->watchers_.erase(this); // self-destruct
+  Remote* remote = remote_;
+  remote->watchers_.erase(this); // self-destruct
+  remote->UpdateSubscribers();
+  remote->UpdateBuffered();
+}
+
+void Remote::ActiveWatcher::WatchWritable(WatchCall* call, bool writable) {
+  if (!writable)
+    LOG(WARNING) << "remote: watcher fell behind with " << call->buffered() << " bytes buffered";
+  remote_->UpdateBuffered();
+}
+
+void Remote::UpdateSubscribers() {
+  // watch requests are rare, messages are not: just start over
+  subscribers_.clear();
+  for (ActiveWatcher* watcher : watchers_) {
+    for (const auto& net : watcher->nets_) {
+      Connection* conn = host_->conn(net);
+      if (!conn)
+        continue;
+      auto& list = subscribers_[conn];
+      if (list.empty() || list.back() != watcher)  // the same net listed twice
+        list.push_back(watcher);
+    }
+  }
 }
 
 bool Remote::SendTo(const ::irc::bot::SendToRequest& req, ::google::protobuf::Empty* resp) {
@@ -60,34 +121,58 @@ bool Remote::SendTo(const ::irc::bot::SendToRequest& req, ::google::protobuf::Em
   return true;
 }
 
-void Remote::RemoteServiceError(::base::error_ptr error) {
-  LOG(WARNING) << "remote: " << *error;
+void Remote::UpdateBuffered() {
+  if (!metric_buffered_bytes_)
+    return;
+  std::size_t total = 0;
+  for (ActiveWatcher* watcher : watchers_)
+    total += watcher->call_->buffered();
+  metric_buffered_bytes_->Set(total);
 }
 
-void Remote::MessageReceived(Connection* conn, const Message& message) {
-  for (const auto& watcher : watchers_)
-    watcher->MessageReceived(conn, message);
+void Remote::RemoteServiceError(::base::error_ptr error) {
+  LOG(WARNING) << "remote: " << *error;
 }
 
-void Remote::ActiveWatcher::MessageReceived(Connection* conn, const Message& message) {
-  if (std::find(nets_.begin(), nets_.end(), conn->net()) == nets_.end())
-    return;
-  IrcEvent event;
-  MessageToEvent(message, &event, /* sent= */ false);
-  call_->Send(event);
+void Remote::MessageReceived(Connection* conn, const MessageView& message) {
+  Broadcast(conn, message, /* sent= */ false);
 }
 
 void Remote::MessageSent(Connection* conn, const Message& message) {
-  for (const auto& watcher : watchers_)
-    watcher->MessageSent(conn, message);
+  Broadcast(conn, message, /* sent= */ true);
 }
 
-void Remote::ActiveWatcher::MessageSent(Connection* conn, const Message& message) {
-  if (std::find(nets_.begin(), nets_.end(), conn->net()) == nets_.end())
+template <typename M>
+void Remote::Broadcast(Connection* conn, const M& message, bool sent) {
+  auto watchers = subscribers_.find(conn);
+  if (watchers == subscribers_.end())
     return;
-  IrcEvent event;
-  MessageToEvent(message, &event, /* sent= */ true);
-  call_->Send(event);
+
+  brpc::RpcFrame frame;
+  std::uint64_t dropped = 0;
+  for (ActiveWatcher* watcher : watchers->second) {
+    if (!watcher->filter_.Match(message, conn->casemap()))
+      continue;
+    WatchCall* call = watcher->call_;
+    // with kPause the call buffers everything, so it's up to us to drop events until it drains
+    if (watch_limits_.overflow == brpc::RpcWriteLimits::Overflow::kPause && !call->writable()) {
+      ++dropped;
+      continue;
+    }
+    if (!frame) {
+      IrcEvent event;
+      MessageToEvent(message, &event, sent);
+      frame = brpc::EncodeFrame(event);
+    }
+    std::uint64_t dropped_before = call->dropped();
+    call->Send(frame);
+    dropped += call->dropped() - dropped_before;
+  }
+
+  if (frame)
+    UpdateBuffered();
+  if (dropped > 0 && metric_dropped_events_)
+    metric_dropped_events_->Increment(dropped);
 }
 
 } // namespace irc::bot
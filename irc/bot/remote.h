@@ -6,9 +6,17 @@
 #define IRC_BOT_REMOTE_H_
 
 #include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
+#include <prometheus/counter.h>
+#include <prometheus/gauge.h>
+
+#include "brpc/brpc.h"
 #include "event/loop.h"
 #include "irc/bot/module.h"
+#include "irc/bot/watch_filter.h"
 #include "irc/bot/remote_service.brpc.h"
 #include "irc/bot/remote_service.pb.h"
 
@@ -24,30 +32,49 @@ class Remote : public Module, public RemoteServiceInterface {
   void RemoteServiceError(::base::error_ptr error) override;
 
   // Module
-  void MessageReceived(Connection* conn, const Message& message) override;
+  void MessageReceived(Connection* conn, const MessageView& message) override;
   void MessageSent(Connection* conn, const Message& message) override;
 
  private:
   class ActiveWatcher : public WatchHandler {
    public:
     ActiveWatcher(WatchCall* call, Remote* remote) : call_(call), remote_(remote) {}
-    void WatchOpen(WatchCall* call) override {}
+    void WatchOpen(WatchCall* call) override;
     void WatchMessage(WatchCall* call, const ::irc::bot::WatchRequest& req) override;
     void WatchClose(WatchCall* call, ::base::error_ptr error) override;
-    void MessageReceived(Connection* conn, const Message& message);
-    void MessageSent(Connection* conn, const Message& message);
+    void WatchWritable(WatchCall* call, bool writable) override;
 
    private:
     WatchCall* call_;
     Remote* remote_;
     std::vector<std::string> nets_;
+    WatchFilter filter_;
 
     friend class Remote;
   };
 
+  /**
+   * Sends \p message to the watchers of \p conn whose filters it passes.
+   *
+   * The event is only built and encoded if there are any, and then just once.
+   */
+  template <typename M>
+  void Broadcast(Connection* conn, const M& message, bool sent);
+  /** Rebuilds #subscribers_ from the networks of each watcher. */
+  void UpdateSubscribers();
+  /** Sets the buffered bytes metric to the total over all watchers. */
+  void UpdateBuffered();
+
   ModuleHost* host_;
   RemoteServiceServer server_;
+  /** Write limits of each watch call. */
+  brpc::RpcWriteLimits watch_limits_;
   base::unique_set<ActiveWatcher> watchers_;
+  /** Watchers of each connection, which have at least one. */
+  std::unordered_map<Connection*, std::vector<ActiveWatcher*>> subscribers_;
+
+  prometheus::Counter* metric_dropped_events_ = nullptr;
+  prometheus::Gauge* metric_buffered_bytes_ = nullptr;
 };
 
 /** Enables the support for the remote config module on a bot. */
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <string_view>
+
+#include "base/exc.h"
+#include "irc/bot/watch_filter.h"
+
+namespace irc::bot {
+
+namespace {
+
+char AsciiUpper(char c) { return c >= 'a' && c <= 'z' ? c - 32 : c; }
+
+/** Longest accepted `trailing_regex`. */
+constexpr std::size_t kMaxRegexSize = 256;
+
+/** Returns `true` if the regular expression \p re contains a backreference. */
+bool HasBackreference(std::string_view re) {
+  for (std::size_t i = 0; i < re.size(); ++i) {
+    if (re[i] == '\\') {
+      if (i + 1 < re.size() && re[i + 1] >= '1' && re[i + 1] <= '9')
+        return true;
+      ++i;
+    } else if (re[i] == '[') {
+      for (++i; i < re.size() && re[i] != ']'; ++i)
+        if (re[i] == '\\')
+          ++i;
+    }
+  }
+  return false;
+}
+
+} // unnamed namespace
+
+WatchFilter::WatchFilter(const WatchRequest& req)
+    : targets_(req.targets().begin(), req.targets().end()),
+      prefixes_(req.prefixes().begin(), req.prefixes().end())
+{
+  for (std::string command : req.commands()) {
+    std::transform(command.begin(), command.end(), command.begin(), AsciiUpper);
+    commands_.push_back(std::move(command));
+  }
+
+  if (!req.trailing_regex().empty()) {
+    if (req.trailing_regex().size() > kMaxRegexSize)
+      throw base::Exception("trailing_regex too long: over " + std::to_string(kMaxRegexSize) + " characters");
+    if (HasBackreference(req.trailing_regex()))
+      throw base::Exception("unsafe trailing_regex: backreferences are not allowed");
+    try {
+      // the expression on its own is checked first, so that it can't unbalance the wrapping group
+      std::regex(req.trailing_regex(), std::regex::ECMAScript);
+      // a search is a match of the expression surrounded by anything; a single match with the
+      // polynomial (breadth-first) executor of libstdc++ takes time linear in the input, while
+      // std::regex_search would restart the match at every position
+      trailing_.emplace(
+          "[\\s\\S]*(?:" + req.trailing_regex() + ")[\\s\\S]*",
+          std::regex::ECMAScript | std::regex::optimize | std::regex_constants::__polynomial);
+    } catch (const std::regex_error& e) {
+      throw base::Exception("invalid trailing_regex: " + std::string(e.what()));
+    }
+  }
+}
+
+bool WatchFilter::MatchCommand(std::string_view command) const {
+  for (const auto& c : commands_) {
+    if (c.size() == command.size()
+        && std::equal(c.begin(), c.end(), command.begin(), [](char a, char b) { return a == AsciiUpper(b); }))
+      return true;
+  }
+  return false;
+}
+
+bool WatchFilter::MatchTarget(std::string_view target, const CaseMap& casemap) const {
+  for (const auto& t : targets_)
+    if (casemap.Equal(t, target))
+      return true;
+  return false;
+}
+
+bool WatchFilter::MatchPrefix(std::string_view prefix, const CaseMap& casemap) const {
+  if (prefix.empty())
+    return false;
+  for (const auto& mask : prefixes_)
+    if (casemap.MatchMask(mask, prefix))
+      return true;
+  return false;
+}
+
+bool WatchFilter::MatchTrailing(std::string_view trailing) const {
+  try {
+    return std::regex_match(trailing.begin(), trailing.end(), *trailing_);
+  } catch (const std::regex_error&) {
+    return false;  // e.g., error_complexity or error_stack
+  }
+}
+
+} // namespace irc::bot
@@ -0,0 +1,74 @@
+/** \file
+ * Message filters of remote watch calls.
+ */
+
+#ifndef IRC_BOT_WATCH_FILTER_H_
+#define IRC_BOT_WATCH_FILTER_H_
+
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "irc/bot/remote_service.pb.h"
+#include "irc/casemap.h"
+
+namespace irc::bot {
+
+/**
+ * Compiled form of the filters of a WatchRequest.
+ *
+ * Matching looks at a message as it is, so that messages that don't pass never need to be
+ * converted into an IrcEvent. The network filter is not included: it's applied by indexing the
+ * watchers by connection.
+ */
+class WatchFilter {
+ public:
+  /** Constructs a filter that accepts everything. */
+  WatchFilter() = default;
+
+  /** Compiles the filters of \p req. Throws base::Exception if the regular expression is invalid. */
+  explicit WatchFilter(const WatchRequest& req);
+
+  /**
+   * Returns `true` if \p message passes all the filters.
+   *
+   * \p message can be either a Message or a MessageView. Targets and prefixes are compared using
+   * \p casemap, which should be that of the network the message is on.
+   */
+  template <typename M>
+  bool Match(const M& message, const CaseMap& casemap) const {
+    int nargs = message.nargs();
+    if (!commands_.empty() && !MatchCommand(message.command()))
+      return false;
+    if (!targets_.empty() && (nargs == 0 || !MatchTarget(message.arg(0), casemap)))
+      return false;
+    if (!prefixes_.empty() && !MatchPrefix(message.prefix(), casemap))
+      return false;
+    if (trailing_ && (nargs == 0 || !MatchTrailing(message.arg(nargs - 1))))
+      return false;
+    return true;
+  }
+
+ private:
+  bool MatchCommand(std::string_view command) const;
+  bool MatchTarget(std::string_view target, const CaseMap& casemap) const;
+  bool MatchPrefix(std::string_view prefix, const CaseMap& casemap) const;
+  bool MatchTrailing(std::string_view trailing) const;
+
+  /** Accepted commands, in upper case. */
+  std::vector<std::string> commands_;
+  std::vector<std::string> targets_;
+  std::vector<std::string> prefixes_;
+  /** The `trailing_regex`, wrapped to match whole strings: see the constructor. */
+  std::optional<std::regex> trailing_;
+};
+
+} // namespace irc::bot
+
+#endif // IRC_BOT_WATCH_FILTER_H_
+
+// Local Variables:
+// mode: c++
+// End:
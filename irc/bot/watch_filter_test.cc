@@ -0,0 +1,105 @@
+#include <chrono>
+#include <string>
+
+#include "base/exc.h"
+#include "irc/bot/watch_filter.h"
+#include "irc/message.h"
+#include "gtest/gtest.h"
+
+namespace irc::bot {
+
+namespace {
+
+const CaseMap& kRfc1459 = CaseMap::Get(CaseMapping::kRfc1459);
+
+/** Parses \p line, and returns whether it passes \p filter. */
+bool Match(const WatchFilter& filter, const char* line) {
+  MessageView msg;
+  EXPECT_TRUE(msg.Parse(line));
+  return filter.Match(msg, kRfc1459);
+}
+
+} // unnamed namespace
+
+TEST(WatchFilterTest, Empty) {
+  WatchFilter filter{WatchRequest()};
+  EXPECT_TRUE(Match(filter, ":n!u@h PRIVMSG #chan :hello"));
+  EXPECT_TRUE(Match(filter, "PING"));
+}
+
+TEST(WatchFilterTest, Fields) {
+  WatchRequest req;
+  req.add_commands("privmsg");
+  req.add_commands("001");
+  req.add_targets("#Chan[1]");
+  WatchFilter filter(req);
+  EXPECT_TRUE(Match(filter, ":n!u@h PRIVMSG #chan{1} :hello"));
+  EXPECT_TRUE(Match(filter, ":server 001 #chan[1] :welcome"));
+  EXPECT_FALSE(Match(filter, ":n!u@h NOTICE #chan[1] :hello"));
+  EXPECT_FALSE(Match(filter, ":n!u@h PRIVMSG #other :hello"));
+  EXPECT_FALSE(Match(filter, "PRIVMSG"));
+
+  req.Clear();
+  req.add_prefixes("*!*@*.example.com");
+  req.add_prefixes("admin!*");
+  filter = WatchFilter(req);
+  EXPECT_TRUE(Match(filter, ":n!u@host.EXAMPLE.com JOIN #chan"));
+  EXPECT_TRUE(Match(filter, ":Admin!u@h JOIN #chan"));
+  EXPECT_FALSE(Match(filter, ":n!u@h JOIN #chan"));
+  EXPECT_FALSE(Match(filter, "JOIN #chan"));
+}
+
+TEST(WatchFilterTest, Regex) {
+  WatchRequest req;
+  req.set_trailing_regex("^!(help|info)\\b");
+  WatchFilter filter(req);
+  EXPECT_TRUE(Match(filter, ":n!u@h PRIVMSG #chan :!help me"));
+  EXPECT_TRUE(Match(filter, ":n!u@h PRIVMSG #chan !info"));
+  EXPECT_FALSE(Match(filter, ":n!u@h PRIVMSG #chan :see !help"));
+  EXPECT_FALSE(Match(filter, ":n!u@h PRIVMSG #chan :!helpme"));
+  EXPECT_FALSE(Match(filter, "PING"));
+
+  Message sent{"PRIVMSG", "#chan", "!info"};
+  EXPECT_TRUE(filter.Match(sent, kRfc1459));
+
+  req.set_trailing_regex("(unclosed");
+  EXPECT_THROW(WatchFilter{req}, base::Exception);
+}
+
+TEST(WatchFilterTest, UnsafeRegex) {
+  const char* unsafe[] = {"(.)\\1", "(a)(b)\\2", "a)(b", "a\\"};
+  for (const char* re : unsafe) {
+    WatchRequest req;
+    req.set_trailing_regex(re);
+    EXPECT_THROW(WatchFilter{req}, base::Exception) << re;
+  }
+
+  const char* safe[] = {"\\\\1", "\\b\\d", "(?:ab)*c"};
+  for (const char* re : safe) {
+    WatchRequest req;
+    req.set_trailing_regex(re);
+    EXPECT_NO_THROW(WatchFilter{req}) << re;
+  }
+
+  WatchRequest req;
+  req.set_trailing_regex(std::string(257, 'a'));
+  EXPECT_THROW(WatchFilter{req}, base::Exception);
+}
+
+TEST(WatchFilterTest, NoBacktracking) {
+  // each of these takes seconds or more with a backtracking matcher
+  const char* slow[] = {"a*a*a*a*y", ".*.*.*.*x", "(a+)+y", "(a|aa)*y", "^(\\w+\\s?)*!$"};
+  std::string line = ":n!u@h PRIVMSG #chan :" + std::string(400, 'a');
+
+  auto start = std::chrono::steady_clock::now();
+  for (const char* re : slow) {
+    WatchRequest req;
+    req.set_trailing_regex(re);
+    WatchFilter filter(req);
+    EXPECT_FALSE(Match(filter, line.c_str())) << re;
+    EXPECT_TRUE(Match(filter, (line + "y x!").c_str())) << re;
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+}
+
+} // namespace irc::bot
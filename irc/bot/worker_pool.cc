@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <exception>
+
+#include "base/log.h"
+#include "irc/bot/worker_pool.h"
+
+namespace irc::bot {
+
+WorkerPool::WorkerPool(int threads) {
+  CHECK(threads > 0);
+  for (int i = 0; i < threads; ++i)
+    workers_.emplace_back(&WorkerPool::Work, this);
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& worker : workers_)
+    worker.join();
+}
+
+void WorkerPool::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true) {
+    work_cv_.wait(lock, [this]() { return stopping_ || !ready_.empty(); });
+    if (stopping_)
+      return;
+
+    Queue* queue = ready_.front();
+    ready_.pop_front();
+    std::unique_ptr<Task> task = std::move(queue->tasks_.front());
+    queue->tasks_.pop_front();
+    queue->running_ = true;
+    lock.unlock();
+
+    try {
+      task->Run();
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "worker task failed: " << e.what();
+    }
+    task.reset();
+
+    lock.lock();
+    queue->running_ = false;
+    if (!queue->tasks_.empty()) {
+      // to the back of the line, behind any other queues that have been waiting
+      ready_.push_back(queue);
+      work_cv_.notify_one();
+    }
+    done_cv_.notify_all();
+  }
+}
+
+WorkerPool::Queue::Queue(WorkerPool* pool, std::size_t capacity, Overflow overflow)
+    : pool_(pool), capacity_(capacity), overflow_(overflow)
+{
+  CHECK(capacity > 0);
+}
+
+WorkerPool::Queue::~Queue() {
+  std::unique_lock<std::mutex> lock(pool_->mutex_);
+  tasks_.clear();
+  auto& ready = pool_->ready_;
+  ready.erase(std::remove(ready.begin(), ready.end(), this), ready.end());
+  pool_->done_cv_.wait(lock, [this]() { return !running_; });
+}
+
+bool WorkerPool::Queue::Post(std::unique_ptr<Task> task) {
+  std::unique_lock<std::mutex> lock(pool_->mutex_);
+  bool kept = true;
+
+  if (tasks_.size() >= capacity_) {
+    switch (overflow_) {
+      case Overflow::kDropNewest:
+        return false;
+      case Overflow::kDropOldest:
+        tasks_.pop_front();
+        kept = false;
+        break;
+      case Overflow::kBlock:
+        pool_->done_cv_.wait(lock, [this]() { return tasks_.size() < capacity_; });
+        break;
+    }
+  }
+
+  tasks_.push_back(std::move(task));
+  if (tasks_.size() == 1 && !running_) {
+    pool_->ready_.push_back(this);
+    pool_->work_cv_.notify_one();
+  }
+  return kept;
+}
+
+std::size_t WorkerPool::Queue::size() const {
+  std::lock_guard<std::mutex> lock(pool_->mutex_);
+  return tasks_.size();
+}
+
+} // namespace irc::bot
@@ -0,0 +1,136 @@
+/** \file
+ * Bounded pool of worker threads with serial task queues.
+ */
+
+#ifndef IRC_BOT_WORKER_POOL_H_
+#define IRC_BOT_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "base/common.h"
+
+namespace irc::bot {
+
+/**
+ * Fixed set of worker threads, running tasks from any number of serial queues.
+ *
+ * Tasks of one Queue run one at a time, in the order they were posted, though not necessarily on
+ * the same thread. Queues that have work are served in turn, one task each, so a busy queue can't
+ * starve the others of threads for longer than the duration of a single task.
+ *
+ * Each queue holds a bounded number of tasks waiting to run, and its Overflow policy decides what
+ * happens to a task posted to a full queue. Queues are used from one thread at a time (typically
+ * an event loop); the pool itself doesn't need to be touched after construction.
+ */
+class WorkerPool {
+ public:
+  /** Interface for tasks run by the pool. */
+  struct Task {
+    virtual ~Task() = default;
+    /** Called on a worker thread. Exceptions are logged and otherwise ignored. */
+    virtual void Run() = 0;
+  };
+
+  /** What to do when a task is posted to a queue that is already full. */
+  enum class Overflow {
+    /** Discard the new task. */
+    kDropNewest,
+    /** Discard the oldest task still waiting, to make room for the new one. */
+    kDropOldest,
+    /** Block the posting thread until there is room. */
+    kBlock,
+  };
+
+  class Queue;
+
+  /** Constructs a pool of \p threads worker threads, which are started immediately. */
+  explicit WorkerPool(int threads);
+  DISALLOW_COPY(WorkerPool);
+
+  /** Stops and joins the worker threads. All queues must have been destroyed before the pool. */
+  ~WorkerPool();
+
+  /** Returns the number of worker threads. */
+  int size() const noexcept { return workers_.size(); }
+
+ private:
+  /** Worker thread main loop. */
+  void Work();
+
+  std::mutex mutex_;
+  /** Signaled when a queue becomes ready, or the pool is stopping. */
+  std::condition_variable work_cv_;
+  /** Signaled when a task has finished, which may have made room in (or idled) its queue. */
+  std::condition_variable done_cv_;
+  /** Queues with tasks waiting and none running, in the order they are to be served. */
+  std::deque<Queue*> ready_;
+  std::vector<std::thread> workers_;
+  bool stopping_ = false;
+};
+
+/** Serial queue of tasks, run in order on a WorkerPool. */
+class WorkerPool::Queue {
+ public:
+  /** Constructs a queue on \p pool, for at most \p capacity waiting tasks (not counting a running one). */
+  Queue(WorkerPool* pool, std::size_t capacity, Overflow overflow);
+  DISALLOW_COPY(Queue);
+
+  /**
+   * Discards any tasks still waiting, and waits for a running task (if any) to finish.
+   *
+   * Must not be called from a task of the same queue.
+   */
+  ~Queue();
+
+  /**
+   * Adds \p task to the end of the queue.
+   *
+   * Returns `false` if a task had to be discarded to keep within the capacity: either \p task
+   * itself or the oldest waiting one, depending on the overflow policy. With Overflow::kBlock, this
+   * call waits for room instead, and always returns `true`.
+   */
+  bool Post(std::unique_ptr<Task> task);
+
+  /** Adds the callable \p f to the queue as a task. \sa Post(std::unique_ptr<Task>) */
+  template <typename F>
+  bool Post(F&& f) {
+    return Post(std::unique_ptr<Task>(std::make_unique<TaskF<std::decay_t<F>>>(std::forward<F>(f))));
+  }
+
+  /** Returns the number of tasks waiting to run. */
+  std::size_t size() const;
+
+ private:
+  template <typename F>
+  struct TaskF : public Task {
+    F f;
+    explicit TaskF(F&& f) : f(std::move(f)) {}
+    explicit TaskF(const F& f) : f(f) {}
+    void Run() override { f(); }
+  };
+
+  WorkerPool* pool_;
+  const std::size_t capacity_;
+  const Overflow overflow_;
+  /** Tasks waiting to run. Guarded by the mutex of the pool, like the other mutable fields. */
+  std::deque<std::unique_ptr<Task>> tasks_;
+  /** `true` while a worker is running a task of this queue. */
+  bool running_ = false;
+
+  friend class WorkerPool;
+};
+
+} // namespace irc::bot
+
+#endif // IRC_BOT_WORKER_POOL_H_
+
+// Local Variables:
+// mode: c++
+// End:
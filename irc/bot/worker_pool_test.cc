@@ -0,0 +1,146 @@
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "irc/bot/worker_pool.h"
+#include "irc/message.h"
+#include "gtest/gtest.h"
+
+namespace irc::bot {
+
+namespace {
+
+/** Task that occupies a worker until released. */
+struct Blocker {
+  std::promise<void> started;
+  std::promise<void> release;
+
+  /** Posts the blocking task to \p queue, and waits until it's running. */
+  void Block(WorkerPool::Queue* queue) {
+    queue->Post([this, released = release.get_future()]() { started.set_value(); released.wait(); });
+    started.get_future().wait();
+  }
+  void Release() { release.set_value(); }
+};
+
+} // unnamed namespace
+
+TEST(WorkerPoolTest, Order) {
+  WorkerPool pool(4);
+  WorkerPool::Queue a(&pool, 10000, WorkerPool::Overflow::kBlock), b(&pool, 10000, WorkerPool::Overflow::kBlock);
+  std::vector<int> seen_a, seen_b;
+  std::promise<void> done_a, done_b;
+
+  for (int i = 0; i < 1000; ++i) {
+    a.Post([&seen_a, i]() { seen_a.push_back(i); });
+    b.Post([&seen_b, i]() { seen_b.push_back(i); if (i == 500) throw std::runtime_error("oops"); });
+  }
+  a.Post([&done_a]() { done_a.set_value(); });
+  b.Post([&done_b]() { done_b.set_value(); });
+  done_a.get_future().wait();
+  done_b.get_future().wait();
+
+  ASSERT_EQ(seen_a.size(), 1000);
+  ASSERT_EQ(seen_b.size(), 1000);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(seen_a[i], i);
+    EXPECT_EQ(seen_b[i], i);
+  }
+}
+
+TEST(WorkerPoolTest, Drop) {
+  WorkerPool pool(1);
+  std::vector<char> seen;
+
+  {
+    WorkerPool::Queue queue(&pool, 2, WorkerPool::Overflow::kDropNewest);
+    Blocker blocker;
+    std::promise<void> done;
+    blocker.Block(&queue);
+    EXPECT_TRUE(queue.Post([&seen]() { seen.push_back('a'); }));
+    EXPECT_TRUE(queue.Post([&seen, &done]() { seen.push_back('b'); done.set_value(); }));
+    EXPECT_FALSE(queue.Post([&seen]() { seen.push_back('c'); }));
+    EXPECT_EQ(queue.size(), 2);
+    blocker.Release();
+    done.get_future().wait();
+    EXPECT_EQ(seen, (std::vector<char>{'a', 'b'}));
+  }
+
+  seen.clear();
+  {
+    WorkerPool::Queue queue(&pool, 2, WorkerPool::Overflow::kDropOldest);
+    Blocker blocker;
+    std::promise<void> done;
+    blocker.Block(&queue);
+    EXPECT_TRUE(queue.Post([&seen]() { seen.push_back('a'); }));
+    EXPECT_TRUE(queue.Post([&seen]() { seen.push_back('b'); }));
+    EXPECT_FALSE(queue.Post([&seen, &done]() { seen.push_back('c'); done.set_value(); }));
+    blocker.Release();
+    done.get_future().wait();
+    EXPECT_EQ(seen, (std::vector<char>{'b', 'c'}));
+  }
+
+  seen.clear();
+  {
+    WorkerPool::Queue queue(&pool, 2, WorkerPool::Overflow::kDropNewest);
+    Blocker blocker;
+    blocker.Block(&queue);
+    queue.Post([&seen]() { seen.push_back('a'); });
+    blocker.Release();
+    // destroying the queue waits for the blocker, and discards anything after it
+  }
+  EXPECT_LE(seen.size(), 1);
+}
+
+TEST(WorkerPoolTest, Block) {
+  WorkerPool pool(1);
+  WorkerPool::Queue queue(&pool, 1, WorkerPool::Overflow::kBlock);
+  std::vector<char> seen;
+  std::promise<void> done;
+  std::atomic<bool> posted{false};
+
+  Blocker blocker;
+  blocker.Block(&queue);
+  EXPECT_TRUE(queue.Post([&seen]() { seen.push_back('a'); }));
+  std::thread poster([&]() {
+    EXPECT_TRUE(queue.Post([&seen, &done]() { seen.push_back('b'); done.set_value(); }));
+    posted = true;
+  });
+  EXPECT_FALSE(posted);  // can't get in while 'a' is waiting
+  EXPECT_EQ(queue.size(), 1);
+
+  blocker.Release();
+  poster.join();
+  done.get_future().wait();
+  EXPECT_EQ(seen, (std::vector<char>{'a', 'b'}));
+}
+
+TEST(WorkerPoolTest, MessageTask) {
+  // messages are handed over to the workers the way AsyncModule does it: moved or copied into the
+  // task, with the loop's own copy gone or changed by the time the task runs
+  WorkerPool pool(1);
+  WorkerPool::Queue queue(&pool, 2, WorkerPool::Overflow::kBlock);
+  std::promise<std::string> moved_nick, copied_nick;
+
+  {
+    MessageView view;
+    ASSERT_TRUE(view.Parse(":ab!c@d PRIVMSG #x :hi"));
+    queue.Post([&moved_nick, message = view.ToMessage()]() {
+      moved_nick.set_value(std::string(message.prefix_nick()));
+    });
+  }
+  {
+    Message message({ "PRIVMSG", "#x", "hi" }, "cd!e@f");
+    queue.Post([&copied_nick, message]() {
+      copied_nick.set_value(std::string(message.prefix_nick()));
+    });
+    message.set_prefix("gh!i@j");
+  }
+
+  EXPECT_EQ(moved_nick.get_future().get(), "ab");
+  EXPECT_EQ(copied_nick.get_future().get(), "cd");
+}
+
+} // namespace irc::bot
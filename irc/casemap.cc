@@ -0,0 +1,109 @@
+#include <cstdint>
+
+#include "irc/casemap.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace irc {
+
+constexpr CaseMap::CaseMap(CaseMapping mapping, char last) noexcept : mapping_(mapping), last_(last), fold_{} {
+  for (int c = 0; c < 256; ++c)
+    fold_[c] = static_cast<char>(c >= 'A' && c <= last ? c + 32 : c);
+}
+
+constexpr CaseMap CaseMap::kAscii(CaseMapping::kAscii, 'Z');
+constexpr CaseMap CaseMap::kRfc1459(CaseMapping::kRfc1459, '^');
+constexpr CaseMap CaseMap::kStrictRfc1459(CaseMapping::kStrictRfc1459, ']');
+
+const CaseMap& CaseMap::Get(CaseMapping mapping) noexcept {
+  switch (mapping) {
+    case CaseMapping::kAscii: return kAscii;
+    case CaseMapping::kStrictRfc1459: return kStrictRfc1459;
+    default: return kRfc1459;
+  }
+}
+
+const CaseMap* CaseMap::ForName(std::string_view name) noexcept {
+  for (const CaseMap* map : { &kAscii, &kRfc1459, &kStrictRfc1459 })
+    if (name == map->name())
+      return map;
+  return nullptr;
+}
+
+std::string_view CaseMap::name() const noexcept {
+  switch (mapping_) {
+    case CaseMapping::kAscii: return "ascii";
+    case CaseMapping::kStrictRfc1459: return "strict-rfc1459";
+    default: return "rfc1459";
+  }
+}
+
+std::string CaseMap::Fold(std::string_view s) const {
+  std::string folded(s);
+  for (char& c : folded)
+    c = Fold(c);
+  return folded;
+}
+
+bool CaseMap::Equal(std::string_view a, std::string_view b) const noexcept {
+  if (a.size() != b.size())
+    return false;
+
+  std::size_t i = 0, size = a.size();
+#ifdef __SSE2__
+  if (size >= 16) {
+    // fold(v) = v + 32 for 'A' <= v <= last_; bytes >= 0x80 compare as negative, so stay as they are
+    const __m128i lo = _mm_set1_epi8('A' - 1), hi = _mm_set1_epi8(last_ + 1), delta = _mm_set1_epi8(32);
+    auto fold = [&](__m128i v) {
+      __m128i in = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+      return _mm_add_epi8(v, _mm_and_si128(in, delta));
+    };
+    for (; size - i >= 16; i += 16) {
+      __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a.data() + i));
+      __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.data() + i));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(fold(va), fold(vb))) != 0xffff)
+        return false;
+    }
+  }
+#endif
+  for (; i < size; ++i)
+    if (a[i] != b[i] && Fold(a[i]) != Fold(b[i]))
+      return false;
+  return true;
+}
+
+std::size_t CaseMap::Hash(std::string_view s) const noexcept {
+  std::uint64_t h = 14695981039346656037ull;
+  for (char c : s)
+    h = (h ^ static_cast<unsigned char>(Fold(c))) * 1099511628211ull;
+  return h;
+}
+
+bool CaseMap::MatchMask(std::string_view mask, std::string_view s) const noexcept {
+  // greedy matching, which only ever needs to backtrack to the latest star: it can absorb anything
+  // an earlier star would have
+
+  std::size_t m = 0, i = 0;
+  std::size_t star = std::string_view::npos, star_i = 0;
+  while (i < s.size()) {
+    if (m < mask.size() && mask[m] == '*') {
+      star = m++;
+      star_i = i;
+    } else if (m < mask.size() && (mask[m] == '?' || Fold(mask[m]) == Fold(s[i]))) {
+      ++m;
+      ++i;
+    } else if (star != std::string_view::npos) {
+      m = star + 1;
+      i = ++star_i;
+    } else {
+      return false;
+    }
+  }
+  while (m < mask.size() && mask[m] == '*')
+    ++m;
+  return m == mask.size();
+}
+
+} // namespace irc
@@ -0,0 +1,109 @@
+/** \file
+ * IRC casemapping rules for nicknames and channel names.
+ */
+
+#ifndef IRC_CASEMAP_H_
+#define IRC_CASEMAP_H_
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace irc {
+
+/** Casemapping rules, as advertised by the `CASEMAPPING` ISUPPORT token. */
+enum class CaseMapping {
+  /** `ascii`: only `A-Z` and `a-z` are equivalent. */
+  kAscii,
+  /** `rfc1459`: like ascii, plus `[]\^` and `{}|~` are equivalent. The default if not advertised. */
+  kRfc1459,
+  /** `strict-rfc1459`: like rfc1459, except `^` and `~` are distinct. */
+  kStrictRfc1459,
+};
+
+/**
+ * Case-insensitive comparison and hashing of IRC names under one set of casemapping rules.
+ *
+ * Every mapping folds a contiguous byte range starting at `A` onto the range 32 bytes above, which
+ * the comparison uses to fold 16 bytes at a time with SSE2 where available. The instances are
+ * static and immutable: get them with Get() or ForName().
+ */
+class CaseMap {
+ public:
+  /** Returns the casemap instance for \p mapping. */
+  static const CaseMap& Get(CaseMapping mapping) noexcept;
+
+  /** Returns the casemap for an ISUPPORT `CASEMAPPING` value, or `nullptr` if not recognized. */
+  static const CaseMap* ForName(std::string_view name) noexcept;
+
+  /** Returns the rules this casemap implements. */
+  CaseMapping mapping() const noexcept { return mapping_; }
+  /** Returns the ISUPPORT name of the rules. */
+  std::string_view name() const noexcept;
+
+  /** Returns the folded (lower-case) form of byte \p c. */
+  char Fold(char c) const noexcept { return fold_[static_cast<unsigned char>(c)]; }
+  /** Returns the folded (lower-case) form of string \p s. */
+  std::string Fold(std::string_view s) const;
+
+  /** Returns `true` if \p a and \p b are the same name under these rules. */
+  bool Equal(std::string_view a, std::string_view b) const noexcept;
+  /** Returns a hash of \p s that is consistent with Equal(). */
+  std::size_t Hash(std::string_view s) const noexcept;
+
+  /**
+   * Returns `true` if \p s matches the wildcard mask \p mask under these rules.
+   *
+   * In the mask, `*` matches any number of bytes, and `?` any one byte. This is the usual syntax of
+   * IRC masks (e.g., `nick!*@*.example.com`). There is no escape character.
+   */
+  bool MatchMask(std::string_view mask, std::string_view s) const noexcept;
+
+  /** Hash functor for unordered containers. */
+  struct Hasher {
+    const CaseMap* map;
+    std::size_t operator()(std::string_view s) const noexcept { return map->Hash(s); }
+  };
+  /** Equality functor for unordered containers. */
+  struct Equals {
+    const CaseMap* map;
+    bool operator()(std::string_view a, std::string_view b) const noexcept { return map->Equal(a, b); }
+  };
+
+  /** Map type keyed by IRC names. Construct with MakeMap(). */
+  template <typename K, typename V>
+  using Map = std::unordered_map<K, V, Hasher, Equals>;
+  /** Set type of IRC names. Construct with MakeSet(). */
+  template <typename K>
+  using Set = std::unordered_set<K, Hasher, Equals>;
+
+  /** Returns an empty map using this casemap. */
+  template <typename K, typename V>
+  Map<K, V> MakeMap() const { return Map<K, V>(0, Hasher{this}, Equals{this}); }
+  /** Returns an empty set using this casemap. */
+  template <typename K>
+  Set<K> MakeSet() const { return Set<K>(0, Hasher{this}, Equals{this}); }
+
+ private:
+  constexpr CaseMap(CaseMapping mapping, char last) noexcept;
+
+  static const CaseMap kAscii;
+  static const CaseMap kRfc1459;
+  static const CaseMap kStrictRfc1459;
+
+  CaseMapping mapping_;
+  /** Last byte of the folded range, which starts at `A`. */
+  char last_;
+  std::array<char, 256> fold_;
+};
+
+} // namespace irc
+
+#endif // IRC_CASEMAP_H_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,82 @@
+#include <string>
+
+#include "irc/casemap.h"
+#include "gtest/gtest.h"
+
+namespace irc {
+
+TEST(CaseMapTest, Ascii) {
+  const CaseMap& map = CaseMap::Get(CaseMapping::kAscii);
+  EXPECT_EQ(map.name(), "ascii");
+  EXPECT_TRUE(map.Equal("NickName", "nickname"));
+  EXPECT_FALSE(map.Equal("nick[a]", "nick{a}"));
+  EXPECT_FALSE(map.Equal("nick", "nick_"));
+  EXPECT_EQ(map.Fold("ABC[]^~"), "abc[]^~");
+}
+
+TEST(CaseMapTest, Rfc1459) {
+  const CaseMap& map = CaseMap::Get(CaseMapping::kRfc1459);
+  EXPECT_EQ(map.name(), "rfc1459");
+  EXPECT_TRUE(map.Equal("Nick[A]\\^", "nick{a}|~"));
+  EXPECT_EQ(map.Fold("X[]\\^_"), "x{}|~_");
+  EXPECT_FALSE(map.Equal("_", "\x7f"));
+}
+
+TEST(CaseMapTest, StrictRfc1459) {
+  const CaseMap& map = CaseMap::Get(CaseMapping::kStrictRfc1459);
+  EXPECT_EQ(map.name(), "strict-rfc1459");
+  EXPECT_TRUE(map.Equal("[]\\", "{}|"));
+  EXPECT_FALSE(map.Equal("^", "~"));
+}
+
+TEST(CaseMapTest, MatchMask) {
+  const CaseMap& map = CaseMap::Get(CaseMapping::kRfc1459);
+  EXPECT_TRUE(map.MatchMask("*", ""));
+  EXPECT_TRUE(map.MatchMask("*", "nick!user@host"));
+  EXPECT_TRUE(map.MatchMask("Nick[A]!*@*", "nick{a}!user@host"));
+  EXPECT_TRUE(map.MatchMask("*!*@*.example.com", "n!u@irc.EXAMPLE.com"));
+  EXPECT_TRUE(map.MatchMask("n?ck!*", "nick!u@h"));
+  EXPECT_TRUE(map.MatchMask("*a*b*c", "xxaxxbxxbc"));
+  EXPECT_FALSE(map.MatchMask("*!*@*.example.com", "n!u@example.com"));
+  EXPECT_FALSE(map.MatchMask("n?ck", "nck"));
+  EXPECT_FALSE(map.MatchMask("", "nick"));
+  EXPECT_FALSE(map.MatchMask("nick", "nick!u@h"));
+}
+
+TEST(CaseMapTest, ForName) {
+  EXPECT_EQ(CaseMap::ForName("ascii"), &CaseMap::Get(CaseMapping::kAscii));
+  EXPECT_EQ(CaseMap::ForName("rfc1459"), &CaseMap::Get(CaseMapping::kRfc1459));
+  EXPECT_EQ(CaseMap::ForName("strict-rfc1459"), &CaseMap::Get(CaseMapping::kStrictRfc1459));
+  EXPECT_EQ(CaseMap::ForName("rfc7613"), nullptr);
+}
+
+TEST(CaseMapTest, LongStrings) {
+  // exercise the vectorized path, including non-ASCII bytes that must not be folded
+  const CaseMap& map = CaseMap::Get(CaseMapping::kRfc1459);
+  std::string a = "#Some-Long-Channel-Name[With]Brackets\xc3\x84\xc3\xa4";
+  std::string b = "#some-long-channel-name{with}brackets\xc3\x84\xc3\xa4";
+  EXPECT_TRUE(map.Equal(a, b));
+  EXPECT_EQ(map.Hash(a), map.Hash(b));
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    std::string c = b;
+    c[i] ^= 0x01;
+    EXPECT_FALSE(map.Equal(a, c)) << i;
+  }
+  std::string upper = "\xc3\x84", lower = "\xc3\xa4";
+  EXPECT_FALSE(map.Equal(std::string(16, 'x') + upper, std::string(16, 'x') + lower));
+}
+
+TEST(CaseMapTest, Containers) {
+  const CaseMap& map = CaseMap::Get(CaseMapping::kRfc1459);
+  auto names = map.MakeMap<std::string, int>();
+  names["Nick[away]"] = 1;
+  names["NICK{AWAY}"] = 2;
+  ASSERT_EQ(names.size(), 1u);
+  EXPECT_EQ(names.begin()->second, 2);
+
+  auto set = map.MakeSet<std::string>();
+  EXPECT_TRUE(set.insert("#Chan").second);
+  EXPECT_FALSE(set.insert("#chan").second);
+}
+
+} // namespace irc
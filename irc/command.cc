@@ -0,0 +1,109 @@
+#include <array>
+#include <cstddef>
+
+#include "irc/command.h"
+
+namespace irc {
+
+namespace {
+
+/** Canonical names of the textual commands, in the order of the Command enum values from 1000. */
+constexpr std::string_view kNames[] = {
+  "ACCOUNT", "AUTHENTICATE", "AWAY", "CAP", "CHGHOST", "ERROR", "INVITE", "JOIN", "KICK", "KILL",
+  "MODE", "NAMES", "NICK", "NOTICE", "PART", "PASS", "PING", "PONG", "PRIVMSG", "QUIT", "TOPIC",
+  "USER", "USERHOST", "WHO", "WHOIS",
+};
+constexpr std::size_t kNameCount = sizeof kNames / sizeof *kNames;
+static_assert(kNameCount == static_cast<std::size_t>(Command::kWhois) - static_cast<std::size_t>(Command::kAccount) + 1);
+
+constexpr std::uint16_t kFirstName = static_cast<std::uint16_t>(Command::kAccount);
+
+/** Size of the perfect hash table. Must be a power of 2. */
+constexpr std::size_t kTableSize = 64;
+
+/** ASCII case-insensitive FNV-1a. The `| 0x20` folding is only exact for letters, but lookups always verify the match. */
+constexpr std::uint32_t Hash(std::string_view s, std::uint32_t seed) noexcept {
+  std::uint32_t h = seed;
+  for (char c : s)
+    h = (h ^ static_cast<std::uint8_t>(c | 0x20)) * 16777619u;
+  return (h >> 16) & (kTableSize - 1);
+}
+
+/** Finds a seed for which #Hash maps all known names to distinct slots. */
+constexpr std::uint32_t FindSeed() {
+  for (std::uint32_t seed = 2166136261u; ; ++seed) {
+    bool used[kTableSize] = {};
+    bool ok = true;
+    for (std::string_view name : kNames) {
+      std::uint32_t slot = Hash(name, seed);
+      if (used[slot]) {
+        ok = false;
+        break;
+      }
+      used[slot] = true;
+    }
+    if (ok)
+      return seed;
+  }
+}
+
+constexpr std::uint32_t kSeed = FindSeed();
+
+/** Perfect hash table: the slot of each name holds its index in #kNames plus one, or 0 if empty. */
+constexpr std::array<std::uint8_t, kTableSize> MakeTable() {
+  std::array<std::uint8_t, kTableSize> table = {};
+  for (std::size_t i = 0; i < kNameCount; ++i)
+    table[Hash(kNames[i], kSeed)] = i + 1;
+  return table;
+}
+
+constexpr std::array<std::uint8_t, kTableSize> kTable = MakeTable();
+
+/** Three-digit names of all numerics, back to back. */
+constexpr std::array<char, 3000> MakeNumerics() {
+  std::array<char, 3000> digits = {};
+  for (std::size_t n = 0; n < 1000; ++n) {
+    digits[3 * n] = '0' + n / 100;
+    digits[3 * n + 1] = '0' + n / 10 % 10;
+    digits[3 * n + 2] = '0' + n % 10;
+  }
+  return digits;
+}
+
+constexpr std::array<char, 3000> kNumerics = MakeNumerics();
+
+bool EqualName(std::string_view a, std::string_view canonical) noexcept {
+  if (a.size() != canonical.size())
+    return false;
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    char c = a[i];
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    if (c != canonical[i])
+      return false;
+  }
+  return true;
+}
+
+} // unnamed namespace
+
+Command LookupCommand(std::string_view name) noexcept {
+  if (name.size() == 3 && name[0] >= '0' && name[0] <= '9' && name[1] >= '0' && name[1] <= '9' && name[2] >= '0' && name[2] <= '9')
+    return static_cast<Command>((name[0] - '0') * 100 + (name[1] - '0') * 10 + (name[2] - '0'));
+
+  std::uint8_t entry = kTable[Hash(name, kSeed)];
+  if (entry == 0 || !EqualName(name, kNames[entry - 1]))
+    return Command::kUnknown;
+  return static_cast<Command>(kFirstName + entry - 1);
+}
+
+std::string_view CommandName(Command command) noexcept {
+  auto value = static_cast<std::uint16_t>(command);
+  if (value < 1000)
+    return std::string_view(kNumerics.data() + 3 * value, 3);
+  if (static_cast<std::size_t>(value - kFirstName) < kNameCount)
+    return kNames[value - kFirstName];
+  return std::string_view();
+}
+
+} // namespace irc
@@ -0,0 +1,85 @@
+/** \file
+ * Interned IRC command identifiers.
+ */
+
+#ifndef IRC_COMMAND_H_
+#define IRC_COMMAND_H_
+
+#include <cstdint>
+#include <string_view>
+
+namespace irc {
+
+/**
+ * Identifier of an IRC command.
+ *
+ * Numeric replies are represented by their numeric value (0-999), whether or not they have a name
+ * in this enum, so any numeric can be matched with `static_cast<Command>(n)`. Known textual
+ * commands have values from 1000 up. Anything else is #kUnknown, and must be compared by name.
+ */
+enum class Command : std::uint16_t {
+  // numeric replies
+  kRplWelcome = 1,
+  kRplISupport = 5,
+  kRplNamReply = 353,
+  kRplEndOfNames = 366,
+  kRplEndOfMotd = 376,
+  kErrNoMotd = 422,
+  kErrNicknameInUse = 433,
+  kErrUnavailResource = 437,
+  kErrNickLocked = 902,
+  kRplSaslSuccess = 903,
+  kErrSaslFail = 904,
+  kErrSaslTooLong = 905,
+  kErrSaslAborted = 906,
+  kErrSaslAlready = 907,
+
+  // textual commands
+  kAccount = 1000,
+  kAuthenticate,
+  kAway,
+  kCap,
+  kChghost,
+  kError,
+  kInvite,
+  kJoin,
+  kKick,
+  kKill,
+  kMode,
+  kNames,
+  kNick,
+  kNotice,
+  kPart,
+  kPass,
+  kPing,
+  kPong,
+  kPrivmsg,
+  kQuit,
+  kTopic,
+  kUser,
+  kUserhost,
+  kWho,
+  kWhois,
+
+  kUnknown = 0xffff,
+};
+
+/**
+ * Interns a command string.
+ *
+ * Three-digit strings map to the corresponding numeric. Textual commands are matched
+ * ASCII-case-insensitively via a compile-time perfect hash table. Returns Command::kUnknown for
+ * anything else.
+ */
+Command LookupCommand(std::string_view name) noexcept;
+
+/** Returns the canonical (upper-case, or three-digit) name of \p command, or an empty view for Command::kUnknown. */
+std::string_view CommandName(Command command) noexcept;
+
+} // namespace irc
+
+#endif // IRC_COMMAND_H_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,66 @@
+#include <string>
+
+#include "irc/command.h"
+#include "irc/message.h"
+#include "gtest/gtest.h"
+
+namespace irc {
+
+TEST(CommandTest, LookupTextual) {
+  EXPECT_EQ(LookupCommand("PRIVMSG"), Command::kPrivmsg);
+  EXPECT_EQ(LookupCommand("privmsg"), Command::kPrivmsg);
+  EXPECT_EQ(LookupCommand("PrivMsg"), Command::kPrivmsg);
+  EXPECT_EQ(LookupCommand("WHO"), Command::kWho);
+  EXPECT_EQ(LookupCommand("WHOIS"), Command::kWhois);
+  EXPECT_EQ(LookupCommand("authenticate"), Command::kAuthenticate);
+}
+
+TEST(CommandTest, LookupNumeric) {
+  EXPECT_EQ(LookupCommand("001"), Command::kRplWelcome);
+  EXPECT_EQ(LookupCommand("433"), Command::kErrNicknameInUse);
+  EXPECT_EQ(LookupCommand("999"), static_cast<Command>(999));
+  EXPECT_EQ(LookupCommand("000"), static_cast<Command>(0));
+}
+
+TEST(CommandTest, LookupUnknown) {
+  EXPECT_EQ(LookupCommand(""), Command::kUnknown);
+  EXPECT_EQ(LookupCommand("PRIVMS"), Command::kUnknown);
+  EXPECT_EQ(LookupCommand("PRIVMSGX"), Command::kUnknown);
+  EXPECT_EQ(LookupCommand("WALLOPS"), Command::kUnknown);
+  EXPECT_EQ(LookupCommand("1234"), Command::kUnknown);
+  EXPECT_EQ(LookupCommand("12a"), Command::kUnknown);
+  EXPECT_EQ(LookupCommand("J@IN"), Command::kUnknown);  // '@' | 0x20 == '`'
+}
+
+TEST(CommandTest, NamesRoundTrip) {
+  for (int v = static_cast<int>(Command::kAccount); v <= static_cast<int>(Command::kWhois); ++v) {
+    auto command = static_cast<Command>(v);
+    std::string_view name = CommandName(command);
+    ASSERT_FALSE(name.empty()) << v;
+    EXPECT_EQ(LookupCommand(name), command) << name;
+  }
+  EXPECT_EQ(CommandName(Command::kRplEndOfMotd), "376");
+  EXPECT_EQ(CommandName(static_cast<Command>(5)), "005");
+  EXPECT_EQ(CommandName(Command::kUnknown), "");
+}
+
+TEST(CommandTest, InternedByMessages) {
+  MessageView view;
+  ASSERT_TRUE(view.Parse(":nick!u@h join #chan"));
+  EXPECT_EQ(view.command_id(), Command::kJoin);
+  EXPECT_TRUE(view.command_is(Command::kJoin));
+  ASSERT_TRUE(view.Parse(":server 353 a = #chan :b c"));
+  EXPECT_EQ(view.command_id(), Command::kRplNamReply);
+  ASSERT_TRUE(view.Parse("FOO bar"));
+  EXPECT_EQ(view.command_id(), Command::kUnknown);
+
+  Message m = { "PING", "x" };
+  EXPECT_EQ(m.command_id(), Command::kPing);
+  m.set_command("pong");
+  EXPECT_EQ(m.command_id(), Command::kPong);
+  ASSERT_TRUE(m.Parse("433 * nick :in use"));
+  EXPECT_EQ(m.command_id(), Command::kErrNicknameInUse);
+  EXPECT_EQ(view.ToMessage().command_id(), Command::kUnknown);
+}
+
+} // namespace irc
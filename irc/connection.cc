@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <cerrno>
+#include <cmath>
+#include <charconv>
 #include <chrono>
 #include <cstring>
 #include <iostream>
@@ -9,8 +12,10 @@
 #include <openssl/err.h>
 #include <prometheus/counter.h>
 #include <prometheus/gauge.h>
+#include <prometheus/histogram.h>
 
 #include "base/log.h"
+#include "base/scan.h"
 #include "irc/config.pb.h"
 #include "irc/connection.h"
 
@@ -38,6 +43,21 @@ std::ostream& operator<<(std::ostream& os, const Config::Server& server) {
 constexpr auto kAutoJoinDelay = std::chrono::seconds(30);
 constexpr auto kNickRegainDelay = std::chrono::seconds(120);
 
+namespace {
+
+/**
+ * Returns `true` if \p text mentions excess flood, as the `ERROR` messages of most servers do when
+ * they disconnect a client for it.
+ */
+bool ContainsExcessFlood(std::string_view text) {
+  constexpr std::string_view kNeedle = "excess flood";
+  auto it = std::search(text.begin(), text.end(), kNeedle.begin(), kNeedle.end(),
+                        [](char a, char b) { return (a >= 'A' && a <= 'Z' ? a + 32 : a) == b; });
+  return it != text.end();
+}
+
+} // unnamed namespace
+
 // TODO sort methods?
 
 Connection::Connection(const Config& config, event::Loop* loop, prometheus::Registry* metric_registry, const std::map<std::string, std::string>& metric_labels)
@@ -49,6 +69,10 @@ Connection::Connection(const Config& config, event::Loop* loop, prometheus::Regi
   config_.set_resolve_timeout_ms(30000);
   config_.set_connect_timeout_ms(60000);
   config_.set_reconnect_delay_ms(30000);
+  config_.set_reconnect_max_delay_ms(600000);
+  config_.set_ping_interval_ms(30000);
+  config_.set_ping_timeout_ms(30000);
+  config_.set_idle_timeout_ms(120000);
   config_.MergeFrom(config);
 
   if (config_.has_sasl() && config_.sasl().mech() == SaslMechanism::PLAIN
@@ -62,6 +86,11 @@ Connection::Connection(const Config& config, event::Loop* loop, prometheus::Regi
     throw base::Exception("IRC nickname not configured");
   for (const auto& channel : config_.channels())
     channels_[channel] = ChannelState::kKnown;
+  for (const auto& server : config_.servers()) {
+    FloodConfig flood = config_.flood();
+    flood.MergeFrom(server.flood());
+    floods_.emplace_back(flood);
+  }
 
   if (metric_registry) {
     metric_connection_up_ = &prometheus::BuildGauge()
@@ -94,6 +123,47 @@ Connection::Connection(const Config& config, event::Loop* loop, prometheus::Regi
         .Help("How many bytes are pending in the write queue?")
         .Register(*metric_registry)
         .Add(metric_labels);
+    auto& write_queue_delay = prometheus::BuildHistogram()
+        .Name("irc_write_queue_delay_seconds")
+        .Help("How long did messages wait in the write queue for flood control?")
+        .Register(*metric_registry);
+    const prometheus::Histogram::BucketBoundaries buckets = { 0.001, 0.01, 0.1, 0.5, 1, 2, 5, 10, 30, 60 };
+    const char* lanes[] = { "control", "bulk" };
+    for (int lane = 0; lane < 2; ++lane) {
+      auto labels = metric_labels;
+      labels["lane"] = lanes[lane];
+      metric_write_queue_delay_[lane] = &write_queue_delay.Add(labels, buckets);
+    }
+    metric_flood_rate_ = &prometheus::BuildGauge()
+        .Name("irc_flood_credit_rate")
+        .Help("At what rate (per second) is flood control credit currently regained?")
+        .Register(*metric_registry)
+        .Add(metric_labels);
+    metric_lag_ = &prometheus::BuildGauge()
+        .Name("irc_lag_seconds")
+        .Help("How long did it take for the IRC server to answer the latest keepalive PING?")
+        .Register(*metric_registry)
+        .Add(metric_labels);
+    metric_coalesced_lines_ = &prometheus::BuildCounter()
+        .Name("irc_coalesced_lines")
+        .Help("How many lines have been merged into other queued lines instead of being sent separately?")
+        .Register(*metric_registry)
+        .Add(metric_labels);
+    metric_coalesced_credit_ = &prometheus::BuildCounter()
+        .Name("irc_coalesced_credit")
+        .Help("How much flood control credit has been saved by merging queued lines?")
+        .Register(*metric_registry)
+        .Add(metric_labels);
+    metric_reconnect_time_ = &prometheus::BuildHistogram()
+        .Name("irc_reconnect_seconds")
+        .Help("How long did it take to get reconnected after losing the connection?")
+        .Register(*metric_registry)
+        .Add(metric_labels, prometheus::Histogram::BucketBoundaries{ 1, 5, 10, 30, 60, 120, 300, 600, 1800, 3600 });
+    metric_reconnect_attempts_ = &prometheus::BuildHistogram()
+        .Name("irc_reconnect_attempts")
+        .Help("How many connection attempts did it take to get reconnected after losing the connection?")
+        .Register(*metric_registry)
+        .Add(metric_labels, prometheus::Histogram::BucketBoundaries{ 1, 2, 3, 5, 10, 20, 50 });
   }
 }
 
@@ -105,14 +175,40 @@ Connection::~Connection() {
     loop_->CancelTimer(reconnect_timer_);
   if (write_credit_timer_)
     loop_->CancelTimer(write_credit_timer_);
+  if (keepalive_timer_)
+    loop_->CancelTimer(keepalive_timer_);
+  ReleaseHandshake();
 }
 
 void Connection::Start() {
-  if (socket_)  // already running
+  if (socket_ || handshake_pending_)  // already running
     return;
 
   if (current_server_ >= config_.servers_size())
     throw base::Exception("server configuration not found");
+
+  if (handshake_limiter_) {
+    handshake_pending_ = true;
+    if (!handshake_limiter_->Acquire(this)) {
+      LOG(INFO) << "waiting for other handshakes to finish before connecting to " << config_.servers(current_server_);
+      return;
+    }
+  }
+  Connect();
+}
+
+void Connection::HandshakeGranted() {
+  Connect();
+}
+
+void Connection::ReleaseHandshake() {
+  if (handshake_pending_) {
+    handshake_limiter_->Release(this);
+    handshake_pending_ = false;
+  }
+}
+
+void Connection::Connect() {
   const Config::Server& server = config_.servers(current_server_);
   const TlsConfig* tls = server.has_tls() ? &server.tls() : config_.has_tls() ? &config_.tls() : nullptr;
   sasl_ = server.has_sasl() ? &server.sasl() : config_.has_sasl() ? &config_.sasl() : nullptr;
@@ -125,7 +221,10 @@ void Connection::Start() {
       .host(server.host())
       .port(server.port())
       .resolve_timeout_ms(config_.resolve_timeout_ms())
-      .connect_timeout_ms(config_.connect_timeout_ms());
+      .connect_timeout_ms(config_.connect_timeout_ms())
+      .connect_stagger_ms(config_.connect_stagger_ms())
+      .keepalive_ms(std::max(config_.ping_interval_ms(), 0))
+      .user_timeout_ms(std::max(config_.ping_timeout_ms(), 0));
 
   if (tls)
     builder
@@ -149,6 +248,19 @@ void Connection::Stop() {
 void Connection::ConnectionOpen() {
   LOG(INFO) << "connected to " << config_.servers(current_server_);
 
+  flood().Reset(loop_->now());
+  write_queue_.set_quantum(flood().max_cost());
+  if (metric_flood_rate_)
+    metric_flood_rate_->Set(flood().rate());
+
+  auto now = loop_->now();
+  probe_interval_ = std::chrono::milliseconds(std::max(config_.ping_interval_ms(), 0));
+  if (flood().adaptive() && (probe_interval_.count() == 0 || flood().probe_interval() < probe_interval_))
+    probe_interval_ = flood().probe_interval();
+  next_probe_ = now + probe_interval_;
+  last_read_ = now;
+  ArmKeepaliveTimer();
+
   pass_ = nullptr;
   if (!config_.servers(current_server_).pass().empty())
     pass_ = &config_.servers(current_server_).pass();
@@ -191,6 +303,13 @@ void Connection::CanRead() {
 
   if (got == 0)
     return;
+  last_read_ = loop_->now();
+
+  // find all line delimiters in the new data in one pass; any leftover data from the previous
+  // round is known not to contain any
+
+  read_delims_.clear();
+  base::scan_find2_all(read_buffer_.data() + read_buffer_used_, got, 13, 10, &read_delims_, read_buffer_used_);
 
   read_buffer_used_ += got;
   if (metric_received_bytes_)
@@ -198,20 +317,20 @@ void Connection::CanRead() {
 
   // parse complete messages and pass them to listeners
 
-  auto* start = read_buffer_.data();
-  std::size_t left = read_buffer_used_;
+  auto* data = read_buffer_.data();
+  std::size_t pos = 0, end = read_buffer_used_;
+  auto delim = read_delims_.begin(), delims_end = read_delims_.end();
 
-  while (left > 0) {
-    // read next complete message at 'start'
+  while (pos < end) {
+    // read next complete message at 'pos'
 
-    std::size_t msg_len = 0;
-    while (msg_len < left && msg_len < kMaxMessageSize && start[msg_len] != 10 && start[msg_len] != 13)
-      ++msg_len;
+    std::size_t next = delim != delims_end ? *delim : end;
+    std::size_t msg_len = std::min(next - pos, kMaxMessageSize);
 
-    if (msg_len == kMaxMessageSize || start[msg_len] == 10 || start[msg_len] == 13) {
+    if (msg_len == kMaxMessageSize || next < end) {
       // found a delimiter, or reached maximum message size
       if (msg_len > 0) {
-        if (read_message_.Parse(start, msg_len))
+        if (read_message_.Parse(data + pos, msg_len))
           HandleMessage(read_message_);
         else
           LOG(ERROR) << "invalid IRC message";  /// \todo dump bytes?
@@ -225,90 +344,206 @@ void Connection::CanRead() {
 
     // consume delimiters that followed the message
 
-    start += msg_len;
-    left -= msg_len;
-    while (left > 0 && (*start == 10 || *start == 13)) {
-      ++start;
-      --left;
+    pos += msg_len;
+    while (delim != delims_end && *delim == pos) {
+      ++pos;
+      ++delim;
     }
   }
 
   // save any incomplete data for the next round
 
+  std::size_t left = end - pos;
   read_buffer_used_ = left;
   if (left > 0)
-    std::memmove(read_buffer_.data(), start, left);
+    std::memmove(read_buffer_.data(), data + pos, left);
 
   read_message_.Clear();
 }
 
-void Connection::HandleMessage(const Message& message) {
+void Connection::HandleMessage(const MessageView& message) {
   // standard actions
 
-  if (message.command_is("CAP")) {
-    // CAP -- capability negotiation in progress
-    if (message.arg_is(1, "LS")) {
-      // CAP * LS -- capability negotiation response
-      if (message.arg_is(2, "*") && message.nargs() == 4) {
-        // CAP * LS * :... -- multiline capability reply with continuation lines expected, add to set
-        AddCaps(message.arg(3));
-      } else {
-        // CAP * LS ... -- final capability reply, add to set and then request caps or end negotiation
-        if (message.nargs() == 3)
-          AddCaps(message.arg(2));
-        ReqNeededCaps();
+  switch (message.command_id()) {
+    case Command::kCap:
+      // CAP -- capability negotiation in progress
+      if (message.arg_is(1, "LS")) {
+        // CAP * LS -- capability negotiation response
+        if (message.arg_is(2, "*") && message.nargs() == 4) {
+          // CAP * LS * :... -- multiline capability reply with continuation lines expected, add to set
+          AddCaps(std::string(message.arg(3)));
+        } else {
+          // CAP * LS ... -- final capability reply, add to set and then request caps or end negotiation
+          if (message.nargs() == 3)
+            AddCaps(std::string(message.arg(2)));
+          ReqNeededCaps();
+        }
+      } else if (message.arg_is(1, "ACK") && message.nargs() == 3) {
+        // CAP * ACK :... -- successfully enabled requested capabilities, start auth or end negotiation
+        // TODO: this should really keep a set of requested capabilities and validate the ACK
+        EndCaps(true);
+      } else if (message.arg_is(1, "NAK") && message.nargs() == 3) {
+        // CAP * NAK :... -- failed to enable requested capabilities, end negotiation anyway
+        EndCaps(false);
       }
-    } else if (message.arg_is(1, "ACK") && message.nargs() == 3) {
-      // CAP * ACK :... -- successfully enabled requested capabilities, start auth or end negotiation
-      // TODO: this should really keep a set of requested capabilities and validate the ACK
-      EndCaps(true);
-    } else if (message.arg_is(1, "NAK") && message.nargs() == 3) {
-      // CAP * NAK :... -- failed to enable requested capabilities, end negotiation anyway
-      EndCaps(false);
-    }
-  } else if (sasl_ && message.command_is("AUTHENTICATE") && message.arg_is(0, "+")) {
-    RespondSasl();
-  } else if (message.command_is("902") || message.command_is("903") || message.command_is("904") || message.command_is("905") || message.command_is("906") || message.command_is("907")) {
-    // ERR_NICKLOCKED (902), RPL_SASLSUCCESS (903), ERR_SASLFAIL (904), ERR_SASLTOOLONG (905), ERR_SASLABORTED (906), ERR_SASLALREADY (907):
-    // success or terminal error codes of SASL authentication, finish the registration sequence
-    SendNow({ "CAP", "END" });
-  } else if (message.command_is("001")) {
-    // RPL_WELCOME -- successful registration
-    Registered();
-  } if (message.command_is("376")) {
-    // RPL_ENDOFMOTD -- trigger autojoin (if not done yet)
-    if (auto_join_timer_ != event::kNoTimer) {
-      loop_->CancelTimer(auto_join_timer_);
-      AutoJoinTimer();
-    }
-  } else if (message.command_is("433") || message.command_is("437")) {
-    // ERR_NICKNAMEINUSE | ERR_UNAVAILRESOURCE -- try alt nick if registering, or restart nick regain timer
-    if (state_ == kConnecting) {
-      nick_ = config_.nick() + std::to_string(++alt_nick_);
-      SendNow({ "NICK", nick_.c_str() });
-    } else if (nick_regain_timer_ == event::kNoTimer) {
-      nick_regain_timer_ = loop_->Delay(kNickRegainDelay, base::borrow(&nick_regain_timer_callback_));
-    }
-  } else if (message.command_is("JOIN")) {
-    if (message.prefix_nick_is(nick_) && message.nargs() >= 1) {
-      auto record = channels_.find(message.arg(0));
-      if (record != channels_.end()) {
-        record->second = ChannelState::kJoined;
-        readers_.Call(&Reader::ChannelJoined, record->first);
+      break;
+
+    case Command::kAuthenticate:
+      if (sasl_ && message.arg_is(0, "+"))
+        RespondSasl();
+      break;
+
+    case Command::kErrNickLocked:
+    case Command::kRplSaslSuccess:
+    case Command::kErrSaslFail:
+    case Command::kErrSaslTooLong:
+    case Command::kErrSaslAborted:
+    case Command::kErrSaslAlready:
+      // success or terminal error codes of SASL authentication, finish the registration sequence
+      SendNow({ "CAP", "END" });
+      break;
+
+    case Command::kRplWelcome:
+      // successful registration
+      Registered();
+      break;
+
+    case Command::kRplEndOfMotd:
+      // trigger autojoin (if not done yet)
+      if (auto_join_timer_ != event::kNoTimer) {
+        loop_->CancelTimer(auto_join_timer_);
+        AutoJoinTimer();
+      }
+      break;
+
+    case Command::kErrNicknameInUse:
+    case Command::kErrUnavailResource:
+      // try alt nick if registering, or restart nick regain timer
+      if (state_ == kConnecting) {
+        nick_ = config_.nick() + std::to_string(++alt_nick_);
+        SendNow({ "NICK", nick_.c_str() });
+      } else if (nick_regain_timer_ == event::kNoTimer) {
+        nick_regain_timer_ = loop_->Delay(kNickRegainDelay, base::borrow(&nick_regain_timer_callback_));
+      }
+      break;
+
+    case Command::kRplISupport:
+      HandleISupport(message);
+      break;
+
+    case Command::kJoin:
+      if (casemap_->Equal(message.prefix_nick(), nick_) && message.nargs() >= 1) {
+        auto record = channels_.find(std::string(message.arg(0)));
+        if (record != channels_.end()) {
+          record->second = ChannelState::kJoined;
+          readers_.Call(&Reader::ChannelJoined, record->first);
+        }
+      }
+      break;
+
+    case Command::kNick:
+      if (casemap_->Equal(message.prefix_nick(), nick_) && message.nargs() >= 1) {
+        nick_ = std::string(message.arg(0));
+        readers_.Call(&Reader::NickChanged, nick_);
+      }
+      break;
+
+    case Command::kPing:
+      SendNow({ "PONG", message.nargs() == 1 ? message.arg(0) : std::string_view(config_.nick()) });
+      break;
+
+    case Command::kPong:
+      if (probe_sent_ && message.nargs() >= 1 && message.arg(message.nargs() - 1) == probe_token()) {
+        probe_sent_ = false;
+        auto lag = std::chrono::duration_cast<std::chrono::milliseconds>(loop_->now() - probe_time_);
+        if (metric_lag_)
+          metric_lag_->Set(std::chrono::duration<double>(lag).count());
+        flood().ProbeResult(lag, flood_backlogged_);
+        flood_backlogged_ = false;
+        if (metric_flood_rate_)
+          metric_flood_rate_->Set(flood().rate());
+        LOG(VERBOSE) << "lag " << lag.count() << " ms, flood control rate " << flood().rate();
+      }
+      break;
+
+    case Command::kError:
+      if (message.nargs() >= 1 && ContainsExcessFlood(message.arg(message.nargs() - 1))) {
+        flood().Penalty();
+        LOG(WARNING) << "disconnected for excess flood, reducing rate to " << flood().rate();
       }
+      break;
+
+    default:
+      break;
+  }
+
+  // pass to client
+
+  readers_.Call(static_cast<void (Reader::*)(const MessageView&)>(&Reader::RawReceived), message);
+}
+
+void Connection::HandleISupport(const MessageView& message) {
+  // RPL_ISUPPORT <client> <1-13 tokens> :are supported by this server
+  for (int i = 1; i < message.nargs() - 1; ++i) {
+    std::string_view token = message.arg(i);
+    bool negated = !token.empty() && token[0] == '-';
+    if (negated)
+      token.remove_prefix(1);
+    std::string_view value;
+    if (auto eq = token.find('='); eq != token.npos) {
+      value = token.substr(eq + 1);
+      token = token.substr(0, eq);
     }
-  } else if (message.command_is("NICK")) {
-    if (message.prefix_nick_is(nick_) && message.nargs() >= 1) {
-      nick_ = message.arg(0);
-      readers_.Call(&Reader::NickChanged, nick_);
+
+    if (token == "CASEMAPPING") {
+      const CaseMap* casemap = negated ? nullptr : CaseMap::ForName(value);
+      if (!negated && !casemap)
+        LOG(WARNING) << "unsupported casemapping, assuming rfc1459: " << value;
+      SetCaseMap(casemap ? casemap : &CaseMap::Get(CaseMapping::kRfc1459));
+    } else if (token == "CHANTYPES") {
+      chantypes_ = negated ? kDefaultChanTypes : value;
+    } else if (token == "TARGMAX") {
+      // TARGMAX=PRIVMSG:4,NOTICE:4,JOIN: -- unlisted commands take one target, empty limits none
+      max_targets_ = TargetLimits();
+      if (negated)
+        continue;
+      max_targets_ = TargetLimits{1, 1, 1};
+      while (!value.empty()) {
+        std::string_view item = value.substr(0, value.find(','));
+        value.remove_prefix(std::min(item.size() + 1, value.size()));
+        std::string_view limit;
+        if (auto colon = item.find(':'); colon != item.npos) {
+          limit = item.substr(colon + 1);
+          item = item.substr(0, colon);
+        }
+        int max = kNoTargetLimit;
+        if (!limit.empty()) {
+          auto [end, err] = std::from_chars(limit.data(), limit.data() + limit.size(), max);
+          if (err != std::errc() || end != limit.data() + limit.size() || max < 1)
+            continue;
+        }
+        switch (LookupCommand(item)) {
+          case Command::kJoin: max_targets_.join = max; break;
+          case Command::kPrivmsg: max_targets_.privmsg = max; break;
+          case Command::kNotice: max_targets_.notice = max; break;
+          default: break;
+        }
+      }
     }
-  } else if (message.command_is("PING")) {
-    SendNow({ "PONG", message.nargs() == 1 ? message.arg(0).c_str() : config_.nick().c_str() });
   }
+}
 
-  // pass to client
+void Connection::SetCaseMap(const CaseMap* casemap) {
+  if (casemap == casemap_)
+    return;
+  casemap_ = casemap;
+
+  auto channels = casemap_->MakeMap<std::string, ChannelState>();
+  for (auto& entry : channels_)
+    channels.emplace(entry.first, entry.second);  // names that became equal keep the first state
+  channels_ = std::move(channels);
 
-  readers_.Call(&Reader::RawReceived, read_message_);
+  readers_.Call(&Reader::CaseMappingChanged, *casemap_);
 }
 
 void Connection::AddCaps(const std::string& spec) {
@@ -407,23 +642,6 @@ void Connection::RespondSasl() {
   SendNow({ "AUTHENTICATE", resp });
 }
 
-namespace {
-
-/** IRC commands that get an extra surcharge. */
-const std::unordered_map<std::string, int> extra_cost = {
-  { "JOIN", 1000 },
-  { "NICK", 1000 },
-  { "PART", 1000 },
-  { "PING", 1000 },
-  { "USERHOST", 1000 },
-  { "KICK", 2000 },
-  { "MODE", 2000 },
-  { "TOPIC", 2000 },
-  { "WHO", 3000 },
-};
-
-} // unnamed namespace
-
 void Connection::Send(const Message& message) {
   if (state_ != kReady)
     return;
@@ -431,41 +649,68 @@ void Connection::Send(const Message& message) {
 }
 
 void Connection::SendNow(const Message& message) {
-  bool was_empty = write_queue_.empty();
-
   constexpr std::size_t kMaxContentSize = kMaxMessageSize - 2;
 
-  auto buffer = write_buffer_.push(kMaxContentSize);
-  std::size_t message_size = message.Write(buffer.first.data(), buffer.first.size());  // first half
+  unsigned char buffer[kMaxMessageSize];
+  std::size_t message_size = message.Write(buffer, kMaxContentSize);
   std::size_t write_size = std::min(message_size, kMaxContentSize);
-
-  if (write_size > buffer.first.size()) {
-    // didn't fit, so do trailing half
-    CHECK(buffer.second.valid() && write_size <= buffer.first.size() + buffer.second.size());
-    unsigned char tmp_buffer[write_size];
-    message.Write(tmp_buffer, write_size);
-    std::memcpy(buffer.second.data(), tmp_buffer + buffer.first.size(), write_size - buffer.first.size());
+  buffer[write_size++] = 13;
+  buffer[write_size++] = 10;
+
+  Command command = message.command_id();
+  WriteScheduler::Lane lane = WriteScheduler::LaneFor(command);
+  std::string_view target = message.nargs() > 0 ? message.arg(0) : std::string_view();
+  int cost = flood().Cost(command, write_size);
+  WriteScheduler::Entry entry{std::string(reinterpret_cast<const char*>(buffer), write_size), cost, loop_->now()};
+
+  // a message to a single target can be merged into a queued one of the same kind, or take others
+
+  int max_targets = MaxTargets(command);
+  if (max_targets > 1 && message_size <= kMaxContentSize && message.prefix().empty()
+      && message.nargs() == (command == Command::kJoin ? 1 : 2)
+      && !target.empty() && target != "0" && target[0] != ':' && target.find_first_of(", ") == target.npos) {
+    entry.targets_begin = message.command().size() + 1;
+    entry.targets_end = entry.targets_begin + target.size();
+    if (WriteScheduler::Entry* merged = write_queue_.Coalesce(lane, target, entry, max_targets, kMaxMessageSize)) {
+      int extra = flood().Cost(command, merged->data.size()) - merged->cost;
+      merged->cost += extra;
+      LOG(VERBOSE) << "coalesced " << write_size << " bytes into a queued message (cost " << extra << " instead of " << cost << ')';
+      if (metric_coalesced_lines_)
+        metric_coalesced_lines_->Increment();
+      if (metric_coalesced_credit_)
+        metric_coalesced_credit_->Increment(cost - extra);
+      if (metric_write_queue_bytes_)
+        metric_write_queue_bytes_->Set(write_buffer_.size() + write_queue_.bytes());
+      return;  // the queue wasn't empty, so a flush is pending already
+    }
   }
 
-  if (write_size < kMaxContentSize)
-    write_buffer_.unpush(kMaxContentSize - write_size);
-
-  write_buffer_.write_u8(13);
-  write_buffer_.write_u8(10);
-
-  int cost = 1000;
-  auto extra_cost_it = extra_cost.find(message.command());
-  if (extra_cost_it != extra_cost.end())
-    cost += extra_cost_it->second;
+  // if we're currently waiting for credit for a bulk message, a control message may jump the queue
+  bool reschedule = lane == WriteScheduler::Lane::kControl && write_credit_timer_ != event::kNoTimer && write_queue_.peek_lane() == WriteScheduler::Lane::kBulk;
+  bool idle = write_queue_.empty() && write_buffer_.empty();
 
-  write_queue_.emplace_back(write_size + 2, cost);
-  LOG(VERBOSE) << "added " << write_size + 2 << " bytes to the write queue (cost " << cost << ')';
+  write_queue_.Push(lane, target, std::move(entry));
+  LOG(VERBOSE) << "queued " << write_size << " bytes for writing (cost " << cost << ')';
 
   if (metric_write_queue_bytes_)
-    metric_write_queue_bytes_->Set(write_buffer_.size());
+    metric_write_queue_bytes_->Set(write_buffer_.size() + write_queue_.bytes());
 
-  if (was_empty)  // otherwise we're trying already
+  if (reschedule) {
+    loop_->CancelTimer(write_credit_timer_);
+    write_credit_timer_ = event::kNoTimer;
+    Flush();
+  } else if (idle) {  // otherwise we're trying already
     Flush();
+  }
+}
+
+int Connection::MaxTargets(Command command) const {
+  switch (command) {
+    case Command::kJoin: return max_targets_.join;
+    case Command::kPrivmsg: return max_targets_.privmsg;
+    case Command::kNotice: return max_targets_.notice;
+    default: return 1;
+  }
 }
 
 void Connection::CanWrite() {
@@ -473,105 +718,75 @@ void Connection::CanWrite() {
 }
 
 void Connection::Flush() {
-  if (write_queue_.empty()) {  // nothing to write
+  if (write_queue_.empty() && write_buffer_.empty()) {  // nothing to write
     socket_->WantWrite(false);
     return;
   }
 
   // update credit estimate
 
-  if (write_credit_ < kMaxWriteCredit) {
-    auto now = loop_->now();
-    int delta =
-        std::max(std::min(std::chrono::duration_cast<std::chrono::milliseconds>(now - write_credit_time_),
-                          std::chrono::milliseconds(kMaxWriteCredit)),
-                 std::chrono::milliseconds(0)).count();
-    write_credit_ = std::min(write_credit_ + delta, kMaxWriteCredit);
-    write_credit_time_ = now;
-  }
-
-  // see how much we can write
-
-  std::size_t can_write = 0;
-  int credit_left = write_credit_;
-
-  for (auto&& msg : write_queue_) {
-    int cost = 10 * msg.first + msg.second;
-    if (cost > credit_left)
-      break;
-    can_write += msg.first;
-    credit_left -= cost;
-  }
+  flood().Update(loop_->now());
 
-  // try to send that much
+  // alternate between writing out what's been released to the buffer, and releasing as many
+  // messages as we can afford in scheduling order; messages are only paid for when released, so
+  // the order is decided as late as possible
 
-  std::size_t wrote = 0;
+  for (;;) {
+    if (!write_buffer_.empty()) {
+      LOG(VERBOSE) << "try to write " << write_buffer_.size() << " bytes to server";
 
-  if (can_write > 0) {
-    LOG(VERBOSE) << "try to write " << can_write << " bytes to server";
-
-    auto data = write_buffer_.front(can_write);
-    for (const base::byte_view& slice : { data.first, data.second }) {
-      if (slice.size() == 0)
-        break;
-
-      base::io_result ret = socket_->Write(slice.data(), slice.size());
+      base::io_result ret = socket_->Write(write_buffer_.contiguous_front().data(), write_buffer_.size());
       if (!ret.ok()) {
         ConnectionLost(ret.error());
         return;
       }
-
-      wrote += ret.size();
-      if (ret.size() != slice.size())
-        break;  // couldn't fit all of it in
+      std::size_t wrote = ret.size();
+      write_buffer_.pop(wrote);
+      if (metric_sent_bytes_ && wrote > 0)
+        metric_sent_bytes_->Increment(wrote);
+
+      if (!write_buffer_.empty()) {  // start waiting for the socket immediately
+        if (metric_write_queue_bytes_)
+          metric_write_queue_bytes_->Set(write_buffer_.size() + write_queue_.bytes());
+        socket_->WantWrite(true);
+        return;
+      }
     }
-  }
 
-  // pop off what we managed to write
-
-  if (wrote > 0) {
-    if (metric_sent_bytes_)
-      metric_sent_bytes_->Increment(wrote);
-
-    write_buffer_.pop(wrote);
-    if (metric_write_queue_bytes_)
-      metric_write_queue_bytes_->Set(write_buffer_.size());
-
-    std::size_t pop = wrote;
-    while (pop > 0) {
-      CHECK(!write_queue_.empty());
-      auto& msg = write_queue_.front();
-      std::size_t first_bytes = msg.first;
-      if (first_bytes <= pop) {
-        pop -= first_bytes;
-        write_credit_ -= 10 * msg.first + msg.second;
-        write_queue_.pop_front();
-        if (metric_sent_lines_)
-          metric_sent_lines_->Increment();
-      } else {
-        msg.first -= pop;
-        write_credit_ -= 10 * pop;
+    auto now = loop_->now();
+    bool released = false;
+    while (const WriteScheduler::Entry* msg = write_queue_.Peek()) {
+      if (msg->cost > flood().credit())
         break;
+      flood().Charge(msg->cost);
+      if (probe_queued_ && msg->data == probe_line_) {
+        probe_queued_ = false;
+        probe_sent_ = true;
+        probe_time_ = now;
+        ArmKeepaliveTimer();  // to check for the reply timeout
       }
+      write_buffer_.write(reinterpret_cast<const base::byte*>(msg->data.data()), msg->data.size());
+      if (prometheus::Histogram* delay = metric_write_queue_delay_[write_queue_.peek_lane() == WriteScheduler::Lane::kControl ? 0 : 1])
+        delay->Observe(std::chrono::duration<double>(now - msg->queued).count());
+      if (metric_sent_lines_)
+        metric_sent_lines_->Increment();
+      write_queue_.Pop();
+      released = true;
     }
+    if (!released)
+      break;
   }
 
-  // if we couldn't fit everything we can afford, start waiting immediately
-
-  if (wrote < can_write) {
-    socket_->WantWrite(true);
-    return;
-  }
+  if (metric_write_queue_bytes_)
+    metric_write_queue_bytes_->Set(write_queue_.bytes());
 
   socket_->WantWrite(false);  // otherwise, nothing to write or need more credit
 
   // if we had anything left, see how long we need to wait to afford that
 
-  if (!write_queue_.empty()) {
-    const auto& msg = write_queue_.front();
-    int cost = 10 * msg.first + msg.second;
-    int debt = std::max(cost - write_credit_, 0);
-    write_credit_timer_ = loop_->Delay(std::chrono::milliseconds(debt), base::borrow(&write_credit_timer_callback_));
+  if (const WriteScheduler::Entry* msg = write_queue_.Peek()) {
+    flood_backlogged_ = true;
+    write_credit_timer_ = loop_->Delay(flood().Delay(msg->cost), base::borrow(&write_credit_timer_callback_));
   }
 }
 
@@ -580,26 +795,104 @@ void Connection::WriteCreditTimer() {
   Flush();
 }
 
+void Connection::KeepaliveTimer() {
+  keepalive_timer_ = event::kNoTimer;
+  auto now = loop_->now();
+
+  // give up early on a server that has gone quiet
+
+  const int ping_timeout_ms = config_.ping_timeout_ms();
+  if (probe_sent_ && ping_timeout_ms > 0 && now - probe_time_ >= std::chrono::milliseconds(ping_timeout_ms)) {
+    ConnectionLost(base::make_error("no reply to PING in " + std::to_string(ping_timeout_ms) + " ms"));
+    return;
+  }
+  const int idle_timeout_ms = config_.idle_timeout_ms();
+  if (idle_timeout_ms > 0 && now - last_read_ >= std::chrono::milliseconds(idle_timeout_ms)) {
+    ConnectionLost(base::make_error("nothing received in " + std::to_string(idle_timeout_ms) + " ms"));
+    return;
+  }
+
+  // send the next lag probe if it's time
+
+  if (probe_interval_.count() > 0 && now >= next_probe_) {
+    next_probe_ = now + probe_interval_;
+    if (probe_sent_) {
+      // no reply for a whole interval: count the time so far, which may well be a penalty
+      flood().ProbeResult(std::chrono::duration_cast<std::chrono::milliseconds>(now - probe_time_), flood_backlogged_);
+      if (metric_flood_rate_)
+        metric_flood_rate_->Set(flood().rate());
+    } else if (!probe_queued_ && state_ >= kRegistered) {  // servers won't answer before that
+      auto stamp = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+      probe_line_ = "PING bracket-" + std::to_string(stamp) + "\r\n";
+      int cost = flood().Cost(Command::kPing, probe_line_.size());
+      bool idle = write_queue_.empty() && write_buffer_.empty();
+      write_queue_.Push(WriteScheduler::Lane::kControl, std::string_view(), {probe_line_, cost, now});
+      probe_queued_ = true;
+      if (idle)
+        Flush();
+    }
+  }
+
+  ArmKeepaliveTimer();
+}
+
+void Connection::ArmKeepaliveTimer() {
+  if (keepalive_timer_ != event::kNoTimer) {
+    loop_->CancelTimer(keepalive_timer_);
+    keepalive_timer_ = event::kNoTimer;
+  }
+  if (!socket_)
+    return;
+
+  auto wake = event::TimerPoint::max();
+  if (probe_interval_.count() > 0)
+    wake = next_probe_;
+  if (probe_sent_ && config_.ping_timeout_ms() > 0)
+    wake = std::min(wake, probe_time_ + std::chrono::milliseconds(config_.ping_timeout_ms()));
+  if (config_.idle_timeout_ms() > 0)
+    wake = std::min(wake, last_read_ + std::chrono::milliseconds(config_.idle_timeout_ms()));
+  if (wake == event::TimerPoint::max())
+    return;
+
+  auto delay = std::max(wake - loop_->now(), base::TimerDuration::zero());
+  keepalive_timer_ = loop_->Delay(delay, base::borrow(&keepalive_timer_callback_));
+}
+
 void Connection::ConnectionLost(base::error_ptr error) {
   const Config::Server& server = config_.servers(current_server_);
-  const int reconnect_delay_ms = config_.reconnect_delay_ms();
+
+  // full jitter: a uniformly random delay, up to a cap that grows exponentially with each attempt
+  if (reconnect_attempts_++ == 0)
+    outage_start_ = loop_->now();
+  double cap = std::ldexp(std::max(config_.reconnect_delay_ms(), 0), std::min(reconnect_attempts_ - 1, 30));
+  cap = std::min(cap, static_cast<double>(std::max(config_.reconnect_max_delay_ms(), config_.reconnect_delay_ms())));
+  const int reconnect_delay_ms = std::uniform_int_distribution<int>(0, static_cast<int>(cap))(reconnect_random_);
 
   LOG(WARNING)
       << "connection to " << server << " lost (" << *error
-      << ") - trying next server in " << reconnect_delay_ms << " ms";
+      << ") - trying next server in " << reconnect_delay_ms << " ms (attempt " << reconnect_attempts_ << ')';
 
+  ReleaseHandshake();
   socket_.reset();
   if (metric_connection_up_)
     metric_connection_up_->Set(0);
 
   write_buffer_.clear();
-  write_queue_.clear();
+  write_queue_.Clear();
+  if (metric_write_queue_bytes_)
+    metric_write_queue_bytes_->Set(0);
 
   if (write_credit_timer_ != event::kNoTimer) {
     loop_->CancelTimer(write_credit_timer_);
     write_credit_timer_ = event::kNoTimer;
   }
 
+  if (keepalive_timer_ != event::kNoTimer) {
+    loop_->CancelTimer(keepalive_timer_);
+    keepalive_timer_ = event::kNoTimer;
+  }
+  probe_queued_ = probe_sent_ = flood_backlogged_ = false;
+
   if (auto_join_timer_ != event::kNoTimer) {
     loop_->CancelTimer(auto_join_timer_);
     auto_join_timer_ = event::kNoTimer;
@@ -620,6 +913,9 @@ void Connection::ConnectionLost(base::error_ptr error) {
 
   state_ = kDisconnected;
   nick_.clear();
+  chantypes_ = kDefaultChanTypes;
+  max_targets_ = TargetLimits();
+  SetCaseMap(&CaseMap::Get(CaseMapping::kRfc1459));
 
   current_server_ = (current_server_ + 1) % config_.servers_size();
 
@@ -633,6 +929,16 @@ void Connection::ReconnectTimer() {
 
 void Connection::Registered() {
   state_ = kRegistered;
+
+  ReleaseHandshake();
+  if (reconnect_attempts_ > 0) {
+    if (metric_reconnect_time_)
+      metric_reconnect_time_->Observe(std::chrono::duration<double>(loop_->now() - outage_start_).count());
+    if (metric_reconnect_attempts_)
+      metric_reconnect_attempts_->Observe(reconnect_attempts_);
+    reconnect_attempts_ = 0;
+  }
+
   readers_.Call(&Reader::NickChanged, nick_);
 
   if (nick_ != config_.nick() && nick_regain_timer_ == event::kNoTimer)
@@ -6,19 +6,29 @@
 #define IRC_CONNECTION_H_
 
 #include <array>
+#include <chrono>
+#include <limits>
 #include <memory>
+#include <random>
 #include <queue>
+#include <string>
+#include <string_view>
 #include <unordered_set>
+#include <vector>
 
 #include <prometheus/registry.h>
 
 #include "base/buffer.h"
+#include "base/mirrored_buffer.h"
 #include "base/callback.h"
 #include "base/common.h"
 #include "event/loop.h"
 #include "event/socket.h"
 #include "irc/config.pb.h"
+#include "irc/flood_control.h"
+#include "irc/handshake_limiter.h"
 #include "irc/message.h"
+#include "irc/write_scheduler.h"
 
 namespace irc {
 
@@ -34,42 +44,79 @@ constexpr std::size_t kMaxMessageSize = 512;
  * the initial amount of credit after a connection has been opened). The cost of sending most
  * messages is 1000 + N*10, where N is the number of bytes we need to send. An additional surcharge
  * applies to some commands (nick, join, part, ping, userhost: 1000, topic, kick, mode: 2000, who:
- * 3000). We can only send a message as long as we have sufficient credit for it.
+ * 3000). We can only send a message as long as we have sufficient credit for it. All of these
+ * numbers can be changed per server with a FloodConfig, and the rate can also be made adaptive;
+ * see FloodControl.
  *
  * This model is implemented by keeping the following bits of state:
  *
- * - Amount of credit C at a particular time T.
- * - A queue of bytes that need to be sent.
- * - A queue of (length, per-message cost) pairs that describe the contents of the byte queue.
+ * - Amount of credit C at a particular time T, in the FloodControl of the current server.
+ * - A WriteScheduler of serialized messages that have not been paid for yet, with their costs.
+ * - A buffer of bytes of paid-for messages that still need to be written to the socket.
  *
  * When a client wants to send a message, do the following:
  *
- * - Serialize the message to the send queue, and compute its length and cost.
- * - If the queue was previously empty, try to flush. (Otherwise we're already trying to clear the
- *   queue.)
+ * - Serialize the message, compute its cost, and add it to the scheduler.
+ * - If nothing was previously pending, try to flush. (Otherwise we're already trying to clear the
+ *   queue.) If we were waiting for credit for a bulk message, and this is a control message, stop
+ *   waiting and try to flush too, since the new message goes first.
  *
  * To flush the queue (when the socket seems ready for writing):
  *
  * - Update the credit counter (C += now-T, T = now).
- * - See how many messages we can afford to send from the queue.
- * - Try to write all those messages to the server.
- * - Charge credit for the sent data. If the last message was incomplete, charge only the per-byte
- *   cost, but leave the per-command cost to be paid.
- * - If the write stopped with EAGAIN/EWOULDBLOCK, start waiting for the descriptor to become ready
- *   for writing again.
- * - Otherwise, if the queue still has data remaining, it must be because of insufficient
- *   credit. Compute a suitable delay until we can send the first message and start a timer. Once
- *   the timer fires, try flushing again.
+ * - Try to write out the byte buffer. If the write stopped with EAGAIN/EWOULDBLOCK, start waiting
+ *   for the descriptor to become ready for writing again.
+ * - Otherwise, take messages in scheduling order for as long as we can afford them, charge their
+ *   cost, move them to the byte buffer, and repeat.
+ * - If the scheduler still has messages remaining, it must be because of insufficient credit.
+ *   Compute a suitable delay until we can send the next message and start a timer. Once the timer
+ *   fires, try flushing again.
+ *
+ * Paying for messages only when they are moved to the byte buffer means the scheduler decides the
+ * order as late as possible, so control messages (like `PONG`) are never stuck behind bulk traffic
+ * for longer than it takes to afford one message.
+ *
+ * It also means messages waiting for credit can be coalesced: a single-channel `JOIN`, or a
+ * `PRIVMSG` or `NOTICE` to a single target, is merged into a queued message of the same kind (and
+ * text) by adding its target to the target list, as long as the server's `TARGMAX` and the message
+ * size limit allow. The merged message costs only as much more as its size grows.
+ *
+ * **Keepalive**
+ *
+ * While connected, a `PING` with a timestamped token is sent every `ping_interval_ms` (and, with
+ * adaptive flood control, every probe interval if that's shorter). The time from writing it to the
+ * matching `PONG` is the lag of the connection, exported as a metric, and used by adaptive flood
+ * control. If there's no reply in `ping_timeout_ms`, or nothing at all is received from the server
+ * in `idle_timeout_ms`, the connection is considered lost without waiting for the socket to fail.
+ * TCP keepalive and the TCP user timeout are set accordingly, for the same reason.
+ *
+ * **Reconnecting**
+ *
+ * After a lost connection, the next server is tried after a random delay between zero and a cap
+ * that starts at `reconnect_delay_ms` and doubles with every failed attempt, up to
+ * `reconnect_max_delay_ms` ("full jitter"), so that connections lost at the same time don't all
+ * come back at the same time. The backoff resets once registration succeeds. If a
+ * HandshakeLimiter is set, it additionally caps the number of connections in the middle of a
+ * handshake at once.
  *
  * If we're not in the `kConnected` state, just let the messages remain in the queue. When a
  * connection is established, try to flush the buffer. If connection is lost because of
  * connect/read/write error, clear the queue.
  */
-class Connection : public event::Socket::Watcher {
+class Connection : public event::Socket::Watcher, public HandshakeLimiter::Waiter {
  public:
   /** Callback interface for incoming messages on the connection. */
   struct Reader : public virtual base::Callback {
-    /** Called when any new IRC message has been received. */
+    /**
+     * Called when any new IRC message has been received.
+     *
+     * The message is a view into the connection's read buffer, valid only for the duration of the
+     * call. Use MessageView::ToMessage() to keep a copy. The default implementation passes such a
+     * copy to the Message overload, so a reader can override either one. Overriding this one avoids
+     * the copy.
+     */
+    virtual void RawReceived(const MessageView& message) { RawReceived(message.ToMessage()); }
+    /** Called with a copy of every received message, unless the MessageView overload is overridden. */
     virtual void RawReceived(const Message& message) {}
     // TODO: RawSent, RawQueued?
     /** Called when the connection to a new server is ready for use. */
@@ -82,6 +129,14 @@ class Connection : public event::Socket::Watcher {
     virtual void ChannelJoined(const std::string& channel) {}
     /** Called when we have left a channel (for any reason, including lost connection). */
     virtual void ChannelLeft(const std::string& channel) {}
+    /**
+     * Called when the casemapping rules for nick and channel names have changed.
+     *
+     * This happens when the server advertises a `CASEMAPPING` other than the current one, and when
+     * the connection is lost (which resets to the default `rfc1459` rules). Any containers keyed by
+     * names must be rebuilt.
+     */
+    virtual void CaseMappingChanged(const CaseMap& casemap) {}
   };
 
   /**
@@ -101,6 +156,12 @@ class Connection : public event::Socket::Watcher {
   /** Releases all resources held by the connection. */
   ~Connection();
 
+  /**
+   * Sets a limiter for concurrent handshakes, shared with other connections. Must be called before
+   * Start(). The limiter must outlive the connection.
+   */
+  void set_handshake_limiter(HandshakeLimiter* limiter) { handshake_limiter_ = limiter; }
+
   /**
    * Attempts to establish the connection. After this method is called once, the connection will try
    * to keep itself open, reconnecting to the next server in the configuration after a short delay
@@ -131,11 +192,25 @@ class Connection : public event::Socket::Watcher {
     return readers_.Remove(reader);
   }
 
+  /** Returns the casemapping rules of the current server. */
+  const CaseMap& casemap() const { return *casemap_; }
+  /** Returns the channel name prefixes (`CHANTYPES`) of the current server. */
+  std::string_view chantypes() const { return chantypes_; }
+  /** Returns `true` if \p name is a channel name on the current server. */
+  bool IsChannel(std::string_view name) const { return !name.empty() && chantypes_.find(name[0]) != chantypes_.npos; }
+
  private:
   /** Called when the server socket has connected. */
   void ConnectionOpen() override;
   /** Called if the server socket fails to connect for any reason. */
   void ConnectionFailed(base::error_ptr error) override;
+  /** Called when the handshake limiter lets us go ahead with connecting. */
+  void HandshakeGranted() override;
+
+  /** Starts connecting to the current server. */
+  void Connect();
+  /** Gives the handshake slot back to the limiter, if we're holding or waiting for one. */
+  void ReleaseHandshake();
   /** Called when the server socket is ready to read from. */
   void CanRead() override;
   /** Called when the server socket is ready to write to. */
@@ -151,9 +226,15 @@ class Connection : public event::Socket::Watcher {
   void SendNow(const Message& message);
   /** Tries to flush as much of the send buffer as possible. */
   void Flush();
+  /** Returns how many targets the current server accepts in a \p command, for coalescing. */
+  int MaxTargets(Command command) const;
 
   /** Handles an incoming message. */
-  void HandleMessage(const Message& message);
+  void HandleMessage(const MessageView& message);
+  /** Handles the tokens of an RPL_ISUPPORT message. */
+  void HandleISupport(const MessageView& message);
+  /** Switches to new casemapping rules, rebuilding name containers and notifying readers. */
+  void SetCaseMap(const CaseMap* casemap);
 
   /** Adds new capabilities to the capability set, as part of CAP LS or CAP NEW. */
   void AddCaps(const std::string& spec);
@@ -168,6 +249,14 @@ class Connection : public event::Socket::Watcher {
 
   /** Called by timer when there's enough credit to try writing. */
   void WriteCreditTimer();
+  /** Called by timer to send lag probes, and to check for a dead connection. */
+  void KeepaliveTimer();
+  /** (Re)arms the keepalive timer for the next lag probe or timeout check, if any. */
+  void ArmKeepaliveTimer();
+  /** Returns the token of the current lag probe. */
+  std::string_view probe_token() const { return std::string_view(probe_line_).substr(5, probe_line_.size() - 7); }
+  /** Returns the flood control state of the current server. */
+  FloodControl& flood() { return floods_[current_server_]; }
 
   /** Reverts back to idle state and starts the reconnect timer. */
   void ConnectionLost(base::error_ptr error);
@@ -181,9 +270,6 @@ class Connection : public event::Socket::Watcher {
   /** Callback to attempt to regain the configured nickname. */
   void NickRegainTimer();
 
-  /** Maximum number of write credits. */
-  static constexpr int kMaxWriteCredit = 10000;
-
   /** IRC connection configuration proto. */
   Config config_;
   /** Currently active server in the configuration. */
@@ -203,9 +289,27 @@ class Connection : public event::Socket::Watcher {
   prometheus::Counter* metric_received_bytes_ = nullptr;
   prometheus::Counter* metric_received_lines_ = nullptr;
   prometheus::Gauge* metric_write_queue_bytes_ = nullptr;
+  /** Write queue delay histograms of the control and bulk lanes. */
+  prometheus::Histogram* metric_write_queue_delay_[2] = { nullptr, nullptr };
+  prometheus::Gauge* metric_flood_rate_ = nullptr;
+  prometheus::Gauge* metric_lag_ = nullptr;
+  prometheus::Histogram* metric_reconnect_time_ = nullptr;
+  prometheus::Histogram* metric_reconnect_attempts_ = nullptr;
+  prometheus::Counter* metric_coalesced_lines_ = nullptr;
+  prometheus::Counter* metric_coalesced_credit_ = nullptr;
 
   /** Reconnect timer, active if `kIdle` after an error, but running. */
   event::TimerId reconnect_timer_ = event::kNoTimer;
+  /** Number of connection attempts that have failed since the last successful registration. */
+  int reconnect_attempts_ = 0;
+  /** Time when the connection was last lost, if it hasn't been reestablished since. */
+  event::TimerPoint outage_start_;
+  /** Random number generator for the reconnect delay. */
+  std::minstd_rand reconnect_random_{std::random_device()()};
+  /** Shared limiter for concurrent handshakes, if any. */
+  HandshakeLimiter* handshake_limiter_ = nullptr;
+  /** `true` if we hold a slot from #handshake_limiter_, or are waiting for one. */
+  bool handshake_pending_ = false;
 
   /**
    * Connection state enumeration.
@@ -244,30 +348,42 @@ class Connection : public event::Socket::Watcher {
   std::array<unsigned char, 65536> read_buffer_;
   /** Amount of bytes used for an incomplete message in front of #read_buffer_. */
   std::size_t read_buffer_used_ = 0;
+  /** Offsets of line delimiters found in #read_buffer_ by the latest read. */
+  std::vector<std::uint32_t> read_delims_;
   /** Listener set for incoming messages. */
   base::CallbackSet<Reader> readers_;
-  /** Most recently parsed message. */
-  Message read_message_;
-
-  /** Outgoing byte buffer. */
-  base::ring_buffer write_buffer_;
-  /**
-   * Outgoing message queue, describing #write_buffer_ contents.
-   *
-   * The elements are (bytes, cost) pairs, where the first element is
-   * the message length (up to #kMaxMessageSize), and the second
-   * element is the per-message cost component (not including the
-   * per-byte cost).
-   */
-  std::deque<std::pair<int, int>> write_queue_;
-  /** Available write credits, as of #write_credit_time_. */
-  int write_credit_ = kMaxWriteCredit;
-  /** Time point when #write_credit_ was last updated. */
-  event::TimerPoint write_credit_time_ = loop_->now();
+  /** Most recently parsed message, pointing into #read_buffer_. */
+  MessageView read_message_;
+
+  /** Outgoing byte buffer, holding messages that have already been paid for. */
+  base::mirrored_ring_buffer write_buffer_;
+  /** Outgoing messages waiting for write credit. */
+  WriteScheduler write_queue_;
+  /** Flood control states, one for each server in the configuration. */
+  std::vector<FloodControl> floods_;
   /** `true` if we're waiting for server socket to become ready to write. */
   bool write_expected_ = false;
   /** If we're waiting for enough credits to send, id of the timer. */
   event::TimerId write_credit_timer_ = event::kNoTimer;
+  /** `true` if any messages have had to wait for credit since the last lag probe. */
+  bool flood_backlogged_ = false;
+
+  /** Keepalive timer, active while connected if lag probes or timeouts are enabled. */
+  event::TimerId keepalive_timer_ = event::kNoTimer;
+  /** Interval between lag probes on the current connection, or zero if they're disabled. */
+  std::chrono::milliseconds probe_interval_{0};
+  /** Time when the next lag probe is due. */
+  event::TimerPoint next_probe_;
+  /** Serialized current lag probe (a `PING` message), if any. */
+  std::string probe_line_;
+  /** `true` if a lag probe is in the write queue. */
+  bool probe_queued_ = false;
+  /** `true` if a lag probe has been sent, but the reply not received yet. */
+  bool probe_sent_ = false;
+  /** Time when the last lag probe was written. */
+  event::TimerPoint probe_time_;
+  /** Time when data was last received from the server. */
+  event::TimerPoint last_read_;
 
   /** Currently active nickname. May not match config_.nick() if unavailable. */
   std::string nick_;
@@ -285,12 +401,27 @@ class Connection : public event::Socket::Watcher {
     /** Currently on the channel. */
     kJoined,
   };
+  /** Casemapping rules of the current server. */
+  const CaseMap* casemap_ = &CaseMap::Get(CaseMapping::kRfc1459);
+  /** Channel name prefixes of the current server. */
+  std::string chantypes_{kDefaultChanTypes};
+  /** Target count of commands without a limit. */
+  static constexpr int kNoTargetLimit = std::numeric_limits<int>::max();
+  /** Per-command target count limits, as advertised by `TARGMAX`, or assumed without it. */
+  struct TargetLimits {
+    int join = kNoTargetLimit;
+    int privmsg = 1;
+    int notice = 1;
+  };
+  /** Target count limits of the current server. */
+  TargetLimits max_targets_;
   /** States configured channels are in. */
-  std::unordered_map<std::string, ChannelState> channels_;
+  CaseMap::Map<std::string, ChannelState> channels_ = casemap_->MakeMap<std::string, ChannelState>();
   /** If we're waiting to auto-join channels, id of the timer. */
   event::TimerId auto_join_timer_ = event::kNoTimer;
 
   event::TimedM<Connection, &Connection::WriteCreditTimer> write_credit_timer_callback_{this};
+  event::TimedM<Connection, &Connection::KeepaliveTimer> keepalive_timer_callback_{this};
   event::TimedM<Connection, &Connection::ReconnectTimer> reconnect_timer_callback_{this};
   event::TimedM<Connection, &Connection::AutoJoinTimer> auto_join_timer_callback_{this};
   event::TimedM<Connection, &Connection::NickRegainTimer> nick_regain_timer_callback_{this};
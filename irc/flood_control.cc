@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "base/exc.h"
+#include "irc/flood_control.h"
+
+namespace irc {
+
+namespace {
+
+/** Returns \p value, or \p def if it's unset (zero). */
+template <typename T>
+T Or(T value, T def) {
+  return value != 0 ? value : def;
+}
+
+/** Default per-command surcharges. */
+int DefaultCommandCost(Command command) noexcept {
+  switch (command) {
+    case Command::kJoin:
+    case Command::kNick:
+    case Command::kPart:
+    case Command::kPing:
+    case Command::kUserhost:
+      return 1000;
+    case Command::kKick:
+    case Command::kMode:
+    case Command::kTopic:
+      return 2000;
+    case Command::kWho:
+      return 3000;
+    default:
+      return 0;
+  }
+}
+
+} // unnamed namespace
+
+FloodControl::FloodControl(const FloodConfig& config)
+    : max_credit_(Or(config.max_credit(), 10000)),
+      credit_per_second_(Or(config.credit_per_second(), 1000)),
+      message_cost_(Or(config.message_cost(), 1000)),
+      byte_cost_(Or(config.byte_cost(), 10)),
+      adaptive_(config.has_adaptive()),
+      max_scale_(Or(config.adaptive().max_scale(), 4.0)),
+      min_scale_(Or(config.adaptive().min_scale(), 0.5)),
+      increase_(Or(config.adaptive().increase(), 0.1)),
+      decrease_(Or(config.adaptive().decrease(), 0.5)),
+      probe_interval_(Or(config.adaptive().probe_interval_ms(), 10000)),
+      lag_threshold_(Or(config.adaptive().lag_threshold_ms(), 2000)),
+      credit_(max_credit_)
+{
+  if (max_credit_ < 0 || credit_per_second_ < 0 || message_cost_ < 0 || byte_cost_ < 0)
+    throw base::Exception("flood control parameters must not be negative");
+  for (const auto& [name, cost] : config.command_cost()) {
+    Command command = LookupCommand(name);
+    if (command == Command::kUnknown)
+      throw base::Exception("unknown command in flood control configuration: " + name);
+    command_costs_.emplace_back(command, cost);
+  }
+  if (max_cost() > max_credit_)
+    throw base::Exception("flood control max_credit too low to send a full-length message");
+
+  if (adaptive_) {
+    if (min_scale_ <= 0 || min_scale_ > max_scale_ || decrease_ <= 0 || decrease_ >= 1)
+      throw base::Exception("invalid adaptive flood control parameters");
+    scale_ = std::clamp(1.0, min_scale_, max_scale_);
+  }
+}
+
+void FloodControl::Reset(base::TimerPoint now) noexcept {
+  credit_ = max_credit_;
+  credit_time_ = now;
+  min_lag_ = std::chrono::milliseconds::max();
+}
+
+int FloodControl::Cost(Command command, std::size_t bytes) const noexcept {
+  int extra = DefaultCommandCost(command);
+  for (const auto& [c, cost] : command_costs_) {
+    if (c == command) {
+      extra = cost;
+      break;
+    }
+  }
+  return message_cost_ + byte_cost_ * static_cast<int>(bytes) + extra;
+}
+
+int FloodControl::max_cost() const noexcept {
+  int extra = 3000;  // WHO
+  for (const auto& entry : command_costs_)
+    extra = std::max(extra, entry.second);
+  return message_cost_ + byte_cost_ * 512 + extra;
+}
+
+void FloodControl::Update(base::TimerPoint now) noexcept {
+  if (credit_ < max_credit_ && now > credit_time_) {
+    double elapsed = std::chrono::duration<double>(now - credit_time_).count();
+    credit_ = std::min(credit_ + elapsed * rate(), static_cast<double>(max_credit_));
+  }
+  credit_time_ = std::max(now, credit_time_);
+}
+
+std::chrono::milliseconds FloodControl::Delay(int cost) const noexcept {
+  double debt = cost - credit_;
+  if (debt <= 0 || rate() <= 0)
+    return std::chrono::milliseconds(0);
+  return std::chrono::milliseconds(static_cast<long>(std::ceil(1000 * debt / rate())));
+}
+
+void FloodControl::ProbeResult(std::chrono::milliseconds lag, bool backlogged) noexcept {
+  if (!adaptive_)
+    return;
+  min_lag_ = std::min(min_lag_, lag);
+  if (lag - min_lag_ > lag_threshold_)
+    Penalty();
+  else if (backlogged)
+    scale_ = std::min(scale_ + increase_, max_scale_);
+}
+
+void FloodControl::Penalty() noexcept {
+  if (adaptive_)
+    scale_ = std::max(scale_ * decrease_, min_scale_);
+}
+
+} // namespace irc
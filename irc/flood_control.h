@@ -0,0 +1,110 @@
+/** \file
+ * Output flood control model.
+ */
+
+#ifndef IRC_FLOOD_CONTROL_H_
+#define IRC_FLOOD_CONTROL_H_
+
+#include <chrono>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "base/timer.h"
+#include "irc/command.h"
+#include "irc/config.pb.h"
+
+namespace irc {
+
+/**
+ * Write credit accounting for one server, as configured by a FloodConfig.
+ *
+ * Credit is regained continuously at rate() per second, up to a maximum. The cost of a message is
+ * given by Cost(). The connection keeps the credit up to date with Update(), and sends a message
+ * only when credit() covers its cost, after which it calls Charge().
+ *
+ * In adaptive mode, the regain rate is the configured rate times a scale factor, which is raised
+ * additively by ProbeResult() while the connection has a backlog, and cut multiplicatively by
+ * Penalty() (additive increase, multiplicative decrease). The scale survives Reset(), so it carries
+ * over between connections to the same server.
+ */
+class FloodControl {
+ public:
+  /**
+   * Constructs the model from \p config, using the defaults for any unset fields.
+   *
+   * Throws base::Exception if the configuration is invalid.
+   */
+  explicit FloodControl(const FloodConfig& config);
+
+  /** Restores full credit for a new connection, and forgets the lag baseline. */
+  void Reset(base::TimerPoint now) noexcept;
+
+  /** Returns the cost of sending a message of type \p command, \p bytes long. */
+  int Cost(Command command, std::size_t bytes) const noexcept;
+  /** Returns an upper bound for the cost of any message. */
+  int max_cost() const noexcept;
+
+  /** Adds the credit regained since the last update. */
+  void Update(base::TimerPoint now) noexcept;
+  /** Returns the currently available credit, rounded down. */
+  int credit() const noexcept { return static_cast<int>(credit_); }
+  /** Deducts \p cost from the available credit. */
+  void Charge(int cost) noexcept { credit_ -= cost; }
+  /** Returns how long until there's enough credit for a message costing \p cost. */
+  std::chrono::milliseconds Delay(int cost) const noexcept;
+
+  /** Returns the current credit regain rate, per second. */
+  double rate() const noexcept { return credit_per_second_ * scale_; }
+  /** Returns the current multiple of the configured regain rate. */
+  double scale() const noexcept { return scale_; }
+
+  /** Returns `true` if the regain rate is adjusted adaptively. */
+  bool adaptive() const noexcept { return adaptive_; }
+  /** Returns the interval between lag probes in adaptive mode. */
+  std::chrono::milliseconds probe_interval() const noexcept { return probe_interval_; }
+
+  /**
+   * Reports a lag probe result in adaptive mode.
+   *
+   * If \p lag exceeds the lowest lag seen since Reset() by more than the threshold, applies a
+   * Penalty(). Otherwise, if \p backlogged (messages waited for credit since the last probe), raises
+   * the rate a step.
+   */
+  void ProbeResult(std::chrono::milliseconds lag, bool backlogged) noexcept;
+  /** Cuts back the rate in adaptive mode, after a penalty signal from the server. */
+  void Penalty() noexcept;
+
+ private:
+  int max_credit_;
+  double credit_per_second_;
+  int message_cost_;
+  int byte_cost_;
+  /** Configured surcharges, overriding the default ones. */
+  std::vector<std::pair<Command, int>> command_costs_;
+
+  bool adaptive_;
+  double max_scale_;
+  double min_scale_;
+  double increase_;
+  double decrease_;
+  std::chrono::milliseconds probe_interval_;
+  std::chrono::milliseconds lag_threshold_;
+
+  /** Available credit, as of #credit_time_. */
+  double credit_;
+  /** Time point when #credit_ was last updated. */
+  base::TimerPoint credit_time_;
+  /** Current multiple of the configured regain rate. */
+  double scale_ = 1.0;
+  /** Lowest probe lag seen since the last Reset(). */
+  std::chrono::milliseconds min_lag_ = std::chrono::milliseconds::max();
+};
+
+} // namespace irc
+
+#endif // IRC_FLOOD_CONTROL_H_
+
+// Local Variables:
+// mode: c++
+// End:
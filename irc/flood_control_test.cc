@@ -0,0 +1,96 @@
+#include <chrono>
+
+#include "base/exc.h"
+#include "irc/flood_control.h"
+#include "gtest/gtest.h"
+
+namespace irc {
+
+using std::chrono::milliseconds;
+
+TEST(FloodControlTest, Defaults) {
+  FloodControl flood{FloodConfig()};
+  EXPECT_FALSE(flood.adaptive());
+  EXPECT_EQ(flood.credit(), 10000);
+  EXPECT_EQ(flood.rate(), 1000);
+  EXPECT_EQ(flood.Cost(Command::kPrivmsg, 100), 2000);
+  EXPECT_EQ(flood.Cost(Command::kJoin, 10), 2100);
+  EXPECT_EQ(flood.Cost(Command::kMode, 10), 3100);
+  EXPECT_EQ(flood.Cost(Command::kWho, 10), 4100);
+  EXPECT_EQ(flood.max_cost(), 9120);
+}
+
+TEST(FloodControlTest, Configured) {
+  FloodConfig config;
+  config.set_max_credit(20000);
+  config.set_credit_per_second(2000);
+  config.set_message_cost(500);
+  config.set_byte_cost(5);
+  (*config.mutable_command_cost())["JOIN"] = 0;
+  (*config.mutable_command_cost())["privmsg"] = 250;
+  FloodControl flood(config);
+  EXPECT_EQ(flood.credit(), 20000);
+  EXPECT_EQ(flood.rate(), 2000);
+  EXPECT_EQ(flood.Cost(Command::kPrivmsg, 100), 1250);
+  EXPECT_EQ(flood.Cost(Command::kJoin, 10), 550);
+  EXPECT_EQ(flood.Cost(Command::kWho, 10), 3550);
+}
+
+TEST(FloodControlTest, InvalidConfig) {
+  FloodConfig unknown;
+  (*unknown.mutable_command_cost())["FROBNICATE"] = 100;
+  EXPECT_THROW(FloodControl{unknown}, base::Exception);
+
+  FloodConfig tight;
+  tight.set_max_credit(5000);
+  EXPECT_THROW(FloodControl{tight}, base::Exception);
+
+  FloodConfig adaptive;
+  adaptive.mutable_adaptive()->set_decrease(1.5);
+  EXPECT_THROW(FloodControl{adaptive}, base::Exception);
+}
+
+TEST(FloodControlTest, Credit) {
+  FloodControl flood{FloodConfig()};
+  base::TimerPoint t0;
+  flood.Reset(t0);
+
+  flood.Charge(9500);
+  EXPECT_EQ(flood.credit(), 500);
+  EXPECT_EQ(flood.Delay(2000), milliseconds(1500));
+  EXPECT_EQ(flood.Delay(400), milliseconds(0));
+
+  flood.Update(t0 + milliseconds(1500));
+  EXPECT_EQ(flood.credit(), 2000);
+  flood.Update(t0 + std::chrono::seconds(60));
+  EXPECT_EQ(flood.credit(), 10000);
+}
+
+TEST(FloodControlTest, Adaptive) {
+  FloodConfig config;
+  config.mutable_adaptive()->set_max_scale(1.5);
+  config.mutable_adaptive()->set_increase(0.25);
+  FloodControl flood(config);
+  ASSERT_TRUE(flood.adaptive());
+  flood.Reset(base::TimerPoint());
+  EXPECT_EQ(flood.scale(), 1.0);
+
+  flood.ProbeResult(milliseconds(100), true);
+  EXPECT_EQ(flood.scale(), 1.25);
+  flood.ProbeResult(milliseconds(150), false);  // no backlog, no need to go faster
+  EXPECT_EQ(flood.scale(), 1.25);
+  flood.ProbeResult(milliseconds(120), true);
+  flood.ProbeResult(milliseconds(120), true);
+  EXPECT_EQ(flood.scale(), 1.5);
+  EXPECT_EQ(flood.rate(), 1500);
+
+  flood.ProbeResult(milliseconds(2500), true);  // lag up by more than 2 s: back off
+  EXPECT_EQ(flood.scale(), 0.75);
+  flood.Penalty();
+  EXPECT_EQ(flood.scale(), 0.5);  // clamped to min_scale
+
+  flood.Reset(base::TimerPoint());  // keeps the scale
+  EXPECT_EQ(flood.scale(), 0.5);
+}
+
+} // namespace irc
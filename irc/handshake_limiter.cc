@@ -0,0 +1,71 @@
+#include <algorithm>
+
+#include "base/log.h"
+#include "irc/handshake_limiter.h"
+
+namespace irc {
+
+namespace {
+
+/** Removes \p item from \p container, returning `true` if it was there. */
+template <typename C, typename T>
+bool Erase(C* container, const T& item) {
+  auto it = std::find(container->begin(), container->end(), item);
+  if (it == container->end())
+    return false;
+  container->erase(it);
+  return true;
+}
+
+} // unnamed namespace
+
+HandshakeLimiter::HandshakeLimiter(event::Loop* loop, int max_active)
+    : loop_(loop), max_active_(std::max(max_active, 1))
+{}
+
+HandshakeLimiter::~HandshakeLimiter() {
+  if (notify_timer_ != event::kNoTimer)
+    loop_->CancelTimer(notify_timer_);
+}
+
+bool HandshakeLimiter::Acquire(Waiter* waiter) {
+  CHECK(std::find(active_.begin(), active_.end(), waiter) == active_.end());
+  if (queue_.empty() && active_.size() < max_active_) {
+    active_.push_back(waiter);
+    return true;
+  }
+  if (std::find(queue_.begin(), queue_.end(), waiter) == queue_.end())
+    queue_.push_back(waiter);
+  return false;
+}
+
+void HandshakeLimiter::Release(Waiter* waiter) {
+  if (Erase(&active_, waiter)) {
+    Erase(&granted_, waiter);
+    Grant();
+  } else {
+    Erase(&queue_, waiter);
+  }
+}
+
+void HandshakeLimiter::Grant() {
+  while (!queue_.empty() && active_.size() < max_active_) {
+    active_.push_back(queue_.front());
+    granted_.push_back(queue_.front());
+    queue_.pop_front();
+  }
+  if (!granted_.empty() && notify_timer_ == event::kNoTimer)
+    notify_timer_ = loop_->Delay(std::chrono::milliseconds(0), base::borrow(&notify_timer_callback_));
+}
+
+void HandshakeLimiter::NotifyTimer() {
+  notify_timer_ = event::kNoTimer;
+  // a waiter may release or acquire slots from the callback, so take them one at a time
+  while (!granted_.empty()) {
+    Waiter* waiter = granted_.front();
+    granted_.erase(granted_.begin());
+    waiter->HandshakeGranted();
+  }
+}
+
+} // namespace irc
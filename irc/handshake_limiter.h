@@ -0,0 +1,82 @@
+/** \file
+ * Process-wide limit on concurrent IRC connection handshakes.
+ */
+
+#ifndef IRC_HANDSHAKE_LIMITER_H_
+#define IRC_HANDSHAKE_LIMITER_H_
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#include "base/callback.h"
+#include "base/common.h"
+#include "event/loop.h"
+
+namespace irc {
+
+/**
+ * Caps the number of connections going through a handshake at the same time.
+ *
+ * A handshake covers everything from name resolution to the end of IRC registration. When many
+ * connections are lost at once (say, due to a local network outage), letting all of them reconnect
+ * in parallel tends to trip the connection throttles of the servers, and the resulting failures
+ * just make things worse. With a shared limiter, the rest wait in line, in the order they asked.
+ *
+ * The limiter is not thread-safe: all the connections using it must run on its event loop.
+ */
+class HandshakeLimiter {
+ public:
+  /** Interface for connections waiting for their turn. */
+  struct Waiter : public virtual base::Callback {
+    /** Called when the slot requested by Acquire() has been granted. */
+    virtual void HandshakeGranted() = 0;
+  };
+
+  /** Constructs a limiter allowing \p max_active concurrent handshakes. */
+  HandshakeLimiter(event::Loop* loop, int max_active);
+  DISALLOW_COPY(HandshakeLimiter);
+  ~HandshakeLimiter();
+
+  /**
+   * Requests a handshake slot for \p waiter.
+   *
+   * Returns `true` if the slot was granted immediately. Otherwise, the waiter is queued, and its
+   * Waiter::HandshakeGranted() method is called later from the event loop (never during a call to
+   * this class).
+   */
+  bool Acquire(Waiter* waiter);
+  /** Releases the slot held by \p waiter, or withdraws its request. Does nothing if neither. */
+  void Release(Waiter* waiter);
+
+  /** Returns the number of slots in use, including those granted but not yet notified. */
+  std::size_t active() const noexcept { return active_.size(); }
+  /** Returns the number of waiters queued. */
+  std::size_t waiting() const noexcept { return queue_.size(); }
+
+ private:
+  /** Grants free slots to queued waiters, and arms the notification timer if needed. */
+  void Grant();
+  /** Called by timer to notify the waiters granted a slot. */
+  void NotifyTimer();
+
+  event::Loop* loop_;
+  const std::size_t max_active_;
+  /** Waiters holding a slot. */
+  std::vector<Waiter*> active_;
+  /** Waiters granted a slot, but not notified yet. A subset of #active_. */
+  std::vector<Waiter*> granted_;
+  /** Waiters waiting for a slot, in order of arrival. */
+  std::deque<Waiter*> queue_;
+
+  event::TimerId notify_timer_ = event::kNoTimer;
+  event::TimedM<HandshakeLimiter, &HandshakeLimiter::NotifyTimer> notify_timer_callback_{this};
+};
+
+} // namespace irc
+
+#endif // IRC_HANDSHAKE_LIMITER_H_
+
+// Local Variables:
+// mode: c++
+// End:
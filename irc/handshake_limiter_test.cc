@@ -0,0 +1,73 @@
+#include <vector>
+
+#include "event/loop.h"
+#include "irc/handshake_limiter.h"
+#include "gtest/gtest.h"
+
+namespace irc {
+
+namespace {
+
+struct TestWaiter : public HandshakeLimiter::Waiter {
+  explicit TestWaiter(std::vector<TestWaiter*>* log) : log(log) {}
+  void HandshakeGranted() override { log->push_back(this); }
+  std::vector<TestWaiter*>* log;
+};
+
+} // unnamed namespace
+
+TEST(HandshakeLimiterTest, GrantsInOrder) {
+  event::Loop loop;
+  HandshakeLimiter limiter(&loop, 2);
+  std::vector<TestWaiter*> granted;
+  TestWaiter a(&granted), b(&granted), c(&granted), d(&granted);
+
+  EXPECT_TRUE(limiter.Acquire(&a));
+  EXPECT_TRUE(limiter.Acquire(&b));
+  EXPECT_FALSE(limiter.Acquire(&c));
+  EXPECT_FALSE(limiter.Acquire(&d));
+  EXPECT_EQ(limiter.active(), 2);
+  EXPECT_EQ(limiter.waiting(), 2);
+
+  limiter.Release(&b);
+  EXPECT_TRUE(granted.empty());  // not during the call
+  EXPECT_EQ(limiter.active(), 2);
+  loop.Poll();
+  EXPECT_EQ(granted, std::vector<TestWaiter*>{&c});
+
+  limiter.Release(&a);
+  limiter.Release(&c);
+  loop.Poll();
+  EXPECT_EQ(granted, (std::vector<TestWaiter*>{&c, &d}));
+  EXPECT_EQ(limiter.active(), 1);
+  EXPECT_EQ(limiter.waiting(), 0);
+}
+
+TEST(HandshakeLimiterTest, Withdraw) {
+  event::Loop loop;
+  HandshakeLimiter limiter(&loop, 1);
+  std::vector<TestWaiter*> granted;
+  TestWaiter a(&granted), b(&granted), c(&granted);
+
+  EXPECT_TRUE(limiter.Acquire(&a));
+  EXPECT_FALSE(limiter.Acquire(&b));
+  EXPECT_FALSE(limiter.Acquire(&c));
+  limiter.Release(&b);  // gave up waiting
+  EXPECT_EQ(limiter.waiting(), 1);
+
+  limiter.Release(&a);
+  limiter.Release(&c);  // granted, but released before being told
+  EXPECT_EQ(limiter.active(), 0);
+  loop.Poll();
+  EXPECT_TRUE(granted.empty());
+
+  // a newcomer doesn't jump the queue
+  EXPECT_TRUE(limiter.Acquire(&a));
+  EXPECT_FALSE(limiter.Acquire(&b));
+  limiter.Release(&a);
+  EXPECT_FALSE(limiter.Acquire(&c));
+  loop.Poll();
+  EXPECT_EQ(granted, std::vector<TestWaiter*>{&b});
+}
+
+} // namespace irc
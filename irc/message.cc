@@ -1,7 +1,7 @@
 #include <algorithm>
-#include <cctype>
 #include <cstring>
 
+#include "base/scan.h"
 #include "irc/message.h"
 
 namespace irc {
@@ -9,15 +9,27 @@ namespace irc {
 // TODO: consider leveraging RE2 for some of this
 // TODO: share code between the two constructors
 
+namespace {
+
+/** Returns the length of the token at \p p: the number of bytes before the next space, at most \p left. */
+inline std::size_t TokenLength(const char* p, std::size_t left) {
+  auto* b = reinterpret_cast<const base::byte*>(p);
+  return base::scan_find(b, b + left, ' ') - b;
+}
+
+} // unnamed namespace
+
 Message::Message(std::initializer_list<const char*> contents, const char* prefix) {
   if (prefix)
     prefix_.append(prefix);
+  UpdateNick();
 
   const char* const* p = contents.begin();
   const char* const* end = contents.end();
 
   if (p != end) {
     command_.append(*p);
+    command_id_ = LookupCommand(command_);
     ++p;
   }
 
@@ -30,12 +42,14 @@ Message::Message(std::initializer_list<const char*> contents, const char* prefix
 Message::Message(std::initializer_list<std::string_view> contents, std::string_view prefix) {
   if (!prefix.empty())
     prefix_.append(prefix);
+  UpdateNick();
 
   std::string_view const* p = contents.begin();
   std::string_view const* end = contents.end();
 
   if (p != end) {
     command_.append(*p);
+    command_id_ = LookupCommand(command_);
     ++p;
   }
 
@@ -46,82 +60,21 @@ Message::Message(std::initializer_list<std::string_view> contents, std::string_v
 }
 
 bool Message::Parse(const unsigned char* data, std::size_t count) {
-  auto* p = reinterpret_cast<const char*>(data);
-  std::size_t left = count;
-
-  // parse prefix & extract nick portion
-
-  prefix_.clear();
-  if (left > 0 && *p == ':') {
-    ++p;
-    --left;
-
-    auto* d = static_cast<const char*>(std::memchr(p, ' ', left));
-    if (!d)
-      return false;
-
-    std::size_t prefix_len = d - p;
-    prefix_.append(p, prefix_len);
-    UpdateNick();
-
-    p += prefix_len;
-    left -= prefix_len;
-  }
-
-  // skip any extra leading whitespace
-
-  while (left > 0 && *p == ' ') {
-    ++p;
-    --left;
-  }
-
-  // parse command
-
-  command_.clear();
-  {
-    std::size_t command_len = 0;
-    while (command_len < left && p[command_len] != ' ')
-      ++command_len;
-    if (command_len == 0)
-      return false;
-    command_.append(p, command_len);
-    p += command_len;
-    left -= command_len;
-  }
-
-  // parse any arguments
-
-  args_.clear();
-  while (left > 0) {
-    while (left > 0 && *p == ' ') {
-      ++p;
-      --left;
-    }
-    if (left == 0)
-      break;
-
-    if (*p == ':') {
-      args_.emplace_back(p+1, left-1);
-      return true;
-    }
-
-    std::size_t arg_len = 0;
-    while (arg_len < left && p[arg_len] != ' ')
-      ++arg_len;
-    args_.emplace_back(p, arg_len);
-    p += arg_len;
-    left -= arg_len;
-  }
+  MessageView view;
+  if (!view.Parse(data, count))
+    return false;
 
+  prefix_.assign(view.prefix());
+  UpdateNick();
+  command_.assign(view.command());
+  command_id_ = view.command_id();
+  args_.assign(view.args().begin(), view.args().end());
   return true;
 }
 
 void Message::UpdateNick() {
   auto len = prefix_.find('!');
-  if (len != prefix_.npos)
-    prefix_nick_ = std::string_view{prefix_.data(), len};
-  else
-    prefix_nick_ = std::string_view{};
+  prefix_nick_len_ = len != prefix_.npos ? len : 0;
 }
 
 std::size_t Message::Write(unsigned char* buffer, std::size_t size) const {
@@ -168,24 +121,102 @@ std::size_t Message::Write(unsigned char* buffer, std::size_t size) const {
   return at;
 }
 
-std::string_view Message::reply_target() const {
+std::string_view Message::reply_target(std::string_view chantypes) const {
   if (nargs() < 1 || arg(0).empty())
     return std::string_view();
-  char sigil = arg(0)[0];
-  if (sigil == '#' || sigil == '!' || sigil == '+' || sigil == '&')
+  if (chantypes.find(arg(0)[0]) != chantypes.npos)
     return arg(0);
   else
     return prefix_nick();
 }
 
+MessageView::MessageView(const Message& message)
+    : prefix_(message.prefix()), prefix_nick_(message.prefix_nick()), command_(message.command()),
+      command_id_(message.command_id()), args_(message.args().begin(), message.args().end())
+{}
 
-bool Message::EqualArg(std::string_view a, std::string_view b) {
-  if (a.size() != b.size())
-    return false;
-  for (std::size_t i = 0, len = a.size(); i < len; ++i)
-    if (std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i]))
+bool MessageView::Parse(const unsigned char* data, std::size_t count) {
+  auto* p = reinterpret_cast<const char*>(data);
+  std::size_t left = count;
+
+  // parse prefix & extract nick portion
+
+  prefix_ = prefix_nick_ = std::string_view();
+  if (left > 0 && *p == ':') {
+    ++p;
+    --left;
+
+    std::size_t prefix_len = TokenLength(p, left);
+    if (prefix_len == left)
+      return false;
+
+    prefix_ = std::string_view(p, prefix_len);
+    if (auto nick_len = prefix_.find('!'); nick_len != prefix_.npos)
+      prefix_nick_ = prefix_.substr(0, nick_len);
+
+    p += prefix_len;
+    left -= prefix_len;
+  }
+
+  // skip any extra leading whitespace
+
+  while (left > 0 && *p == ' ') {
+    ++p;
+    --left;
+  }
+
+  // parse command
+
+  {
+    std::size_t command_len = TokenLength(p, left);
+    if (command_len == 0)
       return false;
+    command_ = std::string_view(p, command_len);
+    command_id_ = LookupCommand(command_);
+    p += command_len;
+    left -= command_len;
+  }
+
+  // parse any arguments
+
+  args_.clear();
+  while (left > 0) {
+    while (left > 0 && *p == ' ') {
+      ++p;
+      --left;
+    }
+    if (left == 0)
+      break;
+
+    if (*p == ':') {
+      args_.emplace_back(p+1, left-1);
+      return true;
+    }
+
+    std::size_t arg_len = TokenLength(p, left);
+    args_.emplace_back(p, arg_len);
+    p += arg_len;
+    left -= arg_len;
+  }
+
   return true;
 }
 
+Message MessageView::ToMessage() const {
+  Message message;
+  message.set_prefix(std::string(prefix_));
+  message.set_command(std::string(command_));
+  message.mutable_args()->assign(args_.begin(), args_.end());
+  return message;
+}
+
+std::string_view MessageView::reply_target(std::string_view chantypes) const {
+  if (nargs() < 1 || args_[0].empty())
+    return std::string_view();
+  if (chantypes.find(args_[0][0]) != chantypes.npos)
+    return args_[0];
+  else
+    return prefix_nick();
+}
+
 } // namespace irc
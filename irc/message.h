@@ -11,8 +11,16 @@
 #include <string_view>
 #include <vector>
 
+#include "irc/casemap.h"
+#include "irc/command.h"
+
 namespace irc {
 
+class MessageView;
+
+/** Channel name prefixes assumed if the server does not advertise `CHANTYPES`. */
+inline constexpr std::string_view kDefaultChanTypes = "#!+&";
+
 /** IRC protocol message. */
 class Message {
  public:
@@ -77,6 +85,7 @@ class Message {
   void Clear() {
     prefix_.clear();
     command_.clear();
+    command_id_ = Command::kUnknown;
     args_.clear();
   }
 
@@ -84,6 +93,8 @@ class Message {
   const std::string& prefix() const { return prefix_; }
   /** Returns the command, which is only empty for an empty message. */
   const std::string& command() const { return command_; }
+  /** Returns the interned command identifier. \sa LookupCommand() */
+  Command command_id() const { return command_id_; }
   /** Returns the list of arguments. */
   const std::vector<std::string>& args() const { return args_; }
   /** Returns the number of arguments. */
@@ -92,27 +103,32 @@ class Message {
   const std::string& arg(int at) const { return args_.at(at); }
 
   /** Returns the nick portion of the prefix, if it's in the `nick!user@host` form. Empty otherwise. */
-  std::string_view prefix_nick() const { return prefix_nick_; }
-  /** Returns the reply target for a PRIVMSG type message: the channel it was sent to if public, the sender's nickname if private. */
-  std::string_view reply_target() const;
+  std::string_view prefix_nick() const { return std::string_view(prefix_).substr(0, prefix_nick_len_); }
+  /**
+   * Returns the reply target for a PRIVMSG type message: the channel it was sent to if public, the
+   * sender's nickname if private. The target is a channel if it starts with one of \p chantypes.
+   */
+  std::string_view reply_target(std::string_view chantypes = kDefaultChanTypes) const;
 
   /** Returns true if the command field matches (ASCII-case-insensitive) \p test. */
   bool command_is(const std::string& test) const { return EqualArg(command_, test); }
   /** \overload */
   bool command_is(const char* test) const { return EqualArg(command_, test); }
+  /** \overload */
+  bool command_is(Command test) const { return command_id_ == test; }
   /** Returns true if argument \p n exists and matches (ASCII-case-insensitive) \p test. */
   bool arg_is(unsigned n, const std::string& test) const { return n < args_.size() && EqualArg(args_[n], test); }
   /** \overload */
   bool arg_is(unsigned n, const char* test) const { return n < args_.size() && EqualArg(args_[n], test); }
   /** Returns true if the message has a nick prefix and matches \p test. */
-  bool prefix_nick_is(const std::string& test) const { return EqualArg(prefix_nick_, test); }
+  bool prefix_nick_is(const std::string& test) const { return EqualArg(prefix_nick(), test); }
   /** \overload */
-  bool prefix_nick_is(const char* test) const { return EqualArg(prefix_nick_, test); }
+  bool prefix_nick_is(const char* test) const { return EqualArg(prefix_nick(), test); }
 
   /** Sets the prefix string. */
   void set_prefix(const std::string& prefix) { prefix_ = prefix; UpdateNick(); }
   /** Sets the command string. */
-  void set_command(const std::string& command) { command_ = command; }
+  void set_command(const std::string& command) { command_ = command; command_id_ = LookupCommand(command_); }
   /** Mutable accessor to the argument vector. */
   std::vector<std::string>* mutable_args() { return &args_; }
 
@@ -120,11 +136,90 @@ class Message {
   void UpdateNick();
 
   std::string prefix_;
-  std::string_view prefix_nick_;
+  /** Length of the nick at the start of #prefix_. Not a view, so that copies stay valid. */
+  std::size_t prefix_nick_len_ = 0;
   std::string command_;
+  Command command_id_ = Command::kUnknown;
   std::vector<std::string> args_;
 
-  static bool EqualArg(std::string_view a, std::string_view b);
+  static bool EqualArg(std::string_view a, std::string_view b) { return CaseMap::Get(CaseMapping::kAscii).Equal(a, b); }
+
+  friend class MessageView;
+};
+
+/**
+ * Non-owning view of a parsed IRC protocol message.
+ *
+ * This has the same accessors as Message, but the prefix, command and arguments are views into the
+ * buffer that was parsed, so parsing does not copy or allocate (once the argument vector has grown
+ * to its working size). The contents are only valid as long as the parsed buffer is: for messages
+ * delivered by irc::Connection, that's for the duration of the callback. Use ToMessage() to keep a
+ * copy.
+ */
+class MessageView {
+ public:
+  /** Constructs an empty message view. */
+  MessageView() {}
+
+  /** Constructs a view of the contents of \p message, which must outlive the view. */
+  explicit MessageView(const Message& message);
+
+  /**
+   * Parses an IRC protocol message, making this a view into \p data.
+   *
+   * The syntax is the same as in Message::Parse(). Reusing one object for repeated parses avoids
+   * reallocating the argument vector.
+   */
+  bool Parse(const unsigned char* data, std::size_t count);
+
+  /** \overload */
+  bool Parse(const char* data) {
+    return Parse(reinterpret_cast<const unsigned char*>(data), std::strlen(data));
+  }
+
+  /** Returns an owning copy of the message. */
+  Message ToMessage() const;
+
+  /** Clears all data, making this an empty message view. */
+  void Clear() {
+    prefix_ = prefix_nick_ = command_ = std::string_view();
+    command_id_ = Command::kUnknown;
+    args_.clear();
+  }
+
+  /** Returns the message prefix, which may be empty. */
+  std::string_view prefix() const { return prefix_; }
+  /** Returns the command, which is only empty for an empty message. */
+  std::string_view command() const { return command_; }
+  /** Returns the interned command identifier, computed when parsing. */
+  Command command_id() const { return command_id_; }
+  /** Returns the list of arguments. */
+  const std::vector<std::string_view>& args() const { return args_; }
+  /** Returns the number of arguments. */
+  int nargs() const { return args_.size(); }
+  /** Returns the contents of the argument \p at. */
+  std::string_view arg(int at) const { return args_.at(at); }
+
+  /** Returns the nick portion of the prefix, if it's in the `nick!user@host` form. Empty otherwise. */
+  std::string_view prefix_nick() const { return prefix_nick_; }
+  /** Returns the reply target for a PRIVMSG type message. \sa Message::reply_target() */
+  std::string_view reply_target(std::string_view chantypes = kDefaultChanTypes) const;
+
+  /** Returns true if the command field matches (ASCII-case-insensitive) \p test. */
+  bool command_is(std::string_view test) const { return Message::EqualArg(command_, test); }
+  /** \overload */
+  bool command_is(Command test) const { return command_id_ == test; }
+  /** Returns true if argument \p n exists and matches (ASCII-case-insensitive) \p test. */
+  bool arg_is(unsigned n, std::string_view test) const { return n < args_.size() && Message::EqualArg(args_[n], test); }
+  /** Returns true if the message has a nick prefix and matches \p test. */
+  bool prefix_nick_is(std::string_view test) const { return Message::EqualArg(prefix_nick_, test); }
+
+ private:
+  std::string_view prefix_;
+  std::string_view prefix_nick_;
+  std::string_view command_;
+  Command command_id_ = Command::kUnknown;
+  std::vector<std::string_view> args_;
 };
 
 } // namespace irc
@@ -0,0 +1,48 @@
+#include <cstring>
+
+#include "irc/message.h"
+#include "benchmark/benchmark.h"
+
+namespace irc {
+
+namespace {
+
+/** A representative mix of server traffic: chat, membership changes and numerics. */
+const char* const kLines[] = {
+  ":nick!~user@host.example.com PRIVMSG #channel :well, that's one way of putting it I guess",
+  ":other!~someone@192.0.2.17 JOIN #channel",
+  ":irc.example.net 353 bot = #channel :@op +voiced regular another yetanother",
+  "PING :irc.example.net",
+  ":nick!~user@host.example.com NOTICE bot :private words",
+  ":third!~x@2001:db8::1 PART #channel :Leaving",
+};
+
+} // unnamed namespace
+
+/** Parses a fixed set of lines over and over into a reused message object. */
+template <typename M>
+void BM_ParseLines(benchmark::State& state) {
+  constexpr std::size_t kCount = sizeof kLines / sizeof *kLines;
+  std::size_t lens[kCount];
+  for (std::size_t i = 0; i < kCount; ++i)
+    lens[i] = std::strlen(kLines[i]);
+
+  M message;
+  std::size_t i = 0, bytes = 0;
+  for (auto _ : state) {
+    bool ok = message.Parse(reinterpret_cast<const unsigned char*>(kLines[i]), lens[i]);
+    benchmark::DoNotOptimize(ok);
+    benchmark::DoNotOptimize(message.nargs());
+    bytes += lens[i];
+    if (++i == kCount)
+      i = 0;
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(bytes);
+}
+
+BENCHMARK_TEMPLATE(BM_ParseLines, Message);
+BENCHMARK_TEMPLATE(BM_ParseLines, MessageView);
+
+} // namespace irc
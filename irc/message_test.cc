@@ -1,4 +1,5 @@
 #include <cstring>
+#include <string>
 
 #include "irc/message.h"
 #include "gtest/gtest.h"
@@ -301,4 +302,103 @@ TEST(MessageTest, WriteStopAtCount) {
   }
 }
 
+// The nick stays valid in copies, also when the prefix fits in the short string buffer.
+
+TEST(MessageTest, CopyKeepsNick) {
+  Message m;
+  ASSERT_TRUE(m.Parse(":ab!c@d PRIVMSG #x :hi"));
+  Message copy(m);
+  Message moved(std::move(m));
+  m = Message({ "QUIT" }, "zz!y@x");
+  EXPECT_EQ(copy.prefix_nick(), "ab");
+  EXPECT_EQ(moved.prefix_nick(), "ab");
+  copy = moved;
+  EXPECT_EQ(copy.prefix_nick(), "ab");
+  EXPECT_TRUE(copy.prefix_nick_is("AB"));
+}
+
+// Non-owning message views.
+
+TEST(MessageViewTest, ParsePointsIntoBuffer) {
+  const char* line = ":nick!user@host PRIVMSG #chan :hello there";
+  MessageView m;
+  ASSERT_TRUE(m.Parse(line));
+  EXPECT_EQ(m.prefix(), "nick!user@host");
+  EXPECT_EQ(m.prefix_nick(), "nick");
+  EXPECT_EQ(m.command(), "PRIVMSG");
+  ASSERT_EQ(m.nargs(), 2);
+  EXPECT_EQ(m.arg(0), "#chan");
+  EXPECT_EQ(m.arg(1), "hello there");
+  EXPECT_EQ(m.reply_target(), "#chan");
+  EXPECT_TRUE(m.command_is("privmsg"));
+  EXPECT_TRUE(m.arg_is(0, "#CHAN"));
+  EXPECT_TRUE(m.prefix_nick_is("NICK"));
+
+  EXPECT_EQ(m.prefix().data(), line + 1);
+  EXPECT_EQ(m.arg(1).data(), line + 31);
+}
+
+TEST(MessageViewTest, ReplyTargetChanTypes) {
+  MessageView m;
+  ASSERT_TRUE(m.Parse(":nick!user@host PRIVMSG +chan :hi"));
+  EXPECT_EQ(m.reply_target(), "+chan");
+  EXPECT_EQ(m.reply_target("#"), "nick");
+  ASSERT_TRUE(m.Parse(":nick!user@host PRIVMSG #chan :hi"));
+  EXPECT_EQ(m.reply_target("#"), "#chan");
+}
+
+TEST(MessageViewTest, ReparseResetsFields) {
+  MessageView m;
+  ASSERT_TRUE(m.Parse(":nick!user@host JOIN #a"));
+  ASSERT_TRUE(m.Parse("PING :server"));
+  EXPECT_TRUE(m.prefix().empty());
+  EXPECT_TRUE(m.prefix_nick().empty());
+  EXPECT_EQ(m.command(), "PING");
+  ASSERT_EQ(m.nargs(), 1);
+  EXPECT_EQ(m.arg(0), "server");
+  ASSERT_FALSE(m.Parse(":irc.server "));
+}
+
+TEST(MessageViewTest, ParseStopAtCount) {
+  const unsigned char* data = reinterpret_cast<const unsigned char*>(":foo bar baz :quux");
+  for (std::size_t count = 0; count <= 18; ++count) {
+    Message owned;
+    MessageView view;
+    bool owned_ok = owned.Parse(data, count);
+    ASSERT_EQ(view.Parse(data, count), owned_ok);
+    if (!owned_ok)
+      continue;
+    EXPECT_EQ(view.prefix(), owned.prefix());
+    EXPECT_EQ(view.command(), owned.command());
+    ASSERT_EQ(view.nargs(), owned.nargs());
+    for (int i = 0; i < owned.nargs(); ++i)
+      EXPECT_EQ(view.arg(i), owned.arg(i));
+  }
+}
+
+TEST(MessageViewTest, ToMessage) {
+  std::string line = ":nick!user@host PRIVMSG nick2 :hi";
+  MessageView view;
+  ASSERT_TRUE(view.Parse(line.c_str()));
+  Message m = view.ToMessage();
+  line.assign(line.size(), 'x');
+
+  EXPECT_EQ(m.prefix(), "nick!user@host");
+  EXPECT_EQ(m.prefix_nick(), "nick");
+  EXPECT_EQ(m.command(), "PRIVMSG");
+  ASSERT_EQ(m.nargs(), 2);
+  EXPECT_EQ(m.arg(0), "nick2");
+  EXPECT_EQ(m.arg(1), "hi");
+  EXPECT_EQ(m.reply_target(), "nick");
+}
+
+TEST(MessageViewTest, FromMessage) {
+  Message m({ "PRIVMSG", "#chan", "hi there" }, "nick!user@host");
+  MessageView view(m);
+  EXPECT_EQ(view.prefix_nick(), "nick");
+  EXPECT_EQ(view.command(), "PRIVMSG");
+  ASSERT_EQ(view.nargs(), 2);
+  EXPECT_EQ(view.arg(1), "hi there");
+}
+
 } // namespace irc
@@ -9,12 +9,12 @@
 #include "proto/util.h"
 
 class Reader : public irc::Connection::Reader {
-  void RawReceived(const irc::Message& msg) override {
+  void RawReceived(const irc::MessageView& msg) override {
     std::cerr << "<- ";
     if (!msg.prefix().empty())
       std::cerr << ":" << msg.prefix() << " ";
     std::cerr << msg.command();
-    for (const std::string& arg : msg.args())
+    for (std::string_view arg : msg.args())
       std::cerr << " [" << arg << ']';
     std::cerr << '\n';
   }
@@ -0,0 +1,163 @@
+#include <algorithm>
+
+#include "base/log.h"
+#include "irc/write_scheduler.h"
+
+namespace irc {
+
+WriteScheduler::Lane WriteScheduler::LaneFor(Command command) noexcept {
+  switch (command) {
+    case Command::kAuthenticate:
+    case Command::kCap:
+    case Command::kJoin:
+    case Command::kNick:
+    case Command::kPass:
+    case Command::kPing:
+    case Command::kPong:
+    case Command::kQuit:
+    case Command::kUser:
+      return Lane::kControl;
+    default:
+      return Lane::kBulk;
+  }
+}
+
+void WriteScheduler::Push(Lane lane, std::string_view target, Entry entry) {
+  bytes_ += entry.data.size();
+  bool open = entry.targets_end != 0;
+
+  if (lane == Lane::kControl) {
+    control_.push_back(std::move(entry));
+    if (open)
+      open_[CoalesceKey(control_.back())] = Open{&control_.back(), nullptr};
+    return;
+  }
+
+  auto [it, inserted] = targets_.try_emplace(std::string(target));
+  Target* t = &it->second;
+  if (inserted)
+    t->name = &it->first;
+  if (t->host)
+    t = t->host;
+  if (t->queue.empty())
+    active_.push_back(t);
+  t->queue.push_back(std::move(entry));
+  if (open)
+    open_[CoalesceKey(t->queue.back())] = Open{&t->queue.back(), t};
+}
+
+WriteScheduler::Entry* WriteScheduler::Coalesce(Lane lane, std::string_view target, const Entry& entry, int max_targets, std::size_t max_size) {
+  if (entry.targets_end == 0)
+    return nullptr;
+  auto open = open_.find(CoalesceKey(entry));
+  if (open == open_.end())
+    return nullptr;
+  Entry* into = open->second.entry;
+
+  std::string_view added = std::string_view(entry.data).substr(entry.targets_begin, entry.targets_end - entry.targets_begin);
+  if (into->targets + entry.targets > max_targets || into->data.size() + 1 + added.size() > max_size)
+    return nullptr;
+  std::string_view list = std::string_view(into->data).substr(into->targets_begin, into->targets_end - into->targets_begin);
+  for (std::size_t at = 0; at <= list.size(); ) {
+    std::size_t comma = std::min(list.find(',', at), list.size());
+    if (list.substr(at, comma - at) == added)
+      return nullptr;  // sending twice to the same target is not the same as sending once
+    at = comma + 1;
+  }
+
+  if (lane == Lane::kControl) {
+    if (into != &control_.back())
+      return nullptr;  // would reorder control messages
+  } else {
+    Target* host = open->second.host;
+    auto [it, inserted] = targets_.try_emplace(std::string(target));
+    Target* t = &it->second;
+    if (inserted) {
+      t->name = &it->first;
+    } else if (t->host ? t->host != host : !t->queue.empty()) {
+      return nullptr;  // the target has earlier messages queued elsewhere, which must go first
+    }
+    if (!t->host) {
+      t->host = host;
+      host->guests.push_back(t);
+    }
+  }
+
+  into->data.insert(into->targets_end, 1, ',');
+  into->data.insert(into->targets_end + 1, added);
+  into->targets_end += 1 + added.size();
+  into->targets += entry.targets;
+  bytes_ += 1 + added.size();
+  return into;
+}
+
+const WriteScheduler::Entry* WriteScheduler::Peek() {
+  if (!control_.empty()) {
+    peek_lane_ = Lane::kControl;
+    return &control_.front();
+  }
+  if (active_.empty())
+    return nullptr;
+
+  peek_lane_ = Lane::kBulk;
+  for (;;) {
+    Target* t = active_.front();
+    if (t->fresh) {
+      t->deficit += quantum_;
+      t->fresh = false;
+    }
+    if (t->queue.front().cost <= t->deficit)
+      return &t->queue.front();
+    // out of credit for this round, move on to the next target
+    t->fresh = true;
+    active_.pop_front();
+    active_.push_back(t);
+  }
+}
+
+void WriteScheduler::Pop() {
+  if (peek_lane_ == Lane::kControl) {
+    CHECK(!control_.empty());
+    Close(control_.front());
+    bytes_ -= control_.front().data.size();
+    control_.pop_front();
+    return;
+  }
+
+  CHECK(!active_.empty());
+  Target* t = active_.front();
+  Close(t->queue.front());
+  bytes_ -= t->queue.front().data.size();
+  t->deficit -= t->queue.front().cost;
+  t->queue.pop_front();
+  if (t->queue.empty()) {
+    active_.pop_front();
+    for (Target* guest : t->guests)
+      targets_.erase(targets_.find(*guest->name));
+    targets_.erase(targets_.find(*t->name));
+  }
+}
+
+void WriteScheduler::Clear() {
+  control_.clear();
+  active_.clear();
+  targets_.clear();
+  open_.clear();
+  bytes_ = 0;
+}
+
+std::string WriteScheduler::CoalesceKey(const Entry& entry) {
+  std::string key(entry.data, 0, entry.targets_begin);
+  key.append(entry.data, entry.targets_end);
+  return key;
+}
+
+void WriteScheduler::Close(const Entry& entry) {
+  if (entry.targets_end == 0)
+    return;
+  auto it = open_.find(CoalesceKey(entry));
+  if (it != open_.end() && it->second.entry == &entry)
+    open_.erase(it);
+}
+
+} // namespace irc
@@ -0,0 +1,165 @@
+/** \file
+ * Outbound message scheduling for IRC connections.
+ */
+
+#ifndef IRC_WRITE_SCHEDULER_H_
+#define IRC_WRITE_SCHEDULER_H_
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "base/common.h"
+#include "base/timer.h"
+#include "irc/command.h"
+
+namespace irc {
+
+/**
+ * Queue of serialized outbound messages waiting for flood control credit.
+ *
+ * Messages are split into two lanes. The control lane holds connection maintenance traffic (see
+ * LaneFor()), which must not be held up by anything else, and is always served first, in FIFO
+ * order. The bulk lane holds everything else, keyed by target (the first argument, usually a
+ * channel or a nick). Targets are served by deficit round robin: each target with queued messages
+ * gets a quantum of credit per round, which should be enough for at least one message of any
+ * size, so a module flooding one channel only delays messages to other targets by one message at
+ * a time, and targets sending short messages may send several per round.
+ *
+ * Targets are distinguished byte-wise, so different spellings of the same name under the server's
+ * casemapping just get separate shares.
+ *
+ * Messages that name a single target and could equally well be sent as part of a multi-target
+ * message (see Entry::targets_end) can be merged into a queued one with Coalesce(), saving the
+ * per-message cost while they wait for credit anyway. A bulk target merged into a message queued
+ * for another target becomes a guest of that target until its queue drains: its later messages go
+ * to the same queue, so they can't overtake the merged one.
+ *
+ * The scheduler only decides the order. The connection pops messages with Peek() and Pop() as long
+ * as it can afford their cost.
+ */
+class WriteScheduler {
+ public:
+  /** Scheduling class of a message. */
+  enum class Lane {
+    /** Connection maintenance, such as `PONG`, `NICK`, `JOIN` and SASL. Strictly prioritized. */
+    kControl,
+    /** Everything else, shared fairly between targets. */
+    kBulk,
+  };
+
+  /** A queued message. */
+  struct Entry {
+    /** Serialized message, including the trailing CR LF. */
+    std::string data;
+    /** Total flood control cost of sending the message. */
+    int cost;
+    /** Time when the message was queued. */
+    base::TimerPoint queued;
+    /** Number of comma-separated targets in the message's target list. */
+    int targets = 1;
+    /**
+     * If other messages can be merged into this one, the range of its target list in #data.
+     * Otherwise both are zero. Messages with the same #data outside the range can be merged.
+     */
+    std::size_t targets_begin = 0;
+    /** \sa #targets_begin */
+    std::size_t targets_end = 0;
+  };
+
+  /** Default quantum: the cost of the largest possible message under the default flood control. */
+  static constexpr int kQuantum = 10 * 512 + 4000;
+
+  WriteScheduler() = default;
+  DISALLOW_COPY(WriteScheduler);
+
+  /** Sets the credit added to a bulk target's deficit per round. */
+  void set_quantum(int quantum) noexcept { quantum_ = quantum; }
+
+  /** Returns the lane that messages of type \p command go to. */
+  static Lane LaneFor(Command command) noexcept;
+
+  /** Adds a message to the end of its queue. \p target is ignored for the control lane. */
+  void Push(Lane lane, std::string_view target, Entry entry);
+
+  /**
+   * Tries to merge \p entry into a matching queued message, instead of pushing it.
+   *
+   * The match must be the last message of the control lane, or for the bulk lane, the message must
+   * be the only one for \p target. The merged message can name at most \p max_targets targets and
+   * be at most \p max_size bytes long. Returns the merged message, whose cost the caller should
+   * update, or `nullptr` if \p entry needs to be pushed as is.
+   */
+  Entry* Coalesce(Lane lane, std::string_view target, const Entry& entry, int max_targets, std::size_t max_size);
+
+  /**
+   * Returns the message that should be sent next, or `nullptr` if nothing is queued.
+   *
+   * The returned pointer is valid until the next non-const call. Calling Peek() repeatedly without
+   * a Pop() in between returns the same message.
+   */
+  const Entry* Peek();
+  /** Returns the lane of the message last returned by Peek(). */
+  Lane peek_lane() const noexcept { return peek_lane_; }
+  /** Removes the message last returned by Peek(), which must not have been `nullptr`. */
+  void Pop();
+
+  /** Drops all queued messages. */
+  void Clear();
+
+  /** Returns `true` if no messages are queued. */
+  bool empty() const noexcept { return control_.empty() && active_.empty(); }
+  /** Returns the total size of the queued messages, in bytes. */
+  std::size_t bytes() const noexcept { return bytes_; }
+  /** Returns the number of bulk targets with queued messages. */
+  std::size_t active_targets() const noexcept { return active_.size(); }
+
+ private:
+  struct Target {
+    /** Key of this target in #targets_. */
+    const std::string* name;
+    /** Queued messages to the target. */
+    std::deque<Entry> queue;
+    /** Credit left over from earlier rounds. */
+    int deficit = 0;
+    /** `true` if the target hasn't got its quantum for the current round yet. */
+    bool fresh = true;
+    /** If set, the target whose queue this target's messages go to. */
+    Target* host = nullptr;
+    /** Targets using this target's queue. Unbound when the queue drains. */
+    std::vector<Target*> guests;
+  };
+
+  /** Location of a queued message that others may be merged into. */
+  struct Open {
+    Entry* entry;
+    /** Target whose queue holds the message, or `nullptr` for the control lane. */
+    Target* host;
+  };
+
+  /** Returns the key messages that can be merged into \p entry share: the data minus targets. */
+  static std::string CoalesceKey(const Entry& entry);
+  /** Forgets \p entry as a coalescing candidate, before it's removed. */
+  void Close(const Entry& entry);
+
+  std::deque<Entry> control_;
+  std::unordered_map<std::string, Target> targets_;
+  /** Targets with queued messages, in round robin order. The front one is being served. */
+  std::deque<Target*> active_;
+  /** Most recently queued message for each coalescing key. */
+  std::unordered_map<std::string, Open> open_;
+  std::size_t bytes_ = 0;
+  int quantum_ = kQuantum;
+  Lane peek_lane_ = Lane::kControl;
+};
+
+} // namespace irc
+
+#endif // IRC_WRITE_SCHEDULER_H_
+
+// Local Variables:
+// mode: c++
+// End:
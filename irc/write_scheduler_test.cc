@@ -0,0 +1,152 @@
+#include <string>
+#include <vector>
+
+#include "irc/write_scheduler.h"
+#include "gtest/gtest.h"
+
+namespace irc {
+
+namespace {
+
+using Lane = WriteScheduler::Lane;
+
+WriteScheduler::Entry Msg(const std::string& data, int cost = 1000) {
+  return {data, cost, base::TimerPoint()};
+}
+
+/** Returns a message that can be coalesced, with the target list after \p command. */
+WriteScheduler::Entry Open(const std::string& command, const std::string& target, const std::string& rest = "") {
+  WriteScheduler::Entry entry = Msg(command + ' ' + target + rest);
+  entry.targets_begin = command.size() + 1;
+  entry.targets_end = entry.targets_begin + target.size();
+  return entry;
+}
+
+std::vector<std::string> Drain(WriteScheduler* sched) {
+  std::vector<std::string> out;
+  while (const WriteScheduler::Entry* e = sched->Peek()) {
+    out.push_back(e->data);
+    sched->Pop();
+  }
+  return out;
+}
+
+} // unnamed namespace
+
+TEST(WriteSchedulerTest, LaneFor) {
+  EXPECT_EQ(WriteScheduler::LaneFor(Command::kPong), Lane::kControl);
+  EXPECT_EQ(WriteScheduler::LaneFor(Command::kAuthenticate), Lane::kControl);
+  EXPECT_EQ(WriteScheduler::LaneFor(Command::kJoin), Lane::kControl);
+  EXPECT_EQ(WriteScheduler::LaneFor(Command::kPrivmsg), Lane::kBulk);
+  EXPECT_EQ(WriteScheduler::LaneFor(Command::kUnknown), Lane::kBulk);
+}
+
+TEST(WriteSchedulerTest, ControlFirst) {
+  WriteScheduler sched;
+  sched.Push(Lane::kBulk, "#a", Msg("a1"));
+  sched.Push(Lane::kBulk, "#a", Msg("a2"));
+  sched.Push(Lane::kControl, "", Msg("pong"));
+  EXPECT_EQ(sched.bytes(), 8);
+
+  ASSERT_NE(sched.Peek(), nullptr);
+  EXPECT_EQ(sched.Peek()->data, "pong");
+  EXPECT_EQ(sched.peek_lane(), Lane::kControl);
+  sched.Pop();
+
+  ASSERT_NE(sched.Peek(), nullptr);
+  EXPECT_EQ(sched.Peek()->data, "a1");
+  EXPECT_EQ(sched.peek_lane(), Lane::kBulk);
+  sched.Push(Lane::kControl, "", Msg("nick"));
+  EXPECT_EQ(Drain(&sched), (std::vector<std::string>{"nick", "a1", "a2"}));
+  EXPECT_TRUE(sched.empty());
+  EXPECT_EQ(sched.bytes(), 0);
+}
+
+TEST(WriteSchedulerTest, RoundRobinTargets) {
+  WriteScheduler sched;
+  // a flood of big messages to #a shouldn't hold up #b and #c for more than one message each
+  for (int i = 0; i < 4; ++i)
+    sched.Push(Lane::kBulk, "#a", Msg("a" + std::to_string(i), WriteScheduler::kQuantum));
+  sched.Push(Lane::kBulk, "#b", Msg("b0", WriteScheduler::kQuantum));
+  sched.Push(Lane::kBulk, "#c", Msg("c0", WriteScheduler::kQuantum));
+  sched.Push(Lane::kBulk, "#c", Msg("c1", WriteScheduler::kQuantum));
+  EXPECT_EQ(sched.active_targets(), 3);
+  EXPECT_EQ(Drain(&sched), (std::vector<std::string>{"a0", "b0", "c0", "a1", "c1", "a2", "a3"}));
+  EXPECT_EQ(sched.active_targets(), 0);
+}
+
+TEST(WriteSchedulerTest, DeficitFavorsShortMessages) {
+  WriteScheduler sched;
+  // #short's messages cost a third of #long's, so it gets three per round
+  for (int i = 0; i < 3; ++i)
+    sched.Push(Lane::kBulk, "#long", Msg("L" + std::to_string(i), WriteScheduler::kQuantum));
+  for (int i = 0; i < 6; ++i)
+    sched.Push(Lane::kBulk, "#short", Msg("s" + std::to_string(i), WriteScheduler::kQuantum / 3));
+  EXPECT_EQ(Drain(&sched), (std::vector<std::string>{"L0", "s0", "s1", "s2", "L1", "s3", "s4", "s5", "L2"}));
+}
+
+TEST(WriteSchedulerTest, RequeuedTargetStartsFresh) {
+  WriteScheduler sched;
+  sched.Push(Lane::kBulk, "#a", Msg("a0", 100));
+  EXPECT_EQ(Drain(&sched), std::vector<std::string>{"a0"});
+  // leftover deficit from an emptied queue must not carry over
+  for (int i = 1; i < 3; ++i)
+    sched.Push(Lane::kBulk, "#a", Msg("a" + std::to_string(i), WriteScheduler::kQuantum));
+  sched.Push(Lane::kBulk, "#b", Msg("b0", WriteScheduler::kQuantum));
+  EXPECT_EQ(Drain(&sched), (std::vector<std::string>{"a1", "b0", "a2"}));
+}
+
+TEST(WriteSchedulerTest, Clear) {
+  WriteScheduler sched;
+  sched.Push(Lane::kBulk, "#a", Msg("a0"));
+  sched.Push(Lane::kControl, "", Msg("c0"));
+  sched.Clear();
+  EXPECT_TRUE(sched.empty());
+  EXPECT_EQ(sched.Peek(), nullptr);
+  EXPECT_EQ(sched.bytes(), 0);
+}
+
+TEST(WriteSchedulerTest, CoalesceControl) {
+  WriteScheduler sched;
+  sched.Push(Lane::kControl, "", Open("JOIN", "#a"));
+  ASSERT_NE(sched.Coalesce(Lane::kControl, "#b", Open("JOIN", "#b"), 3, 512), nullptr);
+  EXPECT_EQ(sched.Coalesce(Lane::kControl, "#a", Open("JOIN", "#a"), 3, 512), nullptr);  // duplicate
+  WriteScheduler::Entry* merged = sched.Coalesce(Lane::kControl, "#c", Open("JOIN", "#c"), 3, 512);
+  ASSERT_NE(merged, nullptr);
+  EXPECT_EQ(merged->targets, 3);
+  EXPECT_EQ(sched.Coalesce(Lane::kControl, "#d", Open("JOIN", "#d"), 3, 512), nullptr);  // too many
+  EXPECT_EQ(sched.bytes(), 13);
+
+  // must not move a JOIN ahead of a later control message
+  sched.Push(Lane::kControl, "", Msg("NICK x"));
+  EXPECT_EQ(sched.Coalesce(Lane::kControl, "#e", Open("JOIN", "#e"), 10, 512), nullptr);
+  sched.Push(Lane::kControl, "", Open("JOIN", "#e"));
+  EXPECT_EQ(sched.Coalesce(Lane::kControl, "#ffff", Open("JOIN", "#ffff"), 10, 12), nullptr);  // too long
+  EXPECT_NE(sched.Coalesce(Lane::kControl, "#f", Open("JOIN", "#f"), 10, 512), nullptr);
+
+  EXPECT_EQ(Drain(&sched), (std::vector<std::string>{"JOIN #a,#b,#c", "NICK x", "JOIN #e,#f"}));
+  EXPECT_EQ(sched.Coalesce(Lane::kControl, "#g", Open("JOIN", "#g"), 10, 512), nullptr);
+}
+
+TEST(WriteSchedulerTest, CoalesceBulk) {
+  WriteScheduler sched;
+  sched.Push(Lane::kBulk, "#a", Open("PRIVMSG", "#a", " hi"));
+  sched.Push(Lane::kBulk, "#c", Msg("c0"));
+  EXPECT_EQ(sched.Coalesce(Lane::kBulk, "#b", Open("PRIVMSG", "#b", " bye"), 4, 512), nullptr);  // other text
+  EXPECT_NE(sched.Coalesce(Lane::kBulk, "#b", Open("PRIVMSG", "#b", " hi"), 4, 512), nullptr);
+  EXPECT_EQ(sched.Coalesce(Lane::kBulk, "#c", Open("PRIVMSG", "#c", " hi"), 4, 512), nullptr);  // has c0 queued
+  EXPECT_EQ(sched.active_targets(), 2);
+
+  // #b's later messages must stay behind the merged one
+  sched.Push(Lane::kBulk, "#b", Msg("b1"));
+  EXPECT_EQ(sched.active_targets(), 2);
+  EXPECT_EQ(Drain(&sched), (std::vector<std::string>{"PRIVMSG #a,#b hi", "b1", "c0"}));
+
+  // once the host's queue has drained, #b is on its own again
+  sched.Push(Lane::kBulk, "#b", Msg("b2"));
+  sched.Push(Lane::kBulk, "#a", Msg("a1"));
+  EXPECT_EQ(sched.active_targets(), 2);
+  EXPECT_EQ(Drain(&sched), (std::vector<std::string>{"b2", "a1"}));
+}
+
+} // namespace irc
@@ -7,6 +7,7 @@ def bracket_repositories(
     omit_bazel_skylib=False,
     omit_boringssl=False,
     omit_civetweb=False,
+    omit_com_github_google_benchmark=False,
     omit_com_github_jupp0r_prometheus_cpp=False,
     omit_com_google_googletest=False,
     omit_com_google_protobuf=False,
@@ -19,6 +20,8 @@ def bracket_repositories(
     boringssl()
   if not omit_civetweb and not native.existing_rule("civetweb"):
     civetweb()
+  if not omit_com_github_google_benchmark and not native.existing_rule("com_github_google_benchmark"):
+    com_github_google_benchmark()
   if not omit_com_github_jupp0r_prometheus_cpp and not native.existing_rule("com_github_jupp0r_prometheus_cpp"):
     com_github_jupp0r_prometheus_cpp()
   if not omit_com_google_googletest and not native.existing_rule("com_google_googletest"):
@@ -63,6 +66,16 @@ def civetweb():
         build_file = "@fi_zem_bracket//tools:civetweb.BUILD",
     )
 
+# com_github_google_benchmark (v1.5.2)
+
+def com_github_google_benchmark():
+  http_archive(
+      name = "com_github_google_benchmark",
+      urls = ["https://github.com/google/benchmark/archive/refs/tags/v1.5.2.tar.gz"],
+      sha256 = "dccbdab796baa1043f04982147e67bb6e118fe610da2c65f88912d73987e700c",
+      strip_prefix = "benchmark-1.5.2",
+  )
+
 # com_github_jupp0r_prometheus_cpp (0.12.2)
 
 def com_github_jupp0r_prometheus_cpp():
@@ -0,0 +1,12 @@
+def cc_benchmark(name, deps, srcs=[], **kwargs):
+    if len(srcs) == 0: srcs = [name + ".cc"]
+    native.cc_binary(
+        name = name,
+        srcs = srcs,
+        deps = deps + [
+            "@com_github_google_benchmark//:benchmark",
+            "@com_github_google_benchmark//:benchmark_main",
+        ],
+        testonly = True,
+        **kwargs
+    )